@@ -0,0 +1,187 @@
+#include "buffer_pool.h"
+
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+BufferPool::Options g_default_options;
+
+// Size of an explicit huge page. Arenas which use huge pages are rounded up to
+// a multiple of this.
+const size_t kHugePageSize = 2 << 20;
+
+// Marker stored in |size_class_| for buffers which were mapped individually
+// because they were larger than every size class.
+const int kLargeMapping = -1;
+
+size_t ClassSize(int size_class) {
+  return static_cast<size_t>(1) << (size_class + BufferPool::kMinClassShift);
+}
+
+}  // namespace
+
+BufferPool::Buffer::Buffer(Buffer&& other)
+    : pool_(other.pool_),
+      data_(other.data_),
+      size_(other.size_),
+      size_class_(other.size_class_) {
+  other.pool_ = nullptr;
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) {
+  if (this != &other) {
+    Release();
+    std::swap(pool_, other.pool_);
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(size_class_, other.size_class_);
+  }
+  return *this;
+}
+
+void BufferPool::Buffer::Release() {
+  if (pool_ != nullptr) {
+    pool_->Return(data_, size_, size_class_);
+  }
+  pool_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+BufferPool::BufferPool() : BufferPool(Options()) {}
+
+BufferPool::BufferPool(const Options& options)
+    : options_(options), arena_cursor_(nullptr), arena_end_(nullptr) {
+  for (int i = 0; i < kNumClasses; ++i) {
+    free_lists_[i] = nullptr;
+  }
+}
+
+BufferPool::~BufferPool() {
+  for (const auto& arena : arenas_) {
+    munmap(arena.first, arena.second);
+  }
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size) {
+  ++stats_.acquired;
+  if (size == 0) {
+    return Buffer();
+  }
+
+  int size_class = SizeClassFor(size);
+  if (size_class < 0) {
+    char* data = Map(size, false);
+    if (data == nullptr) {
+      return Buffer();
+    }
+    ++stats_.large_mappings;
+    return Buffer(this, data, size, kLargeMapping);
+  }
+
+  FreeBlock* block = free_lists_[size_class];
+  if (block != nullptr) {
+    free_lists_[size_class] = block->next;
+    ++stats_.reused;
+    return Buffer(this, reinterpret_cast<char*>(block), size, size_class);
+  }
+  char* data = Carve(size_class);
+  if (data == nullptr) {
+    return Buffer();
+  }
+  return Buffer(this, data, size, size_class);
+}
+
+// static
+BufferPool* BufferPool::ForCurrentThread() {
+  static thread_local BufferPool pool(g_default_options);
+  return &pool;
+}
+
+// static
+void BufferPool::SetDefaultOptions(const Options& options) {
+  g_default_options = options;
+}
+
+// static
+int BufferPool::SizeClassFor(size_t size) {
+  int size_class = 0;
+  while (ClassSize(size_class) < size) {
+    if (++size_class == kNumClasses) {
+      return -1;
+    }
+  }
+  return size_class;
+}
+
+char* BufferPool::Carve(int size_class) {
+  size_t class_size = ClassSize(size_class);
+  if (arena_cursor_ == nullptr ||
+      static_cast<size_t>(arena_end_ - arena_cursor_) < class_size) {
+    // The remainder of the current arena is abandoned. Every class size divides
+    // the arena size, so this only happens when switching between classes.
+    size_t arena_size = options_.arena_size;
+    if (arena_size < class_size) {
+      arena_size = class_size;
+    }
+    if (options_.huge_pages) {
+      arena_size = (arena_size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    }
+    char* arena = Map(arena_size, options_.huge_pages);
+    if (arena == nullptr) {
+      return nullptr;
+    }
+    arena_cursor_ = arena;
+    arena_end_ = arena_cursor_ + arena_size;
+    arenas_.emplace_back(arena_cursor_, arena_size);
+    ++stats_.arenas;
+  }
+  char* block = arena_cursor_;
+  arena_cursor_ += class_size;
+  return block;
+}
+
+char* BufferPool::Map(size_t size, bool huge_pages) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (options_.prefault) {
+    flags |= MAP_POPULATE;
+  }
+
+  void* memory = MAP_FAILED;
+  if (huge_pages) {
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+                  -1, 0);
+  }
+  if (memory == MAP_FAILED) {
+    // Fall back to regular pages, which the kernel may still promote to
+    // transparent huge pages.
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED) {
+      printf("mmap of %zu bytes error : %s\n", size, strerror(errno));
+      return nullptr;
+    }
+    if (huge_pages) {
+      madvise(memory, size, MADV_HUGEPAGE);
+    }
+  }
+  return static_cast<char*>(memory);
+}
+
+void BufferPool::Return(char* data, size_t size, int size_class) {
+  if (size_class == kLargeMapping) {
+    munmap(data, size);
+    return;
+  }
+  FreeBlock* block = reinterpret_cast<FreeBlock*>(data);
+  block->next = free_lists_[size_class];
+  free_lists_[size_class] = block;
+}
@@ -0,0 +1,126 @@
+#ifndef __USBIP_BUFFER_POOL_H__
+#define __USBIP_BUFFER_POOL_H__
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Pool of URB payload and response buffers.
+//
+// Requests are rounded up to one of a fixed set of power-of-two size classes.
+// Blocks are carved out of large mmap'd arenas and returned to a per-class free
+// list when released, so once a session has warmed up its buffers are recycled
+// without ever touching the global allocator. Requests larger than the biggest
+// size class are mapped individually.
+//
+// A pool is not thread-safe; each thread uses its own through
+// ForCurrentThread().
+class BufferPool {
+ public:
+  struct Options {
+    // Size of each arena which blocks are carved from.
+    size_t arena_size = 4 << 20;
+    // Back arenas with explicit huge pages when the system has them reserved,
+    // and otherwise ask for transparent huge pages.
+    bool huge_pages = false;
+    // Fault in every page of an arena when it is mapped.
+    bool prefault = false;
+  };
+
+  // Move-only handle to a block owned by a pool. The block is returned to the
+  // pool when the handle is destroyed, which must happen on the thread that
+  // owns the pool.
+  class Buffer {
+   public:
+    Buffer() : pool_(nullptr), data_(nullptr), size_(0), size_class_(0) {}
+    Buffer(Buffer&& other);
+    Buffer& operator=(Buffer&& other);
+    ~Buffer() { Release(); }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Returns the block to its pool and leaves the handle empty.
+    void Release();
+
+   private:
+    friend class BufferPool;
+
+    Buffer(BufferPool* pool, char* data, size_t size, int size_class)
+        : pool_(pool), data_(data), size_(size), size_class_(size_class) {}
+
+    BufferPool* pool_;
+    char* data_;
+    size_t size_;
+    int size_class_;
+  };
+
+  // Counters describing how the pool has been used.
+  struct Stats {
+    size_t acquired = 0;
+    size_t reused = 0;
+    size_t arenas = 0;
+    size_t large_mappings = 0;
+  };
+
+  // Smallest and largest size classes (as powers of two).
+  static const int kMinClassShift = 6;
+  static const int kMaxClassShift = 20;
+  static const int kNumClasses = kMaxClassShift - kMinClassShift + 1;
+
+  BufferPool();
+  explicit BufferPool(const Options& options);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // Returns a buffer which can hold at least |size| bytes. The contents of the
+  // buffer are unspecified. Returns an empty buffer if |size| is 0 or no
+  // memory can be mapped for it.
+  Buffer Acquire(size_t size);
+
+  const Stats& stats() const { return stats_; }
+
+  // Returns the pool which belongs to the calling thread, creating it with the
+  // options given to SetDefaultOptions() on first use.
+  static BufferPool* ForCurrentThread();
+
+  // Sets the options used for pools created by ForCurrentThread(). This only
+  // affects threads which have not used their pool yet.
+  static void SetDefaultOptions(const Options& options);
+
+ private:
+  // Links released blocks of the same size class together. The link is stored
+  // in the first bytes of the free block itself.
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Returns the index of the smallest size class which fits |size|, or -1 if
+  // |size| is larger than every class.
+  static int SizeClassFor(size_t size);
+
+  // Carves a new block for |size_class| out of the current arena, mapping a new
+  // arena when necessary. Returns nullptr if the arena cannot be mapped.
+  char* Carve(int size_class);
+
+  // Maps |size| bytes of memory, using explicit huge pages if |huge_pages| is
+  // set and they are available. Returns nullptr on failure.
+  char* Map(size_t size, bool huge_pages);
+
+  void Return(char* data, size_t size, int size_class);
+
+  Options options_;
+  FreeBlock* free_lists_[kNumClasses];
+  std::vector<std::pair<char*, size_t>> arenas_;
+  char* arena_cursor_;
+  char* arena_end_;
+  Stats stats_;
+};
+
+#endif  // __USBIP_BUFFER_POOL_H__
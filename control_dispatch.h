@@ -0,0 +1,72 @@
+#ifndef __USBIP_CONTROL_DISPATCH_H__
+#define __USBIP_CONTROL_DISPATCH_H__
+
+#include "transport.h"
+#include "usbip-constants.h"
+#include "usbip.h"
+
+#include <cstddef>
+
+// Matches any recipient or descriptor type in a ControlHandler.
+const int kAnyRecipient = -1;
+const int kAnyDescriptor = -1;
+
+// Returns the "type" stored in bits 5 and 6 of |bmRequestType|.
+constexpr int GetControlType(byte bmRequestType) {
+  return (bmRequestType >> 5) & 3;
+}
+
+// Returns the "recipient" stored in bits 0 to 4 of |bmRequestType|.
+constexpr int GetControlRecipient(byte bmRequestType) {
+  return bmRequestType & 0x1F;
+}
+
+// One entry of a device's control request table.
+//
+// A request is routed to |handler| when its type, recipient and bRequest
+// match. |descriptor_type| additionally matches the high byte of wValue,
+// which is how GET_DESCRIPTOR selects the descriptor, so that each descriptor
+// type can have its own handler.
+template <typename Device>
+struct ControlHandler {
+  typedef void (Device::*Handler)(Transport* transport,
+                                  const USBIP_CMD_SUBMIT& usb_request,
+                                  const StandardDeviceRequest& control_request,
+                                  const char* data, unsigned int data_size);
+
+  int type;
+  int recipient;
+  int request;
+  int descriptor_type;
+  Handler handler;
+
+  constexpr bool Matches(const StandardDeviceRequest& control_request) const {
+    return type == GetControlType(control_request.bmRequestType) &&
+           (recipient == kAnyRecipient ||
+            recipient == GetControlRecipient(control_request.bmRequestType)) &&
+           request == control_request.bRequest &&
+           (descriptor_type == kAnyDescriptor ||
+            descriptor_type == control_request.wValue1);
+  }
+};
+
+// Routes |control_request| to the first entry of |handlers| which matches it.
+// The tables are flat constexpr arrays of a handful of entries, so a linear
+// scan is cheaper than any index. Returns false if no entry matched.
+template <typename Device, size_t N>
+bool DispatchControl(Device* device,
+                     const ControlHandler<Device> (&handlers)[N],
+                     Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                     const StandardDeviceRequest& control_request,
+                     const char* data, unsigned int data_size) {
+  for (const ControlHandler<Device>& entry : handlers) {
+    if (entry.Matches(control_request)) {
+      (device->*entry.handler)(transport, usb_request, control_request, data,
+                               data_size);
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif  // __USBIP_CONTROL_DISPATCH_H__
@@ -0,0 +1,421 @@
+#include "control_server.h"
+
+#include "default_printer.h"
+#include "device_registry.h"
+#include "device_thread.h"
+#include "enumeration_timeline.h"
+#include "event_loop.h"
+#include "golden_file.h"
+#include "job_processor.h"
+#include "monotonic_clock.h"
+#include "printer_profile.h"
+#include "usb_device.h"
+#include "usb_printer.h"
+
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// A client which sends a longer line than this is disconnected.
+const size_t kMaxRequestLength = 4096;
+
+// A client which lets more than this much of its responses pile up unread is
+// disconnected.
+const size_t kMaxPendingOutput = 1 << 20;
+
+// Events which a client's socket is watched for while it has no pending
+// output.
+const uint32_t kClientEvents = EPOLLIN | EPOLLRDHUP;
+
+// Parses "on" or "off" into |value|.
+bool ParseSwitch(const std::string& text, bool* value) {
+  if (text == "on" || text == "off") {
+    *value = text == "on";
+    return true;
+  }
+  return false;
+}
+
+const char* JobStageStatusName(JobStageResult::Status status) {
+  switch (status) {
+    case JobStageResult::Status::kOk:
+      return "ok";
+    case JobStageResult::Status::kFailed:
+      return "failed";
+    case JobStageResult::Status::kSkipped:
+      return "skipped";
+  }
+  return "unknown";
+}
+
+// Describes how a job compares to its golden file, or returns an empty string
+// if it had none.
+std::string DescribeGoldenComparison(const GoldenComparison& golden) {
+  switch (golden.status()) {
+    case GoldenComparison::Status::kNone:
+      return "";
+    case GoldenComparison::Status::kMatching:
+      return "golden:matching:" + std::to_string(golden.compared());
+    case GoldenComparison::Status::kMatched:
+      return "golden:ok:" + std::to_string(golden.compared());
+    case GoldenComparison::Status::kDiverged:
+      return "golden:diverged:" + std::to_string(golden.divergence());
+    case GoldenComparison::Status::kIncomplete:
+      return "golden:incomplete:" + std::to_string(golden.compared());
+  }
+  return "";
+}
+
+}  // namespace
+
+std::unique_ptr<ControlServer> ControlServer::Create(
+    const char* path, EventLoop* loop, UsbDeviceRegistry* devices,
+    PrinterFactory* printers, const PrinterProfile& default_profile) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    printf("control socket path too long : %s\n", path);
+    return nullptr;
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    printf("socket error : %s\n", strerror(errno));
+    return nullptr;
+  }
+  // A socket left behind by a previous server would make bind() fail.
+  unlink(path);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    printf("control socket %s error : %s\n", path, strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<ControlServer>(
+      new ControlServer(path, fd, loop, devices, printers, default_profile));
+}
+
+ControlServer::ControlServer(const char* path, int listen_fd, EventLoop* loop,
+                             UsbDeviceRegistry* devices,
+                             PrinterFactory* printers,
+                             const PrinterProfile& default_profile)
+    : path_(path),
+      listen_fd_(listen_fd),
+      loop_(loop),
+      devices_(devices),
+      printers_(printers),
+      default_profile_(default_profile) {
+  loop_->Add(listen_fd_, EPOLLIN, [this](uint32_t events) { OnAccept(); });
+}
+
+ControlServer::~ControlServer() {
+  while (!clients_.empty()) {
+    CloseClient(clients_.begin()->first);
+  }
+  loop_->Remove(listen_fd_);
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+void ControlServer::SetDeviceCallbacks(DeviceCallback added,
+                                       DeviceCallback removing) {
+  added_ = std::move(added);
+  removing_ = std::move(removing);
+}
+
+void ControlServer::OnAccept() {
+  int fd =
+      accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd < 0) {
+    printf("control accept error : %s\n", strerror(errno));
+    return;
+  }
+  clients_[fd];
+  loop_->Add(fd, kClientEvents,
+             [this, fd](uint32_t events) { OnClientEvents(fd, events); });
+}
+
+void ControlServer::OnClientEvents(int fd, uint32_t events) {
+  if ((events & EPOLLOUT) && !FlushClient(fd)) {
+    return;
+  }
+  if (events & ~EPOLLOUT) {
+    OnClientReadable(fd);
+  }
+}
+
+void ControlServer::OnClientReadable(int fd) {
+  char buffer[1024];
+  ssize_t received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+  if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (received <= 0) {
+    CloseClient(fd);
+    return;
+  }
+
+  Client& client = clients_[fd];
+  client.input.append(buffer, received);
+  bool responded = false;
+  size_t newline;
+  while ((newline = client.input.find('\n')) != std::string::npos) {
+    std::string line = client.input.substr(0, newline);
+    client.input.erase(0, newline + 1);
+    for (const std::string& response_line : HandleRequest(line)) {
+      client.output += response_line + "\n";
+    }
+    responded = true;
+  }
+  if (client.input.size() > kMaxRequestLength) {
+    printf("control request too long, closing %d\n", fd);
+    CloseClient(fd);
+    return;
+  }
+  if (client.output.size() > kMaxPendingOutput) {
+    printf("control client %d is not reading its responses, closing\n", fd);
+    CloseClient(fd);
+    return;
+  }
+  if (responded) {
+    FlushClient(fd);
+  }
+}
+
+bool ControlServer::FlushClient(int fd) {
+  std::string& output = clients_[fd].output;
+  size_t sent = 0;
+  while (sent < output.size()) {
+    ssize_t result = send(fd, output.data() + sent, output.size() - sent,
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (result < 0) {
+      CloseClient(fd);
+      return false;
+    }
+    sent += result;
+  }
+  output.erase(0, sent);
+  loop_->Modify(fd, output.empty() ? kClientEvents : kClientEvents | EPOLLOUT);
+  return true;
+}
+
+void ControlServer::CloseClient(int fd) {
+  loop_->Remove(fd);
+  close(fd);
+  clients_.erase(fd);
+}
+
+UsbPrinter* ControlServer::FindPrinter(const std::string& bus_id,
+                                       std::vector<std::string>* response) {
+  UsbDevice* device = devices_->Find(bus_id.c_str());
+  UsbPrinter* printer = dynamic_cast<UsbPrinter*>(device);
+  if (printer == nullptr) {
+    response->push_back("ERR no printer " + bus_id);
+  }
+  return printer;
+}
+
+std::vector<std::string> ControlServer::HandleRequest(const std::string& line) {
+  std::istringstream words(line);
+  std::string command;
+  std::string name;
+  std::string argument;
+  // |name| is the bus ID or profile name which most requests take.
+  words >> command >> name >> argument;
+  std::vector<std::string> response;
+
+  if (command == "list") {
+    for (const auto& device : devices_->devices()) {
+      char description[64];
+      snprintf(description, sizeof(description), "%s %04x:%04x %s%s",
+               device->bus_id(), device->device_descriptor().idVendor,
+               device->device_descriptor().idProduct,
+               device->attached() ? "attached" : "detached",
+               dynamic_cast<UsbPrinter*>(device.get()) ? " printer" : "");
+      response.push_back(description);
+    }
+    response.push_back("OK");
+  } else if (command == "add-printer") {
+    const PrinterProfile* profile = &default_profile_;
+    if (!name.empty()) {
+      auto it = profiles_.find(name);
+      if (it == profiles_.end()) {
+        response.push_back("ERR no profile " + name);
+        return response;
+      }
+      profile = &it->second;
+    }
+    std::unique_ptr<UsbPrinter> printer = printers_->Create(*profile);
+    if (!printer) {
+      response.push_back("ERR cannot create printer");
+      return response;
+    }
+    UsbDevice* device = devices_->Add(std::move(printer));
+    if (added_) {
+      added_(device);
+    }
+    printf("Control socket added printer %s\n", device->bus_id());
+    response.push_back(std::string("OK ") + device->bus_id());
+  } else if (command == "remove") {
+    UsbDevice* device = devices_->Find(name.c_str());
+    if (device == nullptr) {
+      response.push_back("ERR no device " + name);
+      return response;
+    }
+    if (removing_) {
+      removing_(device);
+    }
+    printf("Control socket removed %s\n", device->bus_id());
+    devices_->Remove(device);
+    response.push_back("OK");
+  } else if (command == "load-profile") {
+    PrinterProfile profile = default_profile_;
+    if (name.empty() || argument.empty() ||
+        !LoadPrinterProfile(argument.c_str(), &profile)) {
+      response.push_back("ERR cannot load profile " + argument);
+      return response;
+    }
+    profiles_[name] = profile;
+    response.push_back("OK");
+  } else if (command == "paper-out" || command == "error") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    bool value = false;
+    if (printer == nullptr) {
+      return response;
+    }
+    if (!ParseSwitch(argument, &value)) {
+      response.push_back("ERR expected on or off");
+      return response;
+    }
+    RunOnDeviceThread(printer, [&]() {
+      if (command == "paper-out") {
+        printer->engine()->SetPaperOut(value, MonotonicNanos());
+      } else {
+        printer->engine()->SetError(value, MonotonicNanos());
+      }
+      // Data which was held back by the condition may now be accepted.
+      printer->ServiceEngine();
+    });
+    response.push_back("OK");
+  } else if (command == "stall") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    if (printer == nullptr) {
+      return response;
+    }
+    char* end = nullptr;
+    unsigned long long ms = strtoull(argument.c_str(), &end, 10);
+    if (argument.empty() || *end != '\0') {
+      response.push_back("ERR expected a duration in milliseconds");
+      return response;
+    }
+    RunOnDeviceThread(printer, [&]() {
+      printer->engine()->InjectStall(ms * 1000000ull, MonotonicNanos());
+      printer->ServiceEngine();
+    });
+    response.push_back("OK");
+  } else if (command == "end-job") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    if (printer == nullptr) {
+      return response;
+    }
+    RunOnDeviceThread(printer, [&]() { printer->EndJob(); });
+    response.push_back("OK");
+  } else if (command == "golden") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    if (printer == nullptr) {
+      return response;
+    }
+    std::shared_ptr<const GoldenFile> golden;
+    if (argument != "off") {
+      golden = GoldenFile::Create(argument);
+      if (!golden) {
+        response.push_back("ERR cannot map golden file " + argument);
+        return response;
+      }
+    }
+    RunOnDeviceThread(printer, [&]() { printer->SetGoldenFile(golden); });
+    response.push_back("OK");
+  } else if (command == "split-jobs") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    if (printer == nullptr) {
+      return response;
+    }
+    bool splitting = false;
+    if (!ParseSwitch(argument, &splitting)) {
+      response.push_back("ERR expected on or off");
+      return response;
+    }
+    RunOnDeviceThread(printer,
+                      [&]() { printer->SetJobSplitting(splitting); });
+    response.push_back("OK");
+  } else if (command == "jobs") {
+    UsbPrinter* printer = FindPrinter(name, &response);
+    if (printer == nullptr) {
+      return response;
+    }
+    std::deque<PrintJobRecord> jobs;
+    RunOnDeviceThread(printer, [&]() { jobs = printer->jobs(); });
+    for (const PrintJobRecord& job : jobs) {
+      char record[96];
+      snprintf(record, sizeof(record), "%d %llu %llu %llu", job.id, job.bytes,
+               static_cast<unsigned long long>(job.start_ns),
+               static_cast<unsigned long long>(job.end_ns));
+      std::string line = record;
+      std::string golden = DescribeGoldenComparison(job.golden);
+      if (!golden.empty()) {
+        line += " " + golden;
+      }
+      if (job.framing != nullptr) {
+        line += std::string(" framing:") + job.framing;
+      }
+      for (const JobStageResult& result : job.results) {
+        line += " " + result.stage + ":" + JobStageStatusName(result.status);
+        if (result.status != JobStageResult::Status::kSkipped) {
+          line += ":" + result.value;
+        }
+      }
+      response.push_back(line);
+    }
+    response.push_back("OK");
+  } else if (command == "timelines") {
+    EnumerationProfiler* profiler = GetEnumerationProfiler();
+    if (profiler == nullptr) {
+      response.push_back("ERR enumeration is not being profiled");
+      return response;
+    }
+    for (const auto& timeline : profiler->timelines()) {
+      if (!name.empty() && timeline->bus_id() != name) {
+        continue;
+      }
+      std::vector<std::string> summary = timeline->Summary();
+      response.insert(response.end(), summary.begin(), summary.end());
+    }
+    response.push_back("OK");
+  } else {
+    response.push_back("ERR unknown request " + command);
+  }
+  return response;
+}
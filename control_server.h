@@ -0,0 +1,122 @@
+#ifndef __USBIP_CONTROL_SERVER_H__
+#define __USBIP_CONTROL_SERVER_H__
+
+#include "default_printer.h"
+#include "device_registry.h"
+#include "event_loop.h"
+#include "printer_profile.h"
+#include "usb_device.h"
+#include "usb_printer.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lets a local process reconfigure a running server through a Unix domain
+// socket, so that a test harness can create and destroy printers without
+// restarting the server for each one.
+//
+// The protocol is line based. Each request is a single line of
+// whitespace-separated words, and each response is zero or more lines of
+// output followed by a line which is either "OK", optionally followed by a
+// value, or "ERR" followed by a message. The requests are:
+//
+//   list                      one line per device: bus ID, vid:pid, whether
+//                             it is attached and, for printers, "printer"
+//   add-printer [PROFILE]     adds a printer and returns its bus ID
+//   remove BUS_ID             unplugs a device, disconnecting its client
+//   load-profile NAME PATH    reads a printer profile for add-printer
+//   paper-out BUS_ID on|off   sets or clears a printer's paper-out condition
+//   error BUS_ID on|off       sets or clears a printer's error condition
+//   stall BUS_ID MS           stops a printer's engine for MS milliseconds
+//   end-job BUS_ID            ends the job a printer is receiving
+//   golden BUS_ID PATH|off    compares the printer's next jobs against the
+//                             file at PATH, or stops comparing
+//   split-jobs BUS_ID on|off  sets whether the printer ends jobs where their
+//                             data shows that they end
+//   jobs BUS_ID               one line per job record: id, bytes, the start
+//                             and end times in nanoseconds, then
+//                             golden:matching:BYTES, golden:ok:BYTES,
+//                             golden:diverged:OFFSET or
+//                             golden:incomplete:BYTES if the job has a golden
+//                             file, framing:FORMAT if the printer splits jobs
+//                             and, once the job has been post-processed,
+//                             STAGE:ok:VALUE, STAGE:failed:REASON or
+//                             STAGE:skipped for each stage
+//   timelines [BUS_ID]        the summaries of the last enumerations, or of
+//                             those of BUS_ID, oldest first. See
+//                             EnumerationProfiler.
+//
+// Requests which act on a printer run on the printer's DeviceThread, if it has
+// one, and are answered once they have taken effect there.
+class ControlServer {
+ public:
+  using DeviceCallback = std::function<void(UsbDevice* device)>;
+
+  // Listens on |path|, replacing any stale socket there, and serves requests
+  // from |loop|. Printers are created by |printers|, which must outlive the
+  // server. Those created without a named profile use |default_profile|,
+  // which named profiles are also loaded on top of. Returns nullptr if the
+  // socket could not be set up.
+  static std::unique_ptr<ControlServer> Create(
+      const char* path, EventLoop* loop, UsbDeviceRegistry* devices,
+      PrinterFactory* printers, const PrinterProfile& default_profile);
+
+  ~ControlServer();
+
+  ControlServer(const ControlServer&) = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+
+  // |added| runs after a device has been added to the registry, and
+  // |removing| before one is taken out of it. |removing| must disconnect any
+  // client which has the device imported.
+  void SetDeviceCallbacks(DeviceCallback added, DeviceCallback removing);
+
+  // Runs the request in |line| and returns the response lines.
+  std::vector<std::string> HandleRequest(const std::string& line);
+
+ private:
+  ControlServer(const char* path, int listen_fd, EventLoop* loop,
+                UsbDeviceRegistry* devices, PrinterFactory* printers,
+                const PrinterProfile& default_profile);
+
+  // The requests and responses of one client which are in transit.
+  struct Client {
+    // Partial request line received so far.
+    std::string input;
+    // Responses which the socket has not taken yet.
+    std::string output;
+  };
+
+  void OnAccept();
+  void OnClientEvents(int fd, uint32_t events);
+  void OnClientReadable(int fd);
+
+  // Sends as much of the client's pending output as its socket takes, and
+  // watches the socket for room while some is left. Returns false if the
+  // client has been closed.
+  bool FlushClient(int fd);
+
+  void CloseClient(int fd);
+
+  // Returns the printer with |bus_id|, or nullptr after adding an error to
+  // |response| if there is none.
+  UsbPrinter* FindPrinter(const std::string& bus_id,
+                          std::vector<std::string>* response);
+
+  std::string path_;
+  int listen_fd_;
+  EventLoop* loop_;
+  UsbDeviceRegistry* devices_;
+  PrinterFactory* printers_;
+  PrinterProfile default_profile_;
+  std::unordered_map<std::string, PrinterProfile> profiles_;
+  DeviceCallback added_;
+  DeviceCallback removing_;
+  // By file descriptor.
+  std::unordered_map<int, Client> clients_;
+};
+
+#endif  // __USBIP_CONTROL_SERVER_H__
@@ -0,0 +1,178 @@
+#include "default_printer.h"
+
+#include "device_descriptors.h"
+#include "printer_profile.h"
+#include "spool.h"
+#include "usb_printer.h"
+#include "usbip-constants.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Longest string which fits into the one byte bLength of a string descriptor.
+const size_t kMaxStringLength = 126;
+
+// Encodes |text| as a USB string descriptor. Only ASCII text is supported,
+// which is widened to UTF-16LE, and longer text is truncated.
+std::vector<char> StringDescriptor(const std::string& text) {
+  size_t length = std::min(text.size(), kMaxStringLength);
+  std::vector<char> descriptor = {static_cast<char>(2 + 2 * length),
+                                  USB_DESCRIPTOR_STRING};
+  for (char c : text.substr(0, length)) {
+    descriptor.push_back(c);
+    descriptor.push_back(0x00);
+  }
+  return descriptor;
+}
+
+}  // namespace
+
+std::unique_ptr<UsbPrinter> CreateDefaultPrinter() {
+  return CreatePrinter(PrinterProfile());
+}
+
+std::unique_ptr<UsbPrinter> CreatePrinter(const PrinterProfile& profile) {
+  const USB_DEVICE_DESCRIPTOR device = {
+      0x12,                   // Size of this descriptor in bytes
+      USB_DESCRIPTOR_DEVICE,  // descriptor type
+      0x0110,                 // USB Spec Release Number in BCD format
+      0x00,                   // Class Code
+      0x00,                   // Subclass code
+      0x00,                   // Protocol code
+      0x08,                   // Max packet size for EP0, see usb_config.h
+      profile.vendor_id,      // Vendor ID
+      profile.product_id,     // Product ID
+      0x0000,                 // Device release number in BCD format
+      0x01,                   // Manufacturer string descriptor index
+      0x02,                   // Product string descriptor index
+      // Device serial number string descriptor index
+      static_cast<byte>(profile.serial.empty() ? 0x01 : 0x03),
+      0x01,                   // Number of possible configurations
+  };
+
+  const USB_CONFIGURATION_DESCRIPTOR configuration = {
+      0x09,                          // Size of this descriptor in bytes.
+      USB_DESCRIPTOR_CONFIGURATION,  // descriptor type.
+      0x20,  // Total length of data for this configuration.
+      0x01,  // Number of interfaces in this configuration.
+      0x01,  // Index value for this configuration.
+      0x00,  // Configuration string descriptor index.
+      0x80,  // Configuration characteristics (bmAttributes).
+      0x00,  // Max power consumption (2X mA).
+  };
+
+  std::vector<char> str1 = {
+      0x04, USB_DESCRIPTOR_STRING, // bLength, bDscType
+      0x09, 0x04
+  };
+
+  std::vector<std::vector<char>> strings = {
+      str1, StringDescriptor(profile.manufacturer),
+      StringDescriptor(profile.product)};
+  if (!profile.serial.empty()) {
+    strings.push_back(StringDescriptor(profile.serial));
+  }
+
+  // The device ID is prefixed with its big-endian length, which includes the
+  // two bytes of the length itself.
+  size_t id_length = profile.device_id.size() + 2;
+  std::vector<char> ieee_device_id = {static_cast<char>(id_length >> 8),
+                                      static_cast<char>(id_length & 0xFF)};
+  ieee_device_id.insert(ieee_device_id.end(), profile.device_id.begin(),
+                        profile.device_id.end());
+
+  const std::vector<USB_INTERFACE_DESCRIPTOR> interfaces = {
+      {
+          0x09,                      // Size of this descriptor in bytes
+          USB_DESCRIPTOR_INTERFACE,  // descriptor type.
+          0x00,                      // Interface Number.
+          0x00,                      // Alternate Setting Number.
+          0x02,                      // Number of endpoints in this interface.
+          0x07,                      // Class code.
+          0x01,                      // Subclass code.
+          0x02,                      // Protocol code.
+          0x00,                      // Interface string index.
+      },
+      /*
+      {
+          0x09,                      // Size of this descriptor in bytes
+          USB_DESCRIPTOR_INTERFACE,  // descriptor type.
+          0x01,                      // Interface Number.
+          0x00,                      // Alternate Setting Number.
+          0x02,                      // Number of endpoints in this interface.
+          0x07,                      // Class code.
+          0x01,                      // Subclass code.
+          0x02,                      // Protocol code.
+          0x00,                      // Interface string index.
+      }*/};
+
+  const std::vector<USB_ENDPOINT_DESCRIPTOR> endpoints = {
+      {
+          0x07,                     // Size of this descriptor in bytes.
+          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
+          0x01,                     // Endpoint Address.
+          0x02,                     // Attributes (Bulk Endpoint).
+          512,                      // Max transfer size.
+          0x00,                     // Interval.
+      },
+      {
+          0x07,                     // Size of this descriptor in bytes.
+          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
+          0x81,                     // Endpoint Address.
+          0x02,                     // Attributes (Bulk Endpoint).
+          512,                      // Max transfer size.
+          0x00,                     // Interval.
+      },
+      /*
+      {
+          0x07,                     // Size of this descriptor in bytes.
+          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
+          0x03,                     // Endpoint Address.
+          0x02,                     // Attributes (Bulk Endpoint).
+          0x08,                     // Max transfer size.
+          0x00,                     // Interval.
+      },
+      {
+          0x07,                     // Size of this descriptor in bytes.
+          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
+          0x84,                     // Endpoint Address.
+          0x02,                     // Attributes (Bulk Endpoint).
+          0x08,                     // Max transfer size.
+          0x00,                     // Interval.
+      }*/};
+
+  std::unique_ptr<UsbPrinter> printer = std::make_unique<UsbPrinter>(
+      device, configuration, strings, ieee_device_id, interfaces, endpoints);
+  printer->ConfigureEngine(profile.engine);
+  printer->SetSpeed(profile.speed);
+  printer->SetMaxTransferSize(profile.max_transfer_size);
+  return printer;
+}
+
+PrinterFactory::PrinterFactory(const PrinterSetup& setup)
+    : setup_(setup), created_(0) {}
+
+std::unique_ptr<UsbPrinter> PrinterFactory::Create(
+    const PrinterProfile& profile) {
+  std::unique_ptr<UsbPrinter> printer = CreatePrinter(profile);
+  printer->SetGoldenFile(setup_.golden);
+  printer->SetJobSplitting(setup_.split_jobs);
+  if (!setup_.spool_path.empty()) {
+    std::string path = setup_.spool_path;
+    if (created_ > 0) {
+      path += "." + std::to_string(created_ + 1);
+    }
+    std::unique_ptr<Spool> spool = Spool::Create(path);
+    if (!spool) {
+      return nullptr;
+    }
+    printer->SetSpool(std::move(spool));
+  }
+  ++created_;
+  return printer;
+}
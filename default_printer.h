@@ -0,0 +1,50 @@
+#ifndef __USBIP_DEFAULT_PRINTER_H__
+#define __USBIP_DEFAULT_PRINTER_H__
+
+#include "golden_file.h"
+#include "printer_profile.h"
+#include "usb_printer.h"
+
+#include <memory>
+#include <string>
+
+// Returns the printer which the server emulates by default: a bidirectional
+// USB 1.1 printer with one bulk OUT and one bulk IN endpoint.
+std::unique_ptr<UsbPrinter> CreateDefaultPrinter();
+
+// Returns a printer with the same interfaces as the default one which
+// identifies itself, paces its data and operates at the speed given by
+// |profile|.
+std::unique_ptr<UsbPrinter> CreatePrinter(const PrinterProfile& profile);
+
+// What the server gives every printer besides its profile, whether the printer
+// is created at startup or through the control socket.
+struct PrinterSetup {
+  // The first printer spools its print data to this path and the others to
+  // numbered siblings, PATH.2, PATH.3, ... Nothing is spooled if it is empty.
+  std::string spool_path;
+  // Compared against every job, unless it is null. See GoldenComparison.
+  std::shared_ptr<const GoldenFile> golden;
+  // See UsbPrinter::SetJobSplitting().
+  bool split_jobs = false;
+};
+
+// Creates the server's printers and sets each of them up in the same way.
+class PrinterFactory {
+ public:
+  explicit PrinterFactory(const PrinterSetup& setup);
+
+  PrinterFactory(const PrinterFactory&) = delete;
+  PrinterFactory& operator=(const PrinterFactory&) = delete;
+
+  // Returns a printer created from |profile| and set up as the factory's
+  // PrinterSetup describes, or nullptr if its spool could not be created.
+  std::unique_ptr<UsbPrinter> Create(const PrinterProfile& profile);
+
+ private:
+  PrinterSetup setup_;
+  // Printers created so far, which numbers their spools.
+  int created_;
+};
+
+#endif  // __USBIP_DEFAULT_PRINTER_H__
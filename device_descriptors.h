@@ -100,6 +100,46 @@ typedef struct __attribute__((__packed__)) _USB_HID_DESCRIPTOR {
   word wRPDescriptorLength;
 } USB_HID_DESCRIPTOR;
 
+// SuperSpeed Endpoint Companion Descriptor, which follows each endpoint
+// descriptor of a device operating at SuperSpeed. See USB 3.2, section 9.6.7.
+typedef struct __attribute__((__packed__))
+    _USB_SS_ENDPOINT_COMPANION_DESCRIPTOR {
+  byte bLength;
+  byte bDescriptorType;  // Type = 0x30 (USB_DESCRIPTOR_SS_ENDPOINT_COMPANION).
+  byte bMaxBurst;
+  byte bmAttributes;
+  word wBytesPerInterval;
+} USB_SS_ENDPOINT_COMPANION_DESCRIPTOR;
+
+// Binary Object Store Descriptor. It is followed by |bNumDeviceCaps| device
+// capability descriptors. See USB 3.2, section 9.6.2.
+typedef struct __attribute__((__packed__)) _USB_BOS_DESCRIPTOR {
+  byte bLength;
+  byte bDescriptorType;  // Type = 0x0F (USB_DESCRIPTOR_BOS).
+  word wTotalLength;
+  byte bNumDeviceCaps;
+} USB_BOS_DESCRIPTOR;
+
+// USB 2.0 Extension capability. See USB 3.2, section 9.6.2.1.
+typedef struct __attribute__((__packed__)) _USB_2_0_EXTENSION_CAPABILITY {
+  byte bLength;
+  byte bDescriptorType;     // Type = 0x10 (USB_DESCRIPTOR_DEVICE_CAPABILITY).
+  byte bDevCapabilityType;  // USB_CAPABILITY_USB_2_0_EXTENSION.
+  unsigned int bmAttributes;
+} USB_2_0_EXTENSION_CAPABILITY;
+
+// SuperSpeed USB Device capability. See USB 3.2, section 9.6.2.2.
+typedef struct __attribute__((__packed__)) _USB_SUPERSPEED_CAPABILITY {
+  byte bLength;
+  byte bDescriptorType;     // Type = 0x10 (USB_DESCRIPTOR_DEVICE_CAPABILITY).
+  byte bDevCapabilityType;  // USB_CAPABILITY_SUPERSPEED_USB.
+  byte bmAttributes;
+  word wSpeedsSupported;
+  byte bFunctionalitySupport;
+  byte bU1DevExitLat;
+  word wU2DevExitLat;
+} USB_SUPERSPEED_CAPABILITY;
+
 // Represents a configured HID.
 typedef struct __attribute__((__packed__)) _CONFIG_HID {
   USB_CONFIGURATION_DESCRIPTOR dev_conf;
@@ -0,0 +1,43 @@
+#include "device_registry.h"
+
+#include "usb_device.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <cstring>
+
+UsbDevice* UsbDeviceRegistry::Add(std::unique_ptr<UsbDevice> device) {
+  // |devices_| is ordered by port, so the first device whose port does not
+  // match its position sits just after the first gap.
+  size_t index = 0;
+  while (index < devices_.size() &&
+         devices_[index]->devnum() == static_cast<int>(index) + 2) {
+    ++index;
+  }
+  // Address 1 belongs to the root hub, so port N has device number N + 1.
+  device->SetAddress(1, index + 1);
+  return devices_.insert(devices_.begin() + index, std::move(device))->get();
+}
+
+std::unique_ptr<UsbDevice> UsbDeviceRegistry::Remove(UsbDevice* device) {
+  for (auto it = devices_.begin(); it != devices_.end(); ++it) {
+    if (it->get() == device) {
+      std::unique_ptr<UsbDevice> removed = std::move(*it);
+      devices_.erase(it);
+      return removed;
+    }
+  }
+  return nullptr;
+}
+
+UsbDevice* UsbDeviceRegistry::Find(const char* bus_id) const {
+  for (const auto& device : devices_) {
+    // |bus_id| comes from the client and is not necessarily terminated.
+    if (strncmp(device->bus_id(), bus_id, sizeof(OP_REQ_IMPORT::busID)) == 0) {
+      return device.get();
+    }
+  }
+  return nullptr;
+}
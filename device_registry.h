@@ -0,0 +1,42 @@
+#ifndef __USBIP_DEVICE_REGISTRY_H__
+#define __USBIP_DEVICE_REGISTRY_H__
+
+#include "usb_device.h"
+
+#include <memory>
+#include <vector>
+
+// The set of devices exported by the server.
+//
+// Devices are placed on the lowest free port of bus 1, so the first device is
+// "1-1", the second "1-2" and so on, and the port of a removed device is
+// reused by the next device which is added.
+class UsbDeviceRegistry {
+ public:
+  UsbDeviceRegistry() = default;
+
+  UsbDeviceRegistry(const UsbDeviceRegistry&) = delete;
+  UsbDeviceRegistry& operator=(const UsbDeviceRegistry&) = delete;
+
+  // Takes ownership of |device| and assigns it the lowest free port. Returns
+  // the device.
+  UsbDevice* Add(std::unique_ptr<UsbDevice> device);
+
+  // Removes |device| from the bus and returns it, or nullptr if it is not in
+  // the registry. A client which has the device imported has to be
+  // disconnected first.
+  std::unique_ptr<UsbDevice> Remove(UsbDevice* device);
+
+  // Returns the device with |bus_id|, or nullptr if there is none.
+  UsbDevice* Find(const char* bus_id) const;
+
+  // The devices ordered by port.
+  const std::vector<std::unique_ptr<UsbDevice>>& devices() const {
+    return devices_;
+  }
+
+ private:
+  std::vector<std::unique_ptr<UsbDevice>> devices_;
+};
+
+#endif  // __USBIP_DEVICE_REGISTRY_H__
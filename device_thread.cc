@@ -0,0 +1,373 @@
+#include "device_thread.h"
+
+#include "event_loop.h"
+#include "probes.h"
+#include "spsc_ring.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "usb_device.h"
+#include "usbip.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Number of tasks and of replies which can be in flight between the threads.
+const size_t kRingCapacity = 1024;
+
+// Buffers of ring slots which have grown beyond this are released once they
+// have been used, so that a burst of large URBs does not pin memory in every
+// slot for the life of the thread.
+const size_t kMaxRetainedBuffer = 64 * 1024;
+
+// Wakes the thread which is waiting on |event_fd|.
+void Signal(int event_fd) {
+  uint64_t one = 1;
+  while (write(event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+// Consumes the wakeups which have been signalled on |event_fd|.
+void ClearSignal(int event_fd) {
+  uint64_t count;
+  while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+// Blocks until one of the |count| eventfds at |event_fds| is signalled, and
+// returns whether the one at |event_fds[index]| is. The signals are left for
+// their owners to consume.
+bool WaitForSignal(const int* event_fds, int count, int index = 0) {
+  pollfd polls[2];
+  for (int i = 0; i < count; ++i) {
+    polls[i] = {event_fds[i], POLLIN, 0};
+  }
+  while (poll(polls, count, -1) < 0 && errno == EINTR) {
+  }
+  return (polls[index].revents & POLLIN) != 0;
+}
+
+// Wakes the producer of a ring which a slot has just been freed in, if it is
+// waiting on |event_fd| for room. The producer raises |*awaiting| before it
+// looks at the ring for the last time, and the fences order that against the
+// release of the slot.
+void SignalSpace(std::atomic<bool>* awaiting, int event_fd) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (awaiting->load(std::memory_order_relaxed) && awaiting->exchange(false)) {
+    Signal(event_fd);
+  }
+}
+
+// Drops |buffer|'s storage if a large payload made it grow beyond what is
+// worth keeping.
+void TrimBuffer(std::vector<char>* buffer) {
+  if (buffer->capacity() > kMaxRetainedBuffer) {
+    std::vector<char>().swap(*buffer);
+  }
+}
+
+}  // namespace
+
+// The transport which a device on the thread replies to a session through. It
+// hands the replies over to the network thread, which owns the socket.
+class DeviceThread::RingTransport : public Transport {
+ public:
+  RingTransport(DeviceThread* thread, uint64_t session)
+      : thread_(thread), session_(session) {}
+
+  ssize_t Send(const void* data, size_t size) override {
+    thread_->Complete(session_, data, size);
+    return size;
+  }
+
+  ssize_t Receive(void* data, size_t size) override {
+    // Requests arrive as tasks rather than through the transport.
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+ private:
+  DeviceThread* thread_;
+  uint64_t session_;
+};
+
+std::unique_ptr<DeviceThread> DeviceThread::Create(EventLoop* network_loop,
+                                                   CompletionHandler handler) {
+  int event_fds[kNumEventFds];
+  for (int i = 0; i < kNumEventFds; ++i) {
+    event_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fds[i] < 0) {
+      printf("eventfd error : %s\n", strerror(errno));
+      while (--i >= 0) {
+        close(event_fds[i]);
+      }
+      return nullptr;
+    }
+  }
+  std::unique_ptr<DeviceThread> thread(
+      new DeviceThread(network_loop, std::move(handler), event_fds));
+  thread->thread_ = std::thread(&DeviceThread::Run, thread.get());
+  return thread;
+}
+
+DeviceThread::DeviceThread(EventLoop* network_loop, CompletionHandler handler,
+                           const int* event_fds)
+    : network_loop_(network_loop),
+      handler_(std::move(handler)),
+      timer_wheel_(&loop_),
+      tasks_(kRingCapacity),
+      completions_(kRingCapacity),
+      awaiting_task_space_(false),
+      awaiting_completion_space_(false) {
+  for (int i = 0; i < kNumEventFds; ++i) {
+    event_fds_[i] = event_fds[i];
+  }
+  loop_.Add(event_fds_[kTasks], EPOLLIN,
+            [this](uint32_t events) { RunTasks(); });
+  network_loop_->Add(event_fds_[kCompletions], EPOLLIN,
+                     [this](uint32_t events) { DeliverCompletions(); });
+}
+
+DeviceThread::~DeviceThread() {
+  // The sessions which the replies still in flight were meant for are gone.
+  handler_ = nullptr;
+  BeginTask()->type = Task::Type::kStop;
+  CommitTask();
+  thread_.join();
+  DeliverCompletions();
+  network_loop_->Remove(event_fds_[kCompletions]);
+  loop_.Remove(event_fds_[kTasks]);
+  for (int event_fd : event_fds_) {
+    close(event_fd);
+  }
+}
+
+void DeviceThread::AddDevice(UsbDevice* device) {
+  device->SetEventLoop(&loop_);
+  device->SetTimerWheel(&timer_wheel_);
+  device->SetDeviceThread(this);
+}
+
+void DeviceThread::Attach(uint64_t session, UsbDevice* device) {
+  Task* task = BeginTask();
+  task->type = Task::Type::kAttach;
+  task->session = session;
+  task->device = device;
+  CommitTask();
+}
+
+void DeviceThread::Submit(uint64_t session, UsbDevice* device,
+                          const USBIP_CMD_SUBMIT& request, const char* data,
+                          unsigned int data_size) {
+  Task* task = BeginTask();
+  task->type = Task::Type::kSubmit;
+  task->session = session;
+  task->device = device;
+  task->request = request;
+  task->data_size = data_size;
+  task->spooled = data == nullptr;
+  if (data != nullptr) {
+    // The session's buffer belongs to the network thread's pool.
+    task->payload.assign(data, data + data_size);
+  }
+  CommitTask();
+}
+
+void DeviceThread::Unlink(uint64_t session, UsbDevice* device,
+                          const USBIP_CMD_UNLINK& request) {
+  Task* task = BeginTask();
+  task->type = Task::Type::kUnlink;
+  task->session = session;
+  task->device = device;
+  task->unlink = request;
+  CommitTask();
+}
+
+void DeviceThread::Detach(uint64_t session, UsbDevice* device) {
+  Task* task = BeginTask();
+  task->type = Task::Type::kDetach;
+  task->session = session;
+  task->device = device;
+  CommitTask();
+}
+
+void DeviceThread::Call(std::function<void()> function) {
+  std::atomic<bool> done(false);
+  Task* task = BeginTask();
+  task->type = Task::Type::kCall;
+  task->function = [this, &function, &done]() {
+    function();
+    done.store(true, std::memory_order_release);
+    Signal(event_fds_[kCallDone]);
+  };
+  CommitTask();
+  // The device thread may need room for replies to earlier requests before it
+  // gets to |function|.
+  int event_fds[] = {event_fds_[kCallDone], event_fds_[kCompletions]};
+  while (!done.load(std::memory_order_acquire)) {
+    // A signal may be left over from an earlier call which returned as soon as
+    // it saw |done|, so it only means that |done| is worth checking again.
+    bool completions = WaitForSignal(event_fds, 2, 1);
+    ClearSignal(event_fds_[kCallDone]);
+    if (completions) {
+      DeliverCompletions();
+    }
+  }
+}
+
+void DeviceThread::Post(std::function<void()> function) {
+  Task* task = BeginTask();
+  task->type = Task::Type::kCall;
+  task->function = std::move(function);
+  CommitTask();
+}
+
+void DeviceThread::Run() {
+  loop_.Run();
+}
+
+DeviceThread::Task* DeviceThread::BeginTask() {
+  Task* task = tasks_.BeginPush();
+  while (task == nullptr) {
+    // The device thread is behind. It may itself be waiting for room to
+    // reply, which only this thread can make, so replies wake this thread as
+    // well as room for tasks does.
+    DeliverCompletions();
+    awaiting_task_space_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    task = tasks_.BeginPush();
+    if (task == nullptr) {
+      int event_fds[] = {event_fds_[kTaskSpace], event_fds_[kCompletions]};
+      WaitForSignal(event_fds, 2);
+      ClearSignal(event_fds_[kTaskSpace]);
+      task = tasks_.BeginPush();
+    }
+  }
+  return task;
+}
+
+void DeviceThread::CommitTask() {
+  tasks_.CommitPush();
+  Signal(event_fds_[kTasks]);
+}
+
+void DeviceThread::RunTasks() {
+  ClearSignal(event_fds_[kTasks]);
+  while (Task* task = tasks_.Front()) {
+    RunTask(task);
+    task->function = nullptr;
+    TrimBuffer(&task->payload);
+    tasks_.Pop();
+    SignalSpace(&awaiting_task_space_, event_fds_[kTaskSpace]);
+  }
+}
+
+void DeviceThread::RunTask(Task* task) {
+  switch (task->type) {
+    case Task::Type::kAttach:
+      transports_[task->session].reset(new RingTransport(this, task->session));
+      break;
+    case Task::Type::kSubmit: {
+      auto it = transports_.find(task->session);
+      if (it == transports_.end()) {
+        break;
+      }
+      const char* data = task->spooled ? nullptr : task->payload.data();
+      task->device->HandleUsbRequest(it->second.get(), task->request, data,
+                                     task->data_size);
+      break;
+    }
+    case Task::Type::kUnlink: {
+      auto it = transports_.find(task->session);
+      if (it == transports_.end()) {
+        break;
+      }
+      bool unlinked = task->device->UnlinkUrb(task->unlink.seqnum_urb);
+      USBIP_PROBE2(urb_unlink, task->unlink.seqnum_urb, unlinked);
+      SendUnlinkResponse(it->second.get(), task->unlink,
+                         unlinked ? -ECONNRESET : 0);
+      break;
+    }
+    case Task::Type::kDetach:
+      // Detaching drops the device's pending URBs, which are the only
+      // references to the session's transport.
+      task->device->Detach();
+      transports_.erase(task->session);
+      break;
+    case Task::Type::kCall:
+      task->function();
+      break;
+    case Task::Type::kStop:
+      loop_.Stop();
+      break;
+  }
+}
+
+void DeviceThread::Complete(uint64_t session, const void* data, size_t size) {
+  Completion* completion = completions_.BeginPush();
+  while (completion == nullptr) {
+    // The network thread drains the ring from its event loop, and whenever it
+    // waits for room in the task ring. Sleep until it has.
+    awaiting_completion_space_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    completion = completions_.BeginPush();
+    if (completion == nullptr) {
+      WaitForSignal(&event_fds_[kCompletionSpace], 1);
+      ClearSignal(event_fds_[kCompletionSpace]);
+      completion = completions_.BeginPush();
+    }
+  }
+  completion->session = session;
+  const char* bytes = static_cast<const char*>(data);
+  completion->bytes.assign(bytes, bytes + size);
+  completions_.CommitPush();
+  Signal(event_fds_[kCompletions]);
+}
+
+void DeviceThread::DeliverCompletions() {
+  ClearSignal(event_fds_[kCompletions]);
+  bool delivered = false;
+  while (Completion* completion = completions_.Front()) {
+    if (handler_) {
+      handler_(completion->session, completion->bytes.data(),
+               completion->bytes.size());
+    }
+    TrimBuffer(&completion->bytes);
+    completions_.Pop();
+    delivered = true;
+  }
+  if (delivered) {
+    SignalSpace(&awaiting_completion_space_, event_fds_[kCompletionSpace]);
+  }
+}
+
+void RunOnDeviceThread(UsbDevice* device, std::function<void()> function) {
+  if (DeviceThread* thread = device->device_thread()) {
+    thread->Call(std::move(function));
+  } else {
+    function();
+  }
+}
+
+void PostToDeviceThread(UsbDevice* device, std::function<void()> function) {
+  if (DeviceThread* thread = device->device_thread()) {
+    thread->Post(std::move(function));
+  } else {
+    function();
+  }
+}
@@ -0,0 +1,180 @@
+#ifndef __USBIP_DEVICE_THREAD_H__
+#define __USBIP_DEVICE_THREAD_H__
+
+#include "event_loop.h"
+#include "spsc_ring.h"
+#include "timer_wheel.h"
+#include "usb_device.h"
+#include "usbip.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs the emulation of a set of devices on a thread of its own, so that
+// device logic which takes a while does not hold up the thread which serves
+// the sockets.
+//
+// The network thread decodes each URB and pushes it, with a copy of its
+// payload, onto a single-producer single-consumer ring. The device thread
+// handles the URBs with its own event loop and timer wheel, which also run the
+// devices' deferred completions, and pushes the encoded replies onto a second
+// ring. The network thread picks the replies up from its own event loop and
+// sends them through the session's transport, so that slow clients are
+// throttled exactly as they are when the devices run on the network thread.
+// Payloads and replies are copied into buffers which belong to the slots of
+// the rings and are reused, so steady traffic does not allocate.
+//
+// Each ring is paired with an eventfd which wakes its consumer, and with one
+// which wakes its producer if it is waiting for room.
+//
+// Every interaction with a device which has been added to a DeviceThread must
+// go through it: the network thread only touches the device's descriptors,
+// its address and whether it is attached.
+class DeviceThread {
+ public:
+  // Runs on the network thread with each reply which a device has sent to the
+  // session with |session| as its id.
+  using CompletionHandler =
+      std::function<void(uint64_t session, const char* data, size_t size)>;
+
+  // Starts a device thread whose replies are handed to |handler| from
+  // |network_loop|. Returns nullptr if the thread could not be set up.
+  static std::unique_ptr<DeviceThread> Create(EventLoop* network_loop,
+                                              CompletionHandler handler);
+
+  // Stops and joins the thread. The devices must have been detached.
+  ~DeviceThread();
+
+  DeviceThread(const DeviceThread&) = delete;
+  DeviceThread& operator=(const DeviceThread&) = delete;
+
+  // Moves |device| onto the thread. Must be called before the device is
+  // first imported.
+  void AddDevice(UsbDevice* device);
+
+  // The following are called from the network thread, and take effect on the
+  // device thread in the order they were called.
+
+  // Starts routing the replies which |device| sends to the client of
+  // |session|, which has just imported it.
+  void Attach(uint64_t session, UsbDevice* device);
+
+  // Hands |request| and the |data_size| bytes of its payload at |data| to
+  // |device|. |data| is null if the payload was spooled.
+  void Submit(uint64_t session, UsbDevice* device,
+              const USBIP_CMD_SUBMIT& request, const char* data,
+              unsigned int data_size);
+
+  // Unlinks the URB named by |request| and replies to it.
+  void Unlink(uint64_t session, UsbDevice* device,
+              const USBIP_CMD_UNLINK& request);
+
+  // Detaches |device| after the client of |session| has gone. Replies which
+  // the device sent to the session before it was detached are dropped.
+  void Detach(uint64_t session, UsbDevice* device);
+
+  // Runs |function| on the device thread and waits for it to return.
+  void Call(std::function<void()> function);
+
+  // Runs |function| on the device thread without waiting for it.
+  void Post(std::function<void()> function);
+
+ private:
+  class RingTransport;
+
+  // Work for the device thread.
+  struct Task {
+    enum class Type { kAttach, kSubmit, kUnlink, kDetach, kCall, kStop };
+
+    Type type;
+    uint64_t session;
+    UsbDevice* device;
+    USBIP_CMD_SUBMIT request;
+    USBIP_CMD_UNLINK unlink;
+    // Belongs to the slot, and keeps its capacity from one task to the next.
+    std::vector<char> payload;
+    // Size of the payload, which is not in |payload| if it was spooled.
+    unsigned int data_size;
+    bool spooled;
+    std::function<void()> function;
+  };
+
+  // A reply for the network thread to send.
+  struct Completion {
+    uint64_t session;
+    // Belongs to the slot, like Task::payload.
+    std::vector<char> bytes;
+  };
+
+  // The eventfds which pair with the rings, and the one Call() waits on.
+  enum EventFd {
+    // Tasks have been pushed.
+    kTasks,
+    // The device thread has made room for tasks.
+    kTaskSpace,
+    // Replies have been pushed.
+    kCompletions,
+    // The network thread has made room for replies.
+    kCompletionSpace,
+    // The function given to Call() has returned.
+    kCallDone,
+    kNumEventFds,
+  };
+
+  DeviceThread(EventLoop* network_loop, CompletionHandler handler,
+               const int* event_fds);
+
+  // Body of the thread.
+  void Run();
+
+  // Returns the slot which the next task is to be written into, waiting for
+  // room and delivering replies meanwhile if the ring is full, so that the
+  // device thread can make progress. The task runs once CommitTask() is
+  // called.
+  Task* BeginTask();
+  void CommitTask();
+
+  // Runs every task which has been pushed. Device thread only.
+  void RunTasks();
+  void RunTask(Task* task);
+
+  // Queues |size| bytes at |data| for the client of |session|. Device thread
+  // only.
+  void Complete(uint64_t session, const void* data, size_t size);
+
+  // Hands every queued reply to |handler_|. Network thread only.
+  void DeliverCompletions();
+
+  EventLoop* network_loop_;
+  CompletionHandler handler_;
+
+  // Owned by the device thread once it has started.
+  EventLoop loop_;
+  TimerWheel timer_wheel_;
+  // The transport through which each attached session's device replies, by
+  // session id.
+  std::unordered_map<uint64_t, std::unique_ptr<RingTransport>> transports_;
+
+  SpscRing<Task> tasks_;
+  SpscRing<Completion> completions_;
+  int event_fds_[kNumEventFds];
+  // Raised by the producer of each ring while it waits for room.
+  std::atomic<bool> awaiting_task_space_;
+  std::atomic<bool> awaiting_completion_space_;
+  std::thread thread_;
+};
+
+// Runs |function| on the thread which emulates |device|: on its DeviceThread
+// if it has one, otherwise straight away.
+void RunOnDeviceThread(UsbDevice* device, std::function<void()> function);
+
+// Like RunOnDeviceThread(), but does not wait for |function| to run if
+// |device| has a DeviceThread.
+void PostToDeviceThread(UsbDevice* device, std::function<void()> function);
+
+#endif  // __USBIP_DEVICE_THREAD_H__
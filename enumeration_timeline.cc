@@ -0,0 +1,356 @@
+#include "enumeration_timeline.h"
+
+#include "control_dispatch.h"
+#include "monotonic_clock.h"
+#include "usb_device.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Interface classes whose class requests are named.
+const int kHidInterfaceClass = 0x03;
+const int kPrinterInterfaceClass = 0x07;
+
+EnumerationProfiler* g_profiler = nullptr;
+
+const char* DescriptorName(int type) {
+  switch (type) {
+    case USB_DESCRIPTOR_DEVICE:
+      return "DEVICE";
+    case USB_DESCRIPTOR_CONFIGURATION:
+      return "CONFIGURATION";
+    case USB_DESCRIPTOR_STRING:
+      return "STRING";
+    case USB_DESCRIPTOR_INTERFACE:
+      return "INTERFACE";
+    case USB_DESCRIPTOR_ENDPOINT:
+      return "ENDPOINT";
+    case USB_DESCRIPTOR_DEVICE_QUALIFIER:
+      return "DEVICE_QUALIFIER";
+    case USB_DESCRIPTOR_OTHER_SPEED:
+      return "OTHER_SPEED";
+    case USB_DESCRIPTOR_BOS:
+      return "BOS";
+    case USB_DESCRIPTOR_HID:
+      return "HID";
+    case USB_DESCRIPTOR_HID_REPORT:
+      return "HID_REPORT";
+  }
+  return nullptr;
+}
+
+const char* StandardRequestName(int request) {
+  switch (request) {
+    case GET_STATUS:
+      return "GET_STATUS";
+    case CLEAR_FEATURE:
+      return "CLEAR_FEATURE";
+    case SET_FEATURE:
+      return "SET_FEATURE";
+    case SET_ADDRESS:
+      return "SET_ADDRESS";
+    case SET_DESCRIPTOR:
+      return "SET_DESCRIPTOR";
+    case GET_CONFIGURATION:
+      return "GET_CONFIGURATION";
+    case SET_CONFIGURATION:
+      return "SET_CONFIGURATION";
+    case GET_INTERFACE:
+      return "GET_INTERFACE";
+    case SET_INTERFACE:
+      return "SET_INTERFACE";
+    case SET_FRAME:
+      return "SET_FRAME";
+  }
+  return nullptr;
+}
+
+const char* ClassRequestName(int interface_class, int request) {
+  if (interface_class == kPrinterInterfaceClass) {
+    switch (request) {
+      case GET_DEVICE_ID:
+        return "GET_DEVICE_ID";
+      case GET_PORT_STATUS:
+        return "GET_PORT_STATUS";
+      case SOFT_RESET:
+        return "SOFT_RESET";
+    }
+  } else if (interface_class == kHidInterfaceClass) {
+    switch (request) {
+      case GET_REPORT:
+        return "GET_REPORT";
+      case GET_IDLE:
+        return "GET_IDLE";
+      case GET_PROTOCOL:
+        return "GET_PROTOCOL";
+      case SET_REPORT:
+        return "SET_REPORT";
+      case SET_IDLE:
+        return "SET_IDLE";
+      case SET_PROTOCOL:
+        return "SET_PROTOCOL";
+    }
+  }
+  return nullptr;
+}
+
+// Returns the class of the interface of |device| numbered |number|, or -1.
+int InterfaceClass(const UsbDevice& device, int number) {
+  for (const USB_INTERFACE_DESCRIPTOR& interface : device.interfaces()) {
+    if (interface.bInterfaceNumber == number) {
+      return interface.bInterfaceClass;
+    }
+  }
+  return -1;
+}
+
+// Appends |text| to |json| as the contents of a JSON string. Bus IDs come
+// from clients, so anything outside of printable ASCII is escaped.
+void AppendJsonString(const std::string& text, std::string* json) {
+  for (char c : text) {
+    unsigned char byte_value = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      *json += '\\';
+      *json += c;
+    } else if (byte_value < 0x20 || byte_value >= 0x7F) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", byte_value);
+      *json += escaped;
+    } else {
+      *json += c;
+    }
+  }
+}
+
+// Appends a complete ("X") trace event to |events|. Times are in
+// nanoseconds and |args| is the body of the event's args object.
+void AppendCompleteEvent(const std::string& name, const char* category,
+                         int tid, uint64_t start_ns, uint64_t duration_ns,
+                         const std::string& args, std::string* events) {
+  if (!events->empty()) {
+    *events += ",\n";
+  }
+  *events += "{\"name\":\"";
+  AppendJsonString(name, events);
+  char fields[160];
+  snprintf(fields, sizeof(fields),
+           "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+           "\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+           category, tid, start_ns / 1e3, duration_ns / 1e3);
+  *events += fields;
+  *events += args;
+  *events += "}}";
+}
+
+double Millis(uint64_t ns) { return ns / 1e6; }
+
+}  // namespace
+
+std::string DescribeControlRequest(const UsbDevice& device,
+                                   const StandardDeviceRequest& request) {
+  int type = GetControlType(request.bmRequestType);
+  const char* name = nullptr;
+  if (type == STANDARD_TYPE && request.bRequest == GET_DESCRIPTOR) {
+    char unknown[8];
+    snprintf(unknown, sizeof(unknown), "0x%02x", request.wValue1);
+    const char* descriptor = DescriptorName(request.wValue1);
+    std::string description = "GET_DESCRIPTOR(";
+    description += descriptor != nullptr ? descriptor : unknown;
+    // Strings are read one at a time, so the index tells the reads apart.
+    if (request.wValue1 == USB_DESCRIPTOR_STRING) {
+      description += " " + std::to_string(request.wValue0);
+    }
+    return description + ")";
+  }
+  if (type == STANDARD_TYPE) {
+    name = StandardRequestName(request.bRequest);
+  } else if (type == CLASS_TYPE) {
+    name = ClassRequestName(InterfaceClass(device, request.wIndex0),
+                            request.bRequest);
+  }
+  if (name != nullptr) {
+    return name;
+  }
+  static const char* const kTypeNames[] = {"STANDARD", "CLASS", "VENDOR",
+                                           "RESERVED"};
+  char description[48];
+  snprintf(description, sizeof(description), "%s_REQUEST(0x%02x)",
+           kTypeNames[type], request.bRequest);
+  return description;
+}
+
+EnumerationTimeline::EnumerationTimeline(uint64_t connected_ns)
+    : connected_ns_(connected_ns),
+      step_start_ns_(0),
+      step_start_cpu_ns_(0),
+      session_(0),
+      round_trip_ns_(0),
+      outcome_("") {}
+
+void EnumerationTimeline::BeginStep() {
+  step_start_ns_ = MonotonicNanos();
+  step_start_cpu_ns_ = ThreadCpuNanos();
+}
+
+void EnumerationTimeline::EndStep(std::string name) {
+  uint64_t cpu_ns = ThreadCpuNanos() - step_start_cpu_ns_;
+  steps_.push_back(
+      {std::move(name), step_start_ns_, MonotonicNanos(), cpu_ns});
+}
+
+void EnumerationTimeline::Finish(uint64_t session, const std::string& bus_id,
+                                 uint64_t round_trip_ns,
+                                 const char* outcome) {
+  session_ = session;
+  bus_id_ = bus_id;
+  round_trip_ns_ = round_trip_ns;
+  outcome_ = outcome;
+}
+
+uint64_t EnumerationTimeline::WaitBefore(size_t index) const {
+  uint64_t previous_ns =
+      index == 0 ? connected_ns_ : steps_[index - 1].end_ns;
+  return steps_[index].start_ns - previous_ns;
+}
+
+uint64_t EnumerationTimeline::NetworkPart(uint64_t wait_ns) const {
+  return std::min(wait_ns, round_trip_ns_);
+}
+
+std::vector<std::string> EnumerationTimeline::Summary() const {
+  uint64_t server_ns = 0;
+  uint64_t cpu_ns = 0;
+  uint64_t network_ns = 0;
+  uint64_t host_ns = 0;
+  std::vector<std::string> lines(1);
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    const Step& step = steps_[i];
+    uint64_t wait_ns = WaitBefore(i);
+    server_ns += step.end_ns - step.start_ns;
+    cpu_ns += step.cpu_ns;
+    network_ns += NetworkPart(wait_ns);
+    host_ns += wait_ns - NetworkPart(wait_ns);
+    char line[160];
+    snprintf(line, sizeof(line),
+             "  %s wait=%.3fms server=%.3fms cpu=%.3fms", step.name.c_str(),
+             Millis(wait_ns), Millis(step.end_ns - step.start_ns),
+             Millis(step.cpu_ns));
+    lines.push_back(line);
+  }
+  uint64_t total_ns =
+      steps_.empty() ? 0 : steps_.back().end_ns - connected_ns_;
+  char totals[256];
+  snprintf(totals, sizeof(totals),
+           "Enumeration of %.32s by session %llu %s in %.3fms: "
+           "server=%.3fms cpu=%.3fms host=%.3fms network=%.3fms "
+           "rtt=%.3fms steps=%zu",
+           bus_id_.c_str(), static_cast<unsigned long long>(session_),
+           outcome_, Millis(total_ns), Millis(server_ns), Millis(cpu_ns),
+           Millis(host_ns), Millis(network_ns), Millis(round_trip_ns_),
+           steps_.size());
+  lines[0] = totals;
+  return lines;
+}
+
+void EnumerationTimeline::AppendTraceEvents(int tid,
+                                            std::string* events) const {
+  if (!events->empty()) {
+    *events += ",\n";
+  }
+  *events += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+  *events += std::to_string(tid) + ",\"args\":{\"name\":\"";
+  AppendJsonString(bus_id_ + " session " + std::to_string(session_) + " " +
+                       outcome_,
+                   events);
+  *events += "\"}}";
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    const Step& step = steps_[i];
+    uint64_t wait_ns = WaitBefore(i);
+    char args[96];
+    snprintf(args, sizeof(args), "\"host_us\":%.3f,\"network_us\":%.3f",
+             (wait_ns - NetworkPart(wait_ns)) / 1e3,
+             NetworkPart(wait_ns) / 1e3);
+    AppendCompleteEvent("wait", "client", tid, step.start_ns - wait_ns,
+                        wait_ns, args, events);
+    snprintf(args, sizeof(args), "\"cpu_us\":%.3f", step.cpu_ns / 1e3);
+    AppendCompleteEvent(step.name, "server", tid, step.start_ns,
+                        step.end_ns - step.start_ns, args, events);
+  }
+}
+
+std::unique_ptr<EnumerationProfiler> EnumerationProfiler::Create(
+    const char* trace_path) {
+  std::unique_ptr<EnumerationProfiler> profiler(
+      new EnumerationProfiler(trace_path));
+  if (trace_path != nullptr && !profiler->WriteTrace()) {
+    return nullptr;
+  }
+  return profiler;
+}
+
+EnumerationProfiler::EnumerationProfiler(const char* trace_path)
+    : trace_path_(trace_path != nullptr ? trace_path : ""), first_tid_(1) {}
+
+EnumerationProfiler::~EnumerationProfiler() {
+  if (g_profiler == this) {
+    g_profiler = nullptr;
+  }
+}
+
+void EnumerationProfiler::Add(std::unique_ptr<EnumerationTimeline> timeline) {
+  for (const std::string& line : timeline->Summary()) {
+    printf("%s\n", line.c_str());
+  }
+  timelines_.push_back(std::move(timeline));
+  if (timelines_.size() > kMaxEnumerationTimelines) {
+    timelines_.pop_front();
+    ++first_tid_;
+  }
+  if (!trace_path_.empty()) {
+    WriteTrace();
+  }
+}
+
+bool EnumerationProfiler::WriteTrace() const {
+  std::string events;
+  for (size_t i = 0; i < timelines_.size(); ++i) {
+    timelines_[i]->AppendTraceEvents(first_tid_ + i, &events);
+  }
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" +
+                     events + "\n]}\n";
+  // The file is replaced in one step so that it can be opened at any time.
+  std::string temporary_path = trace_path_ + ".tmp";
+  FILE* file = fopen(temporary_path.c_str(), "w");
+  if (file == nullptr) {
+    printf("open %s error : %s\n", temporary_path.c_str(), strerror(errno));
+    return false;
+  }
+  bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+  if (fclose(file) != 0 || !written) {
+    printf("write %s error : %s\n", temporary_path.c_str(), strerror(errno));
+    return false;
+  }
+  if (rename(temporary_path.c_str(), trace_path_.c_str()) < 0) {
+    printf("rename %s error : %s\n", trace_path_.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+EnumerationProfiler* GetEnumerationProfiler() { return g_profiler; }
+
+void SetEnumerationProfiler(EnumerationProfiler* profiler) {
+  g_profiler = profiler;
+}
@@ -0,0 +1,148 @@
+#ifndef __USBIP_ENUMERATION_TIMELINE_H__
+#define __USBIP_ENUMERATION_TIMELINE_H__
+
+#include "usb_device.h"
+#include "usbip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Timelines which an EnumerationProfiler keeps for reporting.
+const size_t kMaxEnumerationTimelines = 64;
+
+// A timeline which grows to this many steps ends there, as the client is
+// evidently not enumerating the device any more.
+const size_t kMaxEnumerationSteps = 256;
+
+// Names the control request |request| which a client sent to |device|, such
+// as "GET_DESCRIPTOR(CONFIGURATION)" or "GET_DEVICE_ID".
+std::string DescribeControlRequest(const UsbDevice& device,
+                                   const StandardDeviceRequest& request);
+
+// The steps a client takes from connecting to the server until it has
+// finished enumerating the device it imported: OP_REQ_IMPORT, the descriptor
+// reads, SET_CONFIGURATION and the class requests which its driver makes when
+// it binds, such as a printer's GET_DEVICE_ID.
+//
+// Each step is timed from when the server had the whole request until it had
+// queued the reply, in wall-clock time and in CPU time of the thread which
+// served it. The time between one reply and the next request is spent by the
+// network and the host, and the round trip time of the connection tells the
+// two apart: a wait no longer than it is put down to the network and the rest
+// to the host. For devices which run on a DeviceThread, the server time of a
+// URB only covers handing it over to the thread.
+class EnumerationTimeline {
+ public:
+  struct Step {
+    // Name of the request.
+    std::string name;
+    // CLOCK_MONOTONIC times at which the server began handling the request
+    // and had queued its reply.
+    uint64_t start_ns;
+    uint64_t end_ns;
+    // CPU time which the serving thread spent on the request.
+    uint64_t cpu_ns;
+  };
+
+  // Starts the timeline of a client which connected at |connected_ns|.
+  explicit EnumerationTimeline(uint64_t connected_ns);
+
+  EnumerationTimeline(const EnumerationTimeline&) = delete;
+  EnumerationTimeline& operator=(const EnumerationTimeline&) = delete;
+
+  // Begins a step now.
+  void BeginStep();
+
+  // Ends the step begun by the last BeginStep() and names it |name|.
+  void EndStep(std::string name);
+
+  // Ends the timeline of session |session|, which imported the device with
+  // |bus_id|, or asked for one it could not have. |outcome| describes how
+  // enumeration ended and must outlive the timeline. |round_trip_ns| is the
+  // round trip time of the connection, or 0 if it is not known.
+  void Finish(uint64_t session, const std::string& bus_id,
+              uint64_t round_trip_ns, const char* outcome);
+
+  const std::vector<Step>& steps() const { return steps_; }
+  const std::string& bus_id() const { return bus_id_; }
+
+  // Whether no more steps should be added.
+  bool full() const { return steps_.size() >= kMaxEnumerationSteps; }
+
+  // Describes the timeline as a line of totals followed by a line for each
+  // step.
+  std::vector<std::string> Summary() const;
+
+  // Appends the steps, and the waits between them, to |events| as trace
+  // events in the Chrome trace event format. The timeline is shown as a
+  // thread with id |tid|.
+  void AppendTraceEvents(int tid, std::string* events) const;
+
+ private:
+  // Time which the client spent between the end of the previous step, or
+  // connecting, and the start of step |index|.
+  uint64_t WaitBefore(size_t index) const;
+
+  // The part of |wait_ns| which is put down to the network.
+  uint64_t NetworkPart(uint64_t wait_ns) const;
+
+  uint64_t connected_ns_;
+  uint64_t step_start_ns_;
+  uint64_t step_start_cpu_ns_;
+  std::vector<Step> steps_;
+  uint64_t session_;
+  std::string bus_id_;
+  uint64_t round_trip_ns_;
+  const char* outcome_;
+};
+
+// Collects the enumeration timelines of the server's sessions, prints the
+// summary of each as it ends and keeps the last kMaxEnumerationTimelines of
+// them. If it was given a trace path, the kept timelines are written there as
+// Chrome trace event JSON every time one ends, which chrome://tracing and
+// Perfetto open directly. Only the thread which serves the sessions may use
+// it.
+class EnumerationProfiler {
+ public:
+  // Writes the trace to |trace_path|, replacing it, unless it is nullptr.
+  // Returns nullptr if the trace cannot be written.
+  static std::unique_ptr<EnumerationProfiler> Create(const char* trace_path);
+
+  ~EnumerationProfiler();
+
+  EnumerationProfiler(const EnumerationProfiler&) = delete;
+  EnumerationProfiler& operator=(const EnumerationProfiler&) = delete;
+
+  // Takes a timeline which has been finished.
+  void Add(std::unique_ptr<EnumerationTimeline> timeline);
+
+  // The kept timelines, oldest first.
+  const std::deque<std::unique_ptr<EnumerationTimeline>>& timelines() const {
+    return timelines_;
+  }
+
+ private:
+  explicit EnumerationProfiler(const char* trace_path);
+
+  // Replaces the trace file with one holding the kept timelines. Returns
+  // false if it cannot be written.
+  bool WriteTrace() const;
+
+  std::string trace_path_;
+  std::deque<std::unique_ptr<EnumerationTimeline>> timelines_;
+  // Thread id which the oldest kept timeline is shown with in the trace.
+  int first_tid_;
+};
+
+// Returns the profiler which sessions add their timelines to, or nullptr if
+// enumeration is not being profiled.
+EnumerationProfiler* GetEnumerationProfiler();
+
+// Installs |profiler| as the process-wide profiler. Ownership is not taken.
+void SetEnumerationProfiler(EnumerationProfiler* profiler);
+
+#endif  // __USBIP_ENUMERATION_TIMELINE_H__
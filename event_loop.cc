@@ -0,0 +1,166 @@
+#include "event_loop.h"
+
+#include "monotonic_clock.h"
+
+#include <memory>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Maximum number of events which are retrieved by a single call to
+// epoll_wait().
+const int kMaxEvents = 64;
+
+}  // namespace
+
+EventLoop::EventLoop()
+    : running_(false), next_timer_id_(1), armed_deadline_(0) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    printf("epoll_create1 error : %s\n", strerror(errno));
+    exit(1);
+  }
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    printf("timerfd_create error : %s\n", strerror(errno));
+    exit(1);
+  }
+  Add(timer_fd_, EPOLLIN, [this](uint32_t events) {
+    uint64_t expirations;
+    while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+    }
+    armed_deadline_ = 0;
+    RunTimers();
+  });
+}
+
+EventLoop::~EventLoop() {
+  close(timer_fd_);
+  close(epoll_fd_);
+}
+
+bool EventLoop::Add(int fd, uint32_t events, Handler handler) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    printf("epoll_ctl(ADD) error : %s\n", strerror(errno));
+    return false;
+  }
+  if (static_cast<size_t>(fd) >= handlers_.size()) {
+    handlers_.resize(fd + 1);
+  }
+  handlers_[fd] = std::make_unique<Handler>(std::move(handler));
+  return true;
+}
+
+bool EventLoop::Modify(int fd, uint32_t events) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) < 0) {
+    printf("epoll_ctl(MOD) error : %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void EventLoop::Remove(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= handlers_.size() ||
+      !handlers_[fd]) {
+    return;
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  removed_.push_back(std::move(handlers_[fd]));
+}
+
+int EventLoop::AddTimer(uint64_t delay_ns, TimerCallback callback) {
+  int id = next_timer_id_++;
+  timers_.emplace(MonotonicNanos() + delay_ns, id);
+  timer_callbacks_[id] = std::move(callback);
+  ArmTimerFd();
+  return id;
+}
+
+void EventLoop::CancelTimer(int id) { timer_callbacks_.erase(id); }
+
+void EventLoop::RunTimers() {
+  uint64_t now = MonotonicNanos();
+  while (!timers_.empty() && timers_.top().first <= now) {
+    int id = timers_.top().second;
+    timers_.pop();
+    auto it = timer_callbacks_.find(id);
+    if (it == timer_callbacks_.end()) {
+      continue;
+    }
+    TimerCallback callback = std::move(it->second);
+    timer_callbacks_.erase(it);
+    callback();
+  }
+  ArmTimerFd();
+}
+
+void EventLoop::ArmTimerFd() {
+  // Cancelled timers at the front of the queue would only cause spurious
+  // wakeups, so they are discarded here.
+  while (!timers_.empty() &&
+         timer_callbacks_.find(timers_.top().second) ==
+             timer_callbacks_.end()) {
+    timers_.pop();
+  }
+  if (timers_.empty()) {
+    return;
+  }
+  uint64_t deadline = timers_.top().first;
+  if (armed_deadline_ != 0 && armed_deadline_ <= deadline) {
+    return;
+  }
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = deadline / 1000000000ull;
+  spec.it_value.tv_nsec = deadline % 1000000000ull;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    printf("timerfd_settime error : %s\n", strerror(errno));
+    return;
+  }
+  armed_deadline_ = deadline;
+}
+
+void EventLoop::Run() {
+  running_ = true;
+  while (running_) {
+    RunOnce(-1);
+  }
+}
+
+void EventLoop::RunOnce(int timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+  if (count < 0) {
+    if (errno != EINTR) {
+      printf("epoll_wait error : %s\n", strerror(errno));
+    }
+    return;
+  }
+  for (int i = 0; i < count; ++i) {
+    int fd = events[i].data.fd;
+    // The handler may have been removed by an earlier event in this batch.
+    if (static_cast<size_t>(fd) >= handlers_.size() || !handlers_[fd]) {
+      continue;
+    }
+    (*handlers_[fd])(events[i].events);
+  }
+  removed_.clear();
+}
@@ -0,0 +1,80 @@
+#ifndef __USBIP_EVENT_LOOP_H__
+#define __USBIP_EVENT_LOOP_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Single-threaded epoll based event loop. Handlers are registered per file
+// descriptor and are invoked with the epoll event mask whenever the descriptor
+// becomes ready. One-shot timers are multiplexed onto a single timerfd.
+class EventLoop {
+ public:
+  using Handler = std::function<void(uint32_t events)>;
+  using TimerCallback = std::function<void()>;
+
+  EventLoop();
+  ~EventLoop();
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // Starts watching |fd| for |events| and runs |handler| when they occur.
+  // Returns false if |fd| could not be added.
+  bool Add(int fd, uint32_t events, Handler handler);
+
+  // Changes the set of events which |fd| is being watched for.
+  bool Modify(int fd, uint32_t events);
+
+  // Stops watching |fd|. It is safe to call this from within the handler of
+  // |fd| itself.
+  void Remove(int fd);
+
+  // Runs |callback| once, |delay_ns| nanoseconds from now. Returns an id which
+  // can be passed to CancelTimer().
+  int AddTimer(uint64_t delay_ns, TimerCallback callback);
+
+  // Cancels the timer with |id| if it has not fired yet.
+  void CancelTimer(int id);
+
+  // Dispatches events until Stop() is called.
+  void Run();
+
+  // Processes the events which are ready, waiting at most |timeout_ms|
+  // milliseconds for one to arrive (-1 waits forever).
+  void RunOnce(int timeout_ms);
+
+  void Stop() { running_ = false; }
+
+ private:
+  // Runs the callbacks of every timer which has expired.
+  void RunTimers();
+
+  // Programs the timerfd for the earliest pending timer.
+  void ArmTimerFd();
+
+  int epoll_fd_;
+  int timer_fd_;
+  bool running_;
+
+  // Pending timers ordered by deadline. Cancelled timers stay in the queue
+  // until they expire but are removed from |timer_callbacks_|.
+  using TimerEntry = std::pair<uint64_t, int>;
+  std::priority_queue<TimerEntry, std::vector<TimerEntry>,
+                      std::greater<TimerEntry>>
+      timers_;
+  std::unordered_map<int, TimerCallback> timer_callbacks_;
+  int next_timer_id_;
+  uint64_t armed_deadline_;
+  // Indexed by file descriptor.
+  std::vector<std::unique_ptr<Handler>> handlers_;
+  // Handlers which were removed while events were being dispatched. They are
+  // kept alive until the current batch of events has been processed.
+  std::vector<std::unique_ptr<Handler>> removed_;
+};
+
+#endif  // __USBIP_EVENT_LOOP_H__
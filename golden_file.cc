@@ -0,0 +1,127 @@
+#include "golden_file.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Amount compared by each memcmp() while looking for a difference.
+const size_t kCompareBlockSize = 4096;
+
+// Returns the offset of the first byte in which the |size| bytes at |a| and
+// |b| differ, or |size| if they are equal. memcmp() is vectorized by the C
+// library but does not say where the difference is, so it is run a block at a
+// time and only the block which differs is scanned byte by byte.
+size_t FirstDifference(const char* a, const char* b, size_t size) {
+  for (size_t offset = 0; offset < size; offset += kCompareBlockSize) {
+    size_t block = std::min(kCompareBlockSize, size - offset);
+    if (memcmp(a + offset, b + offset, block) != 0) {
+      while (a[offset] == b[offset]) {
+        ++offset;
+      }
+      return offset;
+    }
+  }
+  return size;
+}
+
+}  // namespace
+
+std::unique_ptr<GoldenFile> GoldenFile::Create(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    printf("open %s error : %s\n", path.c_str(), strerror(errno));
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    printf("fstat %s error : %s\n", path.c_str(), strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+  const char* data = nullptr;
+  if (info.st_size > 0) {
+    void* mapping =
+        mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      printf("mmap %s error : %s\n", path.c_str(), strerror(errno));
+      close(fd);
+      return nullptr;
+    }
+    // Jobs are compared front to back.
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapping);
+  }
+  close(fd);
+  return std::unique_ptr<GoldenFile>(
+      new GoldenFile(path, data, info.st_size));
+}
+
+GoldenFile::GoldenFile(const std::string& path, const char* data,
+                       uint64_t size)
+    : path_(path), data_(data), size_(size) {}
+
+GoldenFile::~GoldenFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+GoldenComparison::GoldenComparison()
+    : status_(Status::kNone), compared_(0), divergence_(0) {}
+
+GoldenComparison::GoldenComparison(std::shared_ptr<const GoldenFile> golden)
+    : golden_(std::move(golden)),
+      status_(Status::kMatching),
+      compared_(0),
+      divergence_(0) {}
+
+bool GoldenComparison::Update(const char* data, size_t size) {
+  if (status_ != Status::kMatching && status_ != Status::kIncomplete) {
+    return false;
+  }
+  uint64_t offset = compared_;
+  compared_ += size;
+  uint64_t available = offset < golden_->size() ? golden_->size() - offset : 0;
+  size_t length = std::min<uint64_t>(size, available);
+  size_t difference = FirstDifference(data, golden_->data() + offset, length);
+  if (difference == size) {
+    return false;
+  }
+  // Either a byte differs or the job is longer than the golden file.
+  status_ = Status::kDiverged;
+  divergence_ = offset + difference;
+  return true;
+}
+
+void GoldenComparison::Skip(size_t size) {
+  if (status_ == Status::kMatching) {
+    status_ = Status::kIncomplete;
+  }
+  compared_ += size;
+}
+
+bool GoldenComparison::Finish() {
+  if (status_ == Status::kMatching || status_ == Status::kIncomplete) {
+    if (compared_ < golden_->size()) {
+      status_ = Status::kDiverged;
+      divergence_ = compared_;
+      return true;
+    }
+    if (status_ == Status::kMatching) {
+      status_ = Status::kMatched;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,82 @@
+#ifndef __USBIP_GOLDEN_FILE_H__
+#define __USBIP_GOLDEN_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// The data a printer is expected to receive for a job, mapped read-only so
+// that multi-gigabyte files cost no more than the pages being compared.
+class GoldenFile {
+ public:
+  // Maps the file at |path|. Returns nullptr if it cannot be opened or
+  // mapped.
+  static std::unique_ptr<GoldenFile> Create(const std::string& path);
+
+  ~GoldenFile();
+
+  GoldenFile(const GoldenFile&) = delete;
+  GoldenFile& operator=(const GoldenFile&) = delete;
+
+  const std::string& path() const { return path_; }
+  const char* data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  GoldenFile(const std::string& path, const char* data, uint64_t size);
+
+  std::string path_;
+  const char* data_;
+  uint64_t size_;
+};
+
+// Compares the data of one job against a golden file as it arrives, so that
+// the first divergence is known as soon as the bytes which cause it do, and
+// nothing has to be stored to check the job afterwards.
+class GoldenComparison {
+ public:
+  enum class Status {
+    // The job has no golden file.
+    kNone,
+    // Every byte received so far matches.
+    kMatching,
+    // The job ended and is identical to the golden file.
+    kMatched,
+    // The job differs from the golden file at divergence().
+    kDiverged,
+    // Part of the job could not be compared, as it was not seen by the
+    // printer.
+    kIncomplete,
+  };
+
+  GoldenComparison();
+  explicit GoldenComparison(std::shared_ptr<const GoldenFile> golden);
+
+  // Compares the next |size| bytes of the job at |data|. Returns true if the
+  // job diverges from the golden file here for the first time.
+  bool Update(const char* data, size_t size);
+
+  // Accounts for |size| bytes of the job which cannot be compared.
+  void Skip(size_t size);
+
+  // Ends the comparison. Returns true if the job first diverges by being
+  // shorter than the golden file.
+  bool Finish();
+
+  Status status() const { return status_; }
+  // Number of bytes of the job seen so far, including any skipped ones.
+  uint64_t compared() const { return compared_; }
+  // Offset of the first byte which differs, or of the end of the shorter of
+  // the job and the golden file.
+  uint64_t divergence() const { return divergence_; }
+  const GoldenFile* golden() const { return golden_.get(); }
+
+ private:
+  std::shared_ptr<const GoldenFile> golden_;
+  Status status_;
+  uint64_t compared_;
+  uint64_t divergence_;
+};
+
+#endif  // __USBIP_GOLDEN_FILE_H__
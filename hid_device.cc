@@ -0,0 +1,225 @@
+#include "hid_device.h"
+
+#include "control_dispatch.h"
+#include "device_descriptors.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <vector>
+
+#include <cstdio>
+
+HidDevice::HidDevice(
+    const USB_DEVICE_DESCRIPTOR& device_descriptor,
+    const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+    const std::vector<std::vector<char>>& strings,
+    const USB_INTERFACE_DESCRIPTOR& interface,
+    const USB_HID_DESCRIPTOR& hid_descriptor,
+    const USB_ENDPOINT_DESCRIPTOR& endpoint,
+    const std::vector<char>& report_descriptor, int report_size)
+    : UsbDevice(device_descriptor, configuration_descriptor, strings,
+                {interface}, {endpoint}),
+      hid_descriptor_(hid_descriptor),
+      report_descriptor_(report_descriptor),
+      report_(report_size, 0),
+      interval_ms_(endpoint.bInterval > 0 ? endpoint.bInterval : 1),
+      idle_rate_(0),
+      protocol_(1),
+      reports_sent_(0),
+      pending_count_(0),
+      report_scheduled_(false),
+      report_timer_(0),
+      last_report_tick_(0) {
+  const char* hid = reinterpret_cast<const char*>(&hid_descriptor_);
+  SetClassDescriptor(0, std::vector<char>(hid, hid + sizeof(hid_descriptor_)));
+}
+
+bool HidDevice::UnlinkUrb(int seqnum) {
+  for (int i = 0; i < pending_count_; ++i) {
+    if (pending_[i].request.seqnum != seqnum) {
+      continue;
+    }
+    for (int j = i + 1; j < pending_count_; ++j) {
+      pending_[j - 1] = pending_[j];
+    }
+    --pending_count_;
+    return true;
+  }
+  return false;
+}
+
+void HidDevice::Detach() {
+  UsbDevice::Detach();
+  pending_count_ = 0;
+  if (report_scheduled_) {
+    timer_wheel_->Cancel(report_timer_);
+    report_scheduled_ = false;
+  }
+  idle_rate_ = 0;
+  protocol_ = 1;
+}
+
+void HidDevice::HandleDataRequest(Transport* transport,
+                                  const USBIP_CMD_SUBMIT& usb_request,
+                                  const char* data, unsigned int data_size) {
+  if (usb_request.direction == 0) {
+    // There is no interrupt OUT endpoint; accept and discard the data.
+    SendUsbOutResponse(transport, usb_request, data_size, 0);
+    return;
+  }
+  if (timer_wheel_ == nullptr) {
+    // Without a wheel there is no way to pace reports, so they are delivered
+    // as soon as they are requested.
+    GenerateReport(report_.data());
+    ++reports_sent_;
+    SendUsbRequest(transport, usb_request, report_.data(), report_.size(), 0);
+    return;
+  }
+  if (pending_count_ == kMaxPendingInterruptUrbs) {
+    // The URB is given back rather than left for the host to time out.
+    printf("Too many pending interrupt URBs, stalling %d\n",
+           usb_request.seqnum);
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  pending_[pending_count_++] = {transport, usb_request};
+  ScheduleReport();
+}
+
+void HidDevice::ScheduleReport() {
+  if (report_scheduled_ || pending_count_ == 0) {
+    return;
+  }
+  uint64_t due = last_report_tick_ + interval_ms_;
+  uint64_t now = timer_wheel_->now();
+  report_timer_ = timer_wheel_->Schedule(due > now ? due - now : 0,
+                                         [this]() { OnInterval(); });
+  report_scheduled_ = true;
+}
+
+void HidDevice::OnInterval() {
+  report_scheduled_ = false;
+  last_report_tick_ = timer_wheel_->now();
+  if (pending_count_ == 0) {
+    return;
+  }
+  PendingUrb urb = pending_[0];
+  for (int i = 1; i < pending_count_; ++i) {
+    pending_[i - 1] = pending_[i];
+  }
+  --pending_count_;
+
+  GenerateReport(report_.data());
+  ++reports_sent_;
+  unsigned int size = report_.size();
+  if (static_cast<unsigned int>(urb.request.transfer_buffer_length) < size) {
+    size = urb.request.transfer_buffer_length;
+  }
+  SendUsbRequest(urb.transport, urb.request, report_.data(), size, 0);
+  ScheduleReport();
+}
+
+bool HidDevice::HandleClassControl(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  static constexpr ControlHandler<HidDevice> kHandlers[] = {
+      {STANDARD_TYPE, RECIPIENT_INTERFACE, GET_DESCRIPTOR, USB_DESCRIPTOR_HID,
+       &HidDevice::HandleGetHidDescriptor},
+      {STANDARD_TYPE, RECIPIENT_INTERFACE, GET_DESCRIPTOR,
+       USB_DESCRIPTOR_HID_REPORT, &HidDevice::HandleGetReportDescriptor},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, GET_REPORT, kAnyDescriptor,
+       &HidDevice::HandleGetReport},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, GET_IDLE, kAnyDescriptor,
+       &HidDevice::HandleGetIdle},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, GET_PROTOCOL, kAnyDescriptor,
+       &HidDevice::HandleGetProtocol},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, SET_REPORT, kAnyDescriptor,
+       &HidDevice::HandleSetReport},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, SET_IDLE, kAnyDescriptor,
+       &HidDevice::HandleSetIdle},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, SET_PROTOCOL, kAnyDescriptor,
+       &HidDevice::HandleSetProtocol},
+  };
+  return DispatchControl(this, kHandlers, transport, usb_request,
+                         control_request, data, data_size);
+}
+
+void HidDevice::HandleGetHidDescriptor(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  SendDescriptor(transport, usb_request, control_request,
+                 reinterpret_cast<const char*>(&hid_descriptor_),
+                 sizeof(hid_descriptor_));
+}
+
+void HidDevice::HandleGetReportDescriptor(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  SendDescriptor(transport, usb_request, control_request,
+                 report_descriptor_.data(), report_descriptor_.size());
+}
+
+void HidDevice::HandleGetReport(Transport* transport,
+                                const USBIP_CMD_SUBMIT& usb_request,
+                                const StandardDeviceRequest& control_request,
+                                const char* data, unsigned int data_size) {
+  unsigned int size = report_.size();
+  if (control_request.wLength < size) {
+    size = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, report_.data(), size, 0);
+}
+
+void HidDevice::HandleGetIdle(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request,
+                              const StandardDeviceRequest& control_request,
+                              const char* data, unsigned int data_size) {
+  SendUsbRequest(transport, usb_request, (const char*)&idle_rate_, 1, 0);
+}
+
+void HidDevice::HandleGetProtocol(Transport* transport,
+                                  const USBIP_CMD_SUBMIT& usb_request,
+                                  const StandardDeviceRequest& control_request,
+                                  const char* data, unsigned int data_size) {
+  SendUsbRequest(transport, usb_request, (const char*)&protocol_, 1, 0);
+}
+
+void HidDevice::HandleSetReport(Transport* transport,
+                                const USBIP_CMD_SUBMIT& usb_request,
+                                const StandardDeviceRequest& control_request,
+                                const char* data, unsigned int data_size) {
+  LogRequest("SET_REPORT received %u bytes\n", data_size);
+  OnOutputReport(data, data_size);
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
+
+void HidDevice::HandleSetIdle(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request,
+                              const StandardDeviceRequest& control_request,
+                              const char* data, unsigned int data_size) {
+  // Reports are generated every interval regardless of the idle rate, but it
+  // is remembered so that GET_IDLE reports it back.
+  idle_rate_ = control_request.wValue1;
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
+
+void HidDevice::HandleSetProtocol(Transport* transport,
+                                  const USBIP_CMD_SUBMIT& usb_request,
+                                  const StandardDeviceRequest& control_request,
+                                  const char* data, unsigned int data_size) {
+  protocol_ = control_request.wValue0;
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
+
+void HidDevice::SendDescriptor(Transport* transport,
+                               const USBIP_CMD_SUBMIT& usb_request,
+                               const StandardDeviceRequest& control_request,
+                               const char* descriptor, unsigned int size) {
+  if (control_request.wLength < size) {
+    size = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, descriptor, size, 0);
+}
@@ -0,0 +1,127 @@
+#ifndef __USBIP_HID_DEVICE_H__
+#define __USBIP_HID_DEVICE_H__
+
+#include "device_descriptors.h"
+#include "timer_wheel.h"
+#include "usb_device.h"
+#include "usbip.h"
+
+#include <cstdint>
+#include <vector>
+
+// Number of interrupt IN URBs which can wait for the next report.
+const int kMaxPendingInterruptUrbs = 32;
+
+// A HID with a single interface and one interrupt IN endpoint.
+//
+// Input reports are delivered at the endpoint's bInterval (in milliseconds, as
+// for a full-speed device): each interval the oldest pending interrupt IN URB
+// is completed with a freshly generated report. The intervals are driven by
+// the device's TimerWheel, so a device without URBs to complete costs nothing.
+class HidDevice : public UsbDevice {
+ public:
+  // |endpoint| must be the interrupt IN endpoint. |report_size| is the size of
+  // the input reports described by |report_descriptor|.
+  HidDevice(const USB_DEVICE_DESCRIPTOR& device_descriptor,
+            const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+            const std::vector<std::vector<char>>& strings,
+            const USB_INTERFACE_DESCRIPTOR& interface,
+            const USB_HID_DESCRIPTOR& hid_descriptor,
+            const USB_ENDPOINT_DESCRIPTOR& endpoint,
+            const std::vector<char>& report_descriptor, int report_size);
+
+  // Number of input reports which have been delivered.
+  uint64_t reports_sent() const { return reports_sent_; }
+
+  bool UnlinkUrb(int seqnum) override;
+  void Detach() override;
+
+ protected:
+  // Fills |report| with the next |report_size| byte input report.
+  virtual void GenerateReport(char* report) = 0;
+
+  // Called with the output report sent by SET_REPORT, e.g. keyboard LEDs.
+  virtual void OnOutputReport(const char* data, unsigned int size) {}
+
+  // Handles the HID class requests (HID v1.11 section 7.2) and the HID class
+  // descriptors (section 7.1).
+  bool HandleClassControl(Transport* transport,
+                          const USBIP_CMD_SUBMIT& usb_request,
+                          const StandardDeviceRequest& control_request,
+                          const char* data, unsigned int data_size) override;
+
+  void HandleDataRequest(Transport* transport,
+                         const USBIP_CMD_SUBMIT& usb_request, const char* data,
+                         unsigned int data_size) override;
+
+ private:
+  void HandleGetHidDescriptor(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request,
+                              const StandardDeviceRequest& control_request,
+                              const char* data, unsigned int data_size);
+
+  void HandleGetReportDescriptor(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const StandardDeviceRequest& control_request,
+                                 const char* data, unsigned int data_size);
+
+  void HandleGetReport(Transport* transport,
+                       const USBIP_CMD_SUBMIT& usb_request,
+                       const StandardDeviceRequest& control_request,
+                       const char* data, unsigned int data_size);
+
+  void HandleGetIdle(Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                     const StandardDeviceRequest& control_request,
+                     const char* data, unsigned int data_size);
+
+  void HandleGetProtocol(Transport* transport,
+                         const USBIP_CMD_SUBMIT& usb_request,
+                         const StandardDeviceRequest& control_request,
+                         const char* data, unsigned int data_size);
+
+  void HandleSetReport(Transport* transport,
+                       const USBIP_CMD_SUBMIT& usb_request,
+                       const StandardDeviceRequest& control_request,
+                       const char* data, unsigned int data_size);
+
+  void HandleSetIdle(Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                     const StandardDeviceRequest& control_request,
+                     const char* data, unsigned int data_size);
+
+  void HandleSetProtocol(Transport* transport,
+                         const USBIP_CMD_SUBMIT& usb_request,
+                         const StandardDeviceRequest& control_request,
+                         const char* data, unsigned int data_size);
+
+  // Sends |size| bytes of |descriptor|, truncated to the requested length.
+  void SendDescriptor(Transport* transport,
+                      const USBIP_CMD_SUBMIT& usb_request,
+                      const StandardDeviceRequest& control_request,
+                      const char* descriptor, unsigned int size);
+
+  // Schedules the next interval if URBs are waiting and none is scheduled.
+  void ScheduleReport();
+
+  // Completes the oldest pending URB with a new report.
+  void OnInterval();
+
+  USB_HID_DESCRIPTOR hid_descriptor_;
+  std::vector<char> report_descriptor_;
+  // The most recent input report, which GET_REPORT also returns.
+  std::vector<char> report_;
+  int interval_ms_;
+  byte idle_rate_;
+  byte protocol_;
+  uint64_t reports_sent_;
+
+  // Interrupt IN URBs waiting for a report, oldest first.
+  PendingUrb pending_[kMaxPendingInterruptUrbs];
+  int pending_count_;
+
+  bool report_scheduled_;
+  TimerWheel::TimerId report_timer_;
+  // Wheel tick at which the last report was delivered.
+  uint64_t last_report_tick_;
+};
+
+#endif  // __USBIP_HID_DEVICE_H__
@@ -0,0 +1,183 @@
+#include "hid_keyboard.h"
+
+#include "device_descriptors.h"
+#include "usbip-constants.h"
+
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const USB_DEVICE_DESCRIPTOR kDeviceDescriptor = {
+    0x12,                   // Size of this descriptor in bytes
+    USB_DESCRIPTOR_DEVICE,  // DEVICE descriptor type
+    0x0110,                 // USB Spec Release Number in BCD format
+    0x00,                   // Class Code
+    0x00,                   // Subclass code
+    0x00,                   // Protocol code
+    0x08,                   // Max packet size for EP0
+    0x2706,                 // Vendor ID
+    0x0100,                 // Product ID
+    0x0000,                 // Device release number in BCD format
+    0x01,                   // Manufacturer string descriptor index
+    0x02,                   // Product string descriptor index
+    0x00,                   // Device serial number string descriptor index
+    0x01,                   // Number of possible configurations
+};
+
+const USB_CONFIGURATION_DESCRIPTOR kConfigurationDescriptor = {
+    0x09,                          // Size of this descriptor in bytes
+    USB_DESCRIPTOR_CONFIGURATION,  // CONFIGURATION descriptor type
+    0x0022,                        // Total length of data for this cfg
+    1,                             // Number of interfaces in this cfg
+    1,                             // Index value of this configuration
+    0,                             // Configuration string index
+    0x80,                          // Configuration characteristics
+    50,                            // Max power consumption (2X mA)
+};
+
+const USB_INTERFACE_DESCRIPTOR kInterfaceDescriptor = {
+    0x09,                      // Size of this descriptor in bytes
+    USB_DESCRIPTOR_INTERFACE,  // INTERFACE descriptor type
+    0,                         // Interface Number
+    0,                         // Alternate Setting Number
+    1,                         // Number of endpoints in this intf
+    0x03,                      // Class code
+    0x01,                      // Subclass code
+    0x01,                      // Protocol code
+    0,                         // Interface string index
+};
+
+// HID report descriptor of a boot protocol keyboard: a modifier byte, a
+// reserved byte and six key codes, plus five LEDs as an output report.
+const unsigned char kReportDescriptor[] = {
+    0x05, 0x01,  // Usage Page (Generic Desktop),
+    0x09, 0x06,  // Usage (Keyboard),
+    0xA1, 0x01,  // Collection (Application),
+    0x05, 0x07,  // Usage Page (Key Codes);
+    0x19, 0xE0,  // Usage Minimum (224),
+    0x29, 0xE7,  // Usage Maximum (231),
+    0x15, 0x00,  // Logical Minimum (0),
+    0x25, 0x01,  // Logical Maximum (1),
+    0x75, 0x01,  // Report Size (1),
+    0x95, 0x08,  // Report Count (8),
+    0x81, 0x02,  // Input (Data, Variable, Absolute),
+    0x95, 0x01,  // Report Count (1),
+    0x75, 0x08,  // Report Size (8),
+    0x81, 0x01,  // Input (Constant),
+    0x95, 0x05,  // Report Count (5),
+    0x75, 0x01,  // Report Size (1),
+    0x05, 0x08,  // Usage Page (Page# for LEDs),
+    0x19, 0x01,  // Usage Minimum (1),
+    0x29, 0x05,  // Usage Maximum (5),
+    0x91, 0x02,  // Output (Data, Variable, Absolute),
+    0x95, 0x01,  // Report Count (1),
+    0x75, 0x03,  // Report Size (3),
+    0x91, 0x01,  // Output (Constant),
+    0x95, 0x06,  // Report Count (6),
+    0x75, 0x08,  // Report Size (8),
+    0x15, 0x00,  // Logical Minimum (0),
+    0x25, 0x65,  // Logical Maximum(101),
+    0x05, 0x07,  // Usage Page (Key Codes),
+    0x19, 0x00,  // Usage Minimum (0),
+    0x29, 0x65,  // Usage Maximum (101),
+    0x81, 0x00,  // Input (Data, Array),
+    0xC0,        // End Collection
+};
+
+const USB_HID_DESCRIPTOR kHidDescriptor = {
+    0x09,                       // Size of this descriptor in bytes
+    USB_DESCRIPTOR_HID,         // HID descriptor type
+    0x0111,                     // HID Spec Release Number in BCD format (1.11)
+    0x00,                       // Country Code (0x00 for Not supported)
+    0x01,                       // Number of class descriptors
+    USB_DESCRIPTOR_HID_REPORT,  // Report descriptor type
+    sizeof(kReportDescriptor),  // Size of the report descriptor
+};
+
+// Modifiers, a reserved byte and six key codes.
+const int kReportSize = 8;
+
+// Usage IDs of the letter keys 'a' through 'z'.
+const int kFirstLetterKey = 0x04;
+const int kLastLetterKey = 0x1D;
+
+USB_ENDPOINT_DESCRIPTOR CreateEndpoint(int interval_ms) {
+  USB_ENDPOINT_DESCRIPTOR endpoint = {
+      0x07,                     // Size of this descriptor in bytes
+      USB_DESCRIPTOR_ENDPOINT,  // Endpoint Descriptor
+      0x81,                     // EndpointAddress
+      0x03,                     // Attributes (Interrupt Endpoint)
+      0x0008,                   // size
+      static_cast<byte>(interval_ms),  // Interval
+  };
+  return endpoint;
+}
+
+std::vector<std::vector<char>> CreateStrings() {
+  std::vector<char> languages = {
+      0x04, USB_DESCRIPTOR_STRING,  // bLength, bDscType
+      0x09, 0x04,
+  };
+  std::vector<char> manufacturer = {
+      0x0A, USB_DESCRIPTOR_STRING,  // bLength, bDscType
+      'T', 0x00,
+      'e', 0x00,
+      's', 0x00,
+      't', 0x00,
+  };
+  std::vector<char> product = {
+      0x2A, USB_DESCRIPTOR_STRING,  // bLength, bDscType
+      'V', 0x00,
+      'i', 0x00,
+      'r', 0x00,
+      't', 0x00,
+      'u', 0x00,
+      'a', 0x00,
+      'l', 0x00,
+      ' ', 0x00,
+      'U', 0x00,
+      'S', 0x00,
+      'B', 0x00,
+      ' ', 0x00,
+      'K', 0x00,
+      'e', 0x00,
+      'y', 0x00,
+      'b', 0x00,
+      'o', 0x00,
+      'a', 0x00,
+      'r', 0x00,
+      'd', 0x00,
+  };
+  return {languages, manufacturer, product};
+}
+
+}  // namespace
+
+HidKeyboard::HidKeyboard(int interval_ms)
+    : HidDevice(kDeviceDescriptor, kConfigurationDescriptor, CreateStrings(),
+                kInterfaceDescriptor, kHidDescriptor,
+                CreateEndpoint(interval_ms),
+                std::vector<char>(std::begin(kReportDescriptor),
+                                  std::end(kReportDescriptor)),
+                kReportSize),
+      key_down_(false),
+      leds_(0) {}
+
+void HidKeyboard::GenerateReport(char* report) {
+  memset(report, 0, kReportSize);
+  key_down_ = !key_down_;
+  if (key_down_) {
+    std::uniform_int_distribution<int> key(kFirstLetterKey, kLastLetterKey);
+    report[2] = key(random_);
+  }
+}
+
+void HidKeyboard::OnOutputReport(const char* data, unsigned int size) {
+  if (size > 0) {
+    leds_ = data[0];
+    printf("Keyboard LEDs 0x%02X\n", leds_);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef __USBIP_HID_KEYBOARD_H__
+#define __USBIP_HID_KEYBOARD_H__
+
+#include "hid_device.h"
+
+#include <cstdint>
+#include <random>
+
+// A boot protocol keyboard which alternately presses and releases a random
+// letter key every interval.
+class HidKeyboard : public HidDevice {
+ public:
+  // Reports are delivered every |interval_ms| milliseconds (1 to 255).
+  explicit HidKeyboard(int interval_ms);
+
+  // The LED state most recently set by the host.
+  uint8_t leds() const { return leds_; }
+
+ protected:
+  void GenerateReport(char* report) override;
+  void OnOutputReport(const char* data, unsigned int size) override;
+
+ private:
+  std::minstd_rand random_;
+  bool key_down_;
+  uint8_t leds_;
+};
+
+#endif  // __USBIP_HID_KEYBOARD_H__
@@ -0,0 +1,125 @@
+#include "hid_mouse.h"
+
+#include "device_descriptors.h"
+#include "usbip-constants.h"
+
+#include <vector>
+
+#include <cstring>
+
+namespace {
+
+const USB_DEVICE_DESCRIPTOR kDeviceDescriptor = {
+    0x12,                   // Size of this descriptor in bytes
+    USB_DESCRIPTOR_DEVICE,  // DEVICE descriptor type
+    0x0110,                 // USB Spec Release Number in BCD format
+    0x00,                   // Class Code
+    0x00,                   // Subclass code
+    0x00,                   // Protocol code
+    0x08,                   // Max packet size for EP0
+    0x2706,                 // Vendor ID
+    0x0000,                 // Product ID: Mouse in a circle fw demo
+    0x0000,                 // Device release number in BCD format
+    0x00,                   // Manufacturer string index
+    0x00,                   // Product string index
+    0x00,                   // Device serial number string index
+    0x01,                   // Number of possible configurations
+};
+
+const USB_CONFIGURATION_DESCRIPTOR kConfigurationDescriptor = {
+    0x09,                          // Size of this descriptor in bytes
+    USB_DESCRIPTOR_CONFIGURATION,  // CONFIGURATION descriptor type
+    0x0022,                        // Total length of data for this cfg
+    1,                             // Number of interfaces in this cfg
+    1,                             // Index value of this configuration
+    0,                             // Configuration string index
+    0x80,                          // Configuration characteristics
+    50,                            // Max power consumption (2X mA)
+};
+
+const USB_INTERFACE_DESCRIPTOR kInterfaceDescriptor = {
+    0x09,                      // Size of this descriptor in bytes
+    USB_DESCRIPTOR_INTERFACE,  // INTERFACE descriptor type
+    0,                         // Interface Number
+    0,                         // Alternate Setting Number
+    1,                         // Number of endpoints in this intf
+    0x03,                      // Class code
+    0x01,                      // Subclass code
+    0x02,                      // Protocol code
+    0x00,                      // Interface string index
+};
+
+// HID report descriptor of a three button mouse with relative X, Y and wheel
+// axes.
+const unsigned char kReportDescriptor[] = {
+    0x05, 0x01,  // Usage Page (Generic Desktop),
+    0x09, 0x02,  // Usage (Mouse)
+    0xA1, 0x01,  // Collection (Application)
+    0x09, 0x01,  // Usage (Pointer)
+    0xA1, 0x00,  // Collection (Physical)
+    0x05, 0x09,  // Usage Page (Buttons)
+    0x19, 0x01,  // Usage Minimum (01)
+    0x29, 0x03,  // Usage Maximum (03)
+    0x15, 0x00,  // Logical Minimum (0)
+    0x25, 0x01,  // Logical Maximum (1)
+    0x95, 0x03,  // Report Count (3)
+    0x75, 0x01,  // Report Size (1)
+    0x81, 0x02,  // Input (Data, Variable, Absolute)
+    0x95, 0x01,  // Report Count (1)
+    0x75, 0x05,  // Report Size (5)
+    0x81, 0x01,  // Input (Constant) ;5 bit padding
+    0x05, 0x01,  // Usage Page (Generic Desktop)
+    0x09, 0x30,  // Usage (X)
+    0x09, 0x31,  // Usage (Y)
+    0x09, 0x38,  // Usage (Wheel)
+    0x15, 0x81,  // Logical Minimum (-127)
+    0x25, 0x7F,  // Logical Maximum (127)
+    0x75, 0x08,  // Report Size (8)
+    0x95, 0x03,  // Report Count (3)
+    0x81, 0x06,  // Input (Data, Variable, Relative)
+    0xC0, 0xC0,  // End Collection, End Collection
+};
+
+const USB_HID_DESCRIPTOR kHidDescriptor = {
+    0x09,                       // Size of this descriptor in bytes
+    USB_DESCRIPTOR_HID,         // HID descriptor type
+    0x0111,                     // HID Spec Release Number in BCD format (1.11)
+    0x00,                       // Country Code (0x00 for Not supported)
+    0x01,                       // Number of class descriptors
+    USB_DESCRIPTOR_HID_REPORT,  // Report descriptor type
+    sizeof(kReportDescriptor),  // Size of the report descriptor
+};
+
+// Buttons, X, Y and wheel.
+const int kReportSize = 4;
+
+USB_ENDPOINT_DESCRIPTOR CreateEndpoint(int interval_ms) {
+  USB_ENDPOINT_DESCRIPTOR endpoint = {
+      0x07,                     // Size of this descriptor in bytes
+      USB_DESCRIPTOR_ENDPOINT,  // Endpoint Descriptor
+      0x81,                     // EndpointAddress
+      0x03,                     // Attributes (Interrupt Endpoint)
+      0x0008,                   // size
+      static_cast<byte>(interval_ms),  // Interval
+  };
+  return endpoint;
+}
+
+}  // namespace
+
+HidMouse::HidMouse(int interval_ms)
+    : HidDevice(kDeviceDescriptor, kConfigurationDescriptor,
+                {{0x04, USB_DESCRIPTOR_STRING, 0x09, 0x04}},
+                kInterfaceDescriptor, kHidDescriptor,
+                CreateEndpoint(interval_ms),
+                std::vector<char>(std::begin(kReportDescriptor),
+                                  std::end(kReportDescriptor)),
+                kReportSize) {}
+
+void HidMouse::GenerateReport(char* report) {
+  // Wander by up to 5 units on each axis without pressing any buttons.
+  std::uniform_int_distribution<int> step(-5, 5);
+  memset(report, 0, kReportSize);
+  report[1] = step(random_);
+  report[2] = step(random_);
+}
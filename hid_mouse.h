@@ -0,0 +1,21 @@
+#ifndef __USBIP_HID_MOUSE_H__
+#define __USBIP_HID_MOUSE_H__
+
+#include "hid_device.h"
+
+#include <random>
+
+// A boot protocol mouse which reports small random movements every interval.
+class HidMouse : public HidDevice {
+ public:
+  // Reports are delivered every |interval_ms| milliseconds (1 to 255).
+  explicit HidMouse(int interval_ms);
+
+ protected:
+  void GenerateReport(char* report) override;
+
+ private:
+  std::minstd_rand random_;
+};
+
+#endif  // __USBIP_HID_MOUSE_H__
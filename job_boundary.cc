@@ -0,0 +1,597 @@
+#include "job_boundary.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <strings.h>
+
+namespace {
+
+// The Universal Exit Language command which switches a printer to PJL.
+const char kUel[] = "\x1b%-12345X";
+const size_t kUelSize = sizeof(kUel) - 1;
+
+// Sizes of the headers of raster files and pages, and where the fields which
+// describe the size of a page lie within the page headers.
+const size_t kPwgPageHeaderSize = 1796;
+const size_t kPwgFieldsOffset = 376;
+const size_t kUrfFileHeaderSize = 12;
+const size_t kUrfPageHeaderSize = 32;
+
+struct Signature {
+  const char* bytes;
+  size_t size;
+  JobBoundaryDetector::Format format;
+};
+
+const Signature kSignatures[] = {
+    {kUel, kUelSize, JobBoundaryDetector::Format::kPjl},
+    {"%PDF-", 5, JobBoundaryDetector::Format::kPdf},
+    {"%!", 2, JobBoundaryDetector::Format::kPostScript},
+    {"RaS2", 4, JobBoundaryDetector::Format::kPwgRaster},
+    {"UNIRAST\0", 8, JobBoundaryDetector::Format::kUrf},
+    {"POST ", 5, JobBoundaryDetector::Format::kHttp},
+    {"GET ", 4, JobBoundaryDetector::Format::kHttp},
+    {"PUT ", 4, JobBoundaryDetector::Format::kHttp},
+    {"HEAD ", 5, JobBoundaryDetector::Format::kHttp},
+};
+
+bool IsGap(char c) {
+  return c == '\0' || c == '\r' || c == '\n' || c == ' ' || c == '\t' ||
+         c == '\x04';
+}
+
+bool IsSpace(char c) {
+  return c == '\r' || c == '\n' || c == ' ' || c == '\t';
+}
+
+// Whether |c| can be the first byte of a job whose end can be found, other
+// than an HTTP request.
+bool StartsJob(char c) {
+  return c == '%' || c == '\x1b' || c == 'R' || c == 'U';
+}
+
+uint32_t ReadBigEndian32(const unsigned char* bytes) {
+  return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 |
+         bytes[2] << 8 | bytes[3];
+}
+
+}  // namespace
+
+JobBoundaryDetector::JobBoundaryDetector() { Reset(); }
+
+void JobBoundaryDetector::Reset() {
+  format_ = Format::kUnknown;
+  ended_ = false;
+  prefix_size_ = 0;
+  ClearLine();
+  pjl_state_ = PjlState::kLineStart;
+  pjl_depth_ = 0;
+  uel_matched_ = 0;
+  document_depth_ = 0;
+  after_eof_ = false;
+  raster_state_ = RasterState::kPageHeader;
+  header_offset_ = 0;
+  height_ = 0;
+  line_bytes_ = 0;
+  pixel_bytes_ = 0;
+  lines_ = 0;
+  filled_ = 0;
+  run_remaining_ = 0;
+  declared_pages_ = 0;
+  pages_ = 0;
+  http_state_ = HttpState::kHeaders;
+  request_line_read_ = false;
+  chunked_ = false;
+  body_remaining_ = 0;
+}
+
+size_t JobBoundaryDetector::SkipGap(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size && IsGap(data[offset])) {
+    ++offset;
+  }
+  return offset;
+}
+
+size_t JobBoundaryDetector::Scan(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size && !ended_) {
+    const char* next = data + offset;
+    size_t remaining = size - offset;
+    switch (format_) {
+      case Format::kUnknown:
+        offset += Identify(next, remaining);
+        break;
+      case Format::kPjl:
+        offset += ScanPjl(next, remaining);
+        break;
+      case Format::kPostScript:
+      case Format::kPdf:
+        offset += ScanDocument(next, remaining);
+        break;
+      case Format::kPwgRaster:
+      case Format::kUrf:
+        offset += ScanRaster(next, remaining);
+        break;
+      case Format::kHttp:
+        offset += ScanHttp(next, remaining);
+        break;
+      case Format::kOther:
+        return size;
+    }
+  }
+  return offset;
+}
+
+size_t JobBoundaryDetector::Identify(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size) {
+    prefix_[prefix_size_++] = data[offset++];
+    bool possible = false;
+    for (const Signature& signature : kSignatures) {
+      if (prefix_size_ > signature.size ||
+          memcmp(prefix_, signature.bytes, prefix_size_) != 0) {
+        continue;
+      }
+      if (prefix_size_ == signature.size) {
+        Begin(signature.format);
+        return offset;
+      }
+      possible = true;
+    }
+    if (!possible) {
+      format_ = Format::kOther;
+      return offset;
+    }
+  }
+  return offset;
+}
+
+void JobBoundaryDetector::Begin(Format format) {
+  format_ = format;
+  ClearLine();
+  switch (format) {
+    case Format::kPjl:
+      pjl_state_ = PjlState::kLineStart;
+      break;
+    case Format::kPostScript:
+    case Format::kPdf:
+    case Format::kHttp:
+      // The signature is the start of the first line.
+      line_length_ = prefix_size_;
+      break;
+    case Format::kUrf:
+      raster_state_ = RasterState::kFileHeader;
+      header_offset_ = prefix_size_;
+      break;
+    case Format::kPwgRaster:
+      raster_state_ = RasterState::kPageHeader;
+      header_offset_ = 0;
+      break;
+    default:
+      break;
+  }
+}
+
+size_t JobBoundaryDetector::ScanPjl(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size && !ended_) {
+    char c = data[offset];
+    switch (pjl_state_) {
+      case PjlState::kLineStart:
+        if (c == '\r' || c == '\n') {
+          ++offset;
+        } else {
+          // Anything but a PJL command is the data of a printer language
+          // which the printer picked by itself.
+          pjl_state_ = c == '@' ? PjlState::kCommand : PjlState::kBody;
+        }
+        break;
+      case PjlState::kCommand: {
+        bool complete = false;
+        offset += ReadLine(data + offset, size - offset, &complete);
+        if (complete) {
+          OnPjlCommand();
+          ClearLine();
+        }
+        break;
+      }
+      case PjlState::kBody: {
+        bool found = false;
+        offset += FindUel(data + offset, size - offset, &found);
+        if (found) {
+          pjl_state_ = PjlState::kAfterUel;
+        }
+        break;
+      }
+      case PjlState::kAfterUel:
+      case PjlState::kAfterEoj:
+        if (c == '\r' || c == '\n') {
+          ++offset;
+        } else if (c == '@') {
+          pjl_state_ = PjlState::kCommand;
+        } else if (pjl_state_ == PjlState::kAfterEoj && c == kUel[0]) {
+          pjl_state_ = PjlState::kClosingUel;
+        } else if (pjl_state_ == PjlState::kAfterUel && pjl_depth_ > 0) {
+          pjl_state_ = PjlState::kBody;
+        } else {
+          // No more PJL follows the job's last UEL, so |c| starts the next
+          // job.
+          ended_ = true;
+        }
+        break;
+      case PjlState::kClosingUel:
+        if (c != kUel[uel_matched_]) {
+          uel_matched_ = 0;
+          pjl_state_ = PjlState::kBody;
+          break;
+        }
+        ++offset;
+        if (++uel_matched_ == kUelSize) {
+          uel_matched_ = 0;
+          ended_ = true;
+        }
+        break;
+    }
+  }
+  return offset;
+}
+
+void JobBoundaryDetector::OnPjlCommand() {
+  pjl_state_ = PjlState::kLineStart;
+  if (!LineStartsWith("@PJL", false)) {
+    return;
+  }
+  const char* command = line_ + 4;
+  const char* end = line_ + line_size_;
+  while (command < end && (*command == ' ' || *command == '\t')) {
+    ++command;
+  }
+  size_t length = end - command;
+  // Commands are case insensitive and may be followed by options.
+  auto is = [command, length](const char* name) {
+    size_t name_length = strlen(name);
+    if (length < name_length || strncasecmp(command, name, name_length) != 0) {
+      return false;
+    }
+    return length == name_length ||
+           !isalpha(static_cast<unsigned char>(command[name_length]));
+  };
+  if (is("JOB")) {
+    ++pjl_depth_;
+  } else if (is("EOJ") && pjl_depth_ > 0) {
+    if (--pjl_depth_ == 0) {
+      pjl_state_ = PjlState::kAfterEoj;
+    }
+  } else if (is("ENTER")) {
+    pjl_state_ = PjlState::kBody;
+  }
+}
+
+size_t JobBoundaryDetector::ScanDocument(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size && !ended_) {
+    char c = data[offset];
+    if (after_eof_) {
+      if (IsSpace(c)) {
+        ++offset;
+        continue;
+      }
+      if (StartsJob(c)) {
+        ended_ = true;
+        break;
+      }
+      // An incremental update of the PDF.
+      after_eof_ = false;
+      continue;
+    }
+    if (format_ == Format::kPostScript && line_length_ == 0 && c == '\x04') {
+      ++offset;
+      ended_ = true;
+      break;
+    }
+    bool complete = false;
+    offset += ReadLine(data + offset, size - offset, &complete);
+    if (!complete) {
+      continue;
+    }
+    if (format_ == Format::kPostScript &&
+        LineStartsWith("%%BeginDocument", false)) {
+      ++document_depth_;
+    } else if (format_ == Format::kPostScript &&
+               LineStartsWith("%%EndDocument", false)) {
+      document_depth_ = std::max(document_depth_ - 1, 0);
+    } else if (LineIs("%%EOF") && document_depth_ == 0) {
+      if (format_ == Format::kPostScript) {
+        ended_ = true;
+      } else {
+        after_eof_ = true;
+      }
+    }
+    ClearLine();
+  }
+  return offset;
+}
+
+size_t JobBoundaryDetector::ScanRaster(const char* data, size_t size) {
+  const bool urf = format_ == Format::kUrf;
+  size_t offset = 0;
+  while (offset < size && !ended_ && format_ != Format::kOther) {
+    switch (raster_state_) {
+      case RasterState::kFileHeader:
+      case RasterState::kPageHeader: {
+        bool file_header = raster_state_ == RasterState::kFileHeader;
+        size_t header_size = file_header ? kUrfFileHeaderSize
+                             : urf       ? kUrfPageHeaderSize
+                                         : kPwgPageHeaderSize;
+        // The URF page count is at byte 8 of the file header.
+        size_t fields_offset = file_header ? 8 : urf ? 0 : kPwgFieldsOffset;
+        size_t length = std::min(size - offset, header_size - header_offset_);
+        for (size_t i = 0; i < length; ++i) {
+          size_t at = header_offset_ + i;
+          if (at >= fields_offset && at - fields_offset < sizeof(fields_)) {
+            fields_[at - fields_offset] = data[offset + i];
+          }
+        }
+        offset += length;
+        header_offset_ += length;
+        if (header_offset_ < header_size) {
+          break;
+        }
+        header_offset_ = 0;
+        if (file_header) {
+          declared_pages_ = ReadBigEndian32(fields_);
+          raster_state_ = declared_pages_ > 0 ? RasterState::kPageHeader
+                                              : RasterState::kPageEnd;
+        } else {
+          OnPageHeader();
+        }
+        break;
+      }
+      case RasterState::kLineRepeat:
+        lines_ += static_cast<unsigned char>(data[offset++]) + 1;
+        filled_ = 0;
+        raster_state_ = RasterState::kRunCode;
+        break;
+      case RasterState::kRunCode: {
+        unsigned char code = data[offset++];
+        if (code == 128 && urf) {
+          // Fills the rest of the line with white.
+          run_remaining_ = 0;
+          filled_ = line_bytes_;
+        } else if (code < 128) {
+          run_remaining_ = pixel_bytes_;
+          filled_ += (code + 1) * pixel_bytes_;
+        } else {
+          run_remaining_ = (257 - code) * pixel_bytes_;
+          filled_ += run_remaining_;
+        }
+        raster_state_ = RasterState::kRunPixels;
+        if (run_remaining_ == 0) {
+          OnRunEnd();
+        }
+        break;
+      }
+      case RasterState::kRunPixels: {
+        uint64_t length = std::min<uint64_t>(size - offset, run_remaining_);
+        offset += length;
+        run_remaining_ -= length;
+        if (run_remaining_ == 0) {
+          OnRunEnd();
+        }
+        break;
+      }
+      case RasterState::kPageEnd:
+        if (StartsJob(data[offset])) {
+          ended_ = true;
+        } else {
+          raster_state_ = RasterState::kPageHeader;
+        }
+        break;
+    }
+  }
+  // A raster which does not parse has no end which can be found.
+  return format_ == Format::kOther ? size : offset;
+}
+
+void JobBoundaryDetector::OnPageHeader() {
+  if (format_ == Format::kUrf) {
+    pixel_bytes_ = fields_[0] / 8;
+    line_bytes_ = ReadBigEndian32(fields_ + 12) * pixel_bytes_;
+    height_ = ReadBigEndian32(fields_ + 16);
+  } else {
+    height_ = ReadBigEndian32(fields_);
+    uint32_t bits_per_pixel = ReadBigEndian32(fields_ + 12);
+    pixel_bytes_ = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+    line_bytes_ = ReadBigEndian32(fields_ + 16);
+  }
+  if (height_ == 0 || line_bytes_ == 0 || pixel_bytes_ == 0) {
+    format_ = Format::kOther;
+    return;
+  }
+  lines_ = 0;
+  raster_state_ = RasterState::kLineRepeat;
+}
+
+void JobBoundaryDetector::OnRunEnd() {
+  if (filled_ > line_bytes_) {
+    format_ = Format::kOther;
+  } else if (filled_ < line_bytes_) {
+    raster_state_ = RasterState::kRunCode;
+  } else if (lines_ < height_) {
+    raster_state_ = RasterState::kLineRepeat;
+  } else if (lines_ > height_) {
+    format_ = Format::kOther;
+  } else if (declared_pages_ > 0 && ++pages_ == declared_pages_) {
+    ended_ = true;
+  } else {
+    raster_state_ = declared_pages_ > 0 ? RasterState::kPageHeader
+                                        : RasterState::kPageEnd;
+  }
+}
+
+size_t JobBoundaryDetector::ScanHttp(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size && !ended_) {
+    switch (http_state_) {
+      case HttpState::kHeaders:
+      case HttpState::kChunkSize:
+      case HttpState::kChunkEnd:
+      case HttpState::kTrailer: {
+        bool complete = false;
+        offset += ReadLine(data + offset, size - offset, &complete);
+        if (complete) {
+          OnHttpHeader();
+          ClearLine();
+        }
+        break;
+      }
+      case HttpState::kBody:
+      case HttpState::kChunkData: {
+        uint64_t length = std::min<uint64_t>(size - offset, body_remaining_);
+        offset += length;
+        body_remaining_ -= length;
+        if (body_remaining_ > 0) {
+          break;
+        }
+        if (http_state_ == HttpState::kBody) {
+          ended_ = true;
+        } else {
+          http_state_ = HttpState::kChunkEnd;
+        }
+        break;
+      }
+    }
+  }
+  return offset;
+}
+
+void JobBoundaryDetector::OnHttpHeader() {
+  bool empty = LineIs("");
+  switch (http_state_) {
+    case HttpState::kHeaders:
+      if (!request_line_read_) {
+        request_line_read_ = true;
+      } else if (empty && chunked_) {
+        http_state_ = HttpState::kChunkSize;
+      } else if (empty) {
+        http_state_ = HttpState::kBody;
+        ended_ = body_remaining_ == 0;
+      } else if (LineStartsWith("Content-Length:", true)) {
+        body_remaining_ = strtoull(line_ + 15, nullptr, 10);
+      } else if (LineStartsWith("Transfer-Encoding:", true)) {
+        // "chunked" is always the last coding.
+        const char* end = line_ + line_size_;
+        while (end > line_ && IsSpace(end[-1])) {
+          --end;
+        }
+        chunked_ = end - line_ >= 7 && strncasecmp(end - 7, "chunked", 7) == 0;
+      }
+      break;
+    case HttpState::kChunkSize:
+      body_remaining_ = strtoull(line_, nullptr, 16);
+      http_state_ = body_remaining_ > 0 ? HttpState::kChunkData
+                                        : HttpState::kTrailer;
+      break;
+    case HttpState::kChunkEnd:
+      http_state_ = HttpState::kChunkSize;
+      break;
+    case HttpState::kTrailer:
+      ended_ = empty;
+      break;
+    default:
+      break;
+  }
+}
+
+size_t JobBoundaryDetector::ReadLine(const char* data, size_t size,
+                                     bool* complete) {
+  const char* newline = static_cast<const char*>(memchr(data, '\n', size));
+  size_t length = newline != nullptr ? newline - data : size;
+  size_t kept = std::min(length, sizeof(line_) - 1 - line_size_);
+  memcpy(line_ + line_size_, data, kept);
+  line_size_ += kept;
+  line_[line_size_] = '\0';
+  line_length_ += length;
+  *complete = newline != nullptr;
+  return newline != nullptr ? length + 1 : size;
+}
+
+size_t JobBoundaryDetector::FindUel(const char* data, size_t size,
+                                    bool* found) {
+  size_t offset = 0;
+  while (offset < size) {
+    if (uel_matched_ == 0) {
+      const void* escape = memchr(data + offset, kUel[0], size - offset);
+      if (escape == nullptr) {
+        return size;
+      }
+      offset = static_cast<const char*>(escape) - data;
+    }
+    if (data[offset] == kUel[uel_matched_]) {
+      ++offset;
+      if (++uel_matched_ == kUelSize) {
+        uel_matched_ = 0;
+        *found = true;
+        return offset;
+      }
+    } else {
+      // The UEL's only ESC is its first byte, so a mismatch can only be the
+      // start of another one.
+      uel_matched_ = 0;
+    }
+  }
+  return offset;
+}
+
+bool JobBoundaryDetector::LineStartsWith(const char* prefix,
+                                         bool ignore_case) const {
+  size_t length = strlen(prefix);
+  if (line_size_ < length) {
+    return false;
+  }
+  return ignore_case ? strncasecmp(line_, prefix, length) == 0
+                     : memcmp(line_, prefix, length) == 0;
+}
+
+bool JobBoundaryDetector::LineIs(const char* text) const {
+  if (line_length_ != line_size_) {
+    return false;
+  }
+  size_t size = line_size_;
+  while (size > 0 && IsSpace(line_[size - 1])) {
+    --size;
+  }
+  return size == strlen(text) && memcmp(line_, text, size) == 0;
+}
+
+void JobBoundaryDetector::ClearLine() {
+  line_size_ = 0;
+  line_length_ = 0;
+  line_[0] = '\0';
+}
+
+const char* JobFormatName(JobBoundaryDetector::Format format) {
+  switch (format) {
+    case JobBoundaryDetector::Format::kPjl:
+      return "pjl";
+    case JobBoundaryDetector::Format::kPostScript:
+      return "postscript";
+    case JobBoundaryDetector::Format::kPdf:
+      return "pdf";
+    case JobBoundaryDetector::Format::kPwgRaster:
+      return "pwg-raster";
+    case JobBoundaryDetector::Format::kUrf:
+      return "urf";
+    case JobBoundaryDetector::Format::kHttp:
+      return "http";
+    case JobBoundaryDetector::Format::kUnknown:
+    case JobBoundaryDetector::Format::kOther:
+      break;
+  }
+  return "unknown";
+}
@@ -0,0 +1,201 @@
+#ifndef __USBIP_JOB_BOUNDARY_H__
+#define __USBIP_JOB_BOUNDARY_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// Finds where one print job ends and the next one begins in the data which a
+// printer receives on its bulk OUT endpoint, as the data arrives.
+//
+// Hosts may send several jobs back to back without resetting the printer or
+// letting it go idle in between. The detector identifies the format of each
+// job from its first bytes and then follows just enough of its structure to
+// see where it ends:
+//
+//   PJL          the UEL after the "@PJL EOJ" which closes the outermost
+//                "@PJL JOB", or, without "@PJL JOB", a UEL which is not
+//                followed by more PJL
+//   PostScript   a "%%EOF" line outside of embedded documents, or a ^D at
+//                the start of a line
+//   PDF          a "%%EOF" line followed by the start of another job, as
+//                anything else is an incremental update
+//   PWG raster   the end of a page followed by the start of another job
+//   URF          the end of the last page counted in the file header
+//   HTTP         the end of the body of a request, as given by its
+//                Content-Length or chunked transfer coding, which is how
+//                IPP-USB frames IPP requests
+//
+// Another job is taken to start with '%', ESC, 'R' or 'U', the first bytes
+// of the formats above other than HTTP. Jobs in other formats, or whose
+// structure stops making sense, only end when the printer is told that they
+// do. The data is looked at once, in place; only the start of each line is
+// copied, to match the lines above against.
+class JobBoundaryDetector {
+ public:
+  enum class Format {
+    // Not enough of the job has arrived to tell.
+    kUnknown,
+    kPjl,
+    kPostScript,
+    kPdf,
+    kPwgRaster,
+    kUrf,
+    kHttp,
+    // A format whose end cannot be found.
+    kOther,
+  };
+
+  JobBoundaryDetector();
+
+  // Starts looking at a new job.
+  void Reset();
+
+  // Returns how many of the |size| bytes at |data| are padding which may
+  // come between jobs, such as the line ending or ^D after a PostScript job.
+  static size_t SkipGap(const char* data, size_t size);
+
+  // Returns how many of the |size| bytes at |data| belong to the current
+  // job. Fewer than |size| are taken only once the end of the job has been
+  // found, at which point ended() becomes true and the rest of the data
+  // belongs to the jobs which follow.
+  size_t Scan(const char* data, size_t size);
+
+  // Whether the end of the current job has been found.
+  bool ended() const { return ended_; }
+
+  Format format() const { return format_; }
+
+ private:
+  enum class PjlState {
+    // At the start of a line of PJL commands.
+    kLineStart,
+    // Reading a PJL command.
+    kCommand,
+    // In the data of a printer language, up to the next UEL.
+    kBody,
+    // After a UEL in the middle of a job.
+    kAfterUel,
+    // After the "@PJL EOJ" which closes the job.
+    kAfterEoj,
+    // Matching the UEL which follows "@PJL EOJ".
+    kClosingUel,
+  };
+
+  enum class RasterState {
+    // Reading the rest of the URF file header.
+    kFileHeader,
+    kPageHeader,
+    // Expecting the repeat count which starts a line.
+    kLineRepeat,
+    // Expecting the code which starts a run of pixels.
+    kRunCode,
+    // Skipping the pixels of a run.
+    kRunPixels,
+    // After the last line of a page.
+    kPageEnd,
+  };
+
+  enum class HttpState {
+    kHeaders,
+    kBody,
+    kChunkSize,
+    kChunkData,
+    // The line ending after the data of a chunk.
+    kChunkEnd,
+    kTrailer,
+  };
+
+  // Matches the first bytes of the job against the formats which it can be
+  // in. Returns the number of bytes consumed.
+  size_t Identify(const char* data, size_t size);
+
+  // Prepares to follow a job in |format|, whose signature has been consumed.
+  void Begin(Format format);
+
+  // Follow the structure of a job in each format. Return the number of bytes
+  // consumed, which is 0 only if the job ended before |data|.
+  size_t ScanPjl(const char* data, size_t size);
+  size_t ScanDocument(const char* data, size_t size);
+  size_t ScanRaster(const char* data, size_t size);
+  size_t ScanHttp(const char* data, size_t size);
+
+  // Handles the PJL command in |line_|.
+  void OnPjlCommand();
+
+  // Handles the page header which has been read, whose fields of interest
+  // are in |fields_|.
+  void OnPageHeader();
+
+  // Handles the end of the run of pixels which was last started.
+  void OnRunEnd();
+
+  // Handles the HTTP header line in |line_|.
+  void OnHttpHeader();
+
+  // Consumes bytes up to and including the next newline and keeps the start
+  // of the line in |line_|. Returns the number of bytes consumed and sets
+  // |*complete| if the newline was among them.
+  size_t ReadLine(const char* data, size_t size, bool* complete);
+
+  // Consumes bytes up to and including the next UEL. Returns the number of
+  // bytes consumed and sets |*found| if the UEL was completed.
+  size_t FindUel(const char* data, size_t size, bool* found);
+
+  // Whether the line just read starts with |prefix|, ignoring case if
+  // |ignore_case| is set.
+  bool LineStartsWith(const char* prefix, bool ignore_case) const;
+
+  // Whether the line just read, without trailing whitespace, is |text|.
+  bool LineIs(const char* text) const;
+
+  void ClearLine();
+
+  Format format_;
+  bool ended_;
+
+  // The first bytes of the job while its format is identified.
+  char prefix_[16];
+  size_t prefix_size_;
+
+  // The first bytes of the current line, and the full length of the line.
+  char line_[80];
+  size_t line_size_;
+  uint64_t line_length_;
+
+  PjlState pjl_state_;
+  // Number of "@PJL JOB" commands which have not been closed by "@PJL EOJ".
+  int pjl_depth_;
+  // Bytes of the UEL which have been matched.
+  size_t uel_matched_;
+
+  // Number of "%%BeginDocument" comments not yet closed by "%%EndDocument".
+  int document_depth_;
+  // Whether a PDF is past a "%%EOF" line.
+  bool after_eof_;
+
+  RasterState raster_state_;
+  // The bytes of the file or page header which have been read, and those of
+  // them which are needed.
+  size_t header_offset_;
+  unsigned char fields_[20];
+  uint64_t height_;
+  uint64_t line_bytes_;
+  uint64_t pixel_bytes_;
+  uint64_t lines_;
+  uint64_t filled_;
+  uint64_t run_remaining_;
+  // Pages which the URF file header counts, or 0 if the count is not known.
+  uint32_t declared_pages_;
+  uint32_t pages_;
+
+  HttpState http_state_;
+  bool request_line_read_;
+  bool chunked_;
+  uint64_t body_remaining_;
+};
+
+// Names |format| as the format stage of post-processing does, or "pjl" and
+// "http" for the framings which carry other formats.
+const char* JobFormatName(JobBoundaryDetector::Format format);
+
+#endif  // __USBIP_JOB_BOUNDARY_H__
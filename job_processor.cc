@@ -0,0 +1,270 @@
+#include "job_processor.h"
+
+#include "event_loop.h"
+#include "work_stealing_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Resolves the dependencies of |stages| into indices in |dependencies|.
+// Returns false if a dependency is unknown or the stages do not form a DAG.
+bool ResolveDependencies(const std::vector<JobStage>& stages,
+                         std::vector<std::vector<int>>* dependencies) {
+  std::unordered_map<std::string, int> indices;
+  for (size_t i = 0; i < stages.size(); ++i) {
+    if (!indices.emplace(stages[i].name, i).second) {
+      printf("post-processing stage %s is listed twice\n",
+             stages[i].name.c_str());
+      return false;
+    }
+  }
+  dependencies->assign(stages.size(), {});
+  for (size_t i = 0; i < stages.size(); ++i) {
+    for (const std::string& name : stages[i].dependencies) {
+      auto it = indices.find(name);
+      if (it == indices.end()) {
+        printf("post-processing stage %s depends on unknown stage %s\n",
+               stages[i].name.c_str(), name.c_str());
+        return false;
+      }
+      (*dependencies)[i].push_back(it->second);
+    }
+  }
+
+  // Kahn's algorithm: the stages form a DAG if all of them can be ordered.
+  std::vector<int> waiting(stages.size());
+  std::vector<std::vector<int>> dependents(stages.size());
+  std::vector<int> ready;
+  for (size_t i = 0; i < stages.size(); ++i) {
+    waiting[i] = (*dependencies)[i].size();
+    for (int dependency : (*dependencies)[i]) {
+      dependents[dependency].push_back(i);
+    }
+    if (waiting[i] == 0) {
+      ready.push_back(i);
+    }
+  }
+  size_t ordered = 0;
+  while (!ready.empty()) {
+    int stage = ready.back();
+    ready.pop_back();
+    ++ordered;
+    for (int dependent : dependents[stage]) {
+      if (--waiting[dependent] == 0) {
+        ready.push_back(dependent);
+      }
+    }
+  }
+  if (ordered != stages.size()) {
+    printf("post-processing stages have a dependency cycle\n");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// The post-processing of one job.
+struct JobProcessor::Run {
+  CompletedJob job;
+  // The job's range of the spool, mapped page-aligned.
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+  const char* data = nullptr;
+  // Why the job's data could not be read, if it could not.
+  std::string error;
+  std::vector<JobStageResult> results;
+  // Number of dependencies of each stage which have not finished yet.
+  std::unique_ptr<std::atomic<int>[]> waiting;
+  // Number of stages which have not finished yet.
+  std::atomic<int> remaining;
+};
+
+std::unique_ptr<JobProcessor> JobProcessor::Create(
+    std::vector<JobStage> stages, int threads) {
+  std::vector<std::vector<int>> dependencies;
+  if (!ResolveDependencies(stages, &dependencies)) {
+    return nullptr;
+  }
+  int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    printf("eventfd error : %s\n", strerror(errno));
+    return nullptr;
+  }
+  return std::unique_ptr<JobProcessor>(new JobProcessor(
+      std::move(stages), std::move(dependencies), threads, event_fd));
+}
+
+JobProcessor::JobProcessor(std::vector<JobStage> stages,
+                           std::vector<std::vector<int>> dependencies,
+                           int threads, int event_fd)
+    : stages_(std::move(stages)),
+      dependencies_(std::move(dependencies)),
+      dependents_(stages_.size()),
+      loop_(nullptr),
+      event_fd_(event_fd),
+      pool_(new WorkStealingPool(threads)) {
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    for (int dependency : dependencies_[i]) {
+      dependents_[dependency].push_back(i);
+    }
+  }
+}
+
+JobProcessor::~JobProcessor() {
+  pool_.reset();
+  if (loop_ != nullptr) {
+    loop_->Remove(event_fd_);
+  }
+  close(event_fd_);
+}
+
+void JobProcessor::SetResultCallback(EventLoop* loop,
+                                     ResultCallback callback) {
+  loop_ = loop;
+  callback_ = std::move(callback);
+  loop_->Add(event_fd_, EPOLLIN,
+             [this](uint32_t events) { DeliverResults(); });
+}
+
+void JobProcessor::Submit(const CompletedJob& job) {
+  auto run = std::make_shared<Run>();
+  run->job = job;
+  run->results.resize(stages_.size());
+  run->waiting.reset(new std::atomic<int>[stages_.size()]);
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    run->results[i].stage = stages_[i].name;
+    run->results[i].status = JobStageResult::Status::kSkipped;
+    run->waiting[i].store(dependencies_[i].size(), std::memory_order_relaxed);
+  }
+  run->remaining.store(stages_.size(), std::memory_order_relaxed);
+  pool_->Submit([this, run]() { Start(run); });
+}
+
+void JobProcessor::Start(std::shared_ptr<Run> run) {
+  const CompletedJob& job = run->job;
+  int fd = open(job.spool_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    run->error = "cannot-open-spool";
+  } else if (job.size > 0) {
+    // mmap() wants an offset which is a multiple of the page size.
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = job.offset & ~(page_size - 1);
+    run->mapping_size = job.offset - start + job.size;
+    void* mapping =
+        mmap(nullptr, run->mapping_size, PROT_READ, MAP_SHARED, fd, start);
+    if (mapping == MAP_FAILED) {
+      run->error = "cannot-map-spool";
+    } else {
+      // The stages mostly make a single pass over the data.
+      madvise(mapping, run->mapping_size, MADV_SEQUENTIAL);
+      run->mapping = mapping;
+      run->data = static_cast<const char*>(mapping) + (job.offset - start);
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  if (stages_.empty()) {
+    Finish(run.get());
+    return;
+  }
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    if (dependencies_[i].empty()) {
+      pool_->Submit([this, run, i]() { RunStage(run, i); });
+    }
+  }
+}
+
+void JobProcessor::RunStage(std::shared_ptr<Run> run, int index) {
+  const JobStage& stage = stages_[index];
+  JobStageResult& result = run->results[index];
+  bool ready = true;
+  for (int dependency : dependencies_[index]) {
+    if (run->results[dependency].status != JobStageResult::Status::kOk) {
+      ready = false;
+    }
+  }
+  if (!ready) {
+    result.status = JobStageResult::Status::kSkipped;
+  } else if (!run->error.empty()) {
+    result.status = JobStageResult::Status::kFailed;
+    result.value = run->error;
+  } else {
+    const std::vector<int>& dependencies = dependencies_[index];
+    JobContext context = {
+        run->job, run->data, run->job.size,
+        [this, &run, &dependencies](const std::string& name)
+            -> const JobStageResult* {
+          for (int dependency : dependencies) {
+            if (stages_[dependency].name == name) {
+              return &run->results[dependency];
+            }
+          }
+          return nullptr;
+        }};
+    result.status = stage.run(context, &result.value)
+                        ? JobStageResult::Status::kOk
+                        : JobStageResult::Status::kFailed;
+  }
+
+  // The result is published to the dependents and to Finish() by the
+  // decrements which follow it.
+  for (int dependent : dependents_[index]) {
+    if (run->waiting[dependent].fetch_sub(1, std::memory_order_acq_rel) ==
+        1) {
+      pool_->Submit([this, run, dependent]() { RunStage(run, dependent); });
+    }
+  }
+  if (run->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    Finish(run.get());
+  }
+}
+
+void JobProcessor::Finish(Run* run) {
+  if (run->mapping != nullptr) {
+    munmap(run->mapping, run->mapping_size);
+    run->mapping = nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(finished_mutex_);
+    finished_.emplace_back(run->job, std::move(run->results));
+  }
+  uint64_t one = 1;
+  while (write(event_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+void JobProcessor::DeliverResults() {
+  uint64_t count;
+  while (read(event_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+  std::vector<std::pair<CompletedJob, std::vector<JobStageResult>>> finished;
+  {
+    std::lock_guard<std::mutex> lock(finished_mutex_);
+    finished.swap(finished_);
+  }
+  for (const auto& job : finished) {
+    if (callback_) {
+      callback_(job.first, job.second);
+    }
+  }
+}
@@ -0,0 +1,133 @@
+#ifndef __USBIP_JOB_PROCESSOR_H__
+#define __USBIP_JOB_PROCESSOR_H__
+
+#include "event_loop.h"
+#include "work_stealing_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A print job which a printer has finished receiving into its spool.
+struct CompletedJob {
+  // Identifies the printer: its bus ID, and its generation, which tells it
+  // apart from printers which had the same bus ID before or after it. See
+  // UsbPrinter::generation().
+  std::string bus_id;
+  uint64_t printer_generation;
+  int id;
+  // The job is |size| bytes of the file at |spool_path|, from |offset|.
+  std::string spool_path;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// The outcome of one post-processing stage for a job.
+struct JobStageResult {
+  enum class Status {
+    kOk,
+    kFailed,
+    // Not run because a stage it depends on did not succeed.
+    kSkipped,
+  };
+
+  std::string stage;
+  Status status;
+  // What the stage found, or why it failed. Contains no whitespace.
+  std::string value;
+};
+
+// The data of a job, as the post-processing stages see it.
+struct JobContext {
+  const CompletedJob& job;
+  const char* data;
+  size_t size;
+  // Results of the stages which the current stage depends on, by name, or
+  // nullptr for any other stage.
+  std::function<const JobStageResult*(const std::string& stage)> result;
+};
+
+// A post-processing step. |run| returns true on success and describes the
+// outcome in |value|.
+struct JobStage {
+  std::string name;
+  // Stages which must have succeeded before this one runs.
+  std::vector<std::string> dependencies;
+  std::function<bool(const JobContext& context, std::string* value)> run;
+};
+
+// Runs a DAG of post-processing stages over every completed job, off the
+// threads which emulate the printers.
+//
+// Each job maps its range of the spool and becomes a set of tasks on a
+// WorkStealingPool: the stages without dependencies are queued at once, and
+// each stage queues those of its dependents which it was the last to wait
+// for. Stages of one job therefore run in parallel wherever the DAG allows,
+// and many jobs are spread over every core. The results of a job are handed
+// back on the event loop passed to SetResultCallback().
+class JobProcessor {
+ public:
+  using ResultCallback = std::function<void(
+      const CompletedJob& job, const std::vector<JobStageResult>& results)>;
+
+  // Creates a processor which runs |stages| on |threads| workers. Returns
+  // nullptr if a stage depends on one which is not listed or the
+  // dependencies form a cycle.
+  static std::unique_ptr<JobProcessor> Create(std::vector<JobStage> stages,
+                                              int threads);
+
+  // Finishes the jobs in progress and drops their results.
+  ~JobProcessor();
+
+  JobProcessor(const JobProcessor&) = delete;
+  JobProcessor& operator=(const JobProcessor&) = delete;
+
+  // Runs |callback| on |loop| with the results of each job, in the order of
+  // the stages. Must be called before the first job is submitted.
+  void SetResultCallback(EventLoop* loop, ResultCallback callback);
+
+  // Starts post-processing |job|. Safe to call from any thread.
+  void Submit(const CompletedJob& job);
+
+  const std::vector<JobStage>& stages() const { return stages_; }
+
+ private:
+  struct Run;
+
+  JobProcessor(std::vector<JobStage> stages,
+               std::vector<std::vector<int>> dependencies, int threads,
+               int event_fd);
+
+  // Maps the job's data and queues the stages which have no dependencies.
+  void Start(std::shared_ptr<Run> run);
+
+  // Runs stage |index| of |run| and queues the dependents which are ready.
+  void RunStage(std::shared_ptr<Run> run, int index);
+
+  // Hands the results of |run| over to the event loop.
+  void Finish(Run* run);
+
+  // Runs the result callback for every finished job. Event loop only.
+  void DeliverResults();
+
+  std::vector<JobStage> stages_;
+  // Indices of the stages which each stage depends on, and of those which
+  // depend on it.
+  std::vector<std::vector<int>> dependencies_;
+  std::vector<std::vector<int>> dependents_;
+
+  EventLoop* loop_;
+  ResultCallback callback_;
+  int event_fd_;
+  std::mutex finished_mutex_;
+  std::vector<std::pair<CompletedJob, std::vector<JobStageResult>>> finished_;
+
+  std::unique_ptr<WorkStealingPool> pool_;
+};
+
+#endif  // __USBIP_JOB_PROCESSOR_H__
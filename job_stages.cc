@@ -0,0 +1,489 @@
+#include "job_stages.h"
+
+#include "job_processor.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+
+namespace {
+
+// The Universal Exit Language command which starts a PJL job.
+const char kUel[] = "\x1b%-12345X";
+
+// Size of the page header of a PWG raster page.
+const size_t kPwgHeaderSize = 1796;
+
+// Size of the page header of an Apple raster (URF) page.
+const size_t kUrfHeaderSize = 32;
+
+uint32_t ReadBigEndian32(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 |
+         bytes[2] << 8 | bytes[3];
+}
+
+bool StartsWith(const char* data, size_t size, const char* prefix,
+                size_t prefix_size) {
+  return size >= prefix_size && memcmp(data, prefix, prefix_size) == 0;
+}
+
+// SHA-256 as specified in FIPS 180-4.
+class Sha256 {
+ public:
+  Sha256() : length_(0), buffered_(0) {
+    static const uint32_t kInitial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                         0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                         0x1f83d9ab, 0x5be0cd19};
+    memcpy(state_, kInitial, sizeof(state_));
+  }
+
+  void Update(const char* data, size_t size) {
+    length_ += size;
+    if (buffered_ > 0) {
+      size_t taken = std::min(size, sizeof(buffer_) - buffered_);
+      memcpy(buffer_ + buffered_, data, taken);
+      buffered_ += taken;
+      data += taken;
+      size -= taken;
+      if (buffered_ < sizeof(buffer_)) {
+        return;
+      }
+      Transform(buffer_);
+      buffered_ = 0;
+    }
+    for (; size >= sizeof(buffer_); data += 64, size -= 64) {
+      Transform(reinterpret_cast<const unsigned char*>(data));
+    }
+    memcpy(buffer_, data, size);
+    buffered_ = size;
+  }
+
+  // Returns the digest in hex.
+  std::string Finish() {
+    uint64_t bits = length_ * 8;
+    static const char kPadding[64] = {'\x80'};
+    Update(kPadding, 1 + (119 - buffered_) % 64);
+    char length[8];
+    for (int i = 0; i < 8; ++i) {
+      length[i] = static_cast<char>(bits >> (56 - 8 * i));
+    }
+    Update(length, sizeof(length));
+    char hex[65];
+    for (int i = 0; i < 8; ++i) {
+      snprintf(hex + 8 * i, 9, "%08x", state_[i]);
+    }
+    return hex;
+  }
+
+ private:
+  static uint32_t Rotate(uint32_t value, int bits) {
+    return value >> bits | value << (32 - bits);
+  }
+
+  void Transform(const unsigned char* block) {
+    static const uint32_t kRounds[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = ReadBigEndian32(reinterpret_cast<const char*>(block) + 4 * i);
+    }
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 =
+          Rotate(w[i - 15], 7) ^ Rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 =
+          Rotate(w[i - 2], 17) ^ Rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t s1 = Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25);
+      uint32_t choice = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + choice + kRounds[i] + w[i];
+      uint32_t s0 = Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22);
+      uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+  uint32_t state_[8];
+  uint64_t length_;
+  unsigned char buffer_[64];
+  size_t buffered_;
+};
+
+// Skips the PJL header of a job, if it has one, and returns the offset at
+// which the document itself starts.
+size_t SkipPjl(const char* data, size_t size) {
+  size_t offset = 0;
+  if (!StartsWith(data, size, kUel, sizeof(kUel) - 1)) {
+    return 0;
+  }
+  offset = sizeof(kUel) - 1;
+  while (StartsWith(data + offset, size - offset, "@PJL", 4)) {
+    const void* newline = memchr(data + offset, '\n', size - offset);
+    if (newline == nullptr) {
+      return size;
+    }
+    offset = static_cast<const char*>(newline) - data + 1;
+  }
+  return offset;
+}
+
+// Returns the end of the document which starts at |data|, without the PJL
+// trailer and trailing whitespace which may follow it.
+size_t DocumentEnd(const char* data, size_t size) {
+  const size_t kTrailerSearch = 4096;
+  size_t from = size > kTrailerSearch ? size - kTrailerSearch : 0;
+  for (size_t i = size; i > from; --i) {
+    if (StartsWith(data + i - 1, size - i + 1, kUel, sizeof(kUel) - 1)) {
+      size = i - 1;
+      break;
+    }
+  }
+  while (size > 0 && strchr(" \t\r\n", data[size - 1]) != nullptr &&
+         data[size - 1] != '\0') {
+    --size;
+  }
+  return size;
+}
+
+// Identifies the format of the document at |data|. Returns an empty string
+// if it is not one which the printer understands.
+std::string DetectFormat(const char* data, size_t size) {
+  if (StartsWith(data, size, "%PDF-", 5)) {
+    return "pdf";
+  }
+  if (StartsWith(data, size, "%!", 2)) {
+    return "postscript";
+  }
+  if (StartsWith(data, size, "RaS2", 4)) {
+    return "pwg-raster";
+  }
+  if (StartsWith(data, size, "UNIRAST", 8)) {
+    return "urf";
+  }
+  if (StartsWith(data, size, "\x1b" "E", 2)) {
+    return "pcl";
+  }
+  return "";
+}
+
+// Walks the compressed lines of a raster page which starts at |*offset|. The
+// page has |height| lines of |line_bytes| bytes, made of |pixel_bytes|-byte
+// pixels. Each line starts with a repeat count and is a sequence of runs:
+// codes 0-127 repeat the following pixel 1-128 times and codes 129-255 are
+// followed by 128-2 literal pixels. In URF, code 128 fills the rest of the
+// line with white; in PWG raster it precedes 129 literal pixels. Returns false
+// if the data ends early or a run overflows its line.
+bool SkipRasterPage(const char* data, size_t size, size_t* offset,
+                    uint64_t height, uint64_t line_bytes, uint64_t pixel_bytes,
+                    bool urf) {
+  if (height == 0 || line_bytes == 0 || pixel_bytes == 0) {
+    return false;
+  }
+  uint64_t lines = 0;
+  while (lines < height) {
+    if (*offset >= size) {
+      return false;
+    }
+    lines += static_cast<unsigned char>(data[(*offset)++]) + 1;
+    uint64_t filled = 0;
+    while (filled < line_bytes) {
+      if (*offset >= size) {
+        return false;
+      }
+      unsigned char code = data[(*offset)++];
+      if (code == 128 && urf) {
+        filled = line_bytes;
+      } else if (code < 128) {
+        *offset += pixel_bytes;
+        filled += (code + 1) * pixel_bytes;
+      } else {
+        *offset += (257 - code) * pixel_bytes;
+        filled += (257 - code) * pixel_bytes;
+      }
+      if (*offset > size || filled > line_bytes) {
+        return false;
+      }
+    }
+  }
+  return lines == height;
+}
+
+// Counts the pages of a PWG raster document.
+bool CountPwgPages(const char* data, size_t size, std::string* value) {
+  size_t offset = 4;
+  int pages = 0;
+  while (offset < size) {
+    if (size - offset < kPwgHeaderSize) {
+      *value = "truncated-page-header";
+      return false;
+    }
+    const char* header = data + offset;
+    uint64_t height = ReadBigEndian32(header + 376);
+    uint64_t bits_per_pixel = ReadBigEndian32(header + 388);
+    uint64_t line_bytes = ReadBigEndian32(header + 392);
+    offset += kPwgHeaderSize;
+    ++pages;
+    if (!SkipRasterPage(data, size, &offset, height, line_bytes,
+                        bits_per_pixel < 8 ? 1 : bits_per_pixel / 8, false)) {
+      *value = "bad-raster-page-" + std::to_string(pages);
+      return false;
+    }
+  }
+  *value = std::to_string(pages);
+  return true;
+}
+
+// Counts the pages of a URF document and checks them against the count in
+// its header.
+bool CountUrfPages(const char* data, size_t size, std::string* value) {
+  if (size < 12) {
+    *value = "truncated-header";
+    return false;
+  }
+  uint32_t declared = ReadBigEndian32(data + 8);
+  size_t offset = 12;
+  uint32_t pages = 0;
+  while (offset < size) {
+    if (size - offset < kUrfHeaderSize) {
+      *value = "truncated-page-header";
+      return false;
+    }
+    const char* header = data + offset;
+    uint64_t pixel_bytes = static_cast<unsigned char>(header[0]) / 8;
+    uint64_t width = ReadBigEndian32(header + 12);
+    uint64_t height = ReadBigEndian32(header + 16);
+    offset += kUrfHeaderSize;
+    ++pages;
+    if (!SkipRasterPage(data, size, &offset, height, width * pixel_bytes,
+                        pixel_bytes, true)) {
+      *value = "bad-raster-page-" + std::to_string(pages);
+      return false;
+    }
+  }
+  if (pages != declared) {
+    *value = "page-count-mismatch";
+    return false;
+  }
+  *value = std::to_string(pages);
+  return true;
+}
+
+// Counts the occurrences of |needle| in |data| for which |accept| holds.
+template <typename Accept>
+int CountMatches(const char* data, size_t size, const char* needle,
+                 Accept accept) {
+  size_t needle_size = strlen(needle);
+  int count = 0;
+  const char* end = data + size;
+  for (const char* p = data; p + needle_size <= end;) {
+    const void* found = memmem(p, end - p, needle, needle_size);
+    if (found == nullptr) {
+      break;
+    }
+    const char* match = static_cast<const char*>(found);
+    if (accept(match, match + needle_size)) {
+      ++count;
+    }
+    p = match + needle_size;
+  }
+  return count;
+}
+
+bool Sha256Stage(const JobContext& context, std::string* value) {
+  Sha256 hash;
+  hash.Update(context.data, context.size);
+  *value = hash.Finish();
+  return true;
+}
+
+bool FormatStage(const JobContext& context, std::string* value) {
+  size_t start = SkipPjl(context.data, context.size);
+  const char* document = context.data + start;
+  size_t size = DocumentEnd(document, context.size - start);
+  std::string format = DetectFormat(document, size);
+  if (format.empty()) {
+    *value = "unknown-format";
+    return false;
+  }
+  if (format == "pdf" &&
+      (size < 5 || memcmp(document + size - 5, "%%EOF", 5) != 0)) {
+    *value = "truncated-pdf";
+    return false;
+  }
+  if (format == "pwg-raster" && size < 4 + kPwgHeaderSize) {
+    *value = "truncated-pwg-raster";
+    return false;
+  }
+  *value = format;
+  return true;
+}
+
+bool PagesStage(const JobContext& context, std::string* value) {
+  size_t start = SkipPjl(context.data, context.size);
+  const char* document = context.data + start;
+  size_t size = DocumentEnd(document, context.size - start);
+  std::string format = DetectFormat(document, size);
+  int pages = 0;
+  if (format == "pwg-raster") {
+    return CountPwgPages(document, size, value);
+  } else if (format == "urf") {
+    return CountUrfPages(document, size, value);
+  } else if (format == "pdf") {
+    // Page objects, as opposed to the /Pages nodes of the page tree.
+    pages = CountMatches(document, size, "/Type",
+                         [document, size](const char* match, const char* p) {
+                           const char* end = document + size;
+                           while (p < end && (*p == ' ' || *p == '\n' ||
+                                              *p == '\r' || *p == '\t')) {
+                             ++p;
+                           }
+                           return end - p >= 5 && memcmp(p, "/Page", 5) == 0 &&
+                                  (end - p == 5 || p[5] != 's');
+                         });
+  } else if (format == "postscript") {
+    pages = CountMatches(document, size, "%%Page:",
+                         [document](const char* match, const char* p) {
+                           return match == document || match[-1] == '\n' ||
+                                  match[-1] == '\r';
+                         });
+  } else if (format == "pcl") {
+    // Every page is ejected with a form feed.
+    pages = CountMatches(document, size, "\f",
+                         [](const char* match, const char* p) {
+                           return true;
+                         });
+  } else {
+    *value = "unknown-format";
+    return false;
+  }
+  if (pages == 0) {
+    *value = "no-pages";
+    return false;
+  }
+  *value = std::to_string(pages);
+  return true;
+}
+
+bool ArchiveStage(const std::string& directory, const JobContext& context,
+                  std::string* value) {
+  std::string extension = "prn";
+  if (const JobStageResult* format = context.result("format")) {
+    if (format->value == "pdf") {
+      extension = "pdf";
+    } else if (format->value == "postscript") {
+      extension = "ps";
+    } else if (format->value == "pwg-raster") {
+      extension = "pwg";
+    } else if (format->value == "urf") {
+      extension = "urf";
+    } else if (format->value == "pcl") {
+      extension = "pcl";
+    }
+  }
+  std::string path = directory + "/" + context.job.bus_id + "-job-" +
+                     std::to_string(context.job.id) + "." + extension;
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("cannot archive job to %s : %s\n", path.c_str(), strerror(errno));
+    *value = "cannot-create-file";
+    return false;
+  }
+  size_t written = 0;
+  while (written < context.size) {
+    ssize_t result =
+        write(fd, context.data + written, context.size - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      printf("cannot archive job to %s : %s\n", path.c_str(),
+             strerror(errno));
+      close(fd);
+      *value = "write-error";
+      return false;
+    }
+    written += result;
+  }
+  close(fd);
+  *value = path;
+  return true;
+}
+
+}  // namespace
+
+bool ParseJobStages(const std::string& spec, const JobStageOptions& options,
+                    std::vector<JobStage>* stages) {
+  std::istringstream entries(spec);
+  std::string entry;
+  while (std::getline(entries, entry, ',')) {
+    JobStage stage;
+    size_t colon = entry.find(':');
+    stage.name = entry.substr(0, colon);
+    if (colon != std::string::npos) {
+      std::istringstream dependencies(entry.substr(colon + 1));
+      std::string dependency;
+      while (std::getline(dependencies, dependency, '+')) {
+        stage.dependencies.push_back(dependency);
+      }
+    }
+    if (stage.name == "sha256") {
+      stage.run = Sha256Stage;
+    } else if (stage.name == "format") {
+      stage.run = FormatStage;
+    } else if (stage.name == "pages") {
+      stage.run = PagesStage;
+    } else if (stage.name == "archive") {
+      if (options.archive_dir.empty()) {
+        printf("the archive stage needs an archive directory\n");
+        return false;
+      }
+      std::string directory = options.archive_dir;
+      stage.run = [directory](const JobContext& context, std::string* value) {
+        return ArchiveStage(directory, context, value);
+      };
+    } else {
+      printf("unknown post-processing stage %s\n", stage.name.c_str());
+      return false;
+    }
+    stages->push_back(stage);
+  }
+  return true;
+}
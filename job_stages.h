@@ -0,0 +1,33 @@
+#ifndef __USBIP_JOB_STAGES_H__
+#define __USBIP_JOB_STAGES_H__
+
+#include "job_processor.h"
+
+#include <string>
+#include <vector>
+
+// Settings of the built-in post-processing stages.
+struct JobStageOptions {
+  // Directory which the archive stage copies jobs into.
+  std::string archive_dir;
+};
+
+// Builds the post-processing stages described by |spec|, a comma-separated
+// list of built-in stages, each optionally followed by ':' and the
+// '+'-separated stages it depends on, for example
+// "sha256,format,pages:format,archive:sha256+format". The built-in stages are:
+//
+//   sha256   the SHA-256 digest of the job, in hex
+//   format   the document format, which must be complete: pdf, postscript,
+//            pwg-raster, urf or pcl, optionally wrapped in PJL
+//   pages    the number of pages; raster pages are decoded line by line to
+//            check that each has exactly the lines its header declares
+//   archive  copies the job into |options.archive_dir| and returns the path,
+//            using the format's extension if it depends on format
+//
+// Returns false after printing an error if |spec| is malformed or names an
+// unknown stage.
+bool ParseJobStages(const std::string& spec, const JobStageOptions& options,
+                    std::vector<JobStage>* stages);
+
+#endif  // __USBIP_JOB_STAGES_H__
@@ -1,148 +1,421 @@
 #include "server.h"
-#include "device_descriptors.h"
+#include "buffer_pool.h"
+#include "default_printer.h"
+#include "device_registry.h"
+#include "enumeration_timeline.h"
+#include "golden_file.h"
+#include "hid_keyboard.h"
+#include "hid_mouse.h"
+#include "job_stages.h"
+#include "pcap_writer.h"
+#include "printer_engine.h"
+#include "printer_profile.h"
+#include "startup.h"
+#include "transport.h"
+#include "urb_trace.h"
 #include "usbip.h"
 #include "usbip-constants.h"
 #include "usb_printer.h"
+#include "vhci_host.h"
 
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
-int main() {
-  const USB_DEVICE_DESCRIPTOR device = {
-      0x12,                   // Size of this descriptor in bytes
-      USB_DESCRIPTOR_DEVICE,  // descriptor type
-      0x0110,                 // USB Spec Release Number in BCD format
-      0x00,                   // Class Code
-      0x00,                   // Subclass code
-      0x00,                   // Protocol code
-      0x08,                   // Max packet size for EP0, see usb_config.h
-      0x04a9,                 // Vendor ID
-      0x27e8,                 // Product ID
-      0x0000,                 // Device release number in BCD format
-      0x01,                   // Manufacturer string descriptor index
-      0x02,                   // Product string descriptor index
-      0x01,                   // Device serial number string descriptor index
-      0x01,                   // Number of possible configurations
-  };
+#include <getopt.h>
 
-  const USB_CONFIGURATION_DESCRIPTOR configuration = {
-      0x09,                          // Size of this descriptor in bytes.
-      USB_DESCRIPTOR_CONFIGURATION,  // descriptor type.
-      0x20,  // Total length of data for this configuration.
-      0x01,  // Number of interfaces in this configuration.
-      0x01,  // Index value for this configuration.
-      0x00,  // Configuration string descriptor index.
-      0x80,  // Configuration characteristics (bmAttributes).
-      0x00,  // Max power consumption (2X mA).
-  };
+#include <cstdio>
+#include <cstdlib>
 
-  std::vector<char> str1 = {
-      0x04, USB_DESCRIPTOR_STRING, // bLength, bDscType
-      0x09, 0x04
-  };
+namespace {
 
-  std::vector<char> str2 = {
-      0x0E, USB_DESCRIPTOR_STRING, // bLength, bDscType
-      'D', 0x00,
-      'a', 0x00,
-      'v', 0x00,
-      'i', 0x00,
-      'e', 0x00,
-      'V', 0x00,
-  };
+struct CommandLineOptions {
+  // Describes every printer exported at startup, and those which are added
+  // through the control socket without a profile of their own.
+  PrinterProfile profile;
+  const char* trace_path = nullptr;
+  size_t trace_size = 64 << 20;
+  bool trace_payloads = false;
+  const char* pcap_path = nullptr;
+  PcapWriterOptions pcap;
+  bool timeline = false;
+  const char* timeline_path = nullptr;
+  int printers = 1;
+  int mice = 0;
+  int keyboards = 0;
+  int hid_interval_ms = 10;
+  const char* spool_path = nullptr;
+  const char* golden_path = nullptr;
+  bool split_jobs = false;
+  const char* control_path = nullptr;
+  int ready_fd = -1;
+  int max_sessions = 64;
+  int device_threads = 0;
+  const char* post_job = nullptr;
+  int post_job_threads = 0;
+  const char* vhci_path = nullptr;
+  size_t zerocopy_threshold = 0;
+  BufferPool::Options buffer_pool;
+  JobStageOptions job_stage_options;
+};
 
-  std::vector<char> str3 = {
-      0x28, USB_DESCRIPTOR_STRING, // bLength, bDscType
-      'V', 0x00,
-      'i', 0x00,
-      'r', 0x00,
-      't', 0x00,
-      'u', 0x00,
-      'a', 0x00,
-      'l', 0x00,
-      ' ', 0x00,
-      'U', 0x00,
-      'S', 0x00,
-      'B', 0x00,
-      ' ', 0x00,
-      'P', 0x00,
-      'r', 0x00,
-      'i', 0x00,
-      'n', 0x00,
-      't', 0x00,
-      'e', 0x00,
-      'r', 0x00,
+void PrintUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --bytes-per-second=N   rate at which the engine consumes data\n");
+  printf("  --pages-per-minute=N   engine rate in pages per minute\n");
+  printf("  --bytes-per-page=N     page size used with --pages-per-minute\n");
+  printf("  --buffer-size=N        size of the printer's receive buffer\n");
+  printf("  --spike-probability=P  chance that a chunk triggers a stall\n");
+  printf("  --spike-ms=N           duration of an injected stall\n");
+  printf("  --trace=PATH           record URB traffic to a binary trace\n");
+  printf("  --trace-size=N         size of the trace ring in bytes\n");
+  printf("  --trace-payloads       store URB payloads in the trace\n");
+  printf("  --pcap=PATH            capture URB traffic as usbmon pcapng\n");
+  printf("  --pcap-rotate-size=N   start a new capture file every N bytes\n");
+  printf("  --timeline[=PATH]      write an enumeration profile to PATH\n");
+  printf("  --printers=N           number of printers to export\n");
+  printf("  --mice=N               number of HID mice to export\n");
+  printf("  --keyboards=N          number of HID keyboards to export\n");
+  printf("  --hid-interval-ms=N    polling interval of the HID endpoints\n");
+  printf("  --speed=SPEED          full, high or super speed operation\n");
+  printf("  --spool=PATH           capture print data in PATH, PATH.2, ...\n");
+  printf("  --golden=PATH          compare every print job against PATH\n");
+  printf("  --split-jobs           end jobs where their data shows they end\n");
+  printf("  --profile=PATH         load the printer profile stored at PATH\n");
+  printf("  --control=PATH         accept control requests on a Unix socket\n");
+  printf("  --ready-fd=N           write READY=1 to descriptor N once ready\n");
+  printf("  --max-sessions=N       number of clients served at once\n");
+  printf("  --device-threads=N     run the devices on N extra threads\n");
+  printf("  --post-job=SPEC        post-process jobs, e.g. sha256,format\n");
+  printf("  --post-job-threads=N   threads which post-process jobs\n");
+  printf("  --archive-dir=DIR      where the archive stage copies jobs to\n");
+  printf("  --vhci[=DIR]           attach the devices to the local vhci_hcd\n");
+  printf("  --zerocopy[=N]         send replies of N+ bytes zero-copy\n");
+  printf("  --huge-pages           back URB buffers with huge pages\n");
+  printf("  --prefault             fault in URB buffers as they are mapped\n");
+}
+
+// Parses the command line into |options|. Options are applied in order, so a
+// --profile is overridden by the options which follow it. Returns false if the
+// arguments were invalid.
+bool ParseArguments(int argc, char* argv[], CommandLineOptions* options) {
+  PrinterEngineOptions* engine_options = &options->profile.engine;
+  enum {
+    kBytesPerSecond = 256,
+    kPagesPerMinute,
+    kBytesPerPage,
+    kBufferSize,
+    kSpikeProbability,
+    kSpikeMs,
+    kTrace,
+    kTraceSize,
+    kTracePayloads,
+    kPcap,
+    kPcapRotateSize,
+    kTimeline,
+    kPrinters,
+    kMice,
+    kKeyboards,
+    kHidIntervalMs,
+    kSpeed,
+    kSpool,
+    kGolden,
+    kSplitJobs,
+    kProfile,
+    kControl,
+    kReadyFd,
+    kMaxSessions,
+    kDeviceThreads,
+    kPostJob,
+    kPostJobThreads,
+    kArchiveDir,
+    kVhci,
+    kZeroCopy,
+    kHugePages,
+    kPrefault,
   };
+  const struct option long_options[] = {
+      {"bytes-per-second", required_argument, nullptr, kBytesPerSecond},
+      {"pages-per-minute", required_argument, nullptr, kPagesPerMinute},
+      {"bytes-per-page", required_argument, nullptr, kBytesPerPage},
+      {"buffer-size", required_argument, nullptr, kBufferSize},
+      {"spike-probability", required_argument, nullptr, kSpikeProbability},
+      {"spike-ms", required_argument, nullptr, kSpikeMs},
+      {"trace", required_argument, nullptr, kTrace},
+      {"trace-size", required_argument, nullptr, kTraceSize},
+      {"trace-payloads", no_argument, nullptr, kTracePayloads},
+      {"pcap", required_argument, nullptr, kPcap},
+      {"pcap-rotate-size", required_argument, nullptr, kPcapRotateSize},
+      {"timeline", optional_argument, nullptr, kTimeline},
+      {"printers", required_argument, nullptr, kPrinters},
+      {"mice", required_argument, nullptr, kMice},
+      {"keyboards", required_argument, nullptr, kKeyboards},
+      {"hid-interval-ms", required_argument, nullptr, kHidIntervalMs},
+      {"speed", required_argument, nullptr, kSpeed},
+      {"spool", required_argument, nullptr, kSpool},
+      {"golden", required_argument, nullptr, kGolden},
+      {"split-jobs", no_argument, nullptr, kSplitJobs},
+      {"profile", required_argument, nullptr, kProfile},
+      {"control", required_argument, nullptr, kControl},
+      {"ready-fd", required_argument, nullptr, kReadyFd},
+      {"max-sessions", required_argument, nullptr, kMaxSessions},
+      {"device-threads", required_argument, nullptr, kDeviceThreads},
+      {"post-job", required_argument, nullptr, kPostJob},
+      {"post-job-threads", required_argument, nullptr, kPostJobThreads},
+      {"archive-dir", required_argument, nullptr, kArchiveDir},
+      {"vhci", optional_argument, nullptr, kVhci},
+      {"zerocopy", optional_argument, nullptr, kZeroCopy},
+      {"huge-pages", no_argument, nullptr, kHugePages},
+      {"prefault", no_argument, nullptr, kPrefault},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "h", long_options, nullptr)) !=
+         -1) {
+    switch (option) {
+      case kBytesPerSecond:
+        engine_options->bytes_per_second = atof(optarg);
+        break;
+      case kPagesPerMinute:
+        engine_options->pages_per_minute = atof(optarg);
+        break;
+      case kBytesPerPage:
+        engine_options->bytes_per_page = strtoull(optarg, nullptr, 10);
+        break;
+      case kBufferSize:
+        engine_options->buffer_size = strtoull(optarg, nullptr, 10);
+        break;
+      case kSpikeProbability:
+        engine_options->spike_probability = atof(optarg);
+        break;
+      case kSpikeMs:
+        engine_options->spike_duration_ns =
+            strtoull(optarg, nullptr, 10) * 1000000ull;
+        break;
+      case kTrace:
+        options->trace_path = optarg;
+        break;
+      case kTraceSize:
+        options->trace_size = strtoull(optarg, nullptr, 10);
+        break;
+      case kTracePayloads:
+        options->trace_payloads = true;
+        break;
+      case kPcap:
+        options->pcap_path = optarg;
+        break;
+      case kPcapRotateSize:
+        options->pcap.rotate_size = strtoull(optarg, nullptr, 10);
+        break;
+      case kTimeline:
+        options->timeline = true;
+        options->timeline_path = optarg;
+        break;
+      case kPrinters:
+        options->printers = atoi(optarg);
+        break;
+      case kMice:
+        options->mice = atoi(optarg);
+        break;
+      case kKeyboards:
+        options->keyboards = atoi(optarg);
+        break;
+      case kHidIntervalMs:
+        // bInterval is a single byte.
+        options->hid_interval_ms = atoi(optarg);
+        if (options->hid_interval_ms < 1 || options->hid_interval_ms > 255) {
+          return false;
+        }
+        break;
+      case kSpeed:
+        if (!ParseUsbSpeed(optarg, &options->profile.speed)) {
+          return false;
+        }
+        break;
+      case kSpool:
+        options->spool_path = optarg;
+        break;
+      case kGolden:
+        options->golden_path = optarg;
+        break;
+      case kSplitJobs:
+        options->split_jobs = true;
+        break;
+      case kProfile:
+        if (!LoadPrinterProfile(optarg, &options->profile)) {
+          return false;
+        }
+        break;
+      case kControl:
+        options->control_path = optarg;
+        break;
+      case kReadyFd:
+        options->ready_fd = atoi(optarg);
+        if (options->ready_fd < 0) {
+          return false;
+        }
+        break;
+      case kMaxSessions:
+        options->max_sessions = atoi(optarg);
+        if (options->max_sessions < 1) {
+          return false;
+        }
+        break;
+      case kDeviceThreads:
+        options->device_threads = atoi(optarg);
+        if (options->device_threads < 0) {
+          return false;
+        }
+        break;
+      case kPostJob:
+        options->post_job = optarg;
+        break;
+      case kPostJobThreads:
+        options->post_job_threads = atoi(optarg);
+        if (options->post_job_threads < 1) {
+          return false;
+        }
+        break;
+      case kArchiveDir:
+        options->job_stage_options.archive_dir = optarg;
+        break;
+      case kVhci:
+        options->vhci_path = optarg != nullptr ? optarg : kDefaultVhciPath;
+        break;
+      case kZeroCopy:
+        options->zerocopy_threshold =
+            optarg != nullptr ? strtoull(optarg, nullptr, 10)
+                              : kDefaultZeroCopyThreshold;
+        if (options->zerocopy_threshold == 0) {
+          return false;
+        }
+        break;
+      case kHugePages:
+        options->buffer_pool.huge_pages = true;
+        break;
+      case kPrefault:
+        options->buffer_pool.prefault = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
 
-  const std::vector<std::vector<char>> strings = {str1, str2, str3};
+}  // namespace
 
-  const std::vector<char> ieee_device_id = {
-    0x00, 0x1A,  // Length (26 bytes)
-    'M', 'F', 'G', ':', 'D', 'V', '3', ';',
-    'C', 'M', 'D', ':', 'P', 'D', 'F', ';',
-    'M', 'D', 'L', ':', 'V', 'T', 'L', ';',
-  };
+int main(int argc, char* argv[]) {
+  StartupTimer startup;
+  CommandLineOptions options;
+  if (!ParseArguments(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  // Before any thread has used its pool.
+  BufferPool::SetDefaultOptions(options.buffer_pool);
+  std::vector<JobStage> post_job_stages;
+  if (options.post_job != nullptr) {
+    // Jobs are read back from the spool once they have ended.
+    if (options.spool_path == nullptr) {
+      printf("--post-job needs --spool\n");
+      return 1;
+    }
+    if (!ParseJobStages(options.post_job, options.job_stage_options,
+                        &post_job_stages)) {
+      return 1;
+    }
+  }
+  startup.Mark("arguments");
+
+  std::unique_ptr<UrbTraceRecorder> trace;
+  if (options.trace_path != nullptr) {
+    trace = UrbTraceRecorder::Create(options.trace_path, options.trace_size,
+                                     options.trace_payloads);
+    if (!trace) {
+      return 1;
+    }
+    SetUrbTraceRecorder(trace.get());
+  }
+
+  std::unique_ptr<PcapWriter> pcap;
+  if (options.pcap_path != nullptr) {
+    pcap = PcapWriter::Create(options.pcap_path, options.pcap);
+    if (!pcap) {
+      return 1;
+    }
+    SetPcapWriter(pcap.get());
+  }
+
+  std::unique_ptr<EnumerationProfiler> profiler;
+  if (options.timeline) {
+    profiler = EnumerationProfiler::Create(options.timeline_path);
+    if (!profiler) {
+      return 1;
+    }
+    SetEnumerationProfiler(profiler.get());
+  }
+  startup.Mark("capture");
+
+  std::shared_ptr<const GoldenFile> golden;
+  if (options.golden_path != nullptr) {
+    golden = GoldenFile::Create(options.golden_path);
+    if (!golden) {
+      return 1;
+    }
+  }
+
+  PrinterSetup printer_setup;
+  if (options.spool_path != nullptr) {
+    printer_setup.spool_path = options.spool_path;
+  }
+  printer_setup.golden = golden;
+  printer_setup.split_jobs = options.split_jobs;
+  PrinterFactory printer_factory(printer_setup);
+
+  UsbDeviceRegistry devices;
+  for (int i = 0; i < options.printers; ++i) {
+    std::unique_ptr<UsbPrinter> printer =
+        printer_factory.Create(options.profile);
+    if (!printer) {
+      return 1;
+    }
+    devices.Add(std::move(printer));
+  }
+  // HID devices run at the speed of the profile too, which printers already
+  // operate at.
+  for (int i = 0; i < options.mice; ++i) {
+    devices.Add(std::make_unique<HidMouse>(options.hid_interval_ms))
+        ->SetSpeed(options.profile.speed);
+  }
+  for (int i = 0; i < options.keyboards; ++i) {
+    devices.Add(std::make_unique<HidKeyboard>(options.hid_interval_ms))
+        ->SetSpeed(options.profile.speed);
+  }
+  if (devices.devices().empty() && options.control_path == nullptr) {
+    printf("No devices to export\n");
+    return 1;
+  }
+  for (const auto& device : devices.devices()) {
+    printf("Exporting %04x:%04x as %s\n", device->device_descriptor().idVendor,
+           device->device_descriptor().idProduct, device->bus_id());
+  }
+  startup.Mark("devices");
 
-  const std::vector<USB_INTERFACE_DESCRIPTOR> interfaces = {
-      {
-          0x09,                      // Size of this descriptor in bytes
-          USB_DESCRIPTOR_INTERFACE,  // descriptor type.
-          0x00,                      // Interface Number.
-          0x00,                      // Alternate Setting Number.
-          0x02,                      // Number of endpoints in this interface.
-          0x07,                      // Class code.
-          0x01,                      // Subclass code.
-          0x02,                      // Protocol code.
-          0x00,                      // Interface string index.
-      },
-      /*
-      {
-          0x09,                      // Size of this descriptor in bytes
-          USB_DESCRIPTOR_INTERFACE,  // descriptor type.
-          0x01,                      // Interface Number.
-          0x00,                      // Alternate Setting Number.
-          0x02,                      // Number of endpoints in this interface.
-          0x07,                      // Class code.
-          0x01,                      // Subclass code.
-          0x02,                      // Protocol code.
-          0x00,                      // Interface string index.
-      }*/};
-
-  const std::vector<USB_ENDPOINT_DESCRIPTOR> endpoints = {
-      {
-          0x07,                     // Size of this descriptor in bytes.
-          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
-          0x01,                     // Endpoint Address.
-          0x02,                     // Attributes (Bulk Endpoint).
-          512,                      // Max transfer size.
-          0x00,                     // Interval.
-      },
-      {
-          0x07,                     // Size of this descriptor in bytes.
-          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
-          0x81,                     // Endpoint Address.
-          0x02,                     // Attributes (Bulk Endpoint).
-          512,                      // Max transfer size.
-          0x00,                     // Interval.
-      },
-      /*
-      {
-          0x07,                     // Size of this descriptor in bytes.
-          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
-          0x03,                     // Endpoint Address.
-          0x02,                     // Attributes (Bulk Endpoint).
-          0x08,                     // Max transfer size.
-          0x00,                     // Interval.
-      },
-      {
-          0x07,                     // Size of this descriptor in bytes.
-          USB_DESCRIPTOR_ENDPOINT,  // descriptor type.
-          0x84,                     // Endpoint Address.
-          0x02,                     // Attributes (Bulk Endpoint).
-          0x08,                     // Max transfer size.
-          0x00,                     // Interval.
-      }*/};
-
-  UsbPrinter printer(device, configuration, strings, ieee_device_id, interfaces,
-                     endpoints);
-  run_server(printer);
+  ServerOptions server_options;
+  server_options.control_path = options.control_path;
+  server_options.printer_profile = options.profile;
+  server_options.printer_factory = &printer_factory;
+  server_options.ready_fd = options.ready_fd;
+  server_options.max_sessions = options.max_sessions;
+  server_options.device_threads = options.device_threads;
+  server_options.post_job_stages = std::move(post_job_stages);
+  server_options.post_job_threads = options.post_job_threads;
+  server_options.vhci_path = options.vhci_path;
+  server_options.zerocopy_threshold = options.zerocopy_threshold;
+  server_options.startup = &startup;
+  run_server(&devices, server_options);
 }
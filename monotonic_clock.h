@@ -0,0 +1,21 @@
+#ifndef __USBIP_MONOTONIC_CLOCK_H__
+#define __USBIP_MONOTONIC_CLOCK_H__
+
+#include <cstdint>
+#include <ctime>
+
+// Returns the current value of CLOCK_MONOTONIC in nanoseconds.
+inline uint64_t MonotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+// Returns the CPU time which the calling thread has used in nanoseconds.
+inline uint64_t ThreadCpuNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+#endif  // __USBIP_MONOTONIC_CLOCK_H__
@@ -0,0 +1,312 @@
+#include "pcap_writer.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+PcapWriter* g_writer = nullptr;
+
+const uint32_t kSectionHeaderBlock = 0x0A0D0D0A;
+const uint32_t kInterfaceDescriptionBlock = 0x00000001;
+const uint32_t kEnhancedPacketBlock = 0x00000006;
+const uint32_t kByteOrderMagic = 0x1A2B3C4D;
+const uint16_t kOptionEnd = 0;
+const uint16_t kOptionTimestampResolution = 9;
+// Size of the section header and interface description blocks.
+const size_t kFileHeaderSize = 60;
+
+// The background thread is woken early once this much data is waiting.
+const size_t kFlushThreshold = 64 << 10;
+// Otherwise pending packets are written at least this often.
+const auto kFlushInterval = std::chrono::milliseconds(500);
+
+const uint8_t kTransferTypeControl = 2;
+const uint8_t kTransferTypeBulk = 3;
+
+size_t Pad4(size_t size) { return (size + 3) & ~static_cast<size_t>(3); }
+
+void Append(std::vector<char>* buffer, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  buffer->insert(buffer->end(), bytes, bytes + size);
+}
+
+template <typename T>
+void AppendValue(std::vector<char>* buffer, T value) {
+  Append(buffer, &value, sizeof(value));
+}
+
+// Returns the section header and interface description blocks which start
+// every file.
+std::vector<char> CreateFileHeader() {
+  std::vector<char> header;
+  // Section header block with no options and an unspecified section length.
+  AppendValue<uint32_t>(&header, kSectionHeaderBlock);
+  AppendValue<uint32_t>(&header, 28);
+  AppendValue<uint32_t>(&header, kByteOrderMagic);
+  AppendValue<uint16_t>(&header, 1);
+  AppendValue<uint16_t>(&header, 0);
+  AppendValue<int64_t>(&header, -1);
+  AppendValue<uint32_t>(&header, 28);
+
+  // Interface description block with nanosecond timestamps.
+  AppendValue<uint32_t>(&header, kInterfaceDescriptionBlock);
+  AppendValue<uint32_t>(&header, 32);
+  AppendValue<uint16_t>(&header, kLinkTypeUsbLinuxMmapped);
+  AppendValue<uint16_t>(&header, 0);
+  AppendValue<uint32_t>(&header, 0);
+  AppendValue<uint16_t>(&header, kOptionTimestampResolution);
+  AppendValue<uint16_t>(&header, 1);
+  AppendValue<uint32_t>(&header, 9);
+  AppendValue<uint16_t>(&header, kOptionEnd);
+  AppendValue<uint16_t>(&header, 0);
+  AppendValue<uint32_t>(&header, 32);
+  return header;
+}
+
+// Fills in the fields of |packet| which come from the URB itself.
+UsbmonPacket CreateUsbmonPacket(char type, int seqnum, int devid,
+                                int direction, int ep) {
+  UsbmonPacket packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.id = static_cast<uint32_t>(seqnum);
+  packet.type = type;
+  // Every endpoint other than the default control pipe is a bulk endpoint on
+  // the emulated printer.
+  packet.transfer_type = ep == 0 ? kTransferTypeControl : kTransferTypeBulk;
+  packet.endpoint = (ep & 0x7F) | (direction == 1 ? 0x80 : 0);
+  packet.device = devid & 0xFFFF;
+  packet.bus = devid >> 16;
+  packet.setup_flag = '-';
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  packet.ts_sec = now.tv_sec;
+  packet.ts_usec = now.tv_nsec / 1000;
+  return packet;
+}
+
+// Stores |setup|, which holds the SETUP packet in wire order starting from its
+// most significant byte, into |packet|.
+void SetSetup(UsbmonPacket* packet, long long setup) {
+  packet->setup_flag = 0;
+  for (int i = 0; i < 8; ++i) {
+    packet->setup[i] = static_cast<uint64_t>(setup) >> (56 - 8 * i);
+  }
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<PcapWriter> PcapWriter::Create(
+    const std::string& path, const PcapWriterOptions& options) {
+  std::unique_ptr<PcapWriter> writer(new PcapWriter(path, options));
+  if (!writer->OpenFile()) {
+    return nullptr;
+  }
+  writer->thread_ = std::thread(&PcapWriter::Run, writer.get());
+  return writer;
+}
+
+PcapWriter::PcapWriter(const std::string& path,
+                       const PcapWriterOptions& options)
+    : path_(path),
+      options_(options),
+      fd_(-1),
+      file_index_(0),
+      file_size_(0),
+      dropped_(0),
+      stopping_(false) {}
+
+PcapWriter::~PcapWriter() {
+  if (g_writer == this) {
+    g_writer = nullptr;
+  }
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool PcapWriter::OpenFile() {
+  std::string path = path_;
+  if (file_index_ > 0) {
+    path += "." + std::to_string(file_index_);
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("open(%s) error : %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = fd;
+  ++file_index_;
+  file_size_ = 0;
+
+  std::vector<char> header = CreateFileHeader();
+  if (write(fd_, header.data(), header.size()) !=
+      static_cast<ssize_t>(header.size())) {
+    printf("write(%s) error : %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  file_size_ = header.size();
+  return true;
+}
+
+void PcapWriter::WriteSubmit(const USBIP_CMD_SUBMIT& request, const char* data,
+                             size_t data_size) {
+  UsbmonPacket packet =
+      CreateUsbmonPacket('S', request.seqnum, request.devid,
+                         request.direction, request.ep);
+  if (request.ep == 0) {
+    SetSetup(&packet, request.setup);
+  }
+  packet.length = request.transfer_buffer_length;
+  packet.interval = request.interval;
+  packet.start_frame = request.start_frame;
+  packet.transfer_flags = request.transfer_flags;
+  // IN submissions have no data yet.
+  packet.data_flag = data_size > 0 ? 0 : '<';
+  WritePacket(packet, data, data_size);
+}
+
+void PcapWriter::WriteComplete(const USBIP_CMD_SUBMIT& request, int status,
+                               const char* data, size_t actual_length) {
+  UsbmonPacket packet =
+      CreateUsbmonPacket('C', request.seqnum, request.devid,
+                         request.direction, request.ep);
+  packet.status = status;
+  packet.length = actual_length;
+  packet.interval = request.interval;
+  packet.start_frame = request.start_frame;
+  packet.transfer_flags = request.transfer_flags;
+  size_t data_size = data != nullptr ? actual_length : 0;
+  // OUT completions carry a length but the data was sent with the submission.
+  packet.data_flag = data_size > 0 ? 0 : '>';
+  WritePacket(packet, data, data_size);
+}
+
+void PcapWriter::WriteUnlink(const USBIP_CMD_UNLINK& request, int status) {
+  // usbmon has no record of the unlink request itself; the kernel reports
+  // the cancelled URB as completing with the unlink status.
+  if (status == 0) {
+    return;
+  }
+  UsbmonPacket packet =
+      CreateUsbmonPacket('C', request.seqnum_urb, request.devid,
+                         request.direction, request.ep);
+  packet.status = status;
+  packet.data_flag = request.direction == 1 ? '<' : '>';
+  WritePacket(packet, nullptr, 0);
+}
+
+uint64_t PcapWriter::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+void PcapWriter::WritePacket(const UsbmonPacket& header, const char* data,
+                             size_t data_size) {
+  UsbmonPacket packet = header;
+  packet.captured_length = data_size;
+  size_t packet_size = sizeof(packet) + data_size;
+  size_t block_size = 32 + Pad4(packet_size);
+  uint64_t timestamp =
+      static_cast<uint64_t>(packet.ts_sec) * 1000000000ull +
+      static_cast<uint64_t>(packet.ts_usec) * 1000ull;
+
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.size() + block_size > options_.max_pending) {
+      ++dropped_;
+      return;
+    }
+    AppendValue<uint32_t>(&pending_, kEnhancedPacketBlock);
+    AppendValue<uint32_t>(&pending_, block_size);
+    AppendValue<uint32_t>(&pending_, 0);
+    AppendValue<uint32_t>(&pending_, timestamp >> 32);
+    AppendValue<uint32_t>(&pending_, timestamp & 0xFFFFFFFF);
+    AppendValue<uint32_t>(&pending_, packet_size);
+    AppendValue<uint32_t>(&pending_, packet_size);
+    Append(&pending_, &packet, sizeof(packet));
+    if (data_size > 0) {
+      Append(&pending_, data, data_size);
+    }
+    pending_.resize(pending_.size() + Pad4(packet_size) - packet_size, 0);
+    AppendValue<uint32_t>(&pending_, block_size);
+    wake = pending_.size() >= kFlushThreshold;
+  }
+  if (wake) {
+    wake_.notify_one();
+  }
+}
+
+void PcapWriter::Run() {
+  std::vector<char> writing;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait_for(lock, kFlushInterval, [this] {
+      return stopping_ || pending_.size() >= kFlushThreshold;
+    });
+    // Swap buffers so that packets can keep being added while the file is
+    // written.
+    writing.swap(pending_);
+    bool stopping = stopping_;
+    lock.unlock();
+    if (!writing.empty()) {
+      WriteToFile(writing.data(), writing.size());
+      writing.clear();
+    }
+    lock.lock();
+    if (stopping && pending_.empty()) {
+      return;
+    }
+  }
+}
+
+void PcapWriter::WriteToFile(const char* data, size_t size) {
+  // Batches are never split across files, so a file only exceeds the limit
+  // when a single batch does.
+  if (options_.rotate_size > 0 && file_size_ > kFileHeaderSize &&
+      file_size_ + size > options_.rotate_size) {
+    OpenFile();
+  }
+  if (fd_ < 0) {
+    return;
+  }
+  while (size > 0) {
+    ssize_t written = write(fd_, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      printf("pcap write error : %s\n", strerror(errno));
+      return;
+    }
+    data += written;
+    size -= written;
+    file_size_ += written;
+  }
+}
+
+PcapWriter* GetPcapWriter() { return g_writer; }
+
+void SetPcapWriter(PcapWriter* writer) { g_writer = writer; }
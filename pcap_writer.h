@@ -0,0 +1,131 @@
+#ifndef __USBIP_PCAP_WRITER_H__
+#define __USBIP_PCAP_WRITER_H__
+
+#include "usbip.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes the URB traffic of the server as pcapng using the Linux usbmon link
+// type (LINKTYPE_USB_LINUX_MMAPPED), so captures can be opened directly with
+// Wireshark's USB and printer dissectors.
+//
+// Packets are formatted into an in-memory buffer by the thread which handles
+// the URB. A background thread swaps that buffer for an empty one and writes
+// it out, so the protocol handlers never block on the file. When the current
+// file grows past the rotation size a new file, named after the original with
+// an increasing numeric suffix, is started.
+
+const uint16_t kLinkTypeUsbLinuxMmapped = 220;
+
+// The 64-byte header which precedes the data of every usbmon packet. Fields
+// are in host byte order, as they are when captured from /dev/usbmon.
+struct __attribute__((__packed__)) UsbmonPacket {
+  uint64_t id;
+  // 'S' for a submission, 'C' for a completion.
+  uint8_t type;
+  // 0 isochronous, 1 interrupt, 2 control, 3 bulk.
+  uint8_t transfer_type;
+  // Endpoint number with 0x80 set for IN.
+  uint8_t endpoint;
+  uint8_t device;
+  uint16_t bus;
+  // 0 when |setup| is valid, '-' otherwise.
+  char setup_flag;
+  // 0 when data follows the header, otherwise a character describing why it
+  // does not.
+  char data_flag;
+  int64_t ts_sec;
+  int32_t ts_usec;
+  int32_t status;
+  uint32_t length;
+  uint32_t captured_length;
+  uint8_t setup[8];
+  int32_t interval;
+  int32_t start_frame;
+  uint32_t transfer_flags;
+  uint32_t descriptor_count;
+};
+
+struct PcapWriterOptions {
+  // Start a new file once the current one exceeds this many bytes. 0 disables
+  // rotation.
+  size_t rotate_size = 0;
+  // Packets which arrive while this many bytes are already waiting to be
+  // written are dropped rather than letting the buffer grow without bound.
+  size_t max_pending = 16 << 20;
+};
+
+class PcapWriter {
+ public:
+  // Creates a writer which starts by writing to |path|. Returns nullptr if the
+  // file could not be created.
+  static std::unique_ptr<PcapWriter> Create(const std::string& path,
+                                            const PcapWriterOptions& options);
+
+  // Flushes every pending packet before returning.
+  ~PcapWriter();
+
+  PcapWriter(const PcapWriter&) = delete;
+  PcapWriter& operator=(const PcapWriter&) = delete;
+
+  // |request| is in host byte order. |data| is the OUT payload, if any.
+  void WriteSubmit(const USBIP_CMD_SUBMIT& request, const char* data,
+                   size_t data_size);
+
+  // |data| is the IN payload, if any; OUT completions only report
+  // |actual_length|.
+  void WriteComplete(const USBIP_CMD_SUBMIT& request, int status,
+                     const char* data, size_t actual_length);
+
+  // Records the completion of the URB which |request| unlinked.
+  void WriteUnlink(const USBIP_CMD_UNLINK& request, int status);
+
+  // Number of packets which were dropped because the writer fell behind.
+  uint64_t dropped() const;
+
+ private:
+  PcapWriter(const std::string& path, const PcapWriterOptions& options);
+
+  // Opens the next file in the rotation and writes the section and interface
+  // blocks to it.
+  bool OpenFile();
+
+  // Appends an enhanced packet block to the pending buffer.
+  void WritePacket(const UsbmonPacket& header, const char* data,
+                   size_t data_size);
+
+  // Body of the background thread.
+  void Run();
+
+  // Writes |size| bytes to the current file, rotating it first if needed.
+  void WriteToFile(const char* data, size_t size);
+
+  const std::string path_;
+  const PcapWriterOptions options_;
+  int fd_;
+  int file_index_;
+  size_t file_size_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<char> pending_;
+  uint64_t dropped_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+// Returns the writer which the protocol handlers write to, or nullptr if
+// capture is disabled.
+PcapWriter* GetPcapWriter();
+
+// Installs |writer| as the process-wide writer. Ownership is not taken.
+void SetPcapWriter(PcapWriter* writer);
+
+#endif  // __USBIP_PCAP_WRITER_H__
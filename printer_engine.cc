@@ -0,0 +1,129 @@
+#include "printer_engine.h"
+
+#include "usbip-constants.h"
+
+#include <cmath>
+#include <cstdint>
+
+PrinterEngine::PrinterEngine()
+    : bytes_per_second_(0),
+      buffered_(0),
+      last_update_ns_(0),
+      stalled_until_ns_(0),
+      paper_out_(false),
+      error_(false),
+      random_(1),
+      spike_distribution_(0.0, 1.0) {}
+
+void PrinterEngine::Configure(const PrinterEngineOptions& options) {
+  options_ = options;
+  if (options_.pages_per_minute > 0) {
+    bytes_per_second_ =
+        options_.pages_per_minute * options_.bytes_per_page / 60.0;
+  } else {
+    bytes_per_second_ = options_.bytes_per_second;
+  }
+}
+
+void PrinterEngine::Reset(uint64_t now_ns) {
+  buffered_ = 0;
+  last_update_ns_ = now_ns;
+  stalled_until_ns_ = 0;
+  paper_out_ = false;
+  error_ = false;
+}
+
+void PrinterEngine::Flush(uint64_t now_ns) {
+  buffered_ = 0;
+  last_update_ns_ = now_ns;
+}
+
+size_t PrinterEngine::Accept(size_t size, uint64_t now_ns) {
+  if (unlimited()) {
+    return size;
+  }
+  Advance(now_ns);
+  double space = options_.buffer_size - buffered_;
+  size_t accepted = space < size ? static_cast<size_t>(space) : size;
+  if (accepted == 0) {
+    return 0;
+  }
+  buffered_ += accepted;
+
+  if (options_.spike_probability > 0 &&
+      spike_distribution_(random_) < options_.spike_probability) {
+    InjectStall(options_.spike_duration_ns, now_ns);
+  }
+  return accepted;
+}
+
+uint64_t PrinterEngine::DelayUntilSpace(size_t size, uint64_t now_ns) {
+  if (unlimited()) {
+    return 0;
+  }
+  if (!consuming()) {
+    return UINT64_MAX;
+  }
+  Advance(now_ns);
+  if (size > options_.buffer_size) {
+    size = options_.buffer_size;
+  }
+  double excess = buffered_ + size - options_.buffer_size;
+  if (excess <= 0) {
+    return 0;
+  }
+  uint64_t stall = stalled_until_ns_ > now_ns ? stalled_until_ns_ - now_ns : 0;
+  return stall + static_cast<uint64_t>(
+                     std::ceil(excess / bytes_per_second_ * 1e9));
+}
+
+void PrinterEngine::InjectStall(uint64_t duration_ns, uint64_t now_ns) {
+  Advance(now_ns);
+  uint64_t until = now_ns + duration_ns;
+  if (until > stalled_until_ns_) {
+    stalled_until_ns_ = until;
+  }
+}
+
+void PrinterEngine::SetPaperOut(bool paper_out, uint64_t now_ns) {
+  Advance(now_ns);
+  paper_out_ = paper_out;
+}
+
+void PrinterEngine::SetError(bool error, uint64_t now_ns) {
+  Advance(now_ns);
+  error_ = error;
+}
+
+byte PrinterEngine::PortStatus(uint64_t now_ns) {
+  byte status = 0;
+  if (!error_) {
+    status |= PORT_STATUS_NOT_ERROR;
+  }
+  if (paper_out_) {
+    status |= PORT_STATUS_PAPER_EMPTY;
+  }
+  Advance(now_ns);
+  bool busy = !unlimited() && buffered_ >= options_.buffer_size;
+  if (!busy && !paper_out_ && !error_) {
+    status |= PORT_STATUS_SELECT;
+  }
+  return status;
+}
+
+void PrinterEngine::Advance(uint64_t now_ns) {
+  if (now_ns <= last_update_ns_) {
+    return;
+  }
+  uint64_t start = last_update_ns_;
+  if (stalled_until_ns_ > start) {
+    start = stalled_until_ns_;
+  }
+  if (consuming() && !unlimited() && now_ns > start) {
+    buffered_ -= (now_ns - start) * bytes_per_second_ / 1e9;
+    if (buffered_ < 0) {
+      buffered_ = 0;
+    }
+  }
+  last_update_ns_ = now_ns;
+}
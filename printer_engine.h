@@ -0,0 +1,88 @@
+#ifndef __USBIP_PRINTER_ENGINE_H__
+#define __USBIP_PRINTER_ENGINE_H__
+
+#include "usbip-constants.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+// Parameters of the printer engine performance model.
+struct PrinterEngineOptions {
+  // Rate at which the engine consumes data from its buffer. Zero means data is
+  // consumed as fast as it arrives. If |pages_per_minute| is set it takes
+  // precedence and the rate is derived from it and |bytes_per_page|.
+  double bytes_per_second = 0;
+  double pages_per_minute = 0;
+  size_t bytes_per_page = 512 * 1024;
+
+  // Size of the device-side buffer which bulk OUT data is accepted into.
+  size_t buffer_size = 256 * 1024;
+
+  // Probability that accepting a chunk of data triggers a stall of
+  // |spike_duration_ns|, during which the engine consumes nothing.
+  double spike_probability = 0;
+  uint64_t spike_duration_ns = 0;
+};
+
+// Models the throughput of a physical print engine. Bulk OUT data is accepted
+// into a finite buffer which drains at a fixed rate, so a host which sends
+// faster than the engine prints sees its URBs complete at the pace of a real
+// device. The model is driven entirely by the timestamps passed to it.
+class PrinterEngine {
+ public:
+  PrinterEngine();
+
+  void Configure(const PrinterEngineOptions& options);
+
+  // Returns true if the engine accepts data as fast as it arrives.
+  bool unlimited() const { return bytes_per_second_ <= 0; }
+
+  // Empties the buffer and clears any stall or fault.
+  void Reset(uint64_t now_ns);
+
+  // Empties the buffer but keeps any stall, paper-out or error condition, as
+  // they were injected from outside rather than caused by the host.
+  void Flush(uint64_t now_ns);
+
+  // Accepts as much of |size| bytes as fits into the buffer at |now_ns| and
+  // returns the number of bytes accepted.
+  size_t Accept(size_t size, uint64_t now_ns);
+
+  // Returns how long after |now_ns| the buffer will have room for |size|
+  // bytes, or UINT64_MAX if the engine is not consuming data.
+  uint64_t DelayUntilSpace(size_t size, uint64_t now_ns);
+
+  // Stops the engine from consuming data for |duration_ns| after |now_ns|.
+  void InjectStall(uint64_t duration_ns, uint64_t now_ns);
+
+  // Set or clear the paper-out and error conditions at |now_ns|. The engine
+  // stops consuming data while either one is present.
+  void SetPaperOut(bool paper_out, uint64_t now_ns);
+  void SetError(bool error, uint64_t now_ns);
+
+  // Returns the GET_PORT_STATUS byte for the engine at |now_ns|. The printer
+  // class has no busy bit, so a full buffer is reported by clearing the select
+  // bit in the same way a printer which is temporarily offline would.
+  byte PortStatus(uint64_t now_ns);
+
+  size_t buffered() const { return static_cast<size_t>(buffered_); }
+
+ private:
+  // Drains the buffer for the time which has passed up to |now_ns|.
+  void Advance(uint64_t now_ns);
+
+  bool consuming() const { return !paper_out_ && !error_; }
+
+  PrinterEngineOptions options_;
+  double bytes_per_second_;
+  double buffered_;
+  uint64_t last_update_ns_;
+  uint64_t stalled_until_ns_;
+  bool paper_out_;
+  bool error_;
+  std::minstd_rand random_;
+  std::uniform_real_distribution<double> spike_distribution_;
+};
+
+#endif  // __USBIP_PRINTER_ENGINE_H__
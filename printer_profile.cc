@@ -0,0 +1,121 @@
+#include "printer_profile.h"
+
+#include "printer_engine.h"
+#include "usb_device.h"
+
+#include <fstream>
+#include <string>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Parses all of |text| as an unsigned number in any base strtoull accepts.
+bool ParseNumber(const std::string& text, unsigned long long* value) {
+  if (text.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  errno = 0;
+  *value = strtoull(text.c_str(), &end, 0);
+  return errno == 0 && *end == '\0';
+}
+
+bool ParseDouble(const std::string& text, double* value) {
+  if (text.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  *value = strtod(text.c_str(), &end);
+  return *end == '\0' && *value >= 0;
+}
+
+// Applies a single |key| of a profile file to |profile|.
+bool ApplyProfileValue(const std::string& key, const std::string& value,
+                       PrinterProfile* profile) {
+  PrinterEngineOptions* engine = &profile->engine;
+  unsigned long long number = 0;
+  if (key == "vendor_id" || key == "product_id") {
+    if (!ParseNumber(value, &number) || number > 0xFFFF) {
+      return false;
+    }
+    (key == "vendor_id" ? profile->vendor_id : profile->product_id) = number;
+  } else if (key == "manufacturer") {
+    profile->manufacturer = value;
+  } else if (key == "product") {
+    profile->product = value;
+  } else if (key == "serial") {
+    profile->serial = value;
+  } else if (key == "device_id") {
+    profile->device_id = value;
+  } else if (key == "speed") {
+    return ParseUsbSpeed(value.c_str(), &profile->speed);
+  } else if (key == "max_transfer_size") {
+    if (!ParseNumber(value, &number) || number == 0) {
+      return false;
+    }
+    profile->max_transfer_size = number;
+  } else if (key == "bytes_per_second") {
+    return ParseDouble(value, &engine->bytes_per_second);
+  } else if (key == "pages_per_minute") {
+    return ParseDouble(value, &engine->pages_per_minute);
+  } else if (key == "bytes_per_page" || key == "buffer_size") {
+    if (!ParseNumber(value, &number)) {
+      return false;
+    }
+    (key == "bytes_per_page" ? engine->bytes_per_page : engine->buffer_size) =
+        number;
+  } else if (key == "spike_probability") {
+    return ParseDouble(value, &engine->spike_probability);
+  } else if (key == "spike_ms") {
+    if (!ParseNumber(value, &number)) {
+      return false;
+    }
+    engine->spike_duration_ns = number * 1000000ull;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool LoadPrinterProfile(const char* path, PrinterProfile* profile) {
+  std::ifstream file(path);
+  if (!file) {
+    printf("open %s error : %s\n", path, strerror(errno));
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    ++line_number;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t equals = line.find('=');
+    if (equals == std::string::npos ||
+        !ApplyProfileValue(line.substr(0, equals), line.substr(equals + 1),
+                           profile)) {
+      printf("%s:%d: invalid profile entry\n", path, line_number);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseUsbSpeed(const char* name, UsbSpeed* speed) {
+  if (strcmp(name, "full") == 0) {
+    *speed = UsbSpeed::kFull;
+  } else if (strcmp(name, "high") == 0) {
+    *speed = UsbSpeed::kHigh;
+  } else if (strcmp(name, "super") == 0) {
+    *speed = UsbSpeed::kSuper;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __USBIP_PRINTER_PROFILE_H__
+#define __USBIP_PRINTER_PROFILE_H__
+
+#include "printer_engine.h"
+#include "usb_device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Everything which distinguishes one emulated printer model from another. The
+// defaults describe the printer which the server has always emulated.
+struct PrinterProfile {
+  uint16_t vendor_id = 0x04a9;
+  uint16_t product_id = 0x27e8;
+  std::string manufacturer = "DavieV";
+  std::string product = "Virtual USB Printer";
+  // When empty the manufacturer string doubles as the serial number.
+  std::string serial;
+  // IEEE 1284 device ID returned by GET_DEVICE_ID, without the length prefix.
+  std::string device_id = "MFG:DV3;CMD:PDF;MDL:VTL;";
+  UsbSpeed speed = UsbSpeed::kFull;
+  // Largest payload which the host may send with one bulk OUT URB.
+  size_t max_transfer_size = kDefaultMaxTransferSize;
+  PrinterEngineOptions engine;
+};
+
+// Reads the profile stored at |path| over the values already in |profile|.
+//
+// The file holds one "key=value" pair per line; blank lines and lines starting
+// with '#' are ignored. The keys are vendor_id, product_id, manufacturer,
+// product, serial, device_id, speed (full, high or super), max_transfer_size
+// and the engine parameters bytes_per_second, pages_per_minute,
+// bytes_per_page, buffer_size, spike_probability and spike_ms. Returns false
+// if the file could not be read or contains an unknown key or a malformed
+// value.
+bool LoadPrinterProfile(const char* path, PrinterProfile* profile);
+
+// Parses |name| as a UsbSpeed. Returns false if it is not one of "full", "high"
+// or "super".
+bool ParseUsbSpeed(const char* name, UsbSpeed* speed);
+
+#endif  // __USBIP_PRINTER_PROFILE_H__
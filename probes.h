@@ -0,0 +1,63 @@
+#ifndef __USBIP_PROBES_H__
+#define __USBIP_PROBES_H__
+
+// Static tracepoints (USDT) on the URB path, for measuring latency in a
+// running server with bpftrace or SystemTap, for example:
+//
+//   bpftrace -e 'usdt:./main:usbip:urb_dispatch { @start[arg0] = nsecs; }
+//                usdt:./main:usbip:urb_complete /@start[arg0]/ {
+//                  @latency = hist(nsecs - @start[arg0]);
+//                  delete(@start[arg0]); }'
+//
+// Each probe compiles to a single nop plus an ELF note describing where its
+// arguments live; the nop is only patched into a trap while a tracer is
+// attached, so idle probes cost nothing measurable. The probes need
+// systemtap's <sys/sdt.h> and are left out entirely when it is not
+// available or USBIP_NO_PROBES is defined.
+//
+// Probes of the "usbip" provider and their arguments:
+//
+//   urb_submit       seqnum, ep, direction, transfer_buffer_length
+//                    A USBIP_CMD_SUBMIT header has been received.
+//   urb_dispatch     seqnum, ep, direction, payload length
+//                    The URB is handed to its device.
+//   control_dispatch seqnum, bmRequestType, bRequest, wValue, wLength
+//                    A control URB is routed to its handler.
+//   urb_complete     seqnum, ep, direction, actual_length, status
+//                    USBIP_RET_SUBMIT is sent.
+//   urb_unlink       seqnum of the URB, 1 if it was still pending
+//                    A USBIP_CMD_UNLINK has been answered.
+//   session_attach   devnum, bus ID string
+//   session_detach   devnum, bus ID string
+
+#if !defined(USBIP_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define USBIP_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef USBIP_HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define USBIP_PROBE2(name, a1, a2) DTRACE_PROBE2(usbip, name, a1, a2)
+#define USBIP_PROBE4(name, a1, a2, a3, a4) \
+  DTRACE_PROBE4(usbip, name, a1, a2, a3, a4)
+#define USBIP_PROBE5(name, a1, a2, a3, a4, a5) \
+  DTRACE_PROBE5(usbip, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define USBIP_PROBE2(name, a1, a2) \
+  do {                             \
+  } while (0)
+#define USBIP_PROBE4(name, a1, a2, a3, a4) \
+  do {                                     \
+  } while (0)
+#define USBIP_PROBE5(name, a1, a2, a3, a4, a5) \
+  do {                                         \
+  } while (0)
+
+#endif  // USBIP_HAVE_PROBES
+
+#endif  // __USBIP_PROBES_H__
@@ -0,0 +1,304 @@
+// Microbenchmarks for the functions on the protocol's hot paths. Each
+// benchmark reports the time per operation along with the number of heap
+// allocations per operation.
+//
+// The per-request logging of the protocol handlers is turned off, so that
+// the handlers are timed rather than stdio.
+
+#include "buffer_pool.h"
+#include "default_printer.h"
+#include "device_registry.h"
+#include "event_loop.h"
+#include "session_manager.h"
+#include "transport.h"
+#include "usb_printer.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<uint64_t> g_allocations(0);
+
+// GET_DESCRIPTOR(CONFIGURATION) for up to 255 bytes.
+const long long kGetConfigurationSetup = 0x800600020000FF00ll;
+// GET_DESCRIPTOR(STRING) for string 2 in US English, up to 255 bytes.
+const long long kGetStringSetup = 0x800602030904FF00ll;
+// GET_DESCRIPTOR(DEVICE) for the 18 bytes of the descriptor.
+const long long kGetDeviceSetup = 0x8006000100001200ll;
+
+// Reports the allocations made since |start| as a per-iteration counter.
+void ReportAllocations(benchmark::State& state, uint64_t start) {
+  state.counters["allocs/op"] = benchmark::Counter(
+      static_cast<double>(g_allocations.load() - start),
+      benchmark::Counter::kAvgIterations);
+}
+
+USBIP_CMD_SUBMIT CreateControlRequest(long long setup) {
+  USBIP_CMD_SUBMIT request;
+  memset(&request, 0, sizeof(request));
+  request.command = COMMAND_USBIP_CMD_SUBMIT;
+  request.seqnum = 1;
+  request.devid = (1 << 16) | 2;
+  request.direction = 1;
+  request.ep = 0;
+  request.transfer_buffer_length = 255;
+  request.setup = setup;
+  return request;
+}
+
+void BM_CreateStandardDeviceRequest(benchmark::State& state) {
+  long long setup = kGetConfigurationSetup;
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(setup);
+    StandardDeviceRequest request = CreateStandardDeviceRequest(setup);
+    benchmark::DoNotOptimize(request);
+  }
+  ReportAllocations(state, start);
+}
+BENCHMARK(BM_CreateStandardDeviceRequest);
+
+// The command is copied into an int array, since the packed struct is not
+// aligned for the int accesses of pack_usbip().
+void BM_PackUsbip(benchmark::State& state) {
+  USBIP_CMD_SUBMIT command = CreateControlRequest(kGetConfigurationSetup);
+  int words[sizeof(command) / sizeof(int)];
+  memcpy(words, &command, sizeof(command));
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    pack_usbip(words, sizeof(words));
+    benchmark::ClobberMemory();
+  }
+  ReportAllocations(state, start);
+}
+BENCHMARK(BM_PackUsbip);
+
+void BM_UnpackUsbip(benchmark::State& state) {
+  USBIP_CMD_SUBMIT command = CreateControlRequest(kGetConfigurationSetup);
+  int words[sizeof(command) / sizeof(int)];
+  memcpy(words, &command, sizeof(command));
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    unpack_usbip(words, sizeof(words));
+    benchmark::ClobberMemory();
+  }
+  ReportAllocations(state, start);
+}
+BENCHMARK(BM_UnpackUsbip);
+
+void BM_CreateOpRepDevlist(benchmark::State& state) {
+  std::unique_ptr<UsbPrinter> printer = CreateDefaultPrinter();
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    OP_REP_DEVLIST list;
+    BufferPool::Buffer interface_storage;
+    create_op_rep_devlist(*printer, &interface_storage, &list);
+    benchmark::DoNotOptimize(list);
+  }
+  ReportAllocations(state, start);
+}
+BENCHMARK(BM_CreateOpRepDevlist);
+
+// The descriptor handlers are private to UsbDevice, so they are measured
+// through HandleUsbRequest(), which adds the control request dispatch. The
+// response is written to a MemoryTransport which is emptied every iteration.
+void RunControlRequest(benchmark::State& state, long long setup) {
+  std::unique_ptr<UsbPrinter> printer = CreateDefaultPrinter();
+  MemoryTransport transport;
+  USBIP_CMD_SUBMIT request = CreateControlRequest(setup);
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    printer->HandleUsbRequest(&transport, request, nullptr, 0);
+    transport.DiscardOutput();
+  }
+  ReportAllocations(state, start);
+}
+
+void BM_HandleGetConfigurationDescriptor(benchmark::State& state) {
+  RunControlRequest(state, kGetConfigurationSetup);
+}
+BENCHMARK(BM_HandleGetConfigurationDescriptor);
+
+void BM_HandleGetStringDescriptor(benchmark::State& state) {
+  RunControlRequest(state, kGetStringSetup);
+}
+BENCHMARK(BM_HandleGetStringDescriptor);
+
+// Sends a response carrying |state.range(0)| bytes of data into one end of a
+// socketpair. Draining the other end is part of the measured time, since the
+// socket would otherwise fill up.
+void BM_SendUsbRequest(benchmark::State& state) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  SocketTransport transport(fds[0]);
+  USBIP_CMD_SUBMIT request = CreateControlRequest(kGetConfigurationSetup);
+  std::vector<char> data(state.range(0), 0x55);
+  std::vector<char> sink(sizeof(USBIP_RET_SUBMIT) + data.size());
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    SendUsbRequest(&transport, request, data.data(), data.size(), 0);
+    size_t remaining = sink.size();
+    while (remaining > 0) {
+      ssize_t received = recv(fds[1], sink.data(), remaining, 0);
+      if (received <= 0) {
+        state.SkipWithError("recv failed");
+        break;
+      }
+      remaining -= received;
+    }
+  }
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * data.size());
+  close(fds[0]);
+  close(fds[1]);
+}
+BENCHMARK(BM_SendUsbRequest)->Arg(18)->Arg(512)->Arg(4096);
+
+// Receives exactly |size| bytes from |fd| into |data|.
+bool ReceiveAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+// Serves a printer to a session which starts out attached to it, as the
+// server does for the devices it attaches to the local vhci_hcd, and measures
+// a GET_DESCRIPTOR(DEVICE) round trip over the socketpair. This exercises the
+// attached session without needing the vhci_hcd module.
+void BM_AttachedSessionRoundTrip(benchmark::State& state) {
+  UsbDeviceRegistry devices;
+  UsbDevice* printer = devices.Add(CreateDefaultPrinter());
+  EventLoop loop;
+  SessionManager sessions(&loop, &devices, 1);
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  if (!sessions.OpenAttached(fds[0], printer)) {
+    close(fds[1]);
+    state.SkipWithError("OpenAttached failed");
+    return;
+  }
+  // Packed like the requests of BM_PackUsbip.
+  USBIP_CMD_SUBMIT request = CreateControlRequest(kGetDeviceSetup);
+  int words[sizeof(request) / sizeof(int)];
+  memcpy(words, &request, sizeof(request));
+  pack_usbip(words, sizeof(words));
+  int reply[sizeof(USBIP_RET_SUBMIT) / sizeof(int)];
+  char descriptor[sizeof(USB_DEVICE_DESCRIPTOR)];
+  uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    if (send(fds[1], words, sizeof(words), 0) !=
+        static_cast<ssize_t>(sizeof(words))) {
+      state.SkipWithError("send failed");
+      break;
+    }
+    loop.RunOnce(-1);
+    if (!ReceiveAll(fds[1], reply, sizeof(reply))) {
+      state.SkipWithError("recv failed");
+      break;
+    }
+    unpack_usbip(reply, sizeof(reply));
+    USBIP_RET_SUBMIT response;
+    memcpy(&response, reply, sizeof(response));
+    if (response.command != COMMAND_USBIP_RET_SUBMIT || response.status != 0 ||
+        response.actual_length != sizeof(descriptor) ||
+        !ReceiveAll(fds[1], descriptor, sizeof(descriptor))) {
+      state.SkipWithError("unexpected reply");
+      break;
+    }
+  }
+  ReportAllocations(state, start);
+  close(fds[1]);
+}
+BENCHMARK(BM_AttachedSessionRoundTrip);
+
+// Every allocation made through operator new is counted, which covers the
+// standard containers used by the protocol stack. BufferPool arenas are
+// mmap'd and so are not counted.
+//
+// The replacements below all go through these two. They are kept out of line
+// so that GCC, once it inlines a replacement, does not see a pointer from
+// malloc() reach an operator delete and report a mismatch.
+__attribute__((noinline)) void* Allocate(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size);
+}
+
+__attribute__((noinline)) void Deallocate(void* pointer) {
+  std::free(pointer);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  void* pointer = Allocate(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void* pointer) noexcept { Deallocate(pointer); }
+
+void operator delete(void* pointer, size_t size) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept { Deallocate(pointer); }
+
+void operator delete[](void* pointer, size_t size) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+int main(int argc, char* argv[]) {
+  SetRequestLogging(false);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
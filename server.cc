@@ -1,10 +1,30 @@
+#include "server.h"
+
+#include "control_server.h"
 #include "usbip.h"
 #include "usbip-constants.h"
 #include "device_descriptors.h"
+#include "device_registry.h"
+#include "device_thread.h"
+#include "event_loop.h"
+#include "job_processor.h"
+#include "session_manager.h"
+#include "startup.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "usb_device.h"
 #include "usb_printer.h"
+#include "vhci_host.h"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -49,16 +69,19 @@ struct sockaddr_in bind_server_socket(int fd) {
 int accept_connection(int fd) {
   struct sockaddr_in client;
   socklen_t client_length = sizeof(client);
-  int connection = accept(fd, (struct sockaddr *)&client, &client_length);
+  int connection = accept4(fd, (struct sockaddr *)&client, &client_length,
+                           SOCK_CLOEXEC);
   if (connection < 0) {
+    // The client may have given up before it was accepted, which is no reason
+    // to stop serving everyone else.
     printf("accept error : %s\n", strerror(errno));
-    exit(1);
+    return -1;
   }
   printf("Connection address:%s\n", inet_ntoa(client.sin_addr));
   return connection;
 }
 
-void run_server(UsbPrinter printer) {
+void run_server(UsbDeviceRegistry* devices, const ServerOptions& options) {
   int listenfd = setup_server_socket();
   struct sockaddr_in server = bind_server_socket(listenfd);
   char address[INET_ADDRSTRLEN];
@@ -74,82 +97,133 @@ void run_server(UsbPrinter printer) {
     printf("listen error : %s\n", strerror(errno));
     exit(1);
   }
+  if (options.startup != nullptr) {
+    options.startup->Mark("listen");
+  }
 
-  while (1) {
-    int connection = accept_connection(listenfd);
-    int attached = 0;
-
-    while (1) {
-      if (!attached) {
-        // Read in the header first in order to determine whether the request is
-        // an OP_REQ_DEVLIST or an OP_REQ_IMPORT.
-        OP_HEADER request;
-        ssize_t received = recv(connection, &request, sizeof(request), 0);
-        if (received != sizeof(request)) {
-          printf("receive error : %s\n", strerror (errno));
-          break;
-        }
-
-        request.command = ntohs(request.command);
-        printf("Header Packet\n");
-        printf("command: 0x%02X\n", request.command);
-
-        // Request is OP_REQ_DEVLIST 
-        if (request.command == OP_REQ_DEVLIST_CMD) {
-          handle_device_list(printer, connection);
-        // Request is OP_REQ_IMPORT
-        } else if (request.command == OP_REQ_IMPORT_CMD) {
-          if (!handle_attach(printer, connection)) {
-            attached = 1;
+  EventLoop loop;
+  // Declared ahead of the device threads, which may end jobs as they stop.
+  std::unique_ptr<JobProcessor> job_processor;
+  if (!options.post_job_stages.empty()) {
+    int threads = options.post_job_threads > 0
+                      ? options.post_job_threads
+                      : std::thread::hardware_concurrency();
+    job_processor = JobProcessor::Create(options.post_job_stages, threads);
+    if (!job_processor) {
+      exit(1);
+    }
+    job_processor->SetResultCallback(
+        &loop, [devices](const CompletedJob& job,
+                         const std::vector<JobStageResult>& results) {
+          // The printer may have been unplugged while the job was processed,
+          // and another plugged in at its place.
+          UsbPrinter* printer =
+              dynamic_cast<UsbPrinter*>(devices->Find(job.bus_id.c_str()));
+          if (printer == nullptr ||
+              printer->generation() != job.printer_generation) {
+            return;
           }
-        }
-      } else {
-        printf("------------------------------------------------\n");
-        printf("handles requests\n");
-        USBIP_CMD_SUBMIT command;
-        ssize_t received = recv(connection, &command, sizeof(command), 0);
-        if (received != sizeof(command)) {
-          printf("receive error : %s\n", strerror(errno));
-          break;
-        }
-
-        unpack_usbip((int *)&command, sizeof(command));
-        print_usbip_cmd_submit(command);
-
-        if (command.command == 1) {
-          printer.HandleUsbRequest(connection, command);
-        }
-
-        // Unlink URB
-        if (command.command == 2) {
-          printf("####################### Unlink URB %u  (not working!!!)\n",
-                 command.transfer_flags);
-          // FIXME
-          /*
-           USBIP_RET_UNLINK ret;
-           printf("####################### Unlink URB %u\n",cmd.transfer_flags);
-           ret.command=htonl(0x04);
-           ret.devid=htonl(cmd.devid);
-           ret.direction=htonl(cmd.direction);
-           ret.ep=htonl(cmd.ep);
-           ret.seqnum=htonl(cmd.seqnum);
-           ret.status=htonl(1);
-
-           if (send (sockfd, (char *)&ret, sizeof(USBIP_RET_UNLINK), 0) !=
-           sizeof(USBIP_RET_UNLINK))
-           {
-             printf ("send error : %s \n", strerror (errno));
-             exit(-1);
-           }
-          */
-        }
-
-        if (command.command > 2) {
-          printf("Unknown USBIP cmd!\n");
-          close(connection);
-          return;
-        }
-      }
+          int id = job.id;
+          PostToDeviceThread(printer, [printer, id, results]() {
+            printer->SetJobResults(id, results);
+          });
+        });
+  }
+  // Declared ahead of the sessions, which detach their devices on the
+  // threads when they are destroyed.
+  std::vector<std::unique_ptr<DeviceThread>> device_threads;
+  SessionManager sessions(&loop, devices, options.max_sessions);
+  sessions.SetZeroCopyThreshold(options.zerocopy_threshold);
+  TimerWheel timer_wheel(&loop);
+  for (int i = 0; i < options.device_threads; ++i) {
+    std::unique_ptr<DeviceThread> thread = DeviceThread::Create(
+        &loop, [&sessions](uint64_t session, const char* data, size_t size) {
+          sessions.Deliver(session, data, size);
+        });
+    if (!thread) {
+      exit(1);
+    }
+    device_threads.push_back(std::move(thread));
+  }
+  std::unique_ptr<VhciHost> vhci;
+  if (options.vhci_path != nullptr) {
+    vhci = VhciHost::Create(options.vhci_path);
+    if (!vhci) {
+      printf("vhci_hcd is not available, serving clients over TCP only\n");
+    }
+  }
+  // Serves |device| on one end of a socketpair and hands the other end to
+  // vhci_hcd, as `usbip attach` would after importing the device.
+  auto attach_locally = [&](UsbDevice* device) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+      printf("socketpair error : %s\n", strerror(errno));
+      return;
+    }
+    if (!sessions.OpenAttached(fds[0], device)) {
+      close(fds[1]);
+      return;
+    }
+    if (vhci->Attach(fds[1], *device) < 0) {
+      sessions.CloseSessionsUsing(device);
+    }
+    close(fds[1]);
+  };
+  size_t next_device_thread = 0;
+  auto add_device = [&](UsbDevice* device) {
+    UsbPrinter* printer = dynamic_cast<UsbPrinter*>(device);
+    if (printer != nullptr && job_processor) {
+      JobProcessor* processor = job_processor.get();
+      printer->SetJobCallback(
+          [processor](const CompletedJob& job) { processor->Submit(job); });
+    }
+    if (!device_threads.empty()) {
+      device_threads[next_device_thread++ % device_threads.size()]->AddDevice(
+          device);
+    } else {
+      device->SetEventLoop(&loop);
+      device->SetTimerWheel(&timer_wheel);
+    }
+    if (vhci) {
+      attach_locally(device);
+    }
+  };
+  // Unplugging a device disconnects the client which imported it, as the
+  // host sees the device disappear from its port.
+  auto remove_device = [&](UsbDevice* device) {
+    sessions.CloseSessionsUsing(device);
+    // The device must be detached before the registry destroys it.
+    RunOnDeviceThread(device, []() {});
+  };
+  for (const auto& device : devices->devices()) {
+    add_device(device.get());
+  }
+
+  std::unique_ptr<ControlServer> control;
+  if (options.control_path != nullptr) {
+    control = ControlServer::Create(options.control_path, &loop, devices,
+                                    options.printer_factory,
+                                    options.printer_profile);
+    if (!control) {
+      exit(1);
+    }
+    control->SetDeviceCallbacks(add_device, remove_device);
+    printf("Control socket listening on %s\n", options.control_path);
+  }
+
+  loop.Add(listenfd, EPOLLIN, [&](uint32_t events) {
+    int fd = accept_connection(listenfd);
+    if (fd >= 0) {
+      sessions.Open(fd);
     }
+  });
+
+  // Clients which connect before the loop runs wait in the listen backlog, so
+  // the launcher can be told now rather than after the first poll.
+  NotifyReady(options.ready_fd);
+  if (options.startup != nullptr) {
+    options.startup->Mark("ready");
+    options.startup->Print();
   }
+  loop.Run();
 }
@@ -1,4 +1,10 @@
-#include "usb_printer.h"
+#include "default_printer.h"
+#include "device_registry.h"
+#include "job_processor.h"
+#include "printer_profile.h"
+#include "startup.h"
+
+#include <vector>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -22,8 +28,47 @@ int setup_server_socket();
 struct sockaddr_in bind_server_socket(int fd);
 
 // Accepts a new connection to the server described by |fd| and returns the file
-// descriptor of the connection.
+// descriptor of the connection, or -1 if accepting failed.
 int accept_connection(int fd);
 
-// Runs a simple server which processes USBIP requests.
-void run_server(UsbPrinter printer);
+// Settings of the server which are not tied to one device.
+struct ServerOptions {
+  // Path of the control socket, or nullptr to run without one. See
+  // ControlServer.
+  const char* control_path = nullptr;
+  // Printers added through the control socket start from this profile and are
+  // created by |printer_factory|, which must be set along with
+  // |control_path|.
+  PrinterProfile printer_profile;
+  PrinterFactory* printer_factory = nullptr;
+  // Number of clients which can be connected at the same time. Further
+  // connections are refused.
+  int max_sessions = 64;
+  // Number of threads which emulate the devices, which are spread over them.
+  // With 0 the devices run on the thread which serves the sockets. See
+  // DeviceThread.
+  int device_threads = 0;
+  // Stages which every print job is put through once it has been spooled,
+  // attaching the results to the printer's record of the job. Empty to skip
+  // post-processing. See JobProcessor.
+  std::vector<JobStage> post_job_stages;
+  // Number of threads which run the stages, or 0 for one per core.
+  int post_job_threads = 0;
+  // Sysfs directory of a vhci_hcd controller to plug every device into, or
+  // nullptr to only serve clients which connect over TCP. The server carries
+  // on over TCP alone if the controller is missing. See VhciHost.
+  const char* vhci_path = nullptr;
+  // Replies of at least this many bytes are sent with MSG_ZEROCOPY, or none
+  // if 0. Replies which devices send from a DeviceThread are always copied.
+  size_t zerocopy_threshold = 0;
+  // Descriptor which readiness is reported on, or -1. See NotifyReady().
+  int ready_fd = -1;
+  // If set, the phases of the server's startup are added to it and the
+  // breakdown is printed once the server is ready.
+  StartupTimer* startup = nullptr;
+};
+
+// Runs a simple server which exports every device in |devices| and processes
+// USBIP requests for them. Readiness is reported as soon as the sockets are
+// listening, so the devices must be fully prepared before this is called.
+void run_server(UsbDeviceRegistry* devices, const ServerOptions& options);
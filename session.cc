@@ -0,0 +1,322 @@
+#include "session.h"
+
+#include "device_registry.h"
+#include "device_thread.h"
+#include "enumeration_timeline.h"
+#include "monotonic_clock.h"
+#include "pcap_writer.h"
+#include "probes.h"
+#include "transport.h"
+#include "urb_trace.h"
+#include "usb_device.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <arpa/inet.h>
+
+#include <memory>
+#include <string>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+Session::Session(UsbDeviceRegistry* devices, Transport* transport)
+    : devices_(devices),
+      device_(nullptr),
+      transport_(transport),
+      id_(0),
+      phase_(Phase::kHandshake),
+      await_buffer_(nullptr),
+      await_spool_(nullptr),
+      await_size_(0),
+      await_received_(0) {
+  Await(&op_header_, sizeof(op_header_), Phase::kHandshake);
+}
+
+void Session::Reset() {
+  Close();
+  if (GetEnumerationProfiler() != nullptr) {
+    timeline_.reset(new EnumerationTimeline(MonotonicNanos()));
+  }
+  Await(&op_header_, sizeof(op_header_), Phase::kHandshake);
+}
+
+bool Session::OnReadable() {
+  // A client which is not reading its replies gets no further requests read
+  // from it until it has caught up.
+  while (phase_ != Phase::kClosed && !transport_->failed() &&
+         !transport_->congested() && Fill()) {
+    switch (phase_) {
+      case Phase::kHandshake:
+        OnHandshake();
+        break;
+      case Phase::kImport:
+        OnImport();
+        break;
+      case Phase::kCommand:
+        OnCommand();
+        break;
+      case Phase::kPayload:
+        OnPayload();
+        break;
+      case Phase::kSpool:
+        OnSpool();
+        break;
+      case Phase::kClosed:
+        break;
+    }
+  }
+  if (transport_->failed() && phase_ != Phase::kClosed) {
+    printf("closing session after a send error\n");
+    Close();
+  }
+  return phase_ != Phase::kClosed;
+}
+
+void Session::Await(void* buffer, size_t size, Phase phase) {
+  await_buffer_ = static_cast<char*>(buffer);
+  await_spool_ = nullptr;
+  await_size_ = size;
+  await_received_ = 0;
+  phase_ = phase;
+}
+
+void Session::AwaitSpool(Spool* spool, size_t size) {
+  Await(nullptr, size, Phase::kSpool);
+  await_spool_ = spool;
+}
+
+bool Session::Fill() {
+  while (await_received_ < await_size_) {
+    size_t remaining = await_size_ - await_received_;
+    ssize_t received =
+        await_spool_ != nullptr
+            ? transport_->ReceiveToSpool(await_spool_, remaining)
+            : transport_->Receive(await_buffer_ + await_received_, remaining);
+    if (received > 0) {
+      await_received_ += received;
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return false;
+    }
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received == 0) {
+      printf("connection closed by client\n");
+    } else {
+      printf("receive error : %s\n", strerror(errno));
+    }
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void Session::OnHandshake() {
+  // Read in the header first in order to determine whether the request is an
+  // OP_REQ_DEVLIST or an OP_REQ_IMPORT.
+  word command = ntohs(op_header_.command);
+  LogRequest("Header Packet\n");
+  LogRequest("command: 0x%02X\n", command);
+
+  if (command == OP_REQ_DEVLIST_CMD) {
+    handle_device_list(*devices_, transport_);
+    Await(&op_header_, sizeof(op_header_), Phase::kHandshake);
+  } else if (command == OP_REQ_IMPORT_CMD) {
+    Await(bus_id_, sizeof(bus_id_), Phase::kImport);
+  } else {
+    printf("Unknown OP command 0x%02X\n", command);
+    Close();
+  }
+}
+
+void Session::OnImport() {
+  if (timeline_) {
+    timeline_->BeginStep();
+  }
+  UsbDevice* device = devices_->Find(bus_id_);
+  if (device != nullptr && device->attached()) {
+    printf("device %.32s is already imported\n", bus_id_);
+    device = nullptr;
+  }
+  int refused = handle_attach(device, bus_id_, transport_);
+  if (timeline_) {
+    timeline_->EndStep("OP_REQ_IMPORT");
+  }
+  if (refused) {
+    FinishTimeline("refused");
+    Close();
+    return;
+  }
+  Attach(device);
+}
+
+bool Session::AttachDevice(UsbDevice* device) {
+  if (device->attached()) {
+    printf("device %s is already imported\n", device->bus_id());
+    Close();
+    return false;
+  }
+  Attach(device);
+  return true;
+}
+
+void Session::Attach(UsbDevice* device) {
+  device_ = device;
+  device_->Attach();
+  if (DeviceThread* thread = device_->device_thread()) {
+    thread->Attach(id_, device_);
+  }
+  USBIP_PROBE2(session_attach, device_->devnum(), device_->bus_id());
+  Await(&command_, sizeof(command_), Phase::kCommand);
+}
+
+void Session::OnCommand() {
+  LogRequest("------------------------------------------------\n");
+  LogRequest("handles requests\n");
+  unpack_usbip((int*)&command_, sizeof(command_));
+  print_usbip_cmd_submit(command_);
+
+  if (command_.command == COMMAND_USBIP_CMD_SUBMIT) {
+    USBIP_PROBE4(urb_submit, command_.seqnum, command_.ep, command_.direction,
+                 command_.transfer_buffer_length);
+    // OUT transfers are followed by |transfer_buffer_length| bytes of data
+    // which must be read before the request can be handled.
+    if (command_.direction == 0 && command_.transfer_buffer_length > 0) {
+      // The payload cannot be skipped without reading it, so a client which
+      // sends one that is too big, or which cannot be stored, is cut off.
+      size_t payload_size = command_.transfer_buffer_length;
+      if (payload_size > device_->MaxPayloadSize(command_)) {
+        printf("URB %d carries %zu bytes, more than %s accepts\n",
+               command_.seqnum, payload_size, device_->bus_id());
+        Close();
+        return;
+      }
+      // Payloads bound for a spool bypass user space altogether.
+      if (Spool* spool = device_->SpoolFor(command_)) {
+        AwaitSpool(spool, command_.transfer_buffer_length);
+        return;
+      }
+      payload_ = BufferPool::ForCurrentThread()->Acquire(payload_size);
+      if (payload_.empty()) {
+        printf("no buffer for the %zu byte payload of URB %d\n", payload_size,
+               command_.seqnum);
+        Close();
+        return;
+      }
+      Await(payload_.data(), payload_.size(), Phase::kPayload);
+      return;
+    }
+    DispatchCommand(nullptr, 0);
+    return;
+  }
+
+  if (command_.command == COMMAND_USBIP_CMD_UNLINK) {
+    // USBIP_CMD_UNLINK shares its leading fields with USBIP_CMD_SUBMIT.
+    const USBIP_CMD_UNLINK& unlink =
+        *reinterpret_cast<const USBIP_CMD_UNLINK*>(&command_);
+    printf("Unlink URB %d\n", unlink.seqnum_urb);
+    if (UrbTraceRecorder* trace = GetUrbTraceRecorder()) {
+      trace->RecordCmdUnlink(unlink);
+    }
+    if (DeviceThread* thread = device_->device_thread()) {
+      thread->Unlink(id_, device_, unlink);
+    } else {
+      bool unlinked = device_->UnlinkUrb(unlink.seqnum_urb);
+      USBIP_PROBE2(urb_unlink, unlink.seqnum_urb, unlinked);
+      SendUnlinkResponse(transport_, unlink, unlinked ? -ECONNRESET : 0);
+    }
+    Await(&command_, sizeof(command_), Phase::kCommand);
+    return;
+  }
+
+  printf("Unknown USBIP cmd!\n");
+  Close();
+}
+
+void Session::OnPayload() {
+  DispatchCommand(payload_.data(), payload_.size());
+}
+
+void Session::OnSpool() {
+  DispatchCommand(nullptr, command_.transfer_buffer_length);
+}
+
+void Session::DispatchCommand(const char* data, unsigned int data_size) {
+  // Spooled payloads never pass through user space, so only their headers are
+  // recorded.
+  unsigned int recorded_size = data != nullptr ? data_size : 0;
+  if (UrbTraceRecorder* trace = GetUrbTraceRecorder()) {
+    trace->RecordCmdSubmit(command_, data, recorded_size);
+  }
+  if (PcapWriter* pcap = GetPcapWriter()) {
+    pcap->WriteSubmit(command_, data, recorded_size);
+  }
+  // Enumeration happens on the default control pipe, and is over once the
+  // driver which bound to the device moves data on its other endpoints.
+  bool enumerating = timeline_ && command_.ep == 0;
+  if (timeline_ && !enumerating) {
+    FinishTimeline("complete");
+  }
+  if (enumerating) {
+    timeline_->BeginStep();
+  }
+  if (DeviceThread* thread = device_->device_thread()) {
+    thread->Submit(id_, device_, command_, data, data_size);
+  } else {
+    device_->HandleUsbRequest(transport_, command_, data, data_size);
+  }
+  if (enumerating) {
+    timeline_->EndStep(DescribeControlRequest(
+        *device_, CreateStandardDeviceRequest(command_.setup)));
+    // A printer's driver asks for its device ID last when it binds.
+    if (timeline_->steps().back().name == "GET_DEVICE_ID") {
+      FinishTimeline("complete");
+    } else if (timeline_->full()) {
+      FinishTimeline("truncated");
+    }
+  }
+  payload_.Release();
+  Await(&command_, sizeof(command_), Phase::kCommand);
+}
+
+void Session::FinishTimeline(const char* outcome) {
+  if (!timeline_) {
+    return;
+  }
+  // Clients which only list the devices have nothing to report. Without a
+  // device, the only step is an OP_REQ_IMPORT which was refused.
+  EnumerationProfiler* profiler = GetEnumerationProfiler();
+  if (profiler != nullptr && !timeline_->steps().empty()) {
+    std::string bus_id =
+        device_ != nullptr ? std::string(device_->bus_id())
+                           : std::string(bus_id_, strnlen(bus_id_, 32));
+    timeline_->Finish(id_, bus_id, transport_->RoundTripNanos(), outcome);
+    profiler->Add(std::move(timeline_));
+  }
+  timeline_.reset();
+}
+
+void Session::Close() {
+  FinishTimeline("disconnected");
+  if (device_ != nullptr) {
+    USBIP_PROBE2(session_detach, device_->devnum(), device_->bus_id());
+    device_->Release();
+    if (DeviceThread* thread = device_->device_thread()) {
+      thread->Detach(id_, device_);
+    } else {
+      device_->Detach();
+    }
+    device_ = nullptr;
+  }
+  phase_ = Phase::kClosed;
+  // A payload which was still arriving is dropped along with the connection.
+  payload_.Release();
+  await_buffer_ = nullptr;
+  await_spool_ = nullptr;
+  await_size_ = 0;
+  await_received_ = 0;
+}
@@ -0,0 +1,133 @@
+#ifndef __USBIP_SESSION_H__
+#define __USBIP_SESSION_H__
+
+#include "buffer_pool.h"
+#include "spool.h"
+#include "device_registry.h"
+#include "enumeration_timeline.h"
+#include "transport.h"
+#include "usb_device.h"
+#include "usbip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Protocol state for a single usbip client connection.
+//
+// The session is written as a resumable state machine rather than a blocking
+// loop: each phase declares the next message it is waiting for, and
+// OnReadable() consumes whatever bytes the transport currently has available
+// before suspending until it is called again. This allows a single thread to
+// drive any number of sessions from an event loop.
+class Session {
+ public:
+  enum class Phase {
+    // Waiting for an OP_REQ_DEVLIST or OP_REQ_IMPORT header.
+    kHandshake,
+    // Waiting for the bus ID which follows an OP_REQ_IMPORT header.
+    kImport,
+    // Attached: waiting for the next USBIP_CMD_SUBMIT or USBIP_CMD_UNLINK.
+    kCommand,
+    // Attached: waiting for the OUT payload of the current USBIP_CMD_SUBMIT.
+    kPayload,
+    // Attached: moving the OUT payload of the current USBIP_CMD_SUBMIT into
+    // the device's spool.
+    kSpool,
+    // The connection has been closed or has failed.
+    kClosed,
+  };
+
+  // |devices| are the devices which the client may list and import.
+  Session(UsbDeviceRegistry* devices, Transport* transport);
+
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  // Processes all of the data which is currently available on the transport,
+  // or stops early once the transport is congested. Returns false once the
+  // session has been closed, which also happens when sending to the client
+  // has failed.
+  bool OnReadable();
+
+  // Closes the session if it is open and prepares it to serve a new
+  // connection on its transport from the start of the handshake. The
+  // connection is profiled if there is an EnumerationProfiler.
+  void Reset();
+
+  // Skips the handshake and serves |device| to a client which already
+  // considers it imported, such as the kernel's vhci_hcd when it is handed a
+  // socket directly. Returns false and closes the session if the device is
+  // imported by another client.
+  bool AttachDevice(UsbDevice* device);
+
+  Phase phase() const { return phase_; }
+
+  // The device imported by the client, or nullptr if none is attached.
+  UsbDevice* device() const { return device_; }
+
+  // Identifies the session to a DeviceThread, which tags the replies of the
+  // devices it runs with it.
+  void set_id(uint64_t id) { id_ = id; }
+
+  // Detaches the imported device and ends the session. The owner is
+  // responsible for closing the transport.
+  void Close();
+
+ private:
+  // Suspends the session until |size| bytes have been read into |buffer|, at
+  // which point the session resumes in |phase|.
+  void Await(void* buffer, size_t size, Phase phase);
+
+  // Suspends the session until |size| bytes have been moved from the
+  // transport into |spool|, at which point it resumes in Phase::kSpool.
+  void AwaitSpool(Spool* spool, size_t size);
+
+  // Reads from the transport until the current Await() has been satisfied.
+  // Returns false if no more data is available yet or the session closed.
+  bool Fill();
+
+  // Handlers which run when the message awaited by each phase has arrived.
+  void OnHandshake();
+  void OnImport();
+  void OnCommand();
+  void OnPayload();
+  void OnSpool();
+
+  // Starts serving URBs for |device|, which the client has imported.
+  void Attach(UsbDevice* device);
+
+  // Hands the current command and its payload to the device and begins waiting
+  // for the next command. |data| is null if the payload was spooled.
+  void DispatchCommand(const char* data, unsigned int data_size);
+
+  // Ends the enumeration timeline, if one is being recorded, and hands it to
+  // the profiler. |outcome| says how enumeration ended.
+  void FinishTimeline(const char* outcome);
+
+  UsbDeviceRegistry* devices_;
+  UsbDevice* device_;
+  Transport* transport_;
+  uint64_t id_;
+  Phase phase_;
+
+  // Destination of the read which the session is currently waiting on.
+  // Phase::kSpool reads into |await_spool_| instead.
+  char* await_buffer_;
+  Spool* await_spool_;
+  size_t await_size_;
+  size_t await_received_;
+
+  OP_HEADER op_header_;
+  char bus_id_[32];
+  USBIP_CMD_SUBMIT command_;
+  // Holds the OUT payload of |command_|. It is drawn from the thread's buffer
+  // pool and handed back once the command has been dispatched.
+  BufferPool::Buffer payload_;
+
+  // Steps of the client's enumeration of the device so far, while it is
+  // being profiled.
+  std::unique_ptr<EnumerationTimeline> timeline_;
+};
+
+#endif  // __USBIP_SESSION_H__
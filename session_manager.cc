@@ -0,0 +1,184 @@
+#include "session_manager.h"
+
+#include "buffer_pool.h"
+#include "device_registry.h"
+#include "event_loop.h"
+#include "session.h"
+#include "transport.h"
+#include "usb_device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+SessionManager::SessionManager(EventLoop* loop, UsbDeviceRegistry* devices,
+                               int capacity)
+    : loop_(loop) {
+  slots_.reserve(capacity);
+  free_slots_.reserve(capacity);
+  for (int i = 0; i < capacity; ++i) {
+    slots_.push_back(std::make_unique<Slot>(devices, i));
+    Slot* slot = slots_.back().get();
+    // Replies which are sent from timers can queue up outside of OnEvents().
+    slot->transport.SetQueueCallback([this, slot]() { UpdateEvents(slot); });
+  }
+  // Handing out the slots in order keeps the first ones warm.
+  for (int i = capacity - 1; i >= 0; --i) {
+    free_slots_.push_back(slots_[i].get());
+  }
+}
+
+SessionManager::~SessionManager() {
+  for (const auto& slot : slots_) {
+    if (slot->state != State::kFree) {
+      Close(slot.get());
+    }
+  }
+}
+
+bool SessionManager::Open(int fd) {
+  return OpenSlot(fd) != nullptr;
+}
+
+bool SessionManager::OpenAttached(int fd, UsbDevice* device) {
+  Slot* slot = OpenSlot(fd);
+  if (slot == nullptr) {
+    return false;
+  }
+  if (!slot->session.AttachDevice(device)) {
+    Close(slot);
+    return false;
+  }
+  slot->state = State::kAttached;
+  return true;
+}
+
+SessionManager::Slot* SessionManager::OpenSlot(int fd) {
+  if (free_slots_.empty()) {
+    printf("Too many sessions, refusing connection %d\n", fd);
+    close(fd);
+    return nullptr;
+  }
+  Slot* slot = free_slots_.back();
+  free_slots_.pop_back();
+  slot->transport.Reset(fd);
+  slot->session.Reset();
+  ++slot->generation;
+  slot->session.set_id(static_cast<uint64_t>(slot->generation) << 32 |
+                       slot->index);
+  slot->state = State::kConnected;
+  slot->events = EPOLLIN | EPOLLRDHUP;
+  if (!loop_->Add(fd, slot->events, [this, slot](uint32_t events) {
+        OnEvents(slot, events);
+      })) {
+    Close(slot);
+    return nullptr;
+  }
+  return slot;
+}
+
+void SessionManager::SetZeroCopyThreshold(size_t threshold) {
+  for (const auto& slot : slots_) {
+    slot->transport.SetZeroCopyThreshold(threshold);
+  }
+}
+
+void SessionManager::CloseSessionsUsing(UsbDevice* device) {
+  for (const auto& slot : slots_) {
+    if (slot->state == State::kAttached && slot->session.device() == device) {
+      Close(slot.get());
+    }
+  }
+}
+
+void SessionManager::Deliver(uint64_t session, const char* data,
+                             size_t size) {
+  uint32_t index = static_cast<uint32_t>(session);
+  if (index >= slots_.size()) {
+    return;
+  }
+  Slot* slot = slots_[index].get();
+  // A device may reply while its session is still importing it, so connected
+  // slots are served as well as attached ones.
+  if ((slot->state != State::kConnected && slot->state != State::kAttached) ||
+      slot->generation != session >> 32 || slot->transport.failed()) {
+    return;
+  }
+  if (slot->transport.Send(data, size) != static_cast<ssize_t>(size)) {
+    printf("send error : %s \n", strerror(errno));
+    // The hang-up which follows closes the session.
+    slot->transport.MarkFailed();
+  }
+}
+
+void SessionManager::OnEvents(Slot* slot, uint32_t events) {
+  if (slot->state != State::kConnected && slot->state != State::kAttached) {
+    return;
+  }
+  if (events & EPOLLOUT) {
+    slot->transport.Flush();
+  }
+  // Zero-copy sends complete through the socket's error queue, which is
+  // reported as an error condition whether or not the socket has failed.
+  if (events & EPOLLERR) {
+    if (!slot->transport.ReapZeroCopy()) {
+      Close(slot);
+      return;
+    }
+    events &= ~EPOLLERR;
+  }
+  // Hang-ups are reported even while reading is paused.
+  if (slot->transport.failed() || (events & (EPOLLHUP | EPOLLERR))) {
+    Close(slot);
+    return;
+  }
+  // Once a congested client has caught up, the requests which piled up in
+  // the socket meanwhile are read straight away.
+  if (!slot->transport.congested() && !slot->session.OnReadable()) {
+    Close(slot);
+    return;
+  }
+  slot->state = slot->session.device() != nullptr ? State::kAttached
+                                                  : State::kConnected;
+  UpdateEvents(slot);
+}
+
+void SessionManager::UpdateEvents(Slot* slot) {
+  if (slot->state != State::kConnected && slot->state != State::kAttached) {
+    return;
+  }
+  uint32_t events = 0;
+  if (!slot->transport.congested()) {
+    events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (slot->transport.queued_bytes() > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events != slot->events) {
+    loop_->Modify(slot->transport.fd(), events);
+    slot->events = events;
+  }
+}
+
+void SessionManager::Close(Slot* slot) {
+  int fd = slot->transport.fd();
+  printf("closing connection %d\n", fd);
+  const BufferPool::Stats& stats = BufferPool::ForCurrentThread()->stats();
+  printf("buffer pool: %zu acquired, %zu reused, %zu arenas, %zu large\n",
+         stats.acquired, stats.reused, stats.arenas, stats.large_mappings);
+  slot->state = State::kClosing;
+  slot->session.Close();
+  loop_->Remove(fd);
+  close(fd);
+  slot->transport.Reset(-1);
+  slot->state = State::kFree;
+  free_slots_.push_back(slot);
+}
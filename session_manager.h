@@ -0,0 +1,116 @@
+#ifndef __USBIP_SESSION_MANAGER_H__
+#define __USBIP_SESSION_MANAGER_H__
+
+#include "device_registry.h"
+#include "event_loop.h"
+#include "session.h"
+#include "transport.h"
+#include "usb_device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Owns the sessions of every client connected to the server.
+//
+// The sessions live in a slab which is allocated up front, and a closed
+// session's slot goes back on a free list to serve the next connection, so
+// clients which connect and disconnect at a high rate cost no allocations and
+// memory stays flat. Closing a session is bounded work: the device is
+// detached, which drops its pending URBs, and the socket is closed. Nothing a
+// client does, including hanging up while URBs are in flight, takes the
+// server down.
+//
+// Replies which a client does not read in time queue up in its transport. Once
+// the queue reaches kOutboundPauseBytes the session stops reading requests
+// and only waits for the socket to drain, and a client which lets the queue
+// reach kOutboundLimitBytes is disconnected, so a stuck client neither stalls
+// the event loop nor grows memory without bound.
+class SessionManager {
+ public:
+  // Lifecycle of a slot in the slab.
+  enum class State {
+    // Not serving a connection; on the free list.
+    kFree,
+    // Serving a client which has not imported a device.
+    kConnected,
+    // Serving a client which has imported a device.
+    kAttached,
+    // Being torn down. Stray events for the slot are ignored.
+    kClosing,
+  };
+
+  // Serves the devices in |devices| from |loop| to at most |capacity| clients
+  // at a time.
+  SessionManager(EventLoop* loop, UsbDeviceRegistry* devices, int capacity);
+
+  // Closes every open session.
+  ~SessionManager();
+
+  SessionManager(const SessionManager&) = delete;
+  SessionManager& operator=(const SessionManager&) = delete;
+
+  // Takes ownership of the connected socket |fd| and starts a session on it.
+  // If every slot is in use the connection is closed instead and false is
+  // returned.
+  bool Open(int fd);
+
+  // Like Open(), but the client has already imported |device|, so the
+  // session starts out attached to it instead of waiting for a handshake.
+  bool OpenAttached(int fd, UsbDevice* device);
+
+  // Closes the session of the client which has |device| imported, if any.
+  void CloseSessionsUsing(UsbDevice* device);
+
+  // Sends the |size| bytes at |data|, which a DeviceThread has passed back
+  // from a device, to the client of the session with id |session|. Replies
+  // for a session which has since closed are dropped.
+  void Deliver(uint64_t session, const char* data, size_t size);
+
+  // Sends replies of at least |threshold| bytes to the clients which connect
+  // from now on with MSG_ZEROCOPY, or none if |threshold| is 0. See
+  // SocketTransport.
+  void SetZeroCopyThreshold(size_t threshold);
+
+  int capacity() const { return slots_.size(); }
+  int open_count() const { return slots_.size() - free_slots_.size(); }
+
+ private:
+  struct Slot {
+    Slot(UsbDeviceRegistry* devices, uint32_t index)
+        : transport(-1), session(devices, &transport), index(index) {}
+
+    SocketTransport transport;
+    Session session;
+    State state = State::kFree;
+    // The events which the event loop is watching the socket for.
+    uint32_t events = 0;
+    // Position of the slot in |slots_|.
+    const uint32_t index;
+    // Counts the connections which the slot has served, so that replies meant
+    // for an earlier connection can be told apart. The session's id is this
+    // count followed by the slot's index.
+    uint32_t generation = 0;
+  };
+
+  // Starts a session on |fd| in a free slot. Returns nullptr, having closed
+  // |fd|, if there is none or the socket cannot be watched.
+  Slot* OpenSlot(int fd);
+
+  void OnEvents(Slot* slot, uint32_t events);
+
+  // Watches the socket for requests unless the transport is congested, and
+  // for writability while replies are queued.
+  void UpdateEvents(Slot* slot);
+
+  void Close(Slot* slot);
+
+  EventLoop* loop_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  // Slots which are not serving a connection, most recently freed last so
+  // that reuse hits memory which is still warm.
+  std::vector<Slot*> free_slots_;
+};
+
+#endif  // __USBIP_SESSION_MANAGER_H__
@@ -0,0 +1,114 @@
+#include "spool.h"
+
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Capacity requested for the pipe, so a large URB moves in few splices. The
+// kernel may grant less, which only costs more iterations.
+const int kPipeSize = 1 << 20;
+
+}  // namespace
+
+std::unique_ptr<Spool> Spool::Create(const std::string& path) {
+  int file_fd =
+      open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file_fd < 0) {
+    printf("open %s error : %s\n", path.c_str(), strerror(errno));
+    return nullptr;
+  }
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+    printf("pipe2 error : %s\n", strerror(errno));
+    close(file_fd);
+    return nullptr;
+  }
+  fcntl(pipe_fds[1], F_SETPIPE_SZ, kPipeSize);
+  return std::unique_ptr<Spool>(
+      new Spool(path, file_fd, pipe_fds[0], pipe_fds[1]));
+}
+
+Spool::Spool(const std::string& path, int file_fd, int pipe_read_fd,
+             int pipe_write_fd)
+    : path_(path),
+      file_fd_(file_fd),
+      pipe_read_fd_(pipe_read_fd),
+      pipe_write_fd_(pipe_write_fd),
+      bytes_(0) {}
+
+Spool::~Spool() {
+  close(pipe_read_fd_);
+  close(pipe_write_fd_);
+  close(file_fd_);
+}
+
+ssize_t Spool::SpliceFrom(int fd, size_t size) {
+  // The socket itself is in blocking mode, which SPLICE_F_NONBLOCK does not
+  // override, so the splice is limited to what has already arrived.
+  int available = 0;
+  if (ioctl(fd, FIONREAD, &available) < 0) {
+    return -1;
+  }
+  if (available == 0) {
+    // Either nothing has arrived yet or the peer has closed the connection;
+    // a non-blocking peek tells the two apart.
+    char byte_peeked;
+    return recv(fd, &byte_peeked, 1, MSG_PEEK | MSG_DONTWAIT);
+  }
+  if (size > static_cast<size_t>(available)) {
+    size = available;
+  }
+  ssize_t moved = splice(fd, nullptr, pipe_write_fd_, nullptr, size,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (moved <= 0) {
+    return moved;
+  }
+  if (!DrainPipe(moved)) {
+    return -1;
+  }
+  return moved;
+}
+
+bool Spool::DrainPipe(size_t size) {
+  while (size > 0) {
+    ssize_t written = splice(pipe_read_fd_, nullptr, file_fd_, nullptr, size,
+                             SPLICE_F_MOVE);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      printf("spool splice error : %s\n", strerror(errno));
+      return false;
+    }
+    size -= written;
+    bytes_ += written;
+  }
+  return true;
+}
+
+bool Spool::Write(const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(file_fd_, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0) {
+      printf("spool write error : %s\n", strerror(errno));
+      return false;
+    }
+    data += written;
+    size -= written;
+    bytes_ += written;
+  }
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef __USBIP_SPOOL_H__
+#define __USBIP_SPOOL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+// Captures the data which the host sends to a printer's bulk OUT endpoint
+// into a file.
+//
+// Payloads which arrive on a socket are moved into the file with splice(2)
+// through a pipe, so they never pass through user space: only the usbip
+// headers are parsed by the session. Transports without a file descriptor
+// hand the payload over with Write() instead.
+class Spool {
+ public:
+  // Creates a spool which writes to |path|, truncating it. Returns nullptr if
+  // the file or the pipe could not be created.
+  static std::unique_ptr<Spool> Create(const std::string& path);
+
+  ~Spool();
+
+  Spool(const Spool&) = delete;
+  Spool& operator=(const Spool&) = delete;
+
+  // Moves at most |size| bytes which are waiting on the non-blocking socket
+  // |fd| into the file. Returns the number of bytes taken from the socket, 0
+  // if the peer has closed the connection, or -1 with errno set. Fails with
+  // EAGAIN when no data is available.
+  ssize_t SpliceFrom(int fd, size_t size);
+
+  // Appends |size| bytes from |data| to the file. Returns false on error.
+  bool Write(const char* data, size_t size);
+
+  // Total number of bytes written to the file.
+  uint64_t bytes() const { return bytes_; }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  Spool(const std::string& path, int file_fd, int pipe_read_fd,
+        int pipe_write_fd);
+
+  // Moves the |size| bytes which are sitting in the pipe into the file.
+  bool DrainPipe(size_t size);
+
+  std::string path_;
+  int file_fd_;
+  int pipe_read_fd_;
+  int pipe_write_fd_;
+  uint64_t bytes_;
+};
+
+#endif  // __USBIP_SPOOL_H__
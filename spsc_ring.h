@@ -0,0 +1,90 @@
+#ifndef __USBIP_SPSC_RING_H__
+#define __USBIP_SPSC_RING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer
+// thread.
+//
+// Each side owns one index and only reads the other side's index when its own
+// cached copy says the ring is full or empty, so in steady state a push or pop
+// touches no cache line which the other thread is writing. The indices grow
+// monotonically and are reduced to a slot with a mask, which is why the
+// capacity must be a power of two.
+//
+// Elements are written and read in place and the slots are never destroyed
+// while the ring lives, so buffers inside an element keep their capacity from
+// one use of the slot to the next and steady traffic does not allocate.
+template <typename T>
+class SpscRing {
+ public:
+  // |capacity| must be a power of two.
+  explicit SpscRing(size_t capacity)
+      : slots_(capacity), mask_(capacity - 1) {}
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  size_t capacity() const { return slots_.size(); }
+
+  // Returns the slot which the next element is to be written into, still
+  // holding whatever the consumer left there, or nullptr if the ring is full.
+  // The element reaches the consumer once CommitPush() is called. Only the
+  // producer may call these.
+  T* BeginPush() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - cached_tail_ == slots_.size()) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ == slots_.size()) {
+        return nullptr;
+      }
+    }
+    return &slots_[head & mask_];
+  }
+
+  void CommitPush() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // Returns the oldest element of the ring, or nullptr if the ring is empty.
+  // Its slot is handed back to the producer by Pop(). Only the consumer may
+  // call these.
+  T* Front() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == cached_head_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail == cached_head_) {
+        return nullptr;
+      }
+    }
+    return &slots_[tail & mask_];
+  }
+
+  void Pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+ private:
+  static const size_t kCacheLineSize = 64;
+
+  std::vector<T> slots_;
+  const size_t mask_;
+
+  // Written by the producer.
+  std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+
+  // Keeps the consumer's indices off the producer's cache line. The ring is
+  // not over-aligned, which operator new does not support before C++17.
+  char padding_[kCacheLineSize];
+
+  // Written by the consumer.
+  std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+};
+
+#endif  // __USBIP_SPSC_RING_H__
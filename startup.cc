@@ -0,0 +1,90 @@
+#include "startup.h"
+
+#include "monotonic_clock.h"
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Sends |message| to the datagram socket named by |path|. A leading '@'
+// selects the abstract namespace.
+void SendNotification(const char* path, const std::string& message) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  size_t length = strlen(path);
+  if (length == 0 || length >= sizeof(address.sun_path)) {
+    printf("invalid NOTIFY_SOCKET %s\n", path);
+    return;
+  }
+  memcpy(address.sun_path, path, length);
+  if (path[0] == '@') {
+    address.sun_path[0] = '\0';
+  }
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    printf("socket error : %s\n", strerror(errno));
+    return;
+  }
+  socklen_t address_length = offsetof(struct sockaddr_un, sun_path) + length;
+  if (sendto(fd, message.data(), message.size(), MSG_NOSIGNAL,
+             (sockaddr*)&address, address_length) < 0) {
+    printf("NOTIFY_SOCKET %s error : %s\n", path, strerror(errno));
+  }
+  close(fd);
+}
+
+}  // namespace
+
+StartupTimer::StartupTimer() : start_ns_(MonotonicNanos()) {}
+
+void StartupTimer::Mark(const char* phase) {
+  phases_.push_back({phase, MonotonicNanos()});
+}
+
+uint64_t StartupTimer::total_ns() const {
+  return phases_.empty() ? 0 : phases_.back().end_ns - start_ns_;
+}
+
+void StartupTimer::Print() const {
+  std::string line = "Startup";
+  uint64_t previous_ns = start_ns_;
+  for (const Phase& phase : phases_) {
+    char timing[96];
+    snprintf(timing, sizeof(timing), " %s=%.3fms", phase.name,
+             (phase.end_ns - previous_ns) / 1e6);
+    line += timing;
+    previous_ns = phase.end_ns;
+  }
+  printf("%s total=%.3fms\n", line.c_str(), total_ns() / 1e6);
+  // Launchers often kill the server without it ever flushing stdout.
+  fflush(stdout);
+}
+
+void NotifyReady(int ready_fd) {
+  if (ready_fd >= 0) {
+    const char kReady[] = "READY=1\n";
+    if (write(ready_fd, kReady, sizeof(kReady) - 1) < 0) {
+      printf("ready fd %d error : %s\n", ready_fd, strerror(errno));
+    }
+    close(ready_fd);
+  }
+
+  const char* notify_socket = getenv("NOTIFY_SOCKET");
+  if (notify_socket != nullptr) {
+    SendNotification(notify_socket,
+                     "READY=1\nMAINPID=" + std::to_string(getpid()) + "\n");
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef __USBIP_STARTUP_H__
+#define __USBIP_STARTUP_H__
+
+#include <cstdint>
+#include <vector>
+
+// Breaks the time the server takes to become ready down into phases, so that
+// a slow startup can be traced to the step responsible.
+class StartupTimer {
+ public:
+  // Starts timing from now.
+  StartupTimer();
+
+  StartupTimer(const StartupTimer&) = delete;
+  StartupTimer& operator=(const StartupTimer&) = delete;
+
+  // Ends the current phase and names it |phase|. The next phase starts now.
+  // |phase| must outlive the timer.
+  void Mark(const char* phase);
+
+  // Time from the construction of the timer to the last Mark().
+  uint64_t total_ns() const;
+
+  // Prints the duration of every phase on a single line and flushes stdout.
+  void Print() const;
+
+ private:
+  struct Phase {
+    const char* name;
+    uint64_t end_ns;
+  };
+
+  uint64_t start_ns_;
+  std::vector<Phase> phases_;
+};
+
+// Tells whoever launched the server that it is ready to accept connections.
+// "READY=1\n" is written to |ready_fd| unless it is negative, after which the
+// descriptor is closed, and if the NOTIFY_SOCKET environment variable is set,
+// a systemd style notification is sent to the socket it names. Failures are
+// logged but are not fatal, as the server works regardless.
+void NotifyReady(int ready_fd);
+
+#endif  // __USBIP_STARTUP_H__
@@ -0,0 +1,157 @@
+#include "timer_wheel.h"
+
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+TimerWheel::TimerWheel(EventLoop* event_loop, uint64_t tick_ns,
+                       int slot_count)
+    : event_loop_(event_loop),
+      tick_ns_(tick_ns),
+      slot_mask_(slot_count - 1),
+      current_tick_(0),
+      armed_(false),
+      pending_(0),
+      slots_(slot_count, -1) {
+  if (slot_count <= 0 || (slot_count & (slot_count - 1)) != 0) {
+    printf("timer wheel slot count %d is not a power of two\n", slot_count);
+    exit(1);
+  }
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    printf("timerfd_create error : %s\n", strerror(errno));
+    exit(1);
+  }
+  event_loop_->Add(timer_fd_, EPOLLIN, [this](uint32_t events) {
+    OnTimerFd();
+  });
+}
+
+TimerWheel::~TimerWheel() {
+  event_loop_->Remove(timer_fd_);
+  close(timer_fd_);
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(uint64_t delay_ticks,
+                                         Callback callback) {
+  int index;
+  if (!free_entries_.empty()) {
+    index = free_entries_.back();
+    free_entries_.pop_back();
+  } else {
+    index = entries_.size();
+    entries_.push_back(Entry());
+    entries_[index].generation = 0;
+  }
+  Entry& entry = entries_[index];
+  entry.deadline = current_tick_ + (delay_ticks > 0 ? delay_ticks : 1);
+  entry.callback = std::move(callback);
+  Link(index, entry.deadline & slot_mask_);
+
+  if (++pending_ == 1) {
+    Arm(true);
+  }
+  return (static_cast<uint64_t>(entry.generation) << 32) | index;
+}
+
+void TimerWheel::Cancel(TimerId id) {
+  size_t index = id & 0xFFFFFFFF;
+  uint32_t generation = id >> 32;
+  if (index >= entries_.size() || entries_[index].slot < 0 ||
+      entries_[index].generation != generation) {
+    return;
+  }
+  Unlink(index);
+  entries_[index].callback = nullptr;
+  ++entries_[index].generation;
+  free_entries_.push_back(index);
+  --pending_;
+}
+
+void TimerWheel::OnTimerFd() {
+  uint64_t expirations = 0;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) < 0) {
+    return;
+  }
+  // If the loop was held up, every missed tick is still processed so that
+  // timers fire in order, just late.
+  for (uint64_t i = 0; i < expirations && pending_ > 0; ++i) {
+    ++current_tick_;
+    RunSlot();
+  }
+  if (pending_ == 0) {
+    Arm(false);
+  }
+}
+
+void TimerWheel::RunSlot() {
+  int slot = current_tick_ & slot_mask_;
+  // Callbacks may schedule or cancel other timers, so the due entries are
+  // collected before any of them runs.
+  due_.clear();
+  for (int index = slots_[slot]; index >= 0; index = entries_[index].next) {
+    const Entry& entry = entries_[index];
+    if (entry.deadline <= current_tick_) {
+      due_.push_back((static_cast<uint64_t>(entry.generation) << 32) | index);
+    }
+  }
+  for (TimerId id : due_) {
+    size_t index = id & 0xFFFFFFFF;
+    Entry& entry = entries_[index];
+    if (entry.slot < 0 || entry.generation != (id >> 32)) {
+      continue;
+    }
+    Callback callback = std::move(entry.callback);
+    Cancel(id);
+    callback();
+  }
+}
+
+void TimerWheel::Link(int index, int slot) {
+  Entry& entry = entries_[index];
+  entry.slot = slot;
+  entry.previous = -1;
+  entry.next = slots_[slot];
+  if (entry.next >= 0) {
+    entries_[entry.next].previous = index;
+  }
+  slots_[slot] = index;
+}
+
+void TimerWheel::Unlink(int index) {
+  Entry& entry = entries_[index];
+  if (entry.previous >= 0) {
+    entries_[entry.previous].next = entry.next;
+  } else {
+    slots_[entry.slot] = entry.next;
+  }
+  if (entry.next >= 0) {
+    entries_[entry.next].previous = entry.previous;
+  }
+  entry.slot = -1;
+}
+
+void TimerWheel::Arm(bool armed) {
+  if (armed == armed_) {
+    return;
+  }
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (armed) {
+    spec.it_value.tv_sec = tick_ns_ / 1000000000ull;
+    spec.it_value.tv_nsec = tick_ns_ % 1000000000ull;
+    spec.it_interval = spec.it_value;
+  }
+  if (timerfd_settime(timer_fd_, 0, &spec, nullptr) < 0) {
+    printf("timerfd_settime error : %s\n", strerror(errno));
+    return;
+  }
+  armed_ = armed;
+}
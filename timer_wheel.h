@@ -0,0 +1,88 @@
+#ifndef __USBIP_TIMER_WHEEL_H__
+#define __USBIP_TIMER_WHEEL_H__
+
+#include "event_loop.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hashed timer wheel for the high-rate periodic work of interrupt endpoints.
+//
+// Time advances in fixed ticks (1 ms, one full-speed frame, by default).
+// Scheduling and cancelling a timer are O(1) regardless of how many are
+// pending, which matters when many devices each complete URBs every frame.
+// The wheel is driven by a periodic timerfd registered with an EventLoop. The
+// timerfd is only armed while timers are pending, so an idle wheel costs
+// nothing.
+class TimerWheel {
+ public:
+  using Callback = std::function<void()>;
+
+  // Identifies a scheduled timer. Ids are never reused, so cancelling a timer
+  // which has already fired is harmless.
+  using TimerId = uint64_t;
+
+  // Registers the wheel with |event_loop|. Each tick is |tick_ns| nanoseconds
+  // and the wheel has |slot_count| slots, which should be a power of two
+  // comfortably larger than the longest common delay in ticks.
+  TimerWheel(EventLoop* event_loop, uint64_t tick_ns = 1000000,
+             int slot_count = 256);
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Runs |callback| once, |delay_ticks| ticks from now. A delay of 0 runs it
+  // on the next tick.
+  TimerId Schedule(uint64_t delay_ticks, Callback callback);
+
+  // Cancels the timer with |id| if it has not fired yet.
+  void Cancel(TimerId id);
+
+  uint64_t tick_ns() const { return tick_ns_; }
+
+  // Number of ticks processed since the wheel was created.
+  uint64_t now() const { return current_tick_; }
+
+ private:
+  struct Entry {
+    uint64_t deadline;
+    uint32_t generation;
+    // Neighbours within the slot's list, or -1.
+    int previous;
+    int next;
+    // Slot the entry is linked into, or -1 if it is free.
+    int slot;
+    Callback callback;
+  };
+
+  // Processes the ticks which have elapsed according to the timerfd.
+  void OnTimerFd();
+
+  // Runs the entries of the slot for |current_tick_| which are due.
+  void RunSlot();
+
+  void Link(int index, int slot);
+  void Unlink(int index);
+
+  // Starts or stops the periodic timerfd.
+  void Arm(bool armed);
+
+  EventLoop* event_loop_;
+  int timer_fd_;
+  const uint64_t tick_ns_;
+  const uint64_t slot_mask_;
+  uint64_t current_tick_;
+  bool armed_;
+  int pending_;
+
+  // Head of each slot's list of entries, or -1.
+  std::vector<int> slots_;
+  std::vector<Entry> entries_;
+  std::vector<int> free_entries_;
+  // Scratch space for RunSlot().
+  std::vector<TimerId> due_;
+};
+
+#endif  // __USBIP_TIMER_WHEEL_H__
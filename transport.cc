@@ -0,0 +1,273 @@
+#include "transport.h"
+
+#include "buffer_pool.h"
+#include "spool.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+// Size of the buffer used to copy payloads into a spool.
+const size_t kSpoolCopySize = 16384;
+
+}  // namespace
+
+ssize_t Transport::ReceiveToSpool(Spool* spool, size_t size) {
+  char buffer[kSpoolCopySize];
+  if (size > sizeof(buffer)) {
+    size = sizeof(buffer);
+  }
+  ssize_t received = Receive(buffer, size);
+  if (received > 0 && !spool->Write(buffer, received)) {
+    errno = EIO;
+    return -1;
+  }
+  return received;
+}
+
+ssize_t Transport::SendBuffer(BufferPool::Buffer buffer, size_t size) {
+  return Send(buffer.data(), size);
+}
+
+SocketTransport::SocketTransport(int fd)
+    : fd_(fd),
+      queue_offset_(0),
+      zerocopy_threshold_(0),
+      zerocopy_(false),
+      next_zerocopy_id_(0) {}
+
+void SocketTransport::Reset(int fd) {
+  fd_ = fd;
+  failed_ = false;
+  queue_offset_ = 0;
+  pinned_.clear();
+  next_zerocopy_id_ = 0;
+  // Sockets other than TCP and UDP ones, such as the Unix socketpairs which
+  // are handed to vhci_hcd, refuse SO_ZEROCOPY and simply copy.
+  int enable = 1;
+  zerocopy_ = fd >= 0 && zerocopy_threshold_ > 0 &&
+              setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable,
+                         sizeof(enable)) == 0;
+  // A client which fell far behind leaves a large buffer behind, which is
+  // given back rather than kept for the next connection.
+  if (queue_.capacity() > kOutboundPauseBytes) {
+    std::vector<char>().swap(queue_);
+  }
+  queue_.clear();
+}
+
+void SocketTransport::MarkFailed() {
+  if (!failed_) {
+    shutdown(fd_, SHUT_RDWR);
+  }
+  Transport::MarkFailed();
+}
+
+ssize_t SocketTransport::Send(const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  size_t sent = 0;
+  // Anything which is already queued has to go out first.
+  if (queued_bytes() == 0) {
+    // A client which hangs up must not raise SIGPIPE in the server.
+    ssize_t result = send(fd_, bytes, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+        errno != EINTR) {
+      return -1;
+    }
+    sent = result > 0 ? result : 0;
+  }
+  if (sent == size) {
+    return size;
+  }
+  if (queued_bytes() + size - sent > kOutboundLimitBytes) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  bool was_empty = queued_bytes() == 0;
+  queue_.insert(queue_.end(), bytes + sent, bytes + size);
+  if (was_empty && queue_callback_) {
+    queue_callback_();
+  }
+  return size;
+}
+
+ssize_t SocketTransport::SendBuffer(BufferPool::Buffer buffer, size_t size) {
+  // Data which is queued has been copied already and has to go out first.
+  if (!zerocopy_ || size < zerocopy_threshold_ || queued_bytes() > 0) {
+    return Send(buffer.data(), size);
+  }
+  ssize_t sent = send(fd_, buffer.data(), size,
+                      MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (sent < 0) {
+    // ENOBUFS means that the socket has run out of memory for completion
+    // notifications; the copying path still works.
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+        errno == ENOBUFS) {
+      return Send(buffer.data(), size);
+    }
+    return -1;
+  }
+  pinned_.push_back({next_zerocopy_id_++, std::move(buffer)});
+  if (static_cast<size_t>(sent) == size) {
+    return size;
+  }
+  // The rest is copied, and queued if the socket is full.
+  ssize_t rest = Send(pinned_.back().buffer.data() + sent, size - sent);
+  return rest < 0 ? -1 : size;
+}
+
+bool SocketTransport::ReapZeroCopy() {
+  while (true) {
+    char control[CMSG_SPACE(sizeof(sock_extended_err)) + 64];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(fd_, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr;
+         header = CMSG_NXTHDR(&message, header)) {
+      if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR) &&
+          !(header->cmsg_level == SOL_IPV6 &&
+            header->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const sock_extended_err* error =
+          reinterpret_cast<const sock_extended_err*>(CMSG_DATA(header));
+      if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // The sends numbered |ee_info| to |ee_data| inclusive are complete.
+      uint32_t first = error->ee_info;
+      uint32_t count = error->ee_data - first;
+      for (auto it = pinned_.begin(); it != pinned_.end();) {
+        if (it->id - first <= count) {
+          it = pinned_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+  int error = 0;
+  socklen_t length = sizeof(error);
+  getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length);
+  return error == 0;
+}
+
+void SocketTransport::Flush() {
+  while (queued_bytes() > 0 && !failed_) {
+    ssize_t sent = send(fd_, queue_.data() + queue_offset_, queued_bytes(),
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        MarkFailed();
+      }
+      return;
+    }
+    queue_offset_ += sent;
+  }
+  // The buffer is rewound once it drains, keeping its capacity. A client
+  // which never quite catches up has the sent data trimmed off instead, so
+  // that the buffer stays within the queue limit.
+  if (queued_bytes() == 0) {
+    queue_.clear();
+    queue_offset_ = 0;
+  } else if (queue_offset_ >= queue_.size() / 2) {
+    queue_.erase(queue_.begin(), queue_.begin() + queue_offset_);
+    queue_offset_ = 0;
+  }
+}
+
+ssize_t SocketTransport::Receive(void* data, size_t size) {
+  return recv(fd_, data, size, MSG_DONTWAIT);
+}
+
+ssize_t SocketTransport::ReceiveToSpool(Spool* spool, size_t size) {
+  return spool->SpliceFrom(fd_, size);
+}
+
+MemoryTransport::MemoryTransport()
+    : input_offset_(0), input_closed_(false), output_offset_(0) {}
+
+void MemoryTransport::Write(const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  input_.insert(input_.end(), bytes, bytes + size);
+}
+
+size_t MemoryTransport::Read(void* data, size_t size) {
+  size_t available = pending_output();
+  if (size > available) {
+    size = available;
+  }
+  memcpy(data, output_.data() + output_offset_, size);
+  output_offset_ += size;
+  // Once everything has been read the buffer is reset, but its capacity is
+  // kept so that steady-state traffic does not reallocate.
+  if (output_offset_ == output_.size()) {
+    DiscardOutput();
+  }
+  return size;
+}
+
+void MemoryTransport::DiscardOutput() {
+  output_.clear();
+  output_offset_ = 0;
+}
+
+ssize_t MemoryTransport::Send(const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  output_.insert(output_.end(), bytes, bytes + size);
+  return size;
+}
+
+ssize_t MemoryTransport::Receive(void* data, size_t size) {
+  size_t available = pending_input();
+  if (available == 0) {
+    if (input_closed_) {
+      return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+  if (size > available) {
+    size = available;
+  }
+  memcpy(data, input_.data() + input_offset_, size);
+  input_offset_ += size;
+  if (input_offset_ == input_.size()) {
+    input_.clear();
+    input_offset_ = 0;
+  }
+  return size;
+}
+
+uint64_t SocketTransport::RoundTripNanos() const {
+  // Only TCP keeps an estimate; socketpairs to vhci_hcd have no network.
+  struct tcp_info info;
+  socklen_t length = sizeof(info);
+  if (getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(info.tcpi_rtt) * 1000;
+}
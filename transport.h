@@ -0,0 +1,212 @@
+#ifndef __USBIP_TRANSPORT_H__
+#define __USBIP_TRANSPORT_H__
+
+#include "buffer_pool.h"
+#include "spool.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <cstddef>
+
+// Bytes of replies which a SocketTransport queues for a slow client before its
+// session stops reading new requests from it.
+const size_t kOutboundPauseBytes = 256 * 1024;
+
+// Bytes of replies which a SocketTransport queues before it gives up on the
+// client and fails the connection.
+const size_t kOutboundLimitBytes = 4 * 1024 * 1024;
+
+// Replies from which zero-copy sends pay off when they are enabled. Below
+// this, pinning the pages and handling the completion costs more than the
+// copy which it saves.
+const size_t kDefaultZeroCopyThreshold = 16 * 1024;
+
+// Smallest reply which is ever sent zero-copy. The kernel cannot merge
+// zero-copy sends into one another, so small ones each take a packet of their
+// own, and a client with a small receive window can stall the connection with
+// them for good.
+const size_t kMinZeroCopyThreshold = 4 * 1024;
+
+// Generic byte-stream connection between the virtual device and a usbip
+// client. All of the protocol handlers read and write through this interface
+// so that the same code can be driven by a real socket or by an in-process
+// buffer.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+
+  // Sends |size| bytes from |data| to the client. Returns the number of bytes
+  // which were sent, or -1 with errno set if an error occurred. A transport
+  // may queue the bytes instead of sending them straight away.
+  virtual ssize_t Send(const void* data, size_t size) = 0;
+
+  // Sends the first |size| bytes of |buffer| to the client and takes
+  // ownership of the buffer. Returns like Send(). The default implementation
+  // copies the bytes with Send() and releases the buffer straight away, but a
+  // transport may hold on to it until the bytes are gone.
+  virtual ssize_t SendBuffer(BufferPool::Buffer buffer, size_t size);
+
+  // Whether the client is so far behind in reading replies that no further
+  // requests should be read from it until it catches up.
+  virtual bool congested() const { return false; }
+
+  // Receives at most |size| bytes from the client into |data|. Returns the
+  // number of bytes received, 0 if the client has closed the connection, or -1
+  // with errno set if an error occurred.
+  virtual ssize_t Receive(void* data, size_t size) = 0;
+
+  // Moves at most |size| bytes from the client into |spool| without handing
+  // them to the caller. Returns like Receive(). The default implementation
+  // copies the bytes through a buffer.
+  virtual ssize_t ReceiveToSpool(Spool* spool, size_t size);
+
+  // Whether sending to the client has failed. A failed connection is
+  // unusable, and the session which owns it closes instead of the error
+  // taking down the server.
+  bool failed() const { return failed_; }
+
+  // Records that sending to the client has failed.
+  virtual void MarkFailed() { failed_ = true; }
+
+  // Smoothed round trip time of the connection in nanoseconds, or 0 if it is
+  // not known.
+  virtual uint64_t RoundTripNanos() const { return 0; }
+
+ protected:
+  bool failed_ = false;
+};
+
+// Transport which communicates with the client through the socket |fd|. The
+// socket is not owned by the transport. Neither Send() nor Receive() blocks, so
+// that sessions can be driven from an event loop: Receive() fails with EAGAIN
+// when no data is available, and whatever Send() cannot write straight away is
+// queued until Flush() is called when the socket becomes writable. The queue
+// is bounded by kOutboundLimitBytes, past which the connection fails.
+//
+// Large replies handed over with SendBuffer() can be sent with MSG_ZEROCOPY,
+// so that the kernel transmits straight from the pooled buffer instead of
+// copying it. The buffer stays pinned in the transport until the kernel
+// reports on the socket's error queue that it is done with it, which makes
+// the event loop report EPOLLERR; ReapZeroCopy() then releases it.
+class SocketTransport : public Transport {
+ public:
+  explicit SocketTransport(int fd);
+
+  int fd() const { return fd_; }
+
+  // Points the transport at another socket and clears any failure and queued
+  // data, so that one transport can serve many connections in turn. Buffers
+  // still pinned by zero-copy sends are released, as the connection which
+  // they were for is over.
+  void Reset(int fd);
+
+  // Sends replies of at least |threshold| bytes with MSG_ZEROCOPY, or none if
+  // |threshold| is 0. Lower thresholds are raised to kMinZeroCopyThreshold.
+  // Takes effect from the next Reset(), and only on sockets which support it.
+  void SetZeroCopyThreshold(size_t threshold) {
+    zerocopy_threshold_ = threshold > 0 && threshold < kMinZeroCopyThreshold
+                              ? kMinZeroCopyThreshold
+                              : threshold;
+  }
+
+  // Releases the buffers of zero-copy sends which the kernel has reported as
+  // complete. Returns false if the socket has an actual error.
+  bool ReapZeroCopy();
+
+  // Number of buffers which zero-copy sends still have pinned.
+  size_t pinned_buffers() const { return pinned_.size(); }
+
+  // Sets a callback which runs whenever data is added to an empty queue, so
+  // that the owner can start waiting for the socket to become writable.
+  void SetQueueCallback(std::function<void()> callback) {
+    queue_callback_ = std::move(callback);
+  }
+
+  // Writes as much of the queued data as the socket accepts. Marks the
+  // transport as failed if the socket reports an error.
+  void Flush();
+
+  size_t queued_bytes() const { return queue_.size() - queue_offset_; }
+
+  bool congested() const override {
+    return queued_bytes() >= kOutboundPauseBytes;
+  }
+
+  // Also shuts the socket down, so that the event loop reports it as readable
+  // and its session notices the failure even if it happened in a timer.
+  void MarkFailed() override;
+
+  ssize_t Send(const void* data, size_t size) override;
+  ssize_t SendBuffer(BufferPool::Buffer buffer, size_t size) override;
+  ssize_t Receive(void* data, size_t size) override;
+
+  // Splices the bytes straight from the socket into the spool's file.
+  ssize_t ReceiveToSpool(Spool* spool, size_t size) override;
+
+  uint64_t RoundTripNanos() const override;
+
+ private:
+  int fd_;
+  // Data waiting for the socket to become writable, starting at
+  // |queue_offset_|.
+  std::vector<char> queue_;
+  size_t queue_offset_;
+  std::function<void()> queue_callback_;
+
+  // A buffer which the kernel may still be reading from.
+  struct PinnedBuffer {
+    // The number the kernel gave the send, counting from 0 for each socket.
+    uint32_t id;
+    BufferPool::Buffer buffer;
+  };
+
+  size_t zerocopy_threshold_;
+  // Whether the current socket accepts MSG_ZEROCOPY.
+  bool zerocopy_;
+  uint32_t next_zerocopy_id_;
+  std::deque<PinnedBuffer> pinned_;
+};
+
+// Transport which keeps all traffic in memory. The "client" side is driven
+// directly through Write() and Read(), so the protocol stack can be exercised
+// in-process without making any system calls.
+class MemoryTransport : public Transport {
+ public:
+  MemoryTransport();
+
+  // Queues |size| bytes from |data| to be returned by subsequent calls to
+  // Receive().
+  void Write(const void* data, size_t size);
+
+  // Marks the client side as closed. Once all queued input has been consumed
+  // Receive() reports end-of-stream instead of EAGAIN.
+  void CloseInput() { input_closed_ = true; }
+
+  // Copies at most |size| bytes which were sent by the device into |data| and
+  // returns the number of bytes copied.
+  size_t Read(void* data, size_t size);
+
+  // Discards all of the data which was sent by the device.
+  void DiscardOutput();
+
+  size_t pending_input() const { return input_.size() - input_offset_; }
+  size_t pending_output() const { return output_.size() - output_offset_; }
+
+  ssize_t Send(const void* data, size_t size) override;
+  ssize_t Receive(void* data, size_t size) override;
+
+ private:
+  std::vector<char> input_;
+  size_t input_offset_;
+  bool input_closed_;
+  std::vector<char> output_;
+  size_t output_offset_;
+};
+
+#endif  // __USBIP_TRANSPORT_H__
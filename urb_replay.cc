@@ -0,0 +1,332 @@
+// Replays the URBs recorded in a trace file against a running server and
+// reports how long the server took to complete them.
+
+#include "urb_trace.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct ReplayOptions {
+  const char* host = "127.0.0.1";
+  int port = TCP_SERV_PORT;
+  const char* bus_id = "1-1";
+  bool max_speed = false;
+  const char* trace_path = nullptr;
+};
+
+// Tracks the URBs which have been sent but not yet completed.
+class Completions {
+ public:
+  void Sent(int seqnum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sent_[seqnum] = Clock::now();
+    ++outstanding_;
+  }
+
+  void Completed(int seqnum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sent_.find(seqnum);
+    if (it == sent_.end()) {
+      return;
+    }
+    latencies_.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - it->second)
+            .count());
+    sent_.erase(it);
+    --outstanding_;
+  }
+
+  int outstanding() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return outstanding_;
+  }
+
+  std::vector<double> latencies() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latencies_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<int, Clock::time_point> sent_;
+  std::vector<double> latencies_;
+  int outstanding_ = 0;
+};
+
+bool SendAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      printf("send error : %s\n", strerror(errno));
+      return false;
+    }
+    bytes += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool ReceiveAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+int Connect(const ReplayOptions& options) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(options.port);
+  if (fd < 0 || inet_pton(AF_INET, options.host, &server.sin_addr) != 1 ||
+      connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+    printf("connect error : %s\n", strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+
+// Performs the OP_REQ_IMPORT exchange which attaches the device.
+void Import(int fd, const ReplayOptions& options) {
+  OP_REQ_IMPORT request;
+  memset(&request, 0, sizeof(request));
+  set_op_header(htons(273), htons(OP_REQ_IMPORT_CMD), 0, &request.header);
+  strncpy(request.busID, options.bus_id, sizeof(request.busID) - 1);
+  OP_REP_IMPORT reply;
+  if (!SendAll(fd, &request, sizeof(request)) ||
+      !ReceiveAll(fd, &reply, sizeof(reply)) || reply.header.status != 0) {
+    printf("unable to import %s\n", options.bus_id);
+    exit(1);
+  }
+}
+
+// Reads replies from the server until the connection is closed.
+void ReadReplies(int fd, Completions* completions) {
+  std::vector<char> discard;
+  while (true) {
+    int header[sizeof(USBIP_RET_SUBMIT) / sizeof(int)];
+    if (!ReceiveAll(fd, header, sizeof(header))) {
+      return;
+    }
+    int command = ntohl(header[0]);
+    int seqnum = ntohl(header[1]);
+    int direction = ntohl(header[3]);
+    if (command == COMMAND_USBIP_RET_SUBMIT) {
+      int actual_length = ntohl(header[6]);
+      if (direction == 1 && actual_length > 0) {
+        discard.resize(actual_length);
+        if (!ReceiveAll(fd, discard.data(), actual_length)) {
+          return;
+        }
+      }
+    }
+    completions->Completed(seqnum);
+  }
+}
+
+bool SendSubmit(int fd, const UrbTraceRecord& record) {
+  USBIP_CMD_SUBMIT command;
+  memset(&command, 0, sizeof(command));
+  command.command = COMMAND_USBIP_CMD_SUBMIT;
+  command.seqnum = record.seqnum;
+  command.devid = record.devid;
+  command.direction = record.direction;
+  command.ep = record.ep;
+  command.transfer_flags = record.value;
+  command.transfer_buffer_length = record.length;
+  command.interval = record.interval;
+  command.setup = record.setup;
+  // The packed struct is byte-swapped in an aligned copy.
+  int words[sizeof(command) / sizeof(int)];
+  memcpy(words, &command, sizeof(command));
+  pack_usbip(words, sizeof(words));
+  if (!SendAll(fd, words, sizeof(words))) {
+    return false;
+  }
+  if (record.direction != 0 || record.length == 0) {
+    return true;
+  }
+  // OUT data is replayed verbatim when the trace has it, and as zeros of the
+  // same length otherwise.
+  if (record.flags & kUrbTraceHasPayload) {
+    return SendAll(fd, &record + 1, record.length);
+  }
+  std::vector<char> zeros(record.length);
+  return SendAll(fd, zeros.data(), zeros.size());
+}
+
+bool SendUnlink(int fd, const UrbTraceRecord& record) {
+  int command[sizeof(USBIP_CMD_SUBMIT) / sizeof(int)];
+  memset(command, 0, sizeof(command));
+  command[0] = htonl(COMMAND_USBIP_CMD_UNLINK);
+  command[1] = htonl(record.seqnum);
+  command[2] = htonl(record.devid);
+  command[3] = htonl(record.direction);
+  command[4] = htonl(record.ep);
+  command[5] = htonl(record.value);
+  return SendAll(fd, command, sizeof(command));
+}
+
+double Percentile(const std::vector<double>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * (sorted.size() - 1));
+  return sorted[index];
+}
+
+void PrintUsage(const char* program) {
+  printf("Usage: %s [options] TRACE_FILE\n", program);
+  printf("  --host=ADDRESS  address of the server (default 127.0.0.1)\n");
+  printf("  --port=PORT     port of the server (default %d)\n",
+         TCP_SERV_PORT);
+  printf("  --bus-id=ID     bus ID of the device to attach (default 1-1)\n");
+  printf("  --max-speed     send URBs back to back instead of at the\n");
+  printf("                  recorded times\n");
+}
+
+bool ParseArguments(int argc, char* argv[], ReplayOptions* options) {
+  const struct option long_options[] = {
+      {"host", required_argument, nullptr, 'H'},
+      {"port", required_argument, nullptr, 'p'},
+      {"bus-id", required_argument, nullptr, 'b'},
+      {"max-speed", no_argument, nullptr, 'm'},
+      {nullptr, 0, nullptr, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, nullptr)) !=
+         -1) {
+    switch (option) {
+      case 'H':
+        options->host = optarg;
+        break;
+      case 'p':
+        options->port = atoi(optarg);
+        break;
+      case 'b':
+        options->bus_id = optarg;
+        break;
+      case 'm':
+        options->max_speed = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  if (optind != argc - 1) {
+    return false;
+  }
+  options->trace_path = argv[optind];
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ReplayOptions options;
+  if (!ParseArguments(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  std::unique_ptr<UrbTraceReader> reader =
+      UrbTraceReader::Open(options.trace_path);
+  if (!reader) {
+    return 1;
+  }
+
+  int fd = Connect(options);
+  Import(fd, options);
+
+  Completions completions;
+  std::thread reply_reader(ReadReplies, fd, &completions);
+
+  Clock::time_point start = Clock::now();
+  uint64_t first_timestamp = 0;
+  int sent = 0;
+  while (const UrbTraceRecord* record = reader->Next()) {
+    if (record->kind != URB_TRACE_CMD_SUBMIT &&
+        record->kind != URB_TRACE_CMD_UNLINK) {
+      continue;
+    }
+    if (first_timestamp == 0) {
+      first_timestamp = record->timestamp_ns;
+    }
+    if (!options.max_speed) {
+      std::this_thread::sleep_until(
+          start +
+          std::chrono::nanoseconds(record->timestamp_ns - first_timestamp));
+    }
+    completions.Sent(record->seqnum);
+    bool ok = record->kind == URB_TRACE_CMD_SUBMIT ? SendSubmit(fd, *record)
+                                                   : SendUnlink(fd, *record);
+    if (!ok) {
+      break;
+    }
+    ++sent;
+  }
+
+  // URBs which the server parks indefinitely (such as bulk IN with no data)
+  // never complete, so give up once completions stop arriving.
+  int outstanding = completions.outstanding();
+  Clock::time_point last_progress = Clock::now();
+  while (outstanding > 0 &&
+         Clock::now() - last_progress < std::chrono::seconds(2)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    int now_outstanding = completions.outstanding();
+    if (now_outstanding != outstanding) {
+      outstanding = now_outstanding;
+      last_progress = Clock::now();
+    }
+  }
+  double elapsed =
+      std::chrono::duration<double>(last_progress - start).count();
+
+  shutdown(fd, SHUT_RDWR);
+  reply_reader.join();
+  close(fd);
+
+  std::vector<double> latencies = completions.latencies();
+  std::sort(latencies.begin(), latencies.end());
+  printf("replayed %d URBs in %.3f s, %zu completed, %d outstanding\n", sent,
+         elapsed, latencies.size(), outstanding);
+  printf("latency us: p50 %.1f p99 %.1f max %.1f\n",
+         Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+         latencies.empty() ? 0.0 : latencies.back());
+  return 0;
+}
@@ -0,0 +1,289 @@
+#include "urb_trace.h"
+
+#include "monotonic_clock.h"
+#include "usbip.h"
+
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+UrbTraceRecorder* g_recorder = nullptr;
+
+// Records are kept 8-byte aligned within the ring.
+size_t AlignRecordSize(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+}  // namespace
+
+uint64_t UrbPayloadDigest(const char* data, size_t size) {
+  // A multiply-xorshift hash over 8-byte words. It is not cryptographic, but
+  // is cheap enough to run on every payload and good enough to tell payloads
+  // apart when comparing traces.
+  const uint64_t kMultiplier = 0x9E3779B97F4A7C15ull;
+  uint64_t hash = size * kMultiplier;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, data + i, sizeof(chunk));
+    hash = (hash ^ chunk) * kMultiplier;
+    hash ^= hash >> 29;
+  }
+  uint64_t last = 0;
+  memcpy(&last, data + i, size - i);
+  hash = (hash ^ last) * kMultiplier;
+  return hash ^ (hash >> 32);
+}
+
+// static
+std::unique_ptr<UrbTraceRecorder> UrbTraceRecorder::Create(
+    const char* path, size_t capacity, bool record_payloads) {
+  capacity = AlignRecordSize(capacity);
+  if (capacity < 2 * sizeof(UrbTraceRecord)) {
+    printf("trace capacity %zu is too small\n", capacity);
+    return nullptr;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("open(%s) error : %s\n", path, strerror(errno));
+    return nullptr;
+  }
+  size_t file_size = kUrbTraceHeaderSize + capacity;
+  if (ftruncate(fd, file_size) < 0) {
+    printf("ftruncate(%s) error : %s\n", path, strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+  void* mapping =
+      mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    printf("mmap(%s) error : %s\n", path, strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<UrbTraceRecorder>(new UrbTraceRecorder(
+      fd, static_cast<char*>(mapping), capacity, record_payloads));
+}
+
+UrbTraceRecorder::UrbTraceRecorder(int fd, char* mapping, size_t capacity,
+                                   bool record_payloads)
+    : fd_(fd),
+      mapping_(mapping),
+      header_(reinterpret_cast<UrbTraceFileHeader*>(mapping)),
+      ring_(mapping + kUrbTraceHeaderSize),
+      capacity_(capacity),
+      record_payloads_(record_payloads) {
+  lock_.clear();
+  memcpy(header_->magic, kUrbTraceMagic, sizeof(kUrbTraceMagic));
+  header_->version = kUrbTraceVersion;
+  header_->reserved = 0;
+  header_->capacity = capacity;
+  header_->tail.store(0);
+  header_->head.store(0);
+}
+
+UrbTraceRecorder::~UrbTraceRecorder() {
+  if (g_recorder == this) {
+    g_recorder = nullptr;
+  }
+  munmap(mapping_, kUrbTraceHeaderSize + capacity_);
+  close(fd_);
+}
+
+void UrbTraceRecorder::RecordCmdSubmit(const USBIP_CMD_SUBMIT& request,
+                                       const char* data, size_t data_size) {
+  UrbTraceRecord record;
+  record.kind = URB_TRACE_CMD_SUBMIT;
+  record.seqnum = request.seqnum;
+  record.devid = request.devid;
+  record.direction = request.direction;
+  record.ep = request.ep;
+  record.value = request.transfer_flags;
+  record.length = request.transfer_buffer_length;
+  record.interval = request.interval;
+  record.setup = request.setup;
+  Append(&record, data, data_size);
+}
+
+void UrbTraceRecorder::RecordRetSubmit(const USBIP_CMD_SUBMIT& request,
+                                       int status, const char* data,
+                                       size_t actual_length) {
+  UrbTraceRecord record;
+  record.kind = URB_TRACE_RET_SUBMIT;
+  record.seqnum = request.seqnum;
+  record.devid = request.devid;
+  record.direction = request.direction;
+  record.ep = request.ep;
+  record.value = status;
+  record.length = actual_length;
+  record.interval = request.interval;
+  record.setup = request.setup;
+  // OUT completions carry a length but no data.
+  Append(&record, data, data != nullptr ? actual_length : 0);
+}
+
+void UrbTraceRecorder::RecordCmdUnlink(const USBIP_CMD_UNLINK& request) {
+  UrbTraceRecord record;
+  record.kind = URB_TRACE_CMD_UNLINK;
+  record.seqnum = request.seqnum;
+  record.devid = request.devid;
+  record.direction = request.direction;
+  record.ep = request.ep;
+  record.value = request.seqnum_urb;
+  record.length = 0;
+  record.interval = 0;
+  record.setup = 0;
+  Append(&record, nullptr, 0);
+}
+
+void UrbTraceRecorder::RecordRetUnlink(const USBIP_CMD_UNLINK& request,
+                                       int status) {
+  UrbTraceRecord record;
+  record.kind = URB_TRACE_RET_UNLINK;
+  record.seqnum = request.seqnum;
+  record.devid = request.devid;
+  record.direction = request.direction;
+  record.ep = request.ep;
+  record.value = status;
+  record.length = 0;
+  record.interval = 0;
+  record.setup = 0;
+  Append(&record, nullptr, 0);
+}
+
+void UrbTraceRecorder::Append(UrbTraceRecord* record, const char* payload,
+                              size_t payload_size) {
+  record->timestamp_ns = MonotonicNanos();
+  record->flags = 0;
+  record->reserved = 0;
+  record->digest = payload_size > 0 ? UrbPayloadDigest(payload, payload_size)
+                                    : 0;
+
+  size_t stored_payload = 0;
+  if (record_payloads_ && payload_size > 0 &&
+      AlignRecordSize(sizeof(*record) + payload_size) <= capacity_) {
+    stored_payload = payload_size;
+    record->flags |= kUrbTraceHasPayload;
+  }
+  size_t size = AlignRecordSize(sizeof(*record) + stored_payload);
+  record->size = size;
+
+  while (lock_.test_and_set(std::memory_order_acquire)) {
+  }
+
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  size_t position = head % capacity_;
+  size_t needed = size;
+  // Records never wrap; if there is not enough room before the end of the
+  // ring, the rest of it is filled with padding and the record goes first.
+  size_t padding = capacity_ - position < size ? capacity_ - position : 0;
+  needed += padding;
+
+  // Drop the oldest records until the new one fits.
+  while (tail < head && head + needed - tail > capacity_) {
+    const UrbTraceRecord* oldest =
+        reinterpret_cast<const UrbTraceRecord*>(ring_ + tail % capacity_);
+    tail += oldest->size;
+  }
+  if (head + needed - tail > capacity_) {
+    // Even an empty ring cannot hold the padding and the record together, so
+    // the new record becomes the only one.
+    tail = head + padding;
+  }
+  header_->tail.store(tail, std::memory_order_release);
+
+  if (padding > 0) {
+    UrbTraceRecord* filler =
+        reinterpret_cast<UrbTraceRecord*>(ring_ + position);
+    filler->size = padding;
+    filler->kind = URB_TRACE_PADDING;
+    head += padding;
+    position = 0;
+  }
+
+  memcpy(ring_ + position, record, sizeof(*record));
+  if (stored_payload > 0) {
+    memcpy(ring_ + position + sizeof(*record), payload, stored_payload);
+  }
+  header_->head.store(head + size, std::memory_order_release);
+
+  lock_.clear(std::memory_order_release);
+}
+
+// static
+std::unique_ptr<UrbTraceReader> UrbTraceReader::Open(const char* path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    printf("open(%s) error : %s\n", path, strerror(errno));
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0 ||
+      static_cast<size_t>(info.st_size) < kUrbTraceHeaderSize) {
+    printf("%s is not a trace file\n", path);
+    close(fd);
+    return nullptr;
+  }
+  void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    printf("mmap(%s) error : %s\n", path, strerror(errno));
+    return nullptr;
+  }
+
+  const UrbTraceFileHeader* header =
+      static_cast<const UrbTraceFileHeader*>(mapping);
+  if (memcmp(header->magic, kUrbTraceMagic, sizeof(kUrbTraceMagic)) != 0 ||
+      header->version != kUrbTraceVersion ||
+      kUrbTraceHeaderSize + header->capacity >
+          static_cast<size_t>(info.st_size)) {
+    printf("%s is not a trace file\n", path);
+    munmap(mapping, info.st_size);
+    return nullptr;
+  }
+  return std::unique_ptr<UrbTraceReader>(
+      new UrbTraceReader(static_cast<char*>(mapping), info.st_size));
+}
+
+UrbTraceReader::UrbTraceReader(char* mapping, size_t mapping_size)
+    : mapping_(mapping),
+      mapping_size_(mapping_size),
+      header_(reinterpret_cast<const UrbTraceFileHeader*>(mapping)),
+      ring_(mapping + kUrbTraceHeaderSize),
+      position_(header_->tail.load()),
+      end_(header_->head.load()) {}
+
+UrbTraceReader::~UrbTraceReader() { munmap(mapping_, mapping_size_); }
+
+const UrbTraceRecord* UrbTraceReader::Next() {
+  while (position_ < end_) {
+    const UrbTraceRecord* record = reinterpret_cast<const UrbTraceRecord*>(
+        ring_ + position_ % header_->capacity);
+    if (record->size == 0) {
+      printf("corrupt trace record at offset %llu\n",
+             (unsigned long long)position_);
+      position_ = end_;
+      return nullptr;
+    }
+    position_ += record->size;
+    if (record->kind != URB_TRACE_PADDING) {
+      return record;
+    }
+  }
+  return nullptr;
+}
+
+UrbTraceRecorder* GetUrbTraceRecorder() { return g_recorder; }
+
+void SetUrbTraceRecorder(UrbTraceRecorder* recorder) { g_recorder = recorder; }
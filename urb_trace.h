@@ -0,0 +1,148 @@
+#ifndef __USBIP_URB_TRACE_H__
+#define __USBIP_URB_TRACE_H__
+
+#include "usbip.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Binary trace of the URB traffic of a server.
+//
+// Records are appended to a ring which lives in an mmap'd file, so recording
+// costs a timestamp, a payload digest and a copy into the page cache; the
+// kernel writes the file back in the background and the trace survives a crash
+// of the server. Once the ring is full the oldest records are overwritten.
+//
+// File layout: a UrbTraceFileHeader padded to kUrbTraceHeaderSize bytes,
+// followed by |capacity| bytes of ring. Each record is a UrbTraceRecord
+// optionally followed by the URB payload, padded to a multiple of 8 bytes.
+
+enum UrbTraceKind : uint16_t {
+  // Fills the space at the end of the ring which was too small for a record.
+  URB_TRACE_PADDING = 0,
+  URB_TRACE_CMD_SUBMIT = 1,
+  URB_TRACE_RET_SUBMIT = 2,
+  URB_TRACE_CMD_UNLINK = 3,
+  URB_TRACE_RET_UNLINK = 4,
+};
+
+// Set in UrbTraceRecord::flags when the payload follows the record.
+const uint16_t kUrbTraceHasPayload = 1;
+
+const char kUrbTraceMagic[8] = {'U', 'R', 'B', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t kUrbTraceVersion = 1;
+const size_t kUrbTraceHeaderSize = 4096;
+
+struct UrbTraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t capacity;
+  // Offsets are monotonic byte counts; the position within the ring is the
+  // offset modulo |capacity|. |tail| is the oldest record which is still
+  // intact and |head| is where the next record will be written.
+  std::atomic<uint64_t> tail;
+  std::atomic<uint64_t> head;
+};
+
+struct UrbTraceRecord {
+  // Size of the record including its payload and padding.
+  uint32_t size;
+  uint16_t kind;
+  uint16_t flags;
+  uint64_t timestamp_ns;
+  int32_t seqnum;
+  int32_t devid;
+  int32_t direction;
+  int32_t ep;
+  // transfer_flags for CMD_SUBMIT, status for RET_SUBMIT and RET_UNLINK, and
+  // the seqnum of the target URB for CMD_UNLINK.
+  int32_t value;
+  // transfer_buffer_length for CMD_SUBMIT, actual_length for RET_SUBMIT.
+  uint32_t length;
+  int32_t interval;
+  uint32_t reserved;
+  uint64_t setup;
+  uint64_t digest;
+};
+
+// Computes the digest which is stored for each payload.
+uint64_t UrbPayloadDigest(const char* data, size_t size);
+
+class UrbTraceRecorder {
+ public:
+  // Creates a recorder which writes to |path|, truncating it. The ring holds
+  // |capacity| bytes of records. If |record_payloads| is set the payload of
+  // each URB is stored along with its digest.
+  static std::unique_ptr<UrbTraceRecorder> Create(const char* path,
+                                                  size_t capacity,
+                                                  bool record_payloads);
+
+  ~UrbTraceRecorder();
+
+  UrbTraceRecorder(const UrbTraceRecorder&) = delete;
+  UrbTraceRecorder& operator=(const UrbTraceRecorder&) = delete;
+
+  // |request| is in host byte order.
+  void RecordCmdSubmit(const USBIP_CMD_SUBMIT& request, const char* data,
+                       size_t data_size);
+  void RecordRetSubmit(const USBIP_CMD_SUBMIT& request, int status,
+                       const char* data, size_t actual_length);
+  void RecordCmdUnlink(const USBIP_CMD_UNLINK& request);
+  void RecordRetUnlink(const USBIP_CMD_UNLINK& request, int status);
+
+ private:
+  UrbTraceRecorder(int fd, char* mapping, size_t capacity,
+                   bool record_payloads);
+
+  // Appends a record, copying |record| and |payload_size| bytes of |payload|
+  // into the ring.
+  void Append(UrbTraceRecord* record, const char* payload,
+              size_t payload_size);
+
+  int fd_;
+  char* mapping_;
+  UrbTraceFileHeader* header_;
+  char* ring_;
+  size_t capacity_;
+  bool record_payloads_;
+  // Serializes writers.
+  std::atomic_flag lock_;
+};
+
+// Iterates over the records of a trace file in the order they were written.
+class UrbTraceReader {
+ public:
+  // Returns nullptr if |path| is not a readable trace.
+  static std::unique_ptr<UrbTraceReader> Open(const char* path);
+
+  ~UrbTraceReader();
+
+  UrbTraceReader(const UrbTraceReader&) = delete;
+  UrbTraceReader& operator=(const UrbTraceReader&) = delete;
+
+  // Returns the next record, or nullptr once every record has been read. The
+  // payload, if any, immediately follows the returned record.
+  const UrbTraceRecord* Next();
+
+ private:
+  UrbTraceReader(char* mapping, size_t mapping_size);
+
+  char* mapping_;
+  size_t mapping_size_;
+  const UrbTraceFileHeader* header_;
+  const char* ring_;
+  uint64_t position_;
+  uint64_t end_;
+};
+
+// Returns the recorder which the protocol handlers write to, or nullptr if
+// tracing is disabled.
+UrbTraceRecorder* GetUrbTraceRecorder();
+
+// Installs |recorder| as the process-wide recorder. Ownership is not taken.
+void SetUrbTraceRecorder(UrbTraceRecorder* recorder);
+
+#endif  // __USBIP_URB_TRACE_H__
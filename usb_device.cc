@@ -0,0 +1,632 @@
+#include "usb_device.h"
+
+#include "buffer_pool.h"
+#include "control_dispatch.h"
+#include "device_descriptors.h"
+#include "probes.h"
+#include "usbip.h"
+#include "usbip-constants.h"
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Appends the |size| bytes of |descriptor| to |blob|.
+void AppendDescriptor(const void* descriptor, size_t size,
+                      std::vector<char>* blob) {
+  const char* bytes = static_cast<const char*>(descriptor);
+  blob->insert(blob->end(), bytes, bytes + size);
+}
+
+// Endpoint transfer types, from bits 0 and 1 of bmAttributes.
+const int kBulkEndpoint = 2;
+const int kInterruptEndpoint = 3;
+
+// Returns the bInterval of a high-speed or SuperSpeed interrupt endpoint which
+// is polled at least every |interval_ms| milliseconds. At those speeds the
+// period is 2^(bInterval - 1) microframes of 125us.
+byte ExponentialInterval(int interval_ms) {
+  int microframes = (interval_ms > 0 ? interval_ms : 1) * 8;
+  byte interval = 1;
+  while (interval < 16 && (1 << interval) <= microframes) {
+    ++interval;
+  }
+  return interval;
+}
+
+}  // namespace
+
+UsbDevice::UsbDevice(
+    const USB_DEVICE_DESCRIPTOR& device_descriptor,
+    const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+    const std::vector<std::vector<char>>& strings,
+    const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
+    const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints)
+    : event_loop_(nullptr),
+      timer_wheel_(nullptr),
+      device_descriptor_(device_descriptor),
+      full_speed_device_descriptor_(device_descriptor),
+      speed_(UsbSpeed::kFull),
+      strings_(strings),
+      active_configuration_(-1),
+      attached_(false),
+      device_thread_(nullptr),
+      max_transfer_size_(kDefaultMaxTransferSize) {
+  SetAddress(1, 1);
+  AddConfiguration(configuration_descriptor, interfaces, endpoints);
+}
+
+void UsbDevice::AddConfiguration(
+    const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+    const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
+    const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints) {
+  UsbConfiguration configuration;
+  configuration.descriptor = configuration_descriptor;
+  size_t endpoint = 0;
+  for (const auto& interface : interfaces) {
+    auto& alternates = configuration.interfaces;
+    if (interface.bInterfaceNumber >= alternates.size()) {
+      alternates.resize(interface.bInterfaceNumber + 1);
+    }
+    auto& settings = alternates[interface.bInterfaceNumber];
+    if (interface.bAlternateSetting != settings.size() ||
+        endpoint + interface.bNumEndpoints > endpoints.size()) {
+      printf("Invalid descriptors for interface %u alternate setting %u\n",
+             interface.bInterfaceNumber, interface.bAlternateSetting);
+      exit(1);
+    }
+    UsbAlternateSetting setting;
+    setting.interface = interface;
+    setting.given_endpoints.assign(
+        endpoints.begin() + endpoint,
+        endpoints.begin() + endpoint + interface.bNumEndpoints);
+    for (const auto& descriptor : setting.given_endpoints) {
+      setting.endpoints.push_back(EndpointForSpeed(descriptor, speed_));
+    }
+    endpoint += interface.bNumEndpoints;
+    settings.push_back(setting);
+  }
+  for (const auto& settings : configuration.interfaces) {
+    if (settings.empty()) {
+      printf("Interfaces of configuration %u are not numbered consecutively\n",
+             configuration_descriptor.bConfigurationValue);
+      exit(1);
+    }
+    configuration.default_interfaces.push_back(settings[0].interface);
+  }
+  configuration.descriptor.bNumInterfaces = configuration.interfaces.size();
+  BuildBlob(&configuration);
+
+  configurations_.push_back(configuration);
+  full_speed_device_descriptor_.bNumConfigurations = configurations_.size();
+  BuildSpeedDescriptors();
+  // The device starts out in its first configuration, as it would be after
+  // enumeration.
+  SelectConfiguration(0);
+}
+
+void UsbDevice::BuildBlob(UsbConfiguration* configuration) const {
+  std::vector<char>& blob = configuration->blob;
+  blob.clear();
+  AppendDescriptor(&configuration->descriptor,
+                   configuration->descriptor.bLength, &blob);
+  // Each alternate setting is followed by its class-specific descriptor and
+  // its endpoints. At SuperSpeed every endpoint has a companion descriptor.
+  for (const auto& settings : configuration->interfaces) {
+    for (const auto& setting : settings) {
+      AppendDescriptor(&setting.interface, setting.interface.bLength, &blob);
+      AppendDescriptor(setting.class_descriptor.data(),
+                       setting.class_descriptor.size(), &blob);
+      for (const auto& endpoint : setting.endpoints) {
+        AppendDescriptor(&endpoint, endpoint.bLength, &blob);
+        if (speed_ != UsbSpeed::kSuper) {
+          continue;
+        }
+        USB_SS_ENDPOINT_COMPANION_DESCRIPTOR companion = {
+            sizeof(companion), USB_DESCRIPTOR_SS_ENDPOINT_COMPANION, 0, 0, 0};
+        if ((endpoint.bmAttributes & 3) == kInterruptEndpoint) {
+          companion.wBytesPerInterval = endpoint.wMaxPacketSize;
+        }
+        AppendDescriptor(&companion, sizeof(companion), &blob);
+      }
+    }
+  }
+  configuration->descriptor.wTotalLength = blob.size();
+  memcpy(blob.data(), &configuration->descriptor,
+         configuration->descriptor.bLength);
+
+  // A high-speed device also describes how it would be configured at full
+  // speed.
+  std::vector<char>& other = configuration->other_speed_blob;
+  other.clear();
+  if (speed_ != UsbSpeed::kHigh) {
+    return;
+  }
+  USB_CONFIGURATION_DESCRIPTOR other_descriptor = configuration->descriptor;
+  other_descriptor.bDescriptorType = USB_DESCRIPTOR_OTHER_SPEED;
+  AppendDescriptor(&other_descriptor, other_descriptor.bLength, &other);
+  for (const auto& settings : configuration->interfaces) {
+    for (const auto& setting : settings) {
+      AppendDescriptor(&setting.interface, setting.interface.bLength, &other);
+      AppendDescriptor(setting.class_descriptor.data(),
+                       setting.class_descriptor.size(), &other);
+      for (const auto& endpoint : setting.given_endpoints) {
+        USB_ENDPOINT_DESCRIPTOR full_speed =
+            EndpointForSpeed(endpoint, UsbSpeed::kFull);
+        AppendDescriptor(&full_speed, full_speed.bLength, &other);
+      }
+    }
+  }
+  other_descriptor.wTotalLength = other.size();
+  memcpy(other.data(), &other_descriptor, other_descriptor.bLength);
+}
+
+void UsbDevice::SetSpeed(UsbSpeed speed) {
+  speed_ = speed;
+  for (auto& configuration : configurations_) {
+    for (auto& settings : configuration.interfaces) {
+      for (auto& setting : settings) {
+        for (size_t i = 0; i < setting.endpoints.size(); ++i) {
+          setting.endpoints[i] =
+              EndpointForSpeed(setting.given_endpoints[i], speed);
+        }
+      }
+    }
+    BuildBlob(&configuration);
+  }
+  BuildSpeedDescriptors();
+}
+
+USB_ENDPOINT_DESCRIPTOR UsbDevice::EndpointForSpeed(
+    const USB_ENDPOINT_DESCRIPTOR& endpoint, UsbSpeed speed) {
+  USB_ENDPOINT_DESCRIPTOR result = endpoint;
+  switch (endpoint.bmAttributes & 3) {
+    case kBulkEndpoint:
+      // Full-speed bulk endpoints use at most 64 byte packets, while they
+      // must use exactly 512 bytes at high speed and 1024 at SuperSpeed.
+      // bInterval only describes the NAK rate at high speed.
+      if (speed == UsbSpeed::kFull) {
+        if (result.wMaxPacketSize > 64) {
+          result.wMaxPacketSize = 64;
+        }
+      } else {
+        result.wMaxPacketSize = speed == UsbSpeed::kSuper ? 1024 : 512;
+        result.bInterval = 0;
+      }
+      break;
+    case kInterruptEndpoint:
+      if (speed != UsbSpeed::kFull) {
+        result.bInterval = ExponentialInterval(endpoint.bInterval);
+      }
+      break;
+    default:
+      break;
+  }
+  return result;
+}
+
+void UsbDevice::BuildSpeedDescriptors() {
+  device_descriptor_ = full_speed_device_descriptor_;
+  device_qualifier_.clear();
+  bos_.clear();
+  switch (speed_) {
+    case UsbSpeed::kFull:
+      // A full-speed only device stalls the device qualifier request.
+      break;
+    case UsbSpeed::kHigh: {
+      device_descriptor_.bcdUSB = 0x0200;
+      device_descriptor_.bMaxPacketSize0 = 64;
+      // The qualifier describes the device at the other speed, full speed.
+      USB_DEVICE_QUALIFIER_DESCRIPTOR qualifier = {
+          sizeof(qualifier),
+          USB_DESCRIPTOR_DEVICE_QUALIFIER,
+          0x0200,
+          device_descriptor_.bDeviceClass,
+          device_descriptor_.bDeviceSubClass,
+          device_descriptor_.bDeviceProtocol,
+          full_speed_device_descriptor_.bMaxPacketSize0,
+          device_descriptor_.bNumConfigurations,
+          0,
+      };
+      AppendDescriptor(&qualifier, sizeof(qualifier), &device_qualifier_);
+      break;
+    }
+    case UsbSpeed::kSuper: {
+      // At SuperSpeed bMaxPacketSize0 is an exponent: 2^9 = 512 bytes. A
+      // device operating at SuperSpeed has no device qualifier, but must
+      // provide a BOS.
+      device_descriptor_.bcdUSB = 0x0320;
+      device_descriptor_.bMaxPacketSize0 = 9;
+      USB_BOS_DESCRIPTOR bos = {sizeof(bos), USB_DESCRIPTOR_BOS, 0, 2};
+      // Link power management is supported.
+      USB_2_0_EXTENSION_CAPABILITY usb2 = {
+          sizeof(usb2), USB_DESCRIPTOR_DEVICE_CAPABILITY,
+          USB_CAPABILITY_USB_2_0_EXTENSION, 0x00000002};
+      // Full, high and SuperSpeed are supported and the device is fully
+      // functional from full speed up.
+      USB_SUPERSPEED_CAPABILITY superspeed = {
+          sizeof(superspeed), USB_DESCRIPTOR_DEVICE_CAPABILITY,
+          USB_CAPABILITY_SUPERSPEED_USB, 0, 0x000E, 1, 0x0A, 0x0020};
+      bos.wTotalLength = sizeof(bos) + sizeof(usb2) + sizeof(superspeed);
+      AppendDescriptor(&bos, sizeof(bos), &bos_);
+      AppendDescriptor(&usb2, sizeof(usb2), &bos_);
+      AppendDescriptor(&superspeed, sizeof(superspeed), &bos_);
+      break;
+    }
+  }
+}
+
+void UsbDevice::SetAddress(int busnum, int port) {
+  busnum_ = busnum;
+  // Address 1 belongs to the root hub.
+  devnum_ = port + 1;
+  snprintf(bus_id_, sizeof(bus_id_), "%d-%d", busnum, port);
+  snprintf(usb_path_, sizeof(usb_path_),
+           "/sys/devices/pci0000:00/0000:00:01.2/usb%d/%s", busnum, bus_id_);
+}
+
+size_t UsbDevice::MaxPayloadSize(const USBIP_CMD_SUBMIT& usb_request) const {
+  if (usb_request.ep == 0) {
+    return CreateStandardDeviceRequest(usb_request.setup).wLength;
+  }
+  return max_transfer_size_;
+}
+
+void UsbDevice::SetClassDescriptor(int interface,
+                                   const std::vector<char>& descriptor) {
+  for (auto& configuration : configurations_) {
+    if (static_cast<size_t>(interface) >= configuration.interfaces.size()) {
+      continue;
+    }
+    for (auto& setting : configuration.interfaces[interface]) {
+      setting.class_descriptor = descriptor;
+    }
+    BuildBlob(&configuration);
+  }
+}
+
+void UsbDevice::Detach() {
+  SelectConfiguration(0);
+}
+
+void UsbDevice::SelectConfiguration(int configuration) {
+  active_configuration_ = configuration;
+  for (auto& endpoint : endpoint_map_) {
+    endpoint = {nullptr, -1, -1};
+  }
+  alternate_settings_.clear();
+  if (configuration < 0) {
+    return;
+  }
+  alternate_settings_.resize(configurations_[configuration].interfaces.size());
+  for (size_t i = 0; i < alternate_settings_.size(); ++i) {
+    SelectAlternateSetting(i, 0);
+  }
+}
+
+void UsbDevice::SelectAlternateSetting(int interface, int alternate_setting) {
+  // Only the slots of this interface change; the endpoints of the other
+  // interfaces stay bound.
+  for (auto& endpoint : endpoint_map_) {
+    if (endpoint.interface == interface) {
+      endpoint = {nullptr, -1, -1};
+    }
+  }
+  alternate_settings_[interface] = alternate_setting;
+  const UsbAlternateSetting& setting =
+      configurations_[active_configuration_]
+          .interfaces[interface][alternate_setting];
+  for (const auto& endpoint : setting.endpoints) {
+    int direction = (endpoint.bEndpointAddress & 0x80) ? 1 : 0;
+    endpoint_map_[EndpointSlot(endpoint.bEndpointAddress, direction)] = {
+        &endpoint, interface, alternate_setting};
+  }
+}
+
+void UsbDevice::HandleUsbRequest(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const char* data, unsigned int data_size) {
+  USBIP_PROBE4(urb_dispatch, usb_request.seqnum, usb_request.ep,
+               usb_request.direction, data_size);
+  // Endpoint 0 is used for USB control requests.
+  if (usb_request.ep == 0) {
+    LogRequest("# control requests\n");
+    HandleUsbControl(transport, usb_request, data, data_size);
+    return;
+  }
+  LogRequest("# data requests\n");
+  if (active_endpoint(usb_request.ep, usb_request.direction).descriptor ==
+      nullptr) {
+    printf("Endpoint %d is not active, stalling\n", usb_request.ep);
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  HandleDataRequest(transport, usb_request, data, data_size);
+}
+
+void UsbDevice::HandleUsbControl(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const char* data, unsigned int data_size) {
+  static constexpr ControlHandler<UsbDevice> kHandlers[] = {
+      {STANDARD_TYPE, kAnyRecipient, GET_STATUS, kAnyDescriptor,
+       &UsbDevice::HandleGetStatus},
+      {STANDARD_TYPE, RECIPIENT_ENDPOINT, CLEAR_FEATURE, kAnyDescriptor,
+       &UsbDevice::HandleClearFeature},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR, USB_DESCRIPTOR_DEVICE,
+       &UsbDevice::HandleGetDeviceDescriptor},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR,
+       USB_DESCRIPTOR_CONFIGURATION,
+       &UsbDevice::HandleGetConfigurationDescriptor},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR, USB_DESCRIPTOR_STRING,
+       &UsbDevice::HandleGetStringDescriptor},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR,
+       USB_DESCRIPTOR_DEVICE_QUALIFIER, &UsbDevice::HandleGetDeviceQualifier},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR,
+       USB_DESCRIPTOR_OTHER_SPEED,
+       &UsbDevice::HandleGetOtherSpeedConfiguration},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_DESCRIPTOR, USB_DESCRIPTOR_BOS,
+       &UsbDevice::HandleGetBos},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, GET_CONFIGURATION, kAnyDescriptor,
+       &UsbDevice::HandleGetConfiguration},
+      {STANDARD_TYPE, RECIPIENT_DEVICE, SET_CONFIGURATION, kAnyDescriptor,
+       &UsbDevice::HandleSetConfiguration},
+      {STANDARD_TYPE, RECIPIENT_INTERFACE, GET_INTERFACE, kAnyDescriptor,
+       &UsbDevice::HandleGetInterface},
+      {STANDARD_TYPE, RECIPIENT_INTERFACE, SET_INTERFACE, kAnyDescriptor,
+       &UsbDevice::HandleSetInterface},
+  };
+
+  StandardDeviceRequest control_request =
+      CreateStandardDeviceRequest(usb_request.setup);
+  USBIP_PROBE5(control_dispatch, usb_request.seqnum,
+               control_request.bmRequestType, control_request.bRequest,
+               control_request.wValue1 << 8 | control_request.wValue0,
+               control_request.wLength);
+  print_standard_device_request(control_request);
+  if (DispatchControl(this, kHandlers, transport, usb_request, control_request,
+                      data, data_size) ||
+      HandleClassControl(transport, usb_request, control_request, data,
+                         data_size)) {
+    return;
+  }
+
+  // Without a reply the host would wait for its control timeout, which costs
+  // seconds during enumeration, so unsupported requests are stalled at once.
+  printf("Stalling unsupported request 0x%02X type %d\n",
+         control_request.bRequest,
+         GetControlType(control_request.bmRequestType));
+  SendUsbStall(transport, usb_request);
+}
+
+void UsbDevice::HandleGetStatus(Transport* transport,
+                                const USBIP_CMD_SUBMIT& usb_request,
+                                const StandardDeviceRequest& control_request,
+                                const char* data, unsigned int data_size) {
+  LogRequest("HandleGetStatus %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  // Bit 0 of the device status is "self powered", which follows the
+  // configuration's bmAttributes. Interfaces and endpoints report 0, as no
+  // endpoint is ever halted.
+  word status = 0;
+  if (GetControlRecipient(control_request.bmRequestType) == RECIPIENT_DEVICE &&
+      (configuration_descriptor().bmAttributes & 0x40)) {
+    status = 1;
+  }
+  SendUsbRequest(transport, usb_request, (const char*)&status, sizeof(status),
+                 0);
+}
+
+void UsbDevice::HandleClearFeature(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleClearFeature %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  // The host clears ENDPOINT_HALT after a stall. Endpoints never stay halted,
+  // so there is nothing to clear.
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
+
+void UsbDevice::HandleGetDeviceDescriptor(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetDeviceDescriptor %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  unsigned int length = device_descriptor_.bLength;
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, (char*)&device_descriptor_, length, 0);
+}
+
+void UsbDevice::HandleGetConfigurationDescriptor(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetConfigurationDescriptor %u[%u]\n",
+             control_request.wValue1, control_request.wValue0);
+
+  // The descriptor index selects the configuration. Hosts first ask for the
+  // 9 byte header to learn wTotalLength, so the blob is truncated to wLength.
+  size_t index = control_request.wValue0;
+  if (index >= configurations_.size()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  const std::vector<char>& blob = configurations_[index].blob;
+  unsigned int length = blob.size();
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, blob.data(), length, 0);
+}
+
+void UsbDevice::HandleGetDeviceQualifier(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetDeviceQualifier %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  if (device_qualifier_.empty()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  unsigned int length = device_qualifier_.size();
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, device_qualifier_.data(), length, 0);
+}
+
+void UsbDevice::HandleGetOtherSpeedConfiguration(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetOtherSpeedConfiguration %u[%u]\n",
+             control_request.wValue1, control_request.wValue0);
+
+  size_t index = control_request.wValue0;
+  if (index >= configurations_.size() ||
+      configurations_[index].other_speed_blob.empty()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  const std::vector<char>& blob = configurations_[index].other_speed_blob;
+  unsigned int length = blob.size();
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, blob.data(), length, 0);
+}
+
+void UsbDevice::HandleGetBos(Transport* transport,
+                             const USBIP_CMD_SUBMIT& usb_request,
+                             const StandardDeviceRequest& control_request,
+                             const char* data, unsigned int data_size) {
+  LogRequest("HandleGetBos %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  if (bos_.empty()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  unsigned int length = bos_.size();
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, bos_.data(), length, 0);
+}
+
+void UsbDevice::HandleGetStringDescriptor(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetStringDescriptor %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  size_t index = control_request.wValue0;
+  if (index >= strings_.size()) {
+    printf("Unknown string descriptor %zu\n", index);
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  int string_length = (strings_[index][0] / 2) - 1;
+  if (index != 0) {
+    char str[255];
+    memset(str, 0, 255);
+    for (int i = 0; i < string_length; ++i) {
+      str[i] = strings_[index][i * 2 + 2];
+    }
+    LogRequest("String (%s)\n", str);
+  }
+  int length = strings_[index][0];
+  if (control_request.wLength < length) {
+    length = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, strings_[index].data(), length, 0);
+}
+
+void UsbDevice::HandleGetConfiguration(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetConfiguration %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  byte value = 0;
+  if (active_configuration_ >= 0) {
+    value = configurations_[active_configuration_].descriptor
+                .bConfigurationValue;
+  }
+  SendUsbRequest(transport, usb_request, (const char*)&value, 1, 0);
+}
+
+void UsbDevice::HandleSetConfiguration(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleSetConfiguration %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  // A value of 0 returns the device to the unconfigured state.
+  int configuration = -1;
+  if (control_request.wValue0 != 0) {
+    for (size_t i = 0; i < configurations_.size(); ++i) {
+      if (configurations_[i].descriptor.bConfigurationValue ==
+          control_request.wValue0) {
+        configuration = i;
+        break;
+      }
+    }
+    if (configuration < 0) {
+      SendUsbStall(transport, usb_request);
+      return;
+    }
+  }
+  SelectConfiguration(configuration);
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
+
+void UsbDevice::HandleGetInterface(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetInterface %u[%u]\n", control_request.wIndex1,
+             control_request.wIndex0);
+
+  size_t interface = control_request.wIndex0;
+  if (interface >= alternate_settings_.size()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  byte value = alternate_settings_[interface];
+  SendUsbRequest(transport, usb_request, (const char*)&value, 1, 0);
+}
+
+void UsbDevice::HandleSetInterface(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleSetInterface %u[%u]\n", control_request.wIndex0,
+             control_request.wValue0);
+
+  size_t interface = control_request.wIndex0;
+  size_t alternate_setting = control_request.wValue0;
+  if (interface >= alternate_settings_.size() ||
+      alternate_setting >=
+          configurations_[active_configuration_].interfaces[interface].size()) {
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  SelectAlternateSetting(interface, alternate_setting);
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
+}
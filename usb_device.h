@@ -0,0 +1,370 @@
+#ifndef __USBIP_USB_DEVICE_H__
+#define __USBIP_USB_DEVICE_H__
+
+#include "device_descriptors.h"
+#include "event_loop.h"
+#include "spool.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "usbip-constants.h"
+#include "usbip.h"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+class DeviceThread;
+
+// A URB which has been submitted by the host but not yet completed.
+struct PendingUrb {
+  Transport* transport;
+  USBIP_CMD_SUBMIT request;
+};
+
+// The speed at which a device operates. The values are those of the kernel's
+// enum usb_device_speed, which usbip reports to clients.
+enum class UsbSpeed {
+  kFull = 2,
+  kHigh = 3,
+  kSuper = 5,
+};
+
+// Endpoint addresses are mapped to slots 0-15 for OUT and 16-31 for IN.
+const int kMaxEndpoints = 32;
+
+// Default for the largest payload which a client may send with one URB to a
+// data endpoint. It is the largest size class of the BufferPool, so payloads
+// never need a mapping of their own.
+const size_t kDefaultMaxTransferSize = 1 << 20;
+
+// One alternate setting of an interface.
+struct UsbAlternateSetting {
+  USB_INTERFACE_DESCRIPTOR interface;
+  // Class-specific descriptor placed between the interface and its endpoints.
+  std::vector<char> class_descriptor;
+  // The endpoints as they are described at the device's current speed.
+  std::vector<USB_ENDPOINT_DESCRIPTOR> endpoints;
+  // The endpoints as they were given.
+  std::vector<USB_ENDPOINT_DESCRIPTOR> given_endpoints;
+};
+
+// A configuration along with every alternate setting of its interfaces.
+struct UsbConfiguration {
+  USB_CONFIGURATION_DESCRIPTOR descriptor;
+  // Indexed by bInterfaceNumber and then by bAlternateSetting.
+  std::vector<std::vector<UsbAlternateSetting>> interfaces;
+  // The default alternate setting of each interface, as listed by usbip.
+  std::vector<USB_INTERFACE_DESCRIPTOR> default_interfaces;
+  // The complete descriptor returned by GET_DESCRIPTOR. It is rebuilt only
+  // when the descriptors change, never per request.
+  std::vector<char> blob;
+  // The other-speed configuration descriptor of a high-speed device, which
+  // describes the configuration at full speed. Empty at other speeds.
+  std::vector<char> other_speed_blob;
+};
+
+// The endpoint which is bound to an address by the current configuration and
+// alternate settings.
+struct ActiveEndpoint {
+  // Null if no active alternate setting has an endpoint at the address.
+  const USB_ENDPOINT_DESCRIPTOR* descriptor;
+  int interface;
+  int alternate_setting;
+};
+
+// Base class of every emulated USB device.
+//
+// The base class owns the descriptors and answers the standard control
+// requests which only depend on them (GET_STATUS, GET_DESCRIPTOR,
+// GET/SET_CONFIGURATION, GET/SET_INTERFACE and CLEAR_FEATURE). Subclasses
+// implement the class-specific control requests and the data endpoints.
+// Control requests which nobody handles are stalled straight away.
+//
+// A device can have several configurations and each interface several
+// alternate settings. The descriptors of each configuration are serialized
+// once up front, and the endpoints of the active alternate settings are kept
+// in a table indexed by endpoint address, so selecting a configuration or an
+// alternate setting only touches the endpoints which change.
+class UsbDevice {
+ public:
+  // Creates a device with a single configuration. |interfaces| lists every
+  // alternate setting of every interface, and |endpoints| lists the endpoints
+  // of each of them in the same order. Alternate settings of one interface
+  // must be numbered consecutively from 0. Further configurations can be
+  // added with AddConfiguration().
+  UsbDevice(const USB_DEVICE_DESCRIPTOR& device_descriptor,
+            const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+            const std::vector<std::vector<char>>& strings,
+            const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
+            const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints);
+  virtual ~UsbDevice() = default;
+
+  UsbDevice(const UsbDevice&) = delete;
+  UsbDevice& operator=(const UsbDevice&) = delete;
+
+  const USB_DEVICE_DESCRIPTOR& device_descriptor() const {
+    return device_descriptor_;
+  }
+
+  // The descriptor of the active configuration, or of the first one while the
+  // device is unconfigured.
+  const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor() const {
+    return current_configuration().descriptor;
+  }
+
+  const std::vector<std::vector<char>>& strings() const { return strings_; }
+
+  // The default alternate setting of each interface of the configuration
+  // returned by configuration_descriptor().
+  const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces() const {
+    return current_configuration().default_interfaces;
+  }
+
+  const std::vector<UsbConfiguration>& configurations() const {
+    return configurations_;
+  }
+
+  UsbSpeed speed() const { return speed_; }
+
+  // Describes the device as operating at |speed|. The descriptors passed to
+  // the constructor describe full-speed operation. Bulk packet sizes are
+  // brought within the limits of each speed, and at high speed and SuperSpeed
+  // bcdUSB, the EP0 packet size and interrupt intervals are rewritten to the
+  // values a real device would report, and
+  // the device qualifier, other-speed configuration, BOS and SuperSpeed
+  // endpoint companion descriptors are provided as appropriate. Must be
+  // called before the device is attached.
+  void SetSpeed(UsbSpeed speed);
+
+  // The location of the device on the virtual bus, as reported to clients.
+  int busnum() const { return busnum_; }
+  int devnum() const { return devnum_; }
+  const char* bus_id() const { return bus_id_; }
+  const char* usb_path() const { return usb_path_; }
+
+  // Places the device on |port| of bus |busnum|. Called by the registry.
+  void SetAddress(int busnum, int port);
+
+  // Whether a client currently has the device imported.
+  bool attached() const { return attached_; }
+
+  // Called when a client imports the device.
+  void Attach() { attached_ = true; }
+
+  // Called when the client which imported the device disconnects, so that
+  // another client can import it. The device itself is reset by Detach().
+  void Release() { attached_ = false; }
+
+  // Returns the device to its first configuration once the client which
+  // imported it has gone. Subclasses drop whatever was in flight and must call
+  // the base implementation. A device on a DeviceThread is detached on that
+  // thread, possibly after another client has imported it again, but before
+  // any request of the new client reaches it.
+  virtual void Detach();
+
+  // Sets the largest payload which a client may send with one URB to a data
+  // endpoint.
+  void SetMaxTransferSize(size_t size) { max_transfer_size_ = size; }
+
+  // The largest payload which may accompany the OUT request |usb_request|.
+  // Control requests carry at most the wLength of their SETUP packet. A
+  // client which sends more is not served any further.
+  size_t MaxPayloadSize(const USBIP_CMD_SUBMIT& usb_request) const;
+
+  // Sets the loop used to schedule deferred URB completions.
+  void SetEventLoop(EventLoop* event_loop) { event_loop_ = event_loop; }
+
+  // Sets the wheel used to complete URBs on periodic endpoints.
+  void SetTimerWheel(TimerWheel* timer_wheel) { timer_wheel_ = timer_wheel; }
+
+  // The thread which emulates the device, or nullptr if it runs on the thread
+  // which serves its client. Set by DeviceThread::AddDevice().
+  DeviceThread* device_thread() const { return device_thread_; }
+  void SetDeviceThread(DeviceThread* thread) { device_thread_ = thread; }
+
+  // Determines whether |usb_request| is either a control or data request and
+  // defers to the corresponding function. |data| contains the |data_size|
+  // bytes of payload which accompanied an OUT request.
+  void HandleUsbRequest(Transport* transport,
+                        const USBIP_CMD_SUBMIT& usb_request, const char* data,
+                        unsigned int data_size);
+
+  // Returns the spool which takes the payload of the OUT request
+  // |usb_request|, or nullptr if the payload is passed to HandleUsbRequest().
+  // Spooled payloads reach HandleUsbRequest() as null |data| with the
+  // payload's |data_size|. Called on the thread which serves the client, so
+  // the answer must not depend on state which handling requests changes.
+  virtual Spool* SpoolFor(const USBIP_CMD_SUBMIT& usb_request) {
+    return nullptr;
+  }
+
+  // Removes the pending URB with |seqnum| without completing it. Returns true
+  // if such a URB was pending.
+  virtual bool UnlinkUrb(int seqnum) { return false; }
+
+ protected:
+  // Handles the control requests which are specific to the device class,
+  // including class descriptors fetched with a standard GET_DESCRIPTOR.
+  // Implementations dispatch through their own ControlHandler table. |data|
+  // holds the data stage of an OUT request. Returns false if the request is
+  // not supported, in which case it is stalled.
+  virtual bool HandleClassControl(Transport* transport,
+                                  const USBIP_CMD_SUBMIT& usb_request,
+                                  const StandardDeviceRequest& control_request,
+                                  const char* data,
+                                  unsigned int data_size) = 0;
+
+  // Handles a request for any endpoint other than endpoint 0.
+  virtual void HandleDataRequest(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const char* data, unsigned int data_size) = 0;
+
+  // Adds another configuration, described like the one passed to the
+  // constructor.
+  void AddConfiguration(
+      const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+      const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
+      const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints);
+
+  // Sets the class-specific descriptor which is placed between the descriptor
+  // of each alternate setting of |interface| and its endpoints.
+  void SetClassDescriptor(int interface, const std::vector<char>& descriptor);
+
+  // Returns the endpoint which is active at |ep| in |direction| (1 for IN).
+  const ActiveEndpoint& active_endpoint(int ep, int direction) const {
+    return endpoint_map_[EndpointSlot(ep, direction)];
+  }
+
+  // Returns the selected alternate setting of |interface| in the active
+  // configuration.
+  int alternate_setting(int interface) const {
+    return alternate_settings_[interface];
+  }
+
+  EventLoop* event_loop_;
+  TimerWheel* timer_wheel_;
+
+ private:
+  static int EndpointSlot(int ep, int direction) {
+    return (direction ? 16 : 0) | (ep & 0x0F);
+  }
+
+  const UsbConfiguration& current_configuration() const {
+    int configuration = active_configuration_;
+    return configurations_[configuration >= 0 ? configuration : 0];
+  }
+
+  // Serializes the descriptors of |configuration| into its blobs for the
+  // current speed.
+  void BuildBlob(UsbConfiguration* configuration) const;
+
+  // Returns |endpoint|, as given to the constructor, as it is described at
+  // |speed|.
+  static USB_ENDPOINT_DESCRIPTOR EndpointForSpeed(
+      const USB_ENDPOINT_DESCRIPTOR& endpoint, UsbSpeed speed);
+
+  // Rebuilds the speed-dependent device-level descriptors.
+  void BuildSpeedDescriptors();
+
+  // Makes |configuration| active, or leaves the device unconfigured if it is
+  // -1, with every interface in its default alternate setting.
+  void SelectConfiguration(int configuration);
+
+  // Rebinds the endpoints of |interface| to those of |alternate_setting|.
+  void SelectAlternateSetting(int interface, int alternate_setting);
+
+  // Routes |usb_request| to the handler of the standard request, then to the
+  // subclass, and stalls it if neither supports it.
+  void HandleUsbControl(Transport* transport,
+                        const USBIP_CMD_SUBMIT& usb_request, const char* data,
+                        unsigned int data_size);
+
+  // Handlers of the standard requests. Refer to USB 2.0 section 9.4.
+  void HandleGetStatus(Transport* transport,
+                       const USBIP_CMD_SUBMIT& usb_request,
+                       const StandardDeviceRequest& control_request,
+                       const char* data, unsigned int data_size);
+
+  void HandleClearFeature(Transport* transport,
+                          const USBIP_CMD_SUBMIT& usb_request,
+                          const StandardDeviceRequest& control_request,
+                          const char* data, unsigned int data_size);
+
+  void HandleGetDeviceDescriptor(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const StandardDeviceRequest& control_request,
+                                 const char* data, unsigned int data_size);
+
+  void HandleGetConfigurationDescriptor(
+      Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+      const StandardDeviceRequest& control_request, const char* data,
+      unsigned int data_size);
+
+  void HandleGetDeviceQualifier(Transport* transport,
+                                const USBIP_CMD_SUBMIT& usb_request,
+                                const StandardDeviceRequest& control_request,
+                                const char* data, unsigned int data_size);
+
+  void HandleGetOtherSpeedConfiguration(
+      Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+      const StandardDeviceRequest& control_request, const char* data,
+      unsigned int data_size);
+
+  void HandleGetBos(Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                    const StandardDeviceRequest& control_request,
+                    const char* data, unsigned int data_size);
+
+  void HandleGetStringDescriptor(Transport* transport,
+                                 const USBIP_CMD_SUBMIT& usb_request,
+                                 const StandardDeviceRequest& control_request,
+                                 const char* data, unsigned int data_size);
+
+  void HandleGetConfiguration(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request,
+                              const StandardDeviceRequest& control_request,
+                              const char* data, unsigned int data_size);
+
+  void HandleSetConfiguration(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request,
+                              const StandardDeviceRequest& control_request,
+                              const char* data, unsigned int data_size);
+
+  void HandleGetInterface(Transport* transport,
+                          const USBIP_CMD_SUBMIT& usb_request,
+                          const StandardDeviceRequest& control_request,
+                          const char* data, unsigned int data_size);
+
+  void HandleSetInterface(Transport* transport,
+                          const USBIP_CMD_SUBMIT& usb_request,
+                          const StandardDeviceRequest& control_request,
+                          const char* data, unsigned int data_size);
+
+  USB_DEVICE_DESCRIPTOR device_descriptor_;
+  // The device descriptor as it was given, describing full-speed operation.
+  USB_DEVICE_DESCRIPTOR full_speed_device_descriptor_;
+  UsbSpeed speed_;
+  // Empty when the device does not answer the corresponding request at its
+  // current speed.
+  std::vector<char> device_qualifier_;
+  std::vector<char> bos_;
+  std::vector<std::vector<char>> strings_;
+  std::vector<UsbConfiguration> configurations_;
+
+  // Index into |configurations_| of the active configuration, or -1 while the
+  // device is unconfigured. Atomic because the network thread reads it to
+  // describe a device which runs on a DeviceThread.
+  std::atomic<int> active_configuration_;
+  // The selected alternate setting of each interface.
+  std::vector<int> alternate_settings_;
+  ActiveEndpoint endpoint_map_[kMaxEndpoints];
+
+  int busnum_;
+  int devnum_;
+  char bus_id_[32];
+  char usb_path_[256];
+  bool attached_;
+  DeviceThread* device_thread_;
+  size_t max_transfer_size_;
+};
+
+#endif  // __USBIP_USB_DEVICE_H__
@@ -1,48 +1,27 @@
 #include "usb_printer.h"
 
+#include "buffer_pool.h"
+#include "control_dispatch.h"
 #include "device_descriptors.h"
+#include "monotonic_clock.h"
 #include "usbip.h"
 #include "usbip-constants.h"
 
-#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <utility>
 #include <vector>
 
-namespace {
-
-// Returns the numeric value of the "type" stored within the |bmRequestType|
-// bitmap.
-int GetControlType(byte bmRequestType) {
-  // The "type" of the request is stored within bits 5 and 6 of |bmRequestType|.
-  // So we shift these bits down to the least significant bits and perform a
-  // bitwise AND operation in order to clear any other bits and return strictly
-  // the number value of the type bits.
-  return (bmRequestType >> 5) & 3;
-}
+#include <cerrno>
 
-// Unpacks the standard USB SETUP packet contained within |setup| into a //
-// StandardDeviceRequest struct and returns the result.
-StandardDeviceRequest CreateStandardDeviceRequest(long long setup) {
-  StandardDeviceRequest request;
-  request.bmRequestType = (setup & 0xFF00000000000000) >> 56;
-  request.bRequest = (setup & 0x00FF000000000000) >> 48;
-  request.wValue0 = (setup & 0x0000FF0000000000) >> 40;
-  request.wValue1 = (setup & 0x000000FF00000000) >> 32;
-  request.wIndex0 = (setup & 0x00000000FF000000) >> 24;
-  request.wIndex1 = (setup & 0x0000000000FF0000) >> 16;
-  request.wLength = ntohs(setup & 0x000000000000FFFF);
-  return request;
-}
+namespace {
 
-// Fills |buffer| with the contents of |descriptor|.
-void FillBuffer(const char* descriptor, int size, char* buffer) {
-  for (int i = 0; i < size; ++i) {
-    buffer[i] = descriptor[i];
-  }
-}
+// Generation of the next printer to be created.
+std::atomic<uint64_t> g_next_generation(1);
 
 }  // namespace
 
-// explicit
 UsbPrinter::UsbPrinter(
     const USB_DEVICE_DESCRIPTOR& device_descriptor,
     const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
@@ -50,226 +29,396 @@ UsbPrinter::UsbPrinter(
     const std::vector<char> ieee_device_id,
     const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
     const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints)
-    : device_descriptor_(device_descriptor),
-      configuration_descriptor_(configuration_descriptor),
-      strings_(strings),
+    : UsbDevice(device_descriptor, configuration_descriptor, strings,
+                interfaces, endpoints),
       ieee_device_id_(ieee_device_id),
-      interfaces_(interfaces),
-      endpoints_(endpoints) {}
-
-void UsbPrinter::HandleUsbRequest(int sockfd,
-                                  const USBIP_CMD_SUBMIT& usb_request) {
-  // Endpoint 0 is used for USB control requests.
-  if (usb_request.ep == 0) {
-    printf("# control requests\n");
-    HandleUsbControl(sockfd, usb_request);
-  } else {
-    printf("# data requests\n");
+      comparing_(false),
+      splitting_(false),
+      spooled_bytes_(0),
+      next_job_id_(1),
+      engine_timer_(0),
+      generation_(g_next_generation.fetch_add(1)) {
+  state_.job_in_progress = false;
+  Reset();
+}
+
+void UsbPrinter::Reset() {
+  EndJob();
+  state_.in_head = 0;
+  state_.in_size = 0;
+  state_.pending_in_count = 0;
+  state_.pending_out_count = 0;
+  engine_.Flush(MonotonicNanos());
+  CancelEngineTimer();
+}
+
+void UsbPrinter::EndJob() {
+  if (state_.job_in_progress) {
+    PrintJobRecord& job = jobs_.back();
+    job.end_ns = MonotonicNanos();
+    if (splitting_.load(std::memory_order_relaxed)) {
+      job.framing = JobFormatName(boundaries_.format());
+    }
+    if (job.golden.Finish()) {
+      ReportDivergence(job);
+    }
+    if (job_callback_ && spool_ && job.bytes > 0 &&
+        spooled_bytes_ - job.spool_offset == job.bytes) {
+      job_callback_({bus_id(), generation_, job.id, spool_->path(),
+                     job.spool_offset, job.bytes});
+    }
   }
+  state_.job_in_progress = false;
+  state_.job_bytes = 0;
 }
 
-void UsbPrinter::HandleUsbControl(int sockfd,
-                                  const USBIP_CMD_SUBMIT& usb_request) {
-  StandardDeviceRequest control_request =
-      CreateStandardDeviceRequest(usb_request.setup);
-  print_standard_device_request(control_request);
-  int request_type = GetControlType(control_request.bmRequestType);
-  switch (request_type) {
-    case STANDARD_TYPE:
-      HandleStandardControl(sockfd, usb_request, control_request);
-      break;
-    case CLASS_TYPE:
-      HandlePrinterControl(sockfd, usb_request, control_request);
-      break;
-    case VENDOR_TYPE:
-    case RESERVED_TYPE:
-    default:
-      printf("Unable to handle request of type %d\n", request_type);
-      break;
+void UsbPrinter::SetGoldenFile(std::shared_ptr<const GoldenFile> golden) {
+  golden_ = std::move(golden);
+  comparing_.store(golden_ != nullptr, std::memory_order_relaxed);
+}
+
+void UsbPrinter::SetJobSplitting(bool splitting) {
+  splitting_.store(splitting, std::memory_order_relaxed);
+}
+
+void UsbPrinter::ReportDivergence(const PrintJobRecord& job) const {
+  printf("Job %d on %s diverges from %s at byte %llu\n", job.id, bus_id(),
+         job.golden.golden()->path().c_str(),
+         static_cast<unsigned long long>(job.golden.divergence()));
+}
+
+void UsbPrinter::SetJobResults(int id, std::vector<JobStageResult> results) {
+  for (PrintJobRecord& job : jobs_) {
+    if (job.id == id) {
+      job.results = std::move(results);
+      return;
+    }
   }
 }
 
-void UsbPrinter::HandleStandardControl(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  switch (control_request.bRequest) {
-    case GET_STATUS:
-      break;
-    case GET_DESCRIPTOR:
-      HandleGetDescriptor(sockfd, usb_request, control_request);
-      break;
-    case SET_DESCRIPTOR:
-      break;
-    case GET_CONFIGURATION:
-      HandleGetConfiguration(sockfd, usb_request, control_request);
-      break;
-    case SET_CONFIGURATION:
-      HandleSetConfiguration(sockfd, usb_request, control_request);
-      break;
-    case GET_INTERFACE:
-      // Support for this will be needed for interfaces with alt settings.
-      break;
-    case SET_INTERFACE:
-      HandleSetInterface(sockfd, usb_request, control_request);
-      break;
-    default:
+void UsbPrinter::ConfigureEngine(const PrinterEngineOptions& options) {
+  engine_.Configure(options);
+  engine_.Reset(MonotonicNanos());
+}
+
+void UsbPrinter::ServiceEngine() {
+  CancelEngineTimer();
+  uint64_t now = MonotonicNanos();
+  int completed = 0;
+  while (completed < state_.pending_out_count) {
+    PendingOutUrb& pending = state_.pending_out[completed];
+    pending.remaining -= engine_.Accept(pending.remaining, now);
+    if (pending.remaining > 0) {
       break;
+    }
+    const USBIP_CMD_SUBMIT& request = pending.urb.request;
+    SendUsbOutResponse(pending.urb.transport, request,
+                       request.transfer_buffer_length, 0);
+    ++completed;
   }
+  for (int i = completed; i < state_.pending_out_count; ++i) {
+    state_.pending_out[i - completed] = state_.pending_out[i];
+  }
+  state_.pending_out_count -= completed;
+
+  if (state_.pending_out_count == 0 || event_loop_ == nullptr) {
+    return;
+  }
+  uint64_t delay =
+      engine_.DelayUntilSpace(state_.pending_out[0].remaining, now);
+  if (delay == UINT64_MAX) {
+    // The engine is halted by paper-out or an error; whoever clears the
+    // condition calls ServiceEngine() again.
+    return;
+  }
+  engine_timer_ = event_loop_->AddTimer(delay, [this]() {
+    engine_timer_ = 0;
+    ServiceEngine();
+  });
 }
 
-void UsbPrinter::HandlePrinterControl(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  switch (control_request.bRequest) {
-    case GET_DEVICE_ID:
-      HandleGetDeviceId(sockfd, usb_request, control_request);
-      break;
-    case GET_PORT_STATUS:
-      break;
-    case SOFT_RESET:
-      break;
-    default:
-      printf("Unknown printer class request\n");
+void UsbPrinter::CancelEngineTimer() {
+  if (engine_timer_ != 0 && event_loop_ != nullptr) {
+    event_loop_->CancelTimer(engine_timer_);
   }
+  engine_timer_ = 0;
 }
 
-void UsbPrinter::HandleGetDescriptor(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) const {
-  printf("HandleGetDescriptor %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
+int UsbPrinter::QueueInData(const char* data, int size) {
+  int space = kInQueueSize - state_.in_size;
+  if (size > space) {
+    size = space;
+  }
+  for (int i = 0; i < size; ++i) {
+    int tail = (state_.in_head + state_.in_size) % kInQueueSize;
+    state_.in_queue[tail] = data[i];
+    ++state_.in_size;
+  }
 
-  switch (control_request.wValue1) {
-    case USB_DESCRIPTOR_DEVICE:
-      SendUsbRequest(sockfd, usb_request, (char*)&device_descriptor_,
-                     device_descriptor_.bLength, 0);
-      break;
-    case USB_DESCRIPTOR_CONFIGURATION:
-      HandleGetConfigurationDescriptor(sockfd, usb_request, control_request);
-      break;
-    case USB_DESCRIPTOR_STRING:
-      HandleGetStringDescriptor(sockfd, usb_request, control_request);
-      break;
-    case USB_DESCRIPTOR_INTERFACE:
-      break;
-    case USB_DESCRIPTOR_ENDPOINT:
-      break;
-    case USB_DESCRIPTOR_DEVICE_QUALIFIER:
-      break;
-    default:
-      printf("Unkown descriptor type requested: %d\n", control_request.wValue1);
+  // Hand the new data to the URBs which have been waiting for it, oldest first.
+  int completed = 0;
+  while (completed < state_.pending_in_count && state_.in_size > 0) {
+    CompleteInUrb(state_.pending_in[completed]);
+    ++completed;
   }
+  for (int i = completed; i < state_.pending_in_count; ++i) {
+    state_.pending_in[i - completed] = state_.pending_in[i];
+  }
+  state_.pending_in_count -= completed;
+  return size;
 }
 
-void UsbPrinter::HandleGetConfigurationDescriptor(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) const {
-  printf("HandleGetConfigurationDescriptor %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
-
-  if (control_request.wLength == configuration_descriptor_.bLength) {
-    // Only the configuration descriptor itself has been requested.
-    printf("Only configuration descriptor requested\n");
-    SendUsbRequest(sockfd, usb_request, (char*)&configuration_descriptor_,
-                   control_request.wLength, 0);
-    return;
+bool UsbPrinter::UnlinkUrb(int seqnum) {
+  for (int i = 0; i < state_.pending_in_count; ++i) {
+    if (state_.pending_in[i].request.seqnum != seqnum) {
+      continue;
+    }
+    for (int j = i + 1; j < state_.pending_in_count; ++j) {
+      state_.pending_in[j - 1] = state_.pending_in[j];
+    }
+    --state_.pending_in_count;
+    return true;
+  }
+  for (int i = 0; i < state_.pending_out_count; ++i) {
+    if (state_.pending_out[i].urb.request.seqnum != seqnum) {
+      continue;
+    }
+    for (int j = i + 1; j < state_.pending_out_count; ++j) {
+      state_.pending_out[j - 1] = state_.pending_out[j];
+    }
+    --state_.pending_out_count;
+    return true;
   }
+  return false;
+}
+
+Spool* UsbPrinter::SpoolFor(const USBIP_CMD_SUBMIT& usb_request) {
+  // Every OUT endpoint of the printer is a bulk endpoint carrying print data.
+  // The endpoint table is not consulted, as it belongs to the device's thread:
+  // a payload for an endpoint which is not active is spooled and the request
+  // then stalled by HandleUsbRequest().
+  if (usb_request.direction != 0 || usb_request.ep == 0) {
+    return nullptr;
+  }
+  // Data which is compared against a golden file or split into jobs has to be
+  // seen by the printer, which writes it to the spool itself.
+  if (comparing_.load(std::memory_order_relaxed) ||
+      splitting_.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return spool_.get();
+}
+
+void UsbPrinter::Detach() {
+  UsbDevice::Detach();
+  Reset();
+}
 
-  // NOTE: This currently assumes that if the requested length was not just the
-  // configuration descriptor then all of the descriptors have been requested.
-  // TODO(daviev): If there are any instances where the client requests a size
-  // other than the configuration descriptors bLength or wTotalLength then
-  // change this function to address it.
-
-  auto buf = std::make_unique<char[]>(control_request.wLength);
-  int total = 0;
-
-  // Place the configuration descriptor into the buffer.
-  FillBuffer((char*)&configuration_descriptor_,
-             configuration_descriptor_.bLength, buf.get() + total);
-  total += configuration_descriptor_.bLength;
-
-  // Place each of the corresponding interfaces into the buffer.
-  for (int i = 0; i < configuration_descriptor_.bNumInterfaces; ++i) {
-    auto interface = interfaces_[i];
-    FillBuffer((char*)&interface, interface.bLength, buf.get() + total);
-    total += interface.bLength;
-    // TODO(daviev): For now this assumes that each interface has 2
-    // corresponding endpoints. Update this in the future to support interfaces
-    // that have only 1 endpoint.
-    for (int j = i * 2; j < (i * 2) + 2; ++j) {
-      auto endpoint = endpoints_[j];
-      FillBuffer((char*)&endpoint, endpoint.bLength, buf.get() + total);
-      total += endpoint.bLength;
+void UsbPrinter::HandleDataRequest(Transport* transport,
+                                   const USBIP_CMD_SUBMIT& usb_request,
+                                   const char* data, unsigned int data_size) {
+  if (usb_request.direction == 0) {
+    HandleBulkOut(transport, usb_request, data, data_size);
+  } else {
+    HandleBulkIn(transport, usb_request);
+  }
+}
+
+void UsbPrinter::HandleBulkOut(Transport* transport,
+                               const USBIP_CMD_SUBMIT& usb_request,
+                               const char* data, unsigned int data_size) {
+  // The URB completes once the engine has taken all of its data, which may be
+  // much later than its arrival if the engine's buffer is full. A host which
+  // has more URBs waiting than the printer can hold gets the extra ones back
+  // stalled, with their data left out of the job.
+  if (!engine_.unlimited() && state_.pending_out_count == kMaxPendingOutUrbs) {
+    printf("Too many pending OUT URBs, stalling %d\n", usb_request.seqnum);
+    if (data == nullptr) {
+      // The data is in the spool already.
+      spooled_bytes_ += data_size;
     }
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  // Payloads which were spooled before splitting was turned on cannot be
+  // looked at.
+  if (data != nullptr && splitting_.load(std::memory_order_relaxed)) {
+    SplitJobData(data, data_size);
+  } else {
+    AddJobData(data, data_size);
   }
+  if (engine_.unlimited()) {
+    SendUsbOutResponse(transport, usb_request, data_size, 0);
+    return;
+  }
+
+  PendingOutUrb pending = {{transport, usb_request}, data_size};
+  state_.pending_out[state_.pending_out_count++] = pending;
+  ServiceEngine();
+}
 
-  // After filling the buffer with all of the necessary descriptors we can send
-  // a response.
-  SendUsbRequest(sockfd, usb_request, buf.get(), control_request.wLength, 0);
+void UsbPrinter::StartJob() {
+  state_.job_in_progress = true;
+  if (jobs_.size() == static_cast<size_t>(kMaxJobRecords)) {
+    jobs_.pop_front();
+  }
+  GoldenComparison comparison =
+      golden_ ? GoldenComparison(golden_) : GoldenComparison();
+  jobs_.push_back({next_job_id_++, 0, MonotonicNanos(), 0, spooled_bytes_,
+                   {}, comparison, nullptr});
+  boundaries_.Reset();
 }
 
-void UsbPrinter::HandleGetStringDescriptor(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) const {
-  printf("HandleGetStringDescriptor %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
-
-  int index = control_request.wValue0;
-  int string_length = (strings_[index][0] / 2) - 1;
-  if (index != 0) {
-    char str[255];
-    memset(str, 0, 255);
-    for (int i = 0; i < string_length; ++i) {
-      str[i] = strings_[index][i * 2 + 2];
+void UsbPrinter::AddJobData(const char* data, unsigned int size) {
+  if (!state_.job_in_progress) {
+    StartJob();
+  }
+  GoldenComparison& golden = jobs_.back().golden;
+  if (data == nullptr) {
+    spooled_bytes_ += size;
+    golden.Skip(size);
+  } else {
+    if (golden.Update(data, size)) {
+      ReportDivergence(jobs_.back());
+    }
+    if (spool_ && spool_->Write(data, size)) {
+      spooled_bytes_ += size;
     }
-    printf("String (%s)\n", str);
   }
-  SendUsbRequest(sockfd, usb_request, strings_[index].data(),
-                 strings_[index][0], 0);
+  state_.job_bytes += size;
+  jobs_.back().bytes += size;
 }
 
-void UsbPrinter::HandleGetConfiguration(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  printf("HandleGetConfiguration %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
-
-  // Note: For now we only have on configuration set, so we just respond with
-  // with |configuration_descriptor_.bConfigurationValue|.
-  SendUsbRequest(sockfd, usb_request,
-                 (const char*)&configuration_descriptor_.bConfigurationValue, 1,
-                 0);
+void UsbPrinter::SplitJobData(const char* data, unsigned int size) {
+  while (size > 0) {
+    if (!state_.job_in_progress) {
+      // Padding between jobs is spooled but does not start another one.
+      unsigned int gap = JobBoundaryDetector::SkipGap(data, size);
+      SpoolGap(data, gap);
+      data += gap;
+      size -= gap;
+      if (size == 0) {
+        return;
+      }
+      StartJob();
+    }
+    unsigned int length = boundaries_.Scan(data, size);
+    AddJobData(data, length);
+    data += length;
+    size -= length;
+    if (boundaries_.ended()) {
+      EndJob();
+    }
+  }
 }
 
-void UsbPrinter::HandleSetConfiguration(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  printf("HandleSetConfiguration %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
+void UsbPrinter::SpoolGap(const char* data, unsigned int size) {
+  if (size > 0 && spool_ && spool_->Write(data, size)) {
+    spooled_bytes_ += size;
+  }
+}
 
-  // NOTE: For now we have only one configuration to set, so we just respond
-  // with an empty message as a confirmation.
-  SendUsbRequest(sockfd, usb_request, 0, 0, 0);
+void UsbPrinter::HandleBulkIn(Transport* transport,
+                              const USBIP_CMD_SUBMIT& usb_request) {
+  PendingUrb urb = {transport, usb_request};
+  if (state_.in_size > 0) {
+    CompleteInUrb(urb);
+    return;
+  }
+  if (state_.pending_in_count == kMaxPendingInUrbs) {
+    printf("Too many pending IN URBs, stalling %d\n", usb_request.seqnum);
+    SendUsbStall(transport, usb_request);
+    return;
+  }
+  state_.pending_in[state_.pending_in_count++] = urb;
 }
 
-void UsbPrinter::HandleSetInterface(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  printf("HandleSetInterface %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
+void UsbPrinter::CompleteInUrb(const PendingUrb& urb) {
+  int size = urb.request.transfer_buffer_length;
+  if (size > state_.in_size) {
+    size = state_.in_size;
+  }
+  // The queued data may wrap around the end of the ring, so it is copied out
+  // into a contiguous buffer first.
+  BufferPool::Buffer buffer = BufferPool::ForCurrentThread()->Acquire(size);
+  if (size > 0 && buffer.empty()) {
+    // The data stays queued for the next IN URB.
+    SendUsbStall(urb.transport, urb.request);
+    return;
+  }
+  for (int i = 0; i < size; ++i) {
+    buffer.data()[i] = state_.in_queue[(state_.in_head + i) % kInQueueSize];
+  }
+  state_.in_head = (state_.in_head + size) % kInQueueSize;
+  state_.in_size -= size;
+  SendUsbRequest(urb.transport, urb.request, buffer.data(), size, 0);
+}
 
-  // NOTE: For now we have only one interface to set, so we just respond
-  // with an empty message as a confirmation.
-  SendUsbRequest(sockfd, usb_request, 0, 0, 0);
+bool UsbPrinter::HandleClassControl(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  // Version 1.0 of the printer class addressed SOFT_RESET to "other", so any
+  // recipient is accepted for it.
+  static constexpr ControlHandler<UsbPrinter> kHandlers[] = {
+      {CLASS_TYPE, RECIPIENT_INTERFACE, GET_DEVICE_ID, kAnyDescriptor,
+       &UsbPrinter::HandleGetDeviceId},
+      {CLASS_TYPE, RECIPIENT_INTERFACE, GET_PORT_STATUS, kAnyDescriptor,
+       &UsbPrinter::HandleGetPortStatus},
+      {CLASS_TYPE, kAnyRecipient, SOFT_RESET, kAnyDescriptor,
+       &UsbPrinter::HandleSoftReset},
+  };
+  return DispatchControl(this, kHandlers, transport, usb_request,
+                         control_request, data, data_size);
 }
 
 void UsbPrinter::HandleGetDeviceId(
-    int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-    const StandardDeviceRequest& control_request) {
-  printf("HandleGetDeviceId %u[%u]\n", control_request.wValue1,
-         control_request.wValue0);
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetDeviceId %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  // A profile can set an ID longer than the host asked for, and sending more
+  // than wLength bytes would overflow the host's buffer.
+  unsigned int size = ieee_device_id_.size();
+  if (control_request.wLength < size) {
+    size = control_request.wLength;
+  }
+  SendUsbRequest(transport, usb_request, ieee_device_id_.data(), size, 0);
+}
 
-  SendUsbRequest(sockfd, usb_request, ieee_device_id_.data(),
-                 ieee_device_id_.size(), 0);
+void UsbPrinter::HandleGetPortStatus(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleGetPortStatus %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  byte port_status = engine_.PortStatus(MonotonicNanos());
+  SendUsbRequest(transport, usb_request, (const char*)&port_status, 1, 0);
+}
+
+void UsbPrinter::HandleSoftReset(
+    Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+    const StandardDeviceRequest& control_request, const char* data,
+    unsigned int data_size) {
+  LogRequest("HandleSoftReset %u[%u]\n", control_request.wValue1,
+             control_request.wValue0);
+
+  // The host gets back every URB which the reset discards, as it would from a
+  // real printer, rather than having to unlink them.
+  for (int i = 0; i < state_.pending_out_count; ++i) {
+    const PendingOutUrb& pending = state_.pending_out[i];
+    const USBIP_CMD_SUBMIT& request = pending.urb.request;
+    SendUsbOutResponse(pending.urb.transport, request,
+                       request.transfer_buffer_length - pending.remaining,
+                       -ECONNRESET);
+  }
+  for (int i = 0; i < state_.pending_in_count; ++i) {
+    const PendingUrb& urb = state_.pending_in[i];
+    SendUsbRequest(urb.transport, urb.request, nullptr, 0, -ECONNRESET);
+  }
+  Reset();
+  SendUsbRequest(transport, usb_request, 0, 0, 0);
 }
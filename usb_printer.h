@@ -2,82 +2,247 @@
 #define __USBIP_USB_PRINTER_H__
 
 #include "device_descriptors.h"
+#include "event_loop.h"
+#include "golden_file.h"
+#include "job_boundary.h"
+#include "job_processor.h"
+#include "printer_engine.h"
+#include "spool.h"
+#include "usb_device.h"
 #include "usbip-constants.h"
 #include "usbip.h"
 
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
 
-// Generice USB device interface.
-class UsbPrinter {
- public:
-  explicit UsbPrinter(
-      const USB_DEVICE_DESCRIPTOR& device_descriptor,
-      const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
-      const std::vector<std::vector<char>>& strings,
-      const std::vector<char> ieee_device_id,
-      const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
-      const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints);
-
-  USB_DEVICE_DESCRIPTOR device_descriptor() const { return device_descriptor_; }
-
-  USB_CONFIGURATION_DESCRIPTOR configuration_descriptor() const {
-    return configuration_descriptor_;
-  }
+// Number of bulk IN URBs which can be parked while waiting for data.
+const int kMaxPendingInUrbs = 32;
+
+// Number of bulk OUT URBs which can wait for room in the printer engine.
+const int kMaxPendingOutUrbs = 32;
+
+// Size of the buffer which holds data queued for the bulk IN endpoint.
+const int kInQueueSize = 4096;
+
+// Number of jobs whose records a printer keeps, including the one in progress.
+const int kMaxJobRecords = 64;
+
+// A print job as seen by the printer: the bulk OUT data which arrived between
+// the printer becoming busy and it being reset or told that the job is over,
+// or, if the printer splits jobs, the end of the job being detected.
+struct PrintJobRecord {
+  int id;
+  unsigned long long bytes;
+  uint64_t start_ns;
+  // Zero while the job is still in progress.
+  uint64_t end_ns;
+  // Where the job's data starts in the printer's spool, if it has one.
+  uint64_t spool_offset;
+  // Outcome of each post-processing stage, once the job has been processed.
+  std::vector<JobStageResult> results;
+  // How the job's data compares to the printer's golden file, if it had one
+  // when the job started.
+  GoldenComparison golden;
+  // The format which the job's boundaries were found from, such as "pdf" or
+  // "unknown", once a job has ended on a printer which splits jobs, and
+  // nullptr otherwise. See JobBoundaryDetector.
+  const char* framing;
+};
+
+// A bulk OUT URB whose data has not all been accepted by the printer engine.
+struct PendingOutUrb {
+  PendingUrb urb;
+  unsigned int remaining;
+};
 
-  std::vector<std::vector<char>> strings() const { return strings_; }
+// Runtime state of a printer. Everything in here is discarded by
+// UsbPrinter::Reset(), which only rewinds counters and indices so that a reset
+// costs the same regardless of how much state has built up.
+struct PrinterState {
+  bool job_in_progress;
+  unsigned long long job_bytes;
+
+  // Ring buffer of data waiting to be read from the bulk IN endpoint.
+  char in_queue[kInQueueSize];
+  int in_head;
+  int in_size;
+
+  // Bulk IN URBs waiting for data, oldest first.
+  PendingUrb pending_in[kMaxPendingInUrbs];
+  int pending_in_count;
+
+  // Bulk OUT URBs waiting for the engine to make room, oldest first.
+  PendingOutUrb pending_out[kMaxPendingOutUrbs];
+  int pending_out_count;
+};
 
-  std::vector<USB_INTERFACE_DESCRIPTOR> interfaces() const {
-    return interfaces_;
+// An IEEE 1284 printer with a bulk OUT endpoint for print data and a bulk IN
+// endpoint for status returned by the printer.
+class UsbPrinter : public UsbDevice {
+ public:
+  UsbPrinter(const USB_DEVICE_DESCRIPTOR& device_descriptor,
+             const USB_CONFIGURATION_DESCRIPTOR& configuration_descriptor,
+             const std::vector<std::vector<char>>& strings,
+             const std::vector<char> ieee_device_id,
+             const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
+             const std::vector<USB_ENDPOINT_DESCRIPTOR>& endpoints);
+
+  const PrinterState& state() const { return state_; }
+
+  // Distinguishes the printer from every other one which the process has
+  // created, including those which had its bus ID before it was plugged in.
+  uint64_t generation() const { return generation_; }
+
+  // The most recent jobs, oldest first. A job starts with the first bulk OUT
+  // data after the printer was idle and lasts until EndJob() or Reset(), or
+  // until its end is detected if the printer splits jobs.
+  const std::deque<PrintJobRecord>& jobs() const { return jobs_; }
+
+  // Closes the record of the job in progress, if any, so that the next bulk
+  // OUT data starts a new job. A job whose data is all in the spool is then
+  // handed to the job callback.
+  void EndJob();
+
+  // Runs |callback| with every job which ends after all of its data was
+  // spooled, so that it can be post-processed.
+  void SetJobCallback(std::function<void(const CompletedJob& job)> callback) {
+    job_callback_ = std::move(callback);
   }
 
-  std::vector<USB_ENDPOINT_DESCRIPTOR> endpoints() const { return endpoints_; }
+  // Attaches the post-processing |results| to the record of job |id|, unless
+  // the record has been dropped since.
+  void SetJobResults(int id, std::vector<JobStageResult> results);
+
+  // Returns the printer to its power-on state, dropping any job in progress,
+  // queued IN data and pending URBs. The URBs are not completed, as this is
+  // for when their client has gone; SOFT_RESET completes them first. Stall,
+  // paper-out and error conditions injected through engine() are kept.
+  void Reset();
+
+  // The performance model which paces bulk OUT data and drives the
+  // GET_PORT_STATUS bits. Paper-out, error and stall conditions are injected
+  // through it.
+  PrinterEngine* engine() { return &engine_; }
+
+  // Replaces the parameters of the performance model.
+  void ConfigureEngine(const PrinterEngineOptions& options);
+
+  // Completes the bulk OUT URBs whose data now fits into the engine's buffer
+  // and schedules another call for when the next one will. When no event loop
+  // is set, this has to be called by the embedder.
+  void ServiceEngine();
+
+  // Queues |size| bytes from |data| to be returned on the bulk IN endpoint and
+  // completes any IN URBs which were waiting for it. Returns the number of
+  // bytes which fit into the queue.
+  int QueueInData(const char* data, int size);
+
+  bool UnlinkUrb(int seqnum) override;
+
+  // Unplugging the printer loses everything which was in flight.
+  void Detach() override;
+
+  // Captures everything sent to the bulk OUT endpoint into |spool|.
+  void SetSpool(std::unique_ptr<Spool> spool) { spool_ = std::move(spool); }
+
+  // Compares every job which starts from now on against |golden|, reporting
+  // the first divergence as soon as its data arrives, or stops comparing if
+  // |golden| is null. While a golden file is set, bulk OUT payloads are
+  // received into memory so that they can be compared, and only then written
+  // to the spool, so this should be changed while the printer is idle.
+  void SetGoldenFile(std::shared_ptr<const GoldenFile> golden);
+
+  // Ends each job where its data shows that it ends, so that jobs which the
+  // host sends back to back get a record, a spool range, a golden comparison
+  // and post-processing each. Like comparing against a golden file, this
+  // makes bulk OUT payloads go through memory.
+  void SetJobSplitting(bool splitting);
+
+  Spool* SpoolFor(const USBIP_CMD_SUBMIT& usb_request) override;
+
+ protected:
+  // Handles printer-specific USB requests. Refer to USB Printer Class 1.1
+  // section 4.2.
+  bool HandleClassControl(Transport* transport,
+                          const USBIP_CMD_SUBMIT& usb_request,
+                          const StandardDeviceRequest& control_request,
+                          const char* data, unsigned int data_size) override;
+
+  void HandleDataRequest(Transport* transport,
+                         const USBIP_CMD_SUBMIT& usb_request, const char* data,
+                         unsigned int data_size) override;
 
-  // Determines whether |usb_request| is either a control or data request and
-  // defers to the corresponding function.
-  void HandleUsbRequest(int sockd, const USBIP_CMD_SUBMIT& usb_request);
+ private:
+  // Handles a request for data from the bulk IN endpoint. The URB is completed
+  // immediately if data is queued, and parked until QueueInData() otherwise.
+  void HandleBulkIn(Transport* transport, const USBIP_CMD_SUBMIT& usb_request);
 
-  // Determines whether |usb_request| is either a standard or class-specific
-  // control request and defers to the corresponding function.
-  void HandleUsbControl(int sockfd, const USBIP_CMD_SUBMIT& usb_request);
+  // Handles data sent by the host on the bulk OUT endpoint.
+  void HandleBulkOut(Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                     const char* data, unsigned int data_size);
 
-  // Handles the standard USB requests.
-  void HandleStandardControl(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                             const StandardDeviceRequest& control_request);
+  void HandleGetDeviceId(Transport* transport,
+                         const USBIP_CMD_SUBMIT& usb_request,
+                         const StandardDeviceRequest& control_request,
+                         const char* data, unsigned int data_size);
 
-  // Handles printer-specific USB requests.
-  void HandlePrinterControl(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                            const StandardDeviceRequest& control_request);
+  void HandleGetPortStatus(Transport* transport,
+                           const USBIP_CMD_SUBMIT& usb_request,
+                           const StandardDeviceRequest& control_request,
+                           const char* data, unsigned int data_size);
 
- private:
-  void HandleGetDescriptor(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                           const StandardDeviceRequest& control_request) const;
+  void HandleSoftReset(Transport* transport,
+                       const USBIP_CMD_SUBMIT& usb_request,
+                       const StandardDeviceRequest& control_request,
+                       const char* data, unsigned int data_size);
+
+  // Opens the record of a new job.
+  void StartJob();
 
-  void HandleGetConfigurationDescriptor(
-      int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-      const StandardDeviceRequest& control_request) const;
+  // Adds |size| bytes of bulk OUT data to the job in progress, starting one
+  // if there is none. |data| is null if the bytes went to the spool without
+  // passing through the printer.
+  void AddJobData(const char* data, unsigned int size);
 
-  void HandleGetStringDescriptor(
-      int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-      const StandardDeviceRequest& control_request) const;
+  // Like AddJobData(), but ends jobs where |boundaries_| finds that they do.
+  void SplitJobData(const char* data, unsigned int size);
 
-  void HandleGetConfiguration(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                              const StandardDeviceRequest& control_request);
+  // Writes |size| bytes of bulk OUT data which belong to no job to the spool.
+  void SpoolGap(const char* data, unsigned int size);
 
-  void HandleSetConfiguration(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                              const StandardDeviceRequest& control_request);
+  // Reports that the job in progress has diverged from its golden file.
+  void ReportDivergence(const PrintJobRecord& job) const;
 
-  void HandleSetInterface(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                          const StandardDeviceRequest& control_request);
+  // Completes |urb| with as much queued IN data as it can hold.
+  void CompleteInUrb(const PendingUrb& urb);
 
-  void HandleGetDeviceId(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                         const StandardDeviceRequest& control_request);
+  void CancelEngineTimer();
 
-  USB_DEVICE_DESCRIPTOR device_descriptor_;
-  USB_CONFIGURATION_DESCRIPTOR configuration_descriptor_;
-  std::vector<std::vector<char>> strings_;
   std::vector<char> ieee_device_id_;
-  std::vector<USB_INTERFACE_DESCRIPTOR> interfaces_;
-  std::vector<USB_ENDPOINT_DESCRIPTOR> endpoints_;
+  std::unique_ptr<Spool> spool_;
+  std::shared_ptr<const GoldenFile> golden_;
+  // Whether |golden_| is set, for SpoolFor(), which runs on the client's
+  // thread.
+  std::atomic<bool> comparing_;
+  // Whether jobs are split, likewise.
+  std::atomic<bool> splitting_;
+  JobBoundaryDetector boundaries_;
+  // Number of bytes of bulk OUT data which went into |spool_|. Unlike
+  // Spool::bytes(), this is only touched by the thread running the printer.
+  uint64_t spooled_bytes_;
+  std::function<void(const CompletedJob& job)> job_callback_;
+  PrinterState state_;
+  std::deque<PrintJobRecord> jobs_;
+  int next_job_id_;
+  PrinterEngine engine_;
+  // Id of the timer which will run ServiceEngine(), or 0 if none is pending.
+  int engine_timer_;
+  const uint64_t generation_;
 };
 
 #endif  // __USBIP_USB_PRINTER_H__
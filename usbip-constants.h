@@ -12,12 +12,29 @@
 #define USB_DESCRIPTOR_INTERFACE        0x04    // Interface Descriptor.
 #define USB_DESCRIPTOR_ENDPOINT         0x05    // Endpoint Descriptor.
 #define USB_DESCRIPTOR_DEVICE_QUALIFIER 0x06    // Device Qualifier.
+#define USB_DESCRIPTOR_OTHER_SPEED      0x07    // Other Speed Configuration.
+#define USB_DESCRIPTOR_BOS              0x0F    // Binary Object Store.
+#define USB_DESCRIPTOR_DEVICE_CAPABILITY 0x10   // Device Capability.
+#define USB_DESCRIPTOR_SS_ENDPOINT_COMPANION 0x30  // SuperSpeed Companion.
+
+// Device capability types found in the BOS. See USB 3.2, section 9.6.2.
+#define USB_CAPABILITY_USB_2_0_EXTENSION 0x02
+#define USB_CAPABILITY_SUPERSPEED_USB    0x03
+
+// HID class descriptor types. See HID 1.11, section 7.1.
+#define USB_DESCRIPTOR_HID              0x21    // HID Descriptor.
+#define USB_DESCRIPTOR_HID_REPORT       0x22    // Report Descriptor.
 
 #define STANDARD_TYPE 0  // Standard USB Request.
 #define CLASS_TYPE    1  // Class-specific USB Request.
 #define VENDOR_TYPE   2  // Vendor-specific USB Request.
 #define RESERVED_TYPE 3  // Reserved.
 
+#define RECIPIENT_DEVICE    0  // Request addressed to the device.
+#define RECIPIENT_INTERFACE 1  // Request addressed to an interface.
+#define RECIPIENT_ENDPOINT  2  // Request addressed to an endpoint.
+#define RECIPIENT_OTHER     3  // Other recipient.
+
 // USB "bRequest" Constants.
 // These represent the possible values contained within a USB SETUP packet which
 // specify the type of request.
@@ -38,6 +55,12 @@
 #define GET_PORT_STATUS 1
 #define SOFT_RESET 2
 
+// Bits of the status byte returned by GET_PORT_STATUS.
+// See USB Printer Class 1.1, section 4.2.2.
+#define PORT_STATUS_NOT_ERROR 0x08
+#define PORT_STATUS_SELECT 0x10
+#define PORT_STATUS_PAPER_EMPTY 0x20
+
 // Special "bRequest" values for HID requests.
 #define GET_REPORT 0x01
 #define GET_IDLE 0x02
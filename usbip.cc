@@ -27,12 +27,40 @@
 
 #include "usbip.h"
 
+#include "buffer_pool.h"
 #include "device_descriptors.h"
+#include "pcap_writer.h"
+#include "probes.h"
+#include "transport.h"
+#include "urb_trace.h"
 #include "usbip-constants.h"
-#include "usb_printer.h"
+#include "device_registry.h"
+#include "usb_device.h"
 
-const char kUsbPath[] = "/sys/devices/pci0000:00/0000:00:01.2/usb1/1-1";
-const char kBusId[] = "1-1";
+#include <atomic>
+#include <utility>
+
+#include <cstdarg>
+
+namespace {
+
+std::atomic<bool> g_request_logging(true);
+
+}  // namespace
+
+void SetRequestLogging(bool enabled) {
+  g_request_logging.store(enabled, std::memory_order_relaxed);
+}
+
+void LogRequest(const char* format, ...) {
+  if (!g_request_logging.load(std::memory_order_relaxed)) {
+    return;
+  }
+  va_list arguments;
+  va_start(arguments, format);
+  vprintf(format, arguments);
+  va_end(arguments);
+}
 
 void set_op_header(word version, word command, int status, OP_HEADER *header) {
   header->version = version;
@@ -47,41 +75,41 @@ void set_op_rep_devlist_header(word version, word command, int status,
   devlist_header->numExportedDevices = numExportedDevices;
 }
 
-// Sets the members of |device| using the corresponding values in
-// |device| and |config|.
-void set_op_rep_device(const USB_DEVICE_DESCRIPTOR& dev_dsc,
-                       const USB_CONFIGURATION_DESCRIPTOR& config,
-                       OP_REP_DEVICE* device) {
-  // Set constants.
-  memset(device->usbPath, 0, 256);
-  strcpy(device->usbPath, kUsbPath);
-  memset(device->busID, 0, 32);
-  strcpy(device->busID, kBusId);
-
-  device->busnum=htonl(1);
-  device->devnum=htonl(2);
-  device->speed=htonl(2);
-
-  // Set values using |device|.
-  device->idVendor = htons(dev_dsc.idVendor);
-  device->idProduct = htons(dev_dsc.idProduct);
-  device->bcdDevice = htons(dev_dsc.bcdDevice);
-  device->bDeviceClass = dev_dsc.bDeviceClass;
-  device->bDeviceSubClass = dev_dsc.bDeviceSubClass;
-  device->bDeviceProtocol = dev_dsc.bDeviceProtocol;
-  device->bNumConfigurations = dev_dsc.bNumConfigurations;
+void set_op_rep_device(const UsbDevice& device, OP_REP_DEVICE* rep_device) {
+  const USB_DEVICE_DESCRIPTOR& dev_dsc = device.device_descriptor();
+  const USB_CONFIGURATION_DESCRIPTOR& config =
+      device.configuration_descriptor();
+
+  // Set values using the device's location on the virtual bus.
+  memset(rep_device->usbPath, 0, 256);
+  strncpy(rep_device->usbPath, device.usb_path(), 255);
+  memset(rep_device->busID, 0, 32);
+  strncpy(rep_device->busID, device.bus_id(), 31);
+
+  rep_device->busnum = htonl(device.busnum());
+  rep_device->devnum = htonl(device.devnum());
+  rep_device->speed = htonl(static_cast<int>(device.speed()));
+
+  // Set values using |dev_dsc|.
+  rep_device->idVendor = htons(dev_dsc.idVendor);
+  rep_device->idProduct = htons(dev_dsc.idProduct);
+  rep_device->bcdDevice = htons(dev_dsc.bcdDevice);
+  rep_device->bDeviceClass = dev_dsc.bDeviceClass;
+  rep_device->bDeviceSubClass = dev_dsc.bDeviceSubClass;
+  rep_device->bDeviceProtocol = dev_dsc.bDeviceProtocol;
+  rep_device->bNumConfigurations = dev_dsc.bNumConfigurations;
 
   // Set values using |config|.
-  device->bConfigurationValue = config.bConfigurationValue;
-  device->bNumInterfaces = config.bNumInterfaces;
+  rep_device->bConfigurationValue = config.bConfigurationValue;
+  rep_device->bNumInterfaces = config.bNumInterfaces;
 }
 
 void set_op_rep_devlist_interfaces(
     const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
-    OP_REP_DEVLIST_INTERFACE **rep_interfaces) {
-  // TODO(daviev): Change this to use a smart pointer at some point.
-  *rep_interfaces = (OP_REP_DEVLIST_INTERFACE *)malloc(
+    BufferPool::Buffer* storage, OP_REP_DEVLIST_INTERFACE** rep_interfaces) {
+  *storage = BufferPool::ForCurrentThread()->Acquire(
       interfaces.size() * sizeof(OP_REP_DEVLIST_INTERFACE));
+  *rep_interfaces = (OP_REP_DEVLIST_INTERFACE*)storage->data();
   for (size_t i = 0; i < interfaces.size(); ++i) {
     const auto& interface = interfaces[i];
     (*rep_interfaces)[i].bInterfaceClass = interface.bInterfaceClass;
@@ -91,68 +119,74 @@ void set_op_rep_devlist_interfaces(
   }
 }
 
-// Creates the OP_REP_DEVLIST message used to respond to a request to list the
-// host's exported USB devices.
-void create_op_rep_devlist(
-    const USB_DEVICE_DESCRIPTOR& device,
-    const USB_CONFIGURATION_DESCRIPTOR& config,
-    const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
-    OP_REP_DEVLIST *list) {
+void create_op_rep_devlist(const UsbDevice& device,
+                           BufferPool::Buffer* interface_storage,
+                           OP_REP_DEVLIST* list) {
   set_op_rep_devlist_header(htons(273), htons(5), 0, htonl(1), &list->header);
-  set_op_rep_device(device, config, &list->device);
-  set_op_rep_devlist_interfaces(interfaces, &list->interfaces);
+  set_op_rep_device(device, &list->device);
+  set_op_rep_devlist_interfaces(device.interfaces(), interface_storage,
+                                &list->interfaces);
 }
 
-void handle_device_list(const UsbPrinter& printer, int sockfd) {
-  OP_REP_DEVLIST list;
+void handle_device_list(const UsbDeviceRegistry& devices,
+                        Transport* transport) {
+  OP_REP_DEVLIST_HEADER header;
   printf("list devices\n");
 
-  create_op_rep_devlist(printer.device_descriptor(),
-                        printer.configuration_descriptor(),
-                        printer.interfaces(), &list);
-
-  ssize_t sent = send(sockfd, &list.header, sizeof(list.header), 0);
-  if (sent != sizeof(OP_REP_DEVLIST_HEADER)) {
+  set_op_rep_devlist_header(htons(273), htons(5), 0,
+                            htonl(devices.devices().size()), &header);
+  ssize_t sent = transport->Send(&header, sizeof(header));
+  if (sent != sizeof(header)) {
     printf("send error : %s \n", strerror(errno));
-    goto cleanup;
+    return;
   }
 
-  sent = send(sockfd, &list.device, sizeof(list.device), 0);
-  if (sent != sizeof(list.device)) {
-    printf("send error : %s \n", strerror(errno));
-    goto cleanup;
-  }
+  // Each device is followed by its interfaces.
+  for (const auto& device : devices.devices()) {
+    OP_REP_DEVLIST_DEVICE rep_device;
+    OP_REP_DEVLIST_INTERFACE* interfaces;
+    BufferPool::Buffer interface_storage;
+    set_op_rep_device(*device, &rep_device);
+    set_op_rep_devlist_interfaces(device->interfaces(), &interface_storage,
+                                  &interfaces);
+    if (interface_storage.empty() && rep_device.bNumInterfaces > 0) {
+      printf("no buffer for the interfaces of %s\n", device->bus_id());
+      return;
+    }
 
-  sent = send(sockfd, list.interfaces,
-              sizeof(*list.interfaces) * list.device.bNumInterfaces, 0);
-  if (sent != sizeof(*list.interfaces) * list.device.bNumInterfaces) {
-    printf("send error : %s \n", strerror(errno));
-    goto cleanup;
-  }
+    sent = transport->Send(&rep_device, sizeof(rep_device));
+    if (sent != sizeof(rep_device)) {
+      printf("send error : %s \n", strerror(errno));
+      return;
+    }
 
-cleanup:
-  free(list.interfaces);
+    sent = transport->Send(interfaces,
+                           sizeof(*interfaces) * rep_device.bNumInterfaces);
+    if (sent != sizeof(*interfaces) * rep_device.bNumInterfaces) {
+      printf("send error : %s \n", strerror(errno));
+      return;
+    }
+  }
 }
 
-void create_op_rep_import(const USB_DEVICE_DESCRIPTOR& dev_dsc,
-                          const USB_CONFIGURATION_DESCRIPTOR& config,
-                          OP_REP_IMPORT *rep) {
+void create_op_rep_import(const UsbDevice& device, OP_REP_IMPORT* rep) {
   set_op_header(htons(273), htons(3), 0, &rep->header);
-  set_op_rep_device(dev_dsc, config, &rep->device);
+  set_op_rep_device(device, &rep->device);
 }
 
-int handle_attach(const UsbPrinter& printer, int sockfd) {
-  char busid[32];
-  OP_REP_IMPORT rep;
-  printf("attach device\n");
-  ssize_t received = recv(sockfd, busid, 32, 0);
-  if (received != 32) {
-    printf("receive error : %s \n", strerror(errno));
+int handle_attach(UsbDevice* device, const char* bus_id, Transport* transport) {
+  printf("attach device %.32s\n", bus_id);
+  if (device == nullptr) {
+    // The reply ends after the header when the import fails.
+    OP_HEADER header;
+    set_op_header(htons(273), htons(3), htonl(1), &header);
+    transport->Send(&header, sizeof(header));
     return 1;
   }
-  create_op_rep_import(printer.device_descriptor(),
-                       printer.configuration_descriptor(), &rep);
-  ssize_t sent = send(sockfd, &rep, sizeof(rep), 0);
+
+  OP_REP_IMPORT rep;
+  create_op_rep_import(*device, &rep);
+  ssize_t sent = transport->Send(&rep, sizeof(rep));
   if (sent != sizeof(rep)) {
     printf("send error : %s \n", strerror(errno));
     return 1;
@@ -187,6 +221,9 @@ void unpack_usbip(int *data, size_t msg_size) {
 }
 
 void print_usbip_cmd_submit(const USBIP_CMD_SUBMIT& command) {
+  if (!g_request_logging.load(std::memory_order_relaxed)) {
+    return;
+  }
   printf("usbip cmd %u\n", command.command);
   printf("usbip seqnum %u\n", command.seqnum);
   printf("usbip devid %u\n", command.devid);
@@ -200,6 +237,9 @@ void print_usbip_cmd_submit(const USBIP_CMD_SUBMIT& command) {
 }
 
 void print_standard_device_request(const StandardDeviceRequest& request) {
+  if (!g_request_logging.load(std::memory_order_relaxed)) {
+    return;
+  }
   printf("  UC Request Type %u\n", request.bmRequestType);
   printf("  UC Request %u\n", request.bRequest);
   printf("  UC Value  %u[%u]\n", request.wValue1, request.wValue0);
@@ -207,17 +247,16 @@ void print_standard_device_request(const StandardDeviceRequest& request) {
   printf("  UC Length %u\n", request.wLength);
 }
 
-// Creates a new USBIP_RET_SUBMIT which is initialized using the shared values
-// from |command|.
-USBIP_RET_SUBMIT create_usbip_ret_submit(const USBIP_CMD_SUBMIT *command) {
-  USBIP_RET_SUBMIT usb_req;
-  memset(&usb_req, 0, sizeof(usb_req));
-  usb_req.seqnum = command->seqnum;
-  usb_req.devid = command->devid;
-  usb_req.direction = command->direction;
-  usb_req.ep = command->ep;
-  usb_req.setup = command->setup;
-  return usb_req;
+StandardDeviceRequest CreateStandardDeviceRequest(long long setup) {
+  StandardDeviceRequest request;
+  request.bmRequestType = (setup & 0xFF00000000000000) >> 56;
+  request.bRequest = (setup & 0x00FF000000000000) >> 48;
+  request.wValue0 = (setup & 0x0000FF0000000000) >> 40;
+  request.wValue1 = (setup & 0x000000FF00000000) >> 32;
+  request.wIndex0 = (setup & 0x00000000FF000000) >> 24;
+  request.wIndex1 = (setup & 0x0000000000FF0000) >> 16;
+  request.wLength = ntohs(setup & 0x000000000000FFFF);
+  return request;
 }
 
 USBIP_RET_SUBMIT CreateUsbipRetSubmit(const USBIP_CMD_SUBMIT& request) {
@@ -231,40 +270,125 @@ USBIP_RET_SUBMIT CreateUsbipRetSubmit(const USBIP_CMD_SUBMIT& request) {
   return response;
 }
 
-void SendUsbRequest(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                    const char* data, unsigned int data_size,
-                    unsigned int status) {
+namespace {
+
+// Creates the USBIP_RET_SUBMIT header which completes |usb_request| and puts it
+// into network byte order.
+USBIP_RET_SUBMIT CreatePackedRetSubmit(const USBIP_CMD_SUBMIT& usb_request,
+                                       unsigned int actual_length,
+                                       unsigned int status) {
   USBIP_RET_SUBMIT response = CreateUsbipRetSubmit(usb_request);
   response.status = status;
-  response.actual_length = data_size;
+  response.actual_length = actual_length;
   response.start_frame = 0;
   // TODO(daviev): Figure out what this means.
   response.number_of_packets = 0;
   response.error_count = 0;
+  pack_usbip((int*)&response, sizeof(response));
+  return response;
+}
 
-  if (data_size > 0) {
-    printf("Sending buffer: \n");
-    for (int i = 0; i < data_size; ++i) {
-      printf("%u ", data[i]);
-    }
-    printf("\n");
+// Sends all |size| bytes of |data| to the client, or marks |transport| as
+// failed. A failure only ends the connection it happened on: the session
+// closes once it notices, while the server carries on.
+void SendOrFail(Transport* transport, const void* data, size_t size) {
+  if (transport->failed()) {
+    return;
   }
+  if (transport->Send(data, size) != static_cast<ssize_t>(size)) {
+    printf("send error : %s \n", strerror(errno));
+    transport->MarkFailed();
+  }
+}
 
-  size_t response_size = sizeof(response);
-  pack_usbip((int*)&response, response_size);
-
-  if (send(sockfd, (char*)&response, response_size, 0) != response_size) {
+// Like SendOrFail(), but hands |buffer| over to the transport, which may send
+// the first |size| bytes of it without copying them.
+void SendBufferOrFail(Transport* transport, BufferPool::Buffer buffer,
+                      size_t size) {
+  if (transport->failed()) {
+    return;
+  }
+  if (transport->SendBuffer(std::move(buffer), size) !=
+      static_cast<ssize_t>(size)) {
     printf("send error : %s \n", strerror(errno));
-    exit(-1);
+    transport->MarkFailed();
   }
+}
+
+}  // namespace
 
-  // Skip sending data if there isn't any.
-  if (data_size == 0) {
+void SendUsbRequest(Transport* transport, const USBIP_CMD_SUBMIT& usb_request,
+                    const char* data, unsigned int data_size,
+                    unsigned int status) {
+  USBIP_PROBE5(urb_complete, usb_request.seqnum, usb_request.ep,
+               usb_request.direction, data_size, status);
+  if (UrbTraceRecorder* trace = GetUrbTraceRecorder()) {
+    trace->RecordRetSubmit(usb_request, status, data, data_size);
+  }
+  if (PcapWriter* pcap = GetPcapWriter()) {
+    pcap->WriteComplete(usb_request, status, data, data_size);
+  }
+
+  USBIP_RET_SUBMIT response =
+      CreatePackedRetSubmit(usb_request, data_size, status);
+
+  // The header and data are assembled in a single pooled buffer so that the
+  // response goes out with one write.
+  size_t response_size = sizeof(response) + data_size;
+  BufferPool::Buffer buffer =
+      BufferPool::ForCurrentThread()->Acquire(response_size);
+  if (buffer.empty()) {
+    printf("no buffer for the reply to URB %d\n", usb_request.seqnum);
+    transport->MarkFailed();
     return;
   }
+  memcpy(buffer.data(), &response, sizeof(response));
+  if (data_size > 0) {
+    memcpy(buffer.data() + sizeof(response), data, data_size);
+  }
 
-  if (send(sockfd, data, data_size, 0) != data_size) {
-    printf("send error : %s \n", strerror(errno));
-    exit(-1);
+  SendBufferOrFail(transport, std::move(buffer), response_size);
+}
+
+void SendUsbStall(Transport* transport, const USBIP_CMD_SUBMIT& usb_request) {
+  SendUsbRequest(transport, usb_request, 0, 0, -EPIPE);
+}
+
+void SendUsbOutResponse(Transport* transport,
+                        const USBIP_CMD_SUBMIT& usb_request,
+                        unsigned int actual_length, unsigned int status) {
+  USBIP_PROBE5(urb_complete, usb_request.seqnum, usb_request.ep,
+               usb_request.direction, actual_length, status);
+  if (UrbTraceRecorder* trace = GetUrbTraceRecorder()) {
+    trace->RecordRetSubmit(usb_request, status, nullptr, actual_length);
   }
+  if (PcapWriter* pcap = GetPcapWriter()) {
+    pcap->WriteComplete(usb_request, status, nullptr, actual_length);
+  }
+
+  USBIP_RET_SUBMIT response =
+      CreatePackedRetSubmit(usb_request, actual_length, status);
+  SendOrFail(transport, &response, sizeof(response));
+}
+
+void SendUnlinkResponse(Transport* transport,
+                        const USBIP_CMD_UNLINK& unlink_request, int status) {
+  if (UrbTraceRecorder* trace = GetUrbTraceRecorder()) {
+    trace->RecordRetUnlink(unlink_request, status);
+  }
+  if (PcapWriter* pcap = GetPcapWriter()) {
+    pcap->WriteUnlink(unlink_request, status);
+  }
+
+  // On the wire USBIP_RET_UNLINK is padded to the same size as
+  // USBIP_RET_SUBMIT.
+  int response[sizeof(USBIP_RET_SUBMIT) / sizeof(int)];
+  memset(response, 0, sizeof(response));
+  response[0] = htonl(COMMAND_USBIP_RET_UNLINK);
+  response[1] = htonl(unlink_request.seqnum);
+  response[2] = htonl(unlink_request.devid);
+  response[3] = htonl(unlink_request.direction);
+  response[4] = htonl(unlink_request.ep);
+  response[5] = htonl(status);
+  SendOrFail(transport, response, sizeof(response));
 }
@@ -26,7 +26,9 @@
 #ifndef __USBIP_USBIP_H__
 #define __USBIP_USBIP_H__
 
+#include "buffer_pool.h"
 #include "device_descriptors.h"
+#include "transport.h"
 #include "usbip-constants.h"
 
 #include <vector>
@@ -46,8 +48,8 @@
 
 typedef struct sockaddr sockaddr;
 
-// Temporary forward declaration until the code can become more organized.
-class UsbPrinter;
+class UsbDevice;
+class UsbDeviceRegistry;
 
 /*
  * Structures used by the USBIP protocol for communication.
@@ -198,48 +200,81 @@ void set_op_rep_devlist_header(word version, word command, int status,
                                int numExportedDevices,
                                OP_REP_DEVLIST_HEADER *header);
 
-void set_op_rep_device(const USB_DEVICE_DESCRIPTOR& dev_dsc,
-                       const USB_CONFIGURATION_DESCRIPTOR& configuration,
-                       OP_REP_DEVICE* device);
+// Sets the members of |rep_device| to describe |device|.
+void set_op_rep_device(const UsbDevice& device, OP_REP_DEVICE* rep_device);
 
-// Assigns the values from |interfaces| into |rep_interfaces|.
+// Assigns the values from |interfaces| into |rep_interfaces|, which points into
+// |storage| once the call returns.
 void set_op_rep_devlist_interfaces(
     const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
-    OP_REP_DEVLIST_INTERFACE **rep_interfaces);
+    BufferPool::Buffer* storage, OP_REP_DEVLIST_INTERFACE** rep_interfaces);
 
 // Creates the OP_REP_DEVLIST message used to respond to requests to list the
-// host's exported USB devices.
-void create_op_rep_devlist(
-    const USB_DEVICE_DESCRIPTOR& device,
-    const USB_CONFIGURATION_DESCRIPTOR& config,
-    const std::vector<USB_INTERFACE_DESCRIPTOR>& interfaces,
-    OP_REP_DEVLIST *list);
+// host's exported USB devices when |device| is the only one.
+// |list->interfaces| points into |interface_storage|, which must outlive
+// |list|.
+void create_op_rep_devlist(const UsbDevice& device,
+                           BufferPool::Buffer* interface_storage,
+                           OP_REP_DEVLIST* list);
 
-// Creates the OP_REP_IMPORT message used to respond to a request to attach a
-// host USB device.
-void create_op_rep_import(const USB_DEVICE_DESCRIPTOR& device,
-                          const USB_CONFIGURATION_DESCRIPTOR& config,
-                          OP_REP_IMPORT *rep);
+// Creates the OP_REP_IMPORT message used to respond to a request to attach
+// |device|.
+void create_op_rep_import(const UsbDevice& device, OP_REP_IMPORT* rep);
 
 // Handles an OP_REQ_DEVLIST request by sending an OP_REP_DEVLIST message which
-// describes the virtual USB device along |sockfd|.
-void handle_device_list(const UsbPrinter& printer, int sockfd);
+// describes every device in |devices| along |transport|.
+void handle_device_list(const UsbDeviceRegistry& devices,
+                        Transport* transport);
 
-// Handles and OP_REQ_IMPORT request by sending an OP_REP_IMPORT message which
-// describes the virtual USB device along |sockfd|.
-int handle_attach(const UsbPrinter& printer, int sockfd);
+// Handles an OP_REQ_IMPORT request for |device| by sending an OP_REP_IMPORT
+// message which describes it along |transport|. If |device| is null the
+// request is refused with an error status. Returns 0 if the device was
+// imported.
+int handle_attach(UsbDevice* device, const char* bus_id, Transport* transport);
 
+// Print the fields of |command| and |request| if request logging is on.
 void print_usbip_cmd_submit(const USBIP_CMD_SUBMIT& command);
 void print_standard_device_request(const StandardDeviceRequest& request);
 
+// Turns the per-request logging of the protocol handlers, which is on by
+// default, on or off. The benchmarks turn it off so that they time the
+// handlers rather than stdio.
+void SetRequestLogging(bool enabled);
+
+// Prints |format| like printf() if request logging is on.
+void LogRequest(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+// Unpacks the standard USB SETUP packet contained within |setup| into a
+// StandardDeviceRequest struct and returns the result.
+StandardDeviceRequest CreateStandardDeviceRequest(long long setup);
+
 USBIP_RET_SUBMIT CreateUsbipRetSubmit(const USBIP_CMD_SUBMIT& usb_request);
 
-// Sends a USBIP_RET_SUBMIT message to the socket described by |sockfd|.
+// Sends a USBIP_RET_SUBMIT message along |transport|.
 // |usb_request| contains the metadata for the message and |data| contains the
-// actual URB data bytes.
-void SendUsbRequest(int sockfd, const USBIP_CMD_SUBMIT& usb_request,
-                    const char* data, unsigned int size, unsigned int status);
-void usbip_run(const USB_DEVICE_DESCRIPTOR *dev_dsc);
+// actual URB data bytes. This and the other Send functions mark |transport| as
+// failed if the message cannot be sent.
+void SendUsbRequest(Transport* transport,
+                    const USBIP_CMD_SUBMIT& usb_request, const char* data,
+                    unsigned int size, unsigned int status);
+
+// Sends a USBIP_RET_SUBMIT message along |transport| which completes the OUT
+// request |usb_request| after |actual_length| bytes of its payload were
+// consumed. No data follows the message.
+void SendUsbOutResponse(Transport* transport,
+                        const USBIP_CMD_SUBMIT& usb_request,
+                        unsigned int actual_length, unsigned int status);
+
+// Completes |usb_request| with a STALL (-EPIPE), which is how a device refuses
+// a control request it does not support.
+void SendUsbStall(Transport* transport, const USBIP_CMD_SUBMIT& usb_request);
+
+// Sends a USBIP_RET_UNLINK message along |transport| which answers
+// |unlink_request|. |status| is -ECONNRESET if the URB was unlinked and 0 if it
+// had already completed.
+void SendUnlinkResponse(Transport* transport,
+                        const USBIP_CMD_UNLINK& unlink_request, int status);
 
 // Converts the contents of either a USBIP_CMD_SUBMIT or USB_RET_SUBMIT message
 // into network byte order.
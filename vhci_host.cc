@@ -0,0 +1,112 @@
+#include "vhci_host.h"
+
+#include "usb_device.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// State of a vhci_hcd port which nothing is plugged into (VDEV_ST_NULL).
+const int kPortFree = 4;
+
+// Reads the ports listed in the status file at |path| and returns the first
+// free one on a hub of kind |hub|, or -1. Each line after the header
+// describes a port as "hub port sta spd dev sockfd local_busid"; kernels
+// before 4.13 have a single high-speed hub and leave out the first column.
+int FindFreePortIn(const std::string& path, const std::string& hub) {
+  std::ifstream status(path);
+  std::string line;
+  // The header.
+  std::getline(status, line);
+  while (std::getline(status, line)) {
+    std::istringstream fields(line);
+    std::string port_hub = "hs";
+    int port = -1;
+    int state = -1;
+    if (line.compare(0, 2, "hs") == 0 || line.compare(0, 2, "ss") == 0) {
+      fields >> port_hub;
+    }
+    if (!(fields >> port >> state)) {
+      continue;
+    }
+    if (port_hub == hub && state == kPortFree) {
+      return port;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+std::unique_ptr<VhciHost> VhciHost::Create(const std::string& path) {
+  struct stat info;
+  std::string attach = path + "/attach";
+  if (stat(attach.c_str(), &info) < 0) {
+    printf("no vhci_hcd at %s : %s\n", path.c_str(), strerror(errno));
+    return nullptr;
+  }
+  return std::unique_ptr<VhciHost>(new VhciHost(path));
+}
+
+VhciHost::VhciHost(const std::string& path) : path_(path) {}
+
+int VhciHost::FindFreePort(UsbSpeed speed) const {
+  std::string hub = speed == UsbSpeed::kSuper ? "ss" : "hs";
+  // The ports of every controller are numbered together, and those of the
+  // controllers after the first are listed in status.1, status.2, ...
+  for (int controller = 0;; ++controller) {
+    std::string path = path_ + "/status";
+    if (controller > 0) {
+      path += "." + std::to_string(controller);
+    }
+    if (access(path.c_str(), R_OK) < 0) {
+      return -1;
+    }
+    int port = FindFreePortIn(path, hub);
+    if (port >= 0) {
+      return port;
+    }
+  }
+}
+
+int VhciHost::Attach(int fd, const UsbDevice& device) {
+  int port = FindFreePort(device.speed());
+  if (port < 0) {
+    printf("no free vhci_hcd port for %s\n", device.bus_id());
+    return -1;
+  }
+  // The same request `usbip attach` makes once it has imported the device.
+  uint32_t devid = static_cast<uint32_t>(device.busnum()) << 16 |
+                   static_cast<uint32_t>(device.devnum());
+  char request[64];
+  int length = snprintf(request, sizeof(request), "%d %d %u %d", port, fd,
+                        devid, static_cast<int>(device.speed()));
+  std::string attach = path_ + "/attach";
+  int attach_fd = open(attach.c_str(), O_WRONLY | O_CLOEXEC);
+  if (attach_fd < 0) {
+    printf("open %s error : %s\n", attach.c_str(), strerror(errno));
+    return -1;
+  }
+  ssize_t written = write(attach_fd, request, length);
+  int error = errno;
+  close(attach_fd);
+  if (written != length) {
+    printf("vhci_hcd refused %s on port %d : %s\n", device.bus_id(), port,
+           strerror(error));
+    return -1;
+  }
+  printf("Attached %s to vhci_hcd port %d\n", device.bus_id(), port);
+  return port;
+}
@@ -0,0 +1,47 @@
+#ifndef __USBIP_VHCI_HOST_H__
+#define __USBIP_VHCI_HOST_H__
+
+#include "usb_device.h"
+
+#include <memory>
+#include <string>
+
+// Default sysfs directory of the first vhci_hcd controller.
+const char kDefaultVhciPath[] = "/sys/devices/platform/vhci_hcd.0";
+
+// The kernel's virtual host controller on the machine the server runs on.
+//
+// `usbip attach` connects to the server over TCP, imports a device with
+// OP_REQ_IMPORT and then passes the connected socket to vhci_hcd by writing
+// it to the controller's sysfs attach file. A server on the same machine can
+// do the last step itself with one end of a socketpair, which skips the
+// listener, the import round trip and loopback TCP for every URB. The other
+// end of the socketpair is served like any connection which has imported the
+// device, so everything but the hand-off works without the module loaded.
+class VhciHost {
+ public:
+  // Uses the controller whose sysfs directory is |path|. Returns nullptr if
+  // it does not exist, which is the case when vhci_hcd is not loaded.
+  static std::unique_ptr<VhciHost> Create(const std::string& path);
+
+  VhciHost(const VhciHost&) = delete;
+  VhciHost& operator=(const VhciHost&) = delete;
+
+  // Plugs |device| into a free port of the controller, which then sends its
+  // URBs over the connected stream socket |fd|. The kernel takes its own
+  // reference to the socket, so the caller may close |fd| afterwards. Returns
+  // the port, or -1 if there is no free port for the device's speed or the
+  // kernel refused the socket.
+  int Attach(int fd, const UsbDevice& device);
+
+ private:
+  explicit VhciHost(const std::string& path);
+
+  // Returns a port which is free and on a hub of the right kind for
+  // |speed|, or -1.
+  int FindFreePort(UsbSpeed speed) const;
+
+  std::string path_;
+};
+
+#endif  // __USBIP_VHCI_HOST_H__
@@ -0,0 +1,113 @@
+#include "work_stealing_pool.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// The pool and the index of the worker which the current thread is, if it is
+// a worker of a pool.
+thread_local WorkStealingPool* tls_pool = nullptr;
+thread_local int tls_worker = -1;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(int threads)
+    : queued_(0), next_worker_(0), stopping_(false) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Every deque exists before any worker starts stealing.
+  for (int i = 0; i < threads; ++i) {
+    workers_[i]->thread = std::thread(&WorkStealingPool::Run, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+  }
+  idle_.notify_all();
+  for (const auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  bool from_worker = tls_pool == this;
+  int index = from_worker
+                  ? tls_worker
+                  : next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                        workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    if (from_worker) {
+      workers_[index]->tasks.push_back(std::move(task));
+    } else {
+      workers_[index]->submitted.push_back(std::move(task));
+    }
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  // Taking the lock orders the wakeup after a worker which is about to sleep
+  // has checked |queued_|.
+  { std::lock_guard<std::mutex> lock(idle_mutex_); }
+  idle_.notify_one();
+}
+
+void WorkStealingPool::Run(int index) {
+  tls_pool = this;
+  tls_worker = index;
+  while (true) {
+    Task task;
+    if (Pop(index, &task) || Steal(index, &task)) {
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_.wait(lock, [this]() {
+      return stopping_ || queued_.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping_ && queued_.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+  }
+}
+
+bool WorkStealingPool::Pop(int index, Task* task) {
+  Worker* worker = workers_[index].get();
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  if (!worker->tasks.empty()) {
+    *task = std::move(worker->tasks.back());
+    worker->tasks.pop_back();
+    return true;
+  }
+  if (!worker->submitted.empty()) {
+    *task = std::move(worker->submitted.front());
+    worker->submitted.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool WorkStealingPool::Steal(int index, Task* task) {
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker* victim = workers_[(index + i) % workers_.size()].get();
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    std::deque<Task>* tasks =
+        victim->tasks.empty() ? &victim->submitted : &victim->tasks;
+    if (!tasks->empty()) {
+      *task = std::move(tasks->front());
+      tasks->pop_front();
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,76 @@
+#ifndef __USBIP_WORK_STEALING_POOL_H__
+#define __USBIP_WORK_STEALING_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads which run tasks, balancing them by work
+// stealing.
+//
+// Each worker has a deque of its own. Tasks which a worker queues while
+// running a task go to the back of its own deque and are taken from there
+// first, so follow-up work runs on the core which has its data in cache. A
+// worker whose deque is empty steals from the front of the others', which
+// holds their oldest and typically largest pieces of work. Tasks queued from
+// outside the pool are dealt to the workers in turn, into a second queue
+// which both the worker and thieves take from the front, so that they run in
+// the order they arrived once there is no follow-up work to do.
+//
+// The queues of a worker share a lock, which only contends while the worker
+// is being stolen from. Idle workers sleep until a task is queued.
+class WorkStealingPool {
+ public:
+  using Task = std::function<void()>;
+
+  // Starts |threads| workers.
+  explicit WorkStealingPool(int threads);
+
+  // Runs every task which is still queued, then joins the workers.
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  // Queues |task|. Safe to call from any thread, including the workers.
+  void Submit(Task task);
+
+  int thread_count() const { return workers_.size(); }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    // Tasks queued by the worker itself.
+    std::deque<Task> tasks;
+    // Tasks queued from outside the pool, oldest first.
+    std::deque<Task> submitted;
+    std::thread thread;
+  };
+
+  // Body of the worker at |index|.
+  void Run(int index);
+
+  // Takes the newest task which the worker at |index| queued itself, or else
+  // the oldest one it was dealt.
+  bool Pop(int index, Task* task);
+
+  // Takes the oldest task of any worker other than the one at |index|,
+  // preferring tasks which that worker queued itself to ones it was dealt.
+  bool Steal(int index, Task* task);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Tasks which are queued but not yet taken by a worker.
+  std::atomic<int> queued_;
+  std::atomic<unsigned> next_worker_;
+
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+  bool stopping_;
+};
+
+#endif  // __USBIP_WORK_STEALING_POOL_H__